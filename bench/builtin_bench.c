@@ -0,0 +1,118 @@
+// builtin_bench.c
+//
+// Builtin dispatch: how long it takes to decide whether a command name is a
+// builtin, with a registry of a given size, comparing the linear strcmp
+// scan the shell used to do with the perfect hash it uses now (phash.h).
+// Most commands typed are programs, not builtins, so the lookups are a mix
+// of hits and misses; a miss is the worst case for the scan.
+//
+// Usage: builtin_bench [builtins] [lookups]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/phash.h"
+
+#define DEFAULT_BUILTINS 128
+#define DEFAULT_LOOKUPS 10000000
+
+// The shell's own builtins, from the same list as the registry
+static const char *real_names[] = {
+#define BUILTIN(name, fn, usage, summary, help) name,
+#include "../src/builtins.def"
+#undef BUILTIN
+};
+
+// Commands that are programs, looked up as misses
+static const char *programs[] = {"ls", "grep", "git", "make", "cat", "vim", "python3", "gcc", "sed", "awk"};
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int linear_find(char **names, size_t n, const char *name)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    if (strcmp(names[i], name) == 0)
+      return (int)i;
+  }
+  return -1;
+}
+
+static int phash_find(const Phash *ph, char **names, const char *name)
+{
+  int i = ph->slots[phash_slot(ph->seed, ph->nbuckets, ph->disp, ph->nslots, name)];
+  return strcmp(names[i], name) == 0 ? i : -1;
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_BUILTINS;
+  long lookups = argc > 2 ? strtol(argv[2], NULL, 10) : DEFAULT_LOOKUPS;
+  size_t nreal = sizeof(real_names) / sizeof(real_names[0]);
+  size_t nprograms = sizeof(programs) / sizeof(programs[0]);
+  char **names = malloc(n * sizeof(char *));
+  Phash ph;
+
+  // The shell's own builtins, padded with made-up ones
+  for (size_t i = 0; i < n; i++)
+  {
+    char buf[32];
+    if (i < nreal)
+      snprintf(buf, sizeof(buf), "%s", real_names[i]);
+    else
+      snprintf(buf, sizeof(buf), "builtin%zu", i);
+    names[i] = strdup(buf);
+  }
+  double t0 = now_seconds();
+  if (phash_build(&ph, (const char *const *)names, n) != 0)
+  {
+    fprintf(stderr, "builtin_bench: could not build the table\n");
+    return EXIT_FAILURE;
+  }
+  double build = now_seconds() - t0;
+
+  // Half builtins from across the table, half programs
+  size_t nqueries = 1024;
+  const char **queries = malloc(nqueries * sizeof(char *));
+  srand(1);
+  for (size_t i = 0; i < nqueries; i++)
+    queries[i] = i % 2 ? names[rand() % n] : programs[rand() % nprograms];
+
+  for (size_t i = 0; i < nqueries; i++)
+  {
+    if (linear_find(names, n, queries[i]) != phash_find(&ph, names, queries[i]))
+    {
+      fprintf(stderr, "builtin_bench: lookups disagree on %s\n", queries[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("%zu builtins, %u slots, %u buckets, table built in %.3f ms\n", n, ph.nslots, ph.nbuckets,
+         build * 1e3);
+  long found = 0;
+  t0 = now_seconds();
+  for (long i = 0; i < lookups; i++)
+    found += linear_find(names, n, queries[i & (nqueries - 1)]) >= 0;
+  double linear = now_seconds() - t0;
+  t0 = now_seconds();
+  for (long i = 0; i < lookups; i++)
+    found += phash_find(&ph, names, queries[i & (nqueries - 1)]) >= 0;
+  double hashed = now_seconds() - t0;
+
+  printf("  linear strcmp %8.1f ns/lookup\n", linear / lookups * 1e9);
+  printf("  perfect hash  %8.1f ns/lookup\n", hashed / lookups * 1e9);
+  printf("  (%ld found)\n", found);
+
+  phash_free(&ph);
+  for (size_t i = 0; i < n; i++)
+    free(names[i]);
+  free(names);
+  free(queries);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+// complete_bench.c
+//
+// Tab completion lookups: a directory of many files and one of executables,
+// as a big PATH directory would be, are created in a temporary directory.
+// Each is completed once cold, which reads and sorts it, and then many times
+// warm, which only checks its mtime and binary searches the cached listing.
+// A readdir of the whole directory per completion, which is what completing
+// without the cache costs, is timed alongside.
+//
+// Usage: complete_bench [files] [executables] [lookups]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../src/dircache.h"
+
+#define DEFAULT_FILES 100000
+#define DEFAULT_EXECS 5000
+#define DEFAULT_LOOKUPS 2000
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_name(char *buf, size_t size, size_t i)
+{
+  static const char *parts[] = {"data", "img", "log", "report", "test", "src", "note", "py", "git", "x"};
+  snprintf(buf, size, "%s%s_%zu", parts[i % 10], parts[(i / 10) % 10], i);
+}
+
+static void fill(const char *dir, size_t n, int mode)
+{
+  char path[512];
+  for (size_t i = 0; i < n; i++)
+  {
+    char name[64];
+    make_name(name, sizeof(name), i);
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_CREAT | O_WRONLY, mode);
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+static void empty(const char *dir)
+{
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  char path[512];
+  while (d && (e = readdir(d)) != NULL)
+  {
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    unlink(path);
+  }
+  if (d)
+    closedir(d);
+  rmdir(dir);
+}
+
+// Matches for prefix found by reading the whole directory
+static size_t scan(const char *dir, const char *prefix)
+{
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  size_t len = strlen(prefix), n = 0;
+  while ((e = readdir(d)) != NULL)
+    n += strncmp(e->d_name, prefix, len) == 0;
+  closedir(d);
+  return n;
+}
+
+static size_t lookup(const char *dir, const char *prefix, int execs)
+{
+  DirListing *l = dircache_get(dir);
+  size_t first, n = dircache_prefix(l, prefix, strlen(prefix), &first), found = 0;
+  for (size_t i = first; i < first + n; i++)
+    found += execs ? dircache_is_exec(l, i) : 1;
+  return found;
+}
+
+static void run(const char *label, const char *dir, long lookups, int execs)
+{
+  static const char *prefixes[] = {"d", "img", "logte", "reportsrc_1", "py", "gitx_99", "q", "notenote_"};
+  size_t np = sizeof(prefixes) / sizeof(prefixes[0]);
+
+  double t0 = now_seconds();
+  size_t found = lookup(dir, prefixes[0], execs);
+  double cold = now_seconds() - t0;
+
+  t0 = now_seconds();
+  for (long i = 0; i < lookups; i++)
+    found += lookup(dir, prefixes[i % np], execs);
+  double warm = now_seconds() - t0;
+
+  long scans = lookups / 100 > 0 ? lookups / 100 : 1;
+  t0 = now_seconds();
+  for (long i = 0; i < scans; i++)
+    if (scan(dir, prefixes[i % np]) == (size_t)-1)
+      found++;
+  double scanned = now_seconds() - t0;
+
+  printf("%s (%zu names)\n", label, dircache_get(dir)->count);
+  printf("  cold listing     %10.2f us\n", cold * 1e6);
+  printf("  cached lookup    %10.2f us/completion\n", warm / lookups * 1e6);
+  printf("  readdir scan     %10.2f us/completion\n", scanned / scans * 1e6);
+  if (found == 0)
+    printf("  (no matches)\n");
+}
+
+int main(int argc, char **argv)
+{
+  size_t nfiles = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_FILES;
+  size_t nexecs = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_EXECS;
+  long lookups = argc > 3 ? strtol(argv[3], NULL, 10) : DEFAULT_LOOKUPS;
+  char root[] = "/tmp/complete_benchXXXXXX";
+  char files[64], bin[64];
+
+  if (mkdtemp(root) == NULL)
+  {
+    perror("complete_bench");
+    return EXIT_FAILURE;
+  }
+  snprintf(files, sizeof(files), "%s/files", root);
+  snprintf(bin, sizeof(bin), "%s/bin", root);
+  mkdir(files, 0755);
+  mkdir(bin, 0755);
+  fill(files, nfiles, 0644);
+  fill(bin, nexecs, 0755);
+
+  run("directory", files, lookups, 0);
+  run("PATH directory", bin, lookups, 1);
+
+  empty(files);
+  empty(bin);
+  rmdir(root);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+// defstore_bench.c
+//
+// define lookups: a definitions file of a given number of terms is written
+// to a temporary directory, then loaded into the store (defstore.h) and
+// queried, half for terms that exist and half for ones that do not. A scan
+// of the file line by line per lookup, which is how define used to find a
+// term, is timed on a few queries alongside. Then terms are redefined and
+// deleted until the file has been compacted, and the sorted listing that
+// "define all" prints is timed. Finally the text of the definitions is
+// searched (defindex.h): the first search builds the index, later ones only
+// read the posting lists of their words.
+//
+// Usage: defstore_bench [terms] [lookups] [searches]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/defstore.h"
+#include "../src/defindex.h"
+
+#define DEFAULT_TERMS 1000000
+#define DEFAULT_LOOKUPS 200000
+#define SCAN_LOOKUPS 4
+#define DEFAULT_SEARCHES 200
+// Distinct words the definitions are made of, and words per definition
+#define VOCABULARY 20000
+#define DEF_WORDS 10
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Terms are numbered, shuffled by a multiplier so the file is not sorted
+static void make_term(char *buf, size_t size, size_t i)
+{
+  snprintf(buf, size, "term%zx", (i * 2654435761u) & 0xffffffffu);
+}
+
+// Word w of the vocabulary
+static void make_word(char *buf, size_t size, unsigned w)
+{
+  static const char *syllables[] = {"ka", "lo", "mi", "ne", "pu", "ri", "sa", "to", "ve", "zu", "fi", "fo"};
+  size_t len = 0;
+  buf[0] = '\0';
+  do
+  {
+    len += snprintf(buf + len, size - len, "%s", syllables[w % 12]);
+    w /= 12;
+  } while (w > 0 && len + 3 < size);
+}
+
+// Low word numbers are much more common than high ones, as in real text
+static unsigned pick_word(void)
+{
+  double r = (double)rand() / RAND_MAX;
+  return (unsigned)(r * r * r * VOCABULARY);
+}
+
+static void make_def(char *buf, size_t size)
+{
+  size_t len = 0;
+  for (int i = 0; i < DEF_WORDS && len + 24 < size; i++)
+  {
+    if (i)
+      buf[len++] = ' ';
+    make_word(buf + len, size - len, pick_word());
+    len += strlen(buf + len);
+  }
+  buf[len] = '\0';
+}
+
+// Line by line, as define used to
+static int scan(const char *path, const char *term)
+{
+  FILE *f = fopen(path, "r");
+  char line[512];
+  size_t len = strlen(term);
+  int found = 0;
+  while (!found && fgets(line, sizeof(line), f) != NULL)
+    found = strncmp(line, term, len) == 0 && strncmp(line + len, " = ", 3) == 0;
+  fclose(f);
+  return found;
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_TERMS;
+  long lookups = argc > 2 ? strtol(argv[2], NULL, 10) : DEFAULT_LOOKUPS;
+  long searches = argc > 3 ? strtol(argv[3], NULL, 10) : DEFAULT_SEARCHES;
+  char dir[] = "/tmp/defstore_benchXXXXXX";
+  char path[64], term[32], def[256], query[64];
+  DefIndexHit hits[DEFINDEX_MAX_RESULTS];
+
+  if (mkdtemp(dir) == NULL)
+  {
+    perror("defstore_bench");
+    return EXIT_FAILURE;
+  }
+  snprintf(path, sizeof(path), "%s/defs.txt", dir);
+  FILE *f = fopen(path, "w");
+  for (size_t i = 0; i < n; i++)
+  {
+    make_term(term, sizeof(term), i);
+    make_def(def, sizeof(def));
+    fprintf(f, "%s = %s\n", term, def);
+  }
+  fclose(f);
+
+  double t0 = now_seconds();
+  if (defstore_open(path, 0) != 0)
+  {
+    perror("defstore_bench");
+    return EXIT_FAILURE;
+  }
+  double load = now_seconds() - t0;
+
+  long found = 0;
+  DefEntry e;
+  t0 = now_seconds();
+  for (long i = 0; i < lookups; i++)
+  {
+    make_term(term, sizeof(term), (size_t)(i * 7919) % (2 * n));
+    found += defstore_get(term, strlen(term), &e);
+  }
+  double looked = now_seconds() - t0;
+
+  t0 = now_seconds();
+  for (long i = 0; i < SCAN_LOOKUPS; i++)
+  {
+    make_term(term, sizeof(term), n - 1 - i);
+    found += scan(path, term);
+  }
+  double scanned = now_seconds() - t0;
+
+  // Redefine and delete until compaction has had to run
+  long updates = 0;
+  t0 = now_seconds();
+  for (size_t i = 0; i < n / 2; i++, updates++)
+  {
+    make_term(term, sizeof(term), i);
+    if (i % 2)
+      defstore_delete(term, strlen(term));
+    else
+      defstore_set(term, strlen(term), "Redefined.", 10);
+  }
+  double updated = now_seconds() - t0;
+
+  t0 = now_seconds();
+  size_t count = defstore_count(), bytes = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    defstore_sorted(i, &e);
+    bytes += e.term_len + e.def_len;
+  }
+  double listed = now_seconds() - t0;
+
+  // The first search builds the index; then queries of one to three words,
+  // and one after updates that are indexed as they are read
+  t0 = now_seconds();
+  defindex_search("kalo", hits, DEFINDEX_MAX_RESULTS);
+  double built = now_seconds() - t0;
+  size_t matched = 0;
+  t0 = now_seconds();
+  for (long i = 0; i < searches; i++)
+  {
+    size_t len = 0;
+    for (long w = 0; w <= i % 3; w++)
+    {
+      query[len++] = ' ';
+      make_word(query + len, sizeof(query) - len, pick_word());
+      len += strlen(query + len);
+    }
+    matched += defindex_search(query, hits, DEFINDEX_MAX_RESULTS);
+  }
+  double searched = now_seconds() - t0;
+  for (size_t i = 0; i < n / 100; i++)
+  {
+    make_term(term, sizeof(term), i);
+    defstore_set(term, strlen(term), "Redefined again.", 16);
+  }
+  t0 = now_seconds();
+  defindex_search("redefined", hits, DEFINDEX_MAX_RESULTS);
+  double after = now_seconds() - t0;
+
+  printf("%zu terms, %ld of %ld lookups found\n", n, found, lookups + SCAN_LOOKUPS);
+  printf("  load             %10.2f ms\n", load * 1e3);
+  printf("  hash lookup      %10.2f us/lookup\n", looked / lookups * 1e6);
+  printf("  line scan        %10.2f us/lookup\n", scanned / SCAN_LOOKUPS * 1e6);
+  printf("  set/delete       %10.2f us/update (%ld, with compaction)\n", updated / updates * 1e6, updates);
+  printf("  sorted listing   %10.2f ms (%zu terms, %zu bytes)\n", listed * 1e3, count, bytes);
+  printf("  index build      %10.2f ms\n", built * 1e3);
+  printf("  search           %10.2f us/query (%ld, %zu hits)\n", searched / searches * 1e6, searches, matched);
+  printf("  search after %zu updates %8.2f us\n", n / 100, after * 1e6);
+
+  unlink(path);
+  rmdir(dir);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+// hsearch_bench.c
+//
+// Ctrl+R at scale (hsearch.h): indexes a given number of distinct commands
+// made from a few dozen tools with random arguments, paths and numbers, as
+// a long history file would give, then times each query typed one key at a
+// time, the way the search refreshes on each keystroke. Each refresh counts
+// its fastest of a few runs, to leave out the noise of other processes.
+// Reports the slowest and mean refresh of each query, and the slowest of
+// the whole run.
+//
+// Usage: hsearch_bench [commands]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/hsearch.h"
+
+#define DEFAULT_COMMANDS 500000
+#define ROUNDS 5
+
+static const char *tools[] = {
+  "git commit -m", "git checkout", "git log --oneline", "git push origin", "git rebase -i",
+  "docker run --rm -it", "docker build -t", "docker compose up", "kubectl get pods -n",
+  "kubectl describe pod", "kubectl logs -f", "make -C", "make -j8", "cmake --build",
+  "ssh", "scp -r", "rsync -avz", "grep -rn", "find . -name", "ls -la", "cd", "vim",
+  "python3 manage.py", "npm run", "cargo test --release", "go test ./...", "tar xzf",
+  "curl -sSL", "ps aux | grep", "kill -9", "tail -f /var/log/", "less", "cat", "cp -r",
+  "mv", "rm -rf", "chmod +x", "systemctl restart", "journalctl -u", "ffmpeg -i",
+};
+static const char *words[] = {
+  "src", "build", "release", "config", "deploy", "server", "client", "test", "data",
+  "backup", "main", "feature", "fix", "staging", "prod", "api", "web", "worker", "cache",
+  "index", "notes", "report", "lib", "include", "tmp", "home", "user", "project", "docs",
+  "scripts", "tools", "assets", "images", "logs", "db", "schema", "migrate", "nginx",
+};
+static const char *queries[] = {
+  "cfl9", "mkfl", "dkr", "kbctl", "git ch", "sshprod", "rsync", "zqx", "tail -f", "Make",
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t make_command(char *buf, size_t size, unsigned long i)
+{
+  size_t len = (size_t)snprintf(buf, size, "%s", tools[rand() % COUNT(tools)]);
+  int args = 1 + rand() % 3;
+  for (int a = 0; a < args && len < size; a++)
+  {
+    const char *w = words[rand() % COUNT(words)];
+    switch (rand() % 3)
+    {
+    case 0:
+      len += snprintf(buf + len, size - len, " %s", w);
+      break;
+    case 1:
+      len += snprintf(buf + len, size - len, " %s/%s.%s", w, words[rand() % COUNT(words)],
+                      rand() % 2 ? "c" : "txt");
+      break;
+    default:
+      len += snprintf(buf + len, size - len, " %s-%d", w, rand() % 100);
+      break;
+    }
+  }
+  // Keeps every command distinct
+  if (len < size)
+    len += snprintf(buf + len, size - len, " %lu", i);
+  return len < size ? len : size - 1;
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_COMMANDS;
+  static const char *dirs[] = { "/home/user", "/home/user/project", "/srv/app", "/tmp" };
+  HistSearchResult out[HSEARCH_MAX_RESULTS];
+  char cmd[256];
+
+  HistSearch *hs = hsearch_new();
+  if (!hs)
+    return EXIT_FAILURE;
+  srand(1);
+  double t0 = now_seconds();
+  for (size_t i = 0; i < n; i++)
+  {
+    size_t len = make_command(cmd, sizeof(cmd), i);
+    const char *dir = dirs[rand() % COUNT(dirs)];
+    hsearch_add(hs, cmd, len, dir, strlen(dir));
+  }
+  double indexed = now_seconds() - t0;
+
+  printf("%zu distinct commands, indexed in %.2f s (%.2f us/command)\n", n, indexed, indexed / n * 1e6);
+  double worst_all = 0;
+  for (size_t q = 0; q < COUNT(queries); q++)
+  {
+    const char *query = queries[q];
+    size_t qlen = strlen(query), found = 0;
+    double worst = 0, total = 0;
+    for (size_t k = 1; k <= qlen; k++)
+    {
+      double fastest = 0;
+      for (int r = 0; r < ROUNDS; r++)
+      {
+        t0 = now_seconds();
+        found = hsearch_query(hs, query, k, "/srv/app", out, HSEARCH_MAX_RESULTS);
+        double t = now_seconds() - t0;
+        if (r == 0 || t < fastest)
+          fastest = t;
+      }
+      total += fastest;
+      if (fastest > worst)
+        worst = fastest;
+    }
+    if (worst > worst_all)
+      worst_all = worst;
+    printf("  %-10s slowest %7.1f us, mean %7.1f us/key, %2zu results, best: %s\n", query, worst * 1e6,
+           total / qlen * 1e6, found, found ? out[0].cmd : "-");
+  }
+  printf("slowest refresh %.1f us\n", worst_all * 1e6);
+  hsearch_free(hs);
+  return EXIT_SUCCESS;
+}
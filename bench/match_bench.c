@@ -0,0 +1,130 @@
+// match_bench.c
+//
+// Compares the throughput of the old search path (fgets into a 256-byte
+// buffer + strstr) with the mmap/SIMD kernel in src/match.c.
+//
+// Usage: match_bench [size_mb] [query]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../src/match.h"
+
+#define DEFAULT_SIZE_MB 256
+#define DEFAULT_QUERY "needle_in_the_haystack"
+#define RUNS 3
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write size bytes of source-like text with a match every ~10k lines
+static int write_corpus(const char *path, size_t size, const char *query)
+{
+  static const char *words[] = {"int", "return", "static", "const", "char", "buffer", "size_t",
+                                "while", "if", "else", "for", "struct", "printf", "(void)", "{", "}"};
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    return -1;
+
+  size_t written = 0, line = 0;
+  unsigned seed = 42;
+  char buf[256];
+  while (written < size)
+  {
+    int len = 0, words_in_line = 4 + rand_r(&seed) % 10;
+    for (int w = 0; w < words_in_line; w++)
+      len += snprintf(buf + len, sizeof(buf) - len, "%s ", words[rand_r(&seed) % 16]);
+    if (++line % 10000 == 0)
+      len += snprintf(buf + len, sizeof(buf) - len, "%s", query);
+    buf[len++] = '\n';
+    fwrite(buf, 1, len, fp);
+    written += len;
+  }
+  fclose(fp);
+  return 0;
+}
+
+static long scan_fgets(const char *path, const char *query)
+{
+  FILE *file = fopen(path, "r");
+  long matches = 0;
+  char line[256];
+  if (!file)
+    return -1;
+  while (fgets(line, sizeof(line), file))
+  {
+    if (strstr(line, query))
+      matches++;
+  }
+  fclose(file);
+  return matches;
+}
+
+static void count_match(void *ctx, size_t line_num, const char *line, size_t len)
+{
+  (*(long *)ctx)++;
+}
+
+static long scan_kernel(const char *path, const char *query, MatchScratch *scratch)
+{
+  long matches = 0;
+  match_scan_file(path, query, strlen(query), scratch, count_match, &matches);
+  return matches;
+}
+
+int main(int argc, char **argv)
+{
+  size_t size_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_SIZE_MB;
+  const char *query = argc > 2 ? argv[2] : DEFAULT_QUERY;
+  char path[] = "/tmp/pss_match_benchXXXXXX";
+  MatchScratch scratch = {NULL, 0};
+
+  int fd = mkstemp(path);
+  if (fd < 0)
+  {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  if (write_corpus(path, size_mb << 20, query) != 0)
+  {
+    perror("write corpus");
+    unlink(path);
+    return 1;
+  }
+
+  printf("corpus: %zu MB, query \"%s\", kernel %s\n", size_mb, query, match_kernel_name());
+
+  // Warm the page cache so both paths measure CPU, not the disk
+  scan_kernel(path, query, &scratch);
+
+  double best_fgets = 1e9, best_kernel = 1e9;
+  long m_fgets = 0, m_kernel = 0;
+  for (int r = 0; r < RUNS; r++)
+  {
+    double t0 = now_seconds();
+    m_fgets = scan_fgets(path, query);
+    double t1 = now_seconds();
+    m_kernel = scan_kernel(path, query, &scratch);
+    double t2 = now_seconds();
+    if (t1 - t0 < best_fgets)
+      best_fgets = t1 - t0;
+    if (t2 - t1 < best_kernel)
+      best_kernel = t2 - t1;
+  }
+
+  double mb = (double)size_mb;
+  printf("fgets+strstr : %8.1f MB/s  (%ld matches)\n", mb / best_fgets, m_fgets);
+  printf("match kernel : %8.1f MB/s  (%ld matches)\n", mb / best_kernel, m_kernel);
+  printf("speedup      : %8.2fx\n", best_fgets / best_kernel);
+
+  free(scratch.buf);
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,123 @@
+// remind_bench.c
+//
+// Reminders at scale (remind.h): a child process schedules a given number
+// of reminders at random times over the next year into the file of a
+// temporary directory, then this process loads them as a new shell would.
+// Half of them are cancelled in random order, as many again are scheduled,
+// and the pending ones are listed soonest first. Finally a batch that is
+// already due is scheduled and delivered in one go. Every change goes
+// through the file, under its lock, as in the shell.
+//
+// Usage: remind_bench [reminders]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/remind.h"
+
+#define DEFAULT_REMINDERS 100000
+#define DUE_BATCH 1000
+#define YEAR_SECONDS (365 * 24 * 3600)
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t listed;
+
+static void count_entry(const RemindEntry *e, void *ctx)
+{
+  (void)e;
+  (void)ctx;
+  listed++;
+}
+
+static void fail(const char *what)
+{
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+static void schedule(size_t n, time_t base, time_t spread)
+{
+  char task[64];
+  uint32_t id;
+  for (size_t i = 0; i < n; i++)
+  {
+    snprintf(task, sizeof(task), "Task number %zu", i);
+    if (remind_add(base + (spread ? rand() % spread : 0), task, &id) != 0)
+      fail("remind_add");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_REMINDERS;
+  char dir[] = "/tmp/remind_benchXXXXXX";
+  time_t now = time(NULL);
+
+  if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+    fail("remind_bench");
+
+  // Written by another process, so that this one starts with nothing loaded
+  double t0 = now_seconds();
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    if (remind_open() != 0)
+      fail("remind_open");
+    schedule(n, now + 3600, YEAR_SECONDS);
+    _exit(EXIT_SUCCESS);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || status != 0)
+    fail("remind_bench: child");
+  double added = now_seconds() - t0;
+
+  t0 = now_seconds();
+  if (remind_open() != 0)
+    fail("remind_open");
+  double loaded = now_seconds() - t0;
+  size_t count = remind_count();
+
+  t0 = now_seconds();
+  size_t cancels = n / 2;
+  for (size_t i = 0; i < cancels; i++)
+  {
+    if (remind_cancel((uint32_t)((i * 7919) % n + 1)) < 0)
+      fail("remind_cancel");
+  }
+  double cancelled = now_seconds() - t0;
+
+  t0 = now_seconds();
+  schedule(cancels, now + 3600, YEAR_SECONDS);
+  double readded = now_seconds() - t0;
+
+  t0 = now_seconds();
+  remind_each(count_entry, NULL);
+  double listing = now_seconds() - t0;
+
+  schedule(DUE_BATCH, now - 60, 60);
+  t0 = now_seconds();
+  size_t delivered = remind_deliver(count_entry, NULL);
+  double delivering = now_seconds() - t0;
+
+  printf("%zu reminders, %zu loaded, %zu pending at the end\n", n, count, remind_count());
+  printf("  schedule         %10.2f us/reminder\n", added / n * 1e6);
+  printf("  load             %10.2f ms\n", loaded * 1e3);
+  printf("  cancel           %10.2f us/reminder (%zu, with compaction)\n", cancelled / cancels * 1e6, cancels);
+  printf("  schedule again   %10.2f us/reminder\n", readded / cancels * 1e6);
+  printf("  list in order    %10.2f ms (%zu)\n", listing * 1e3, listed - delivered);
+  printf("  deliver          %10.2f ms (%zu due)\n", delivering * 1e3, delivered);
+
+  unlink(REMIND_FILE_NAME);
+  if (chdir("/") == 0)
+    rmdir(dir);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+// scache_bench.c
+//
+// Time to first command for a script: how long the shell takes from opening
+// a script file until its first command could run. Since scripts are parsed
+// as a whole up front, that is reading plus parsing on a cold cache, and
+// reading plus mapping the cached copy (src/scache.c) on a warm one.
+//
+// Usage: scache_bench [lines] [runs]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "../src/script.h"
+#include "../src/scache.h"
+
+#define DEFAULT_LINES 100000
+#define DEFAULT_RUNS 21
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// A script with a mix of plain commands, pipelines and redirections
+static void write_script(const char *path, long lines)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+  {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(f, "#!/usr/bin/env my_shell\n");
+  for (long i = 0; i < lines; i++)
+  {
+    switch (i % 4)
+    {
+    case 0:
+      fprintf(f, "echo building target %ld of the project\n", i);
+      break;
+    case 1:
+      fprintf(f, "grep -n pattern%ld src/file%ld.c | sort | uniq -c > out/%ld.txt\n", i, i, i);
+      break;
+    case 2:
+      fprintf(f, "# step %ld\n", i);
+      break;
+    default:
+      fprintf(f, "cc -O2 -c src/file%ld.c -o obj/file%ld.o 2>> build.log\n", i, i);
+      break;
+    }
+  }
+  fclose(f);
+}
+
+// Empty the cache directory
+static void clear_cache(const char *dir)
+{
+  char file[512];
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  if (!d)
+    return;
+  while ((e = readdir(d)) != NULL)
+  {
+    if (e->d_name[0] == '.')
+      continue;
+    snprintf(file, sizeof(file), "%s/%s", dir, e->d_name);
+    unlink(file);
+  }
+  closedir(d);
+}
+
+enum { MODE_PARSE, MODE_COLD, MODE_WARM };
+
+// Seconds until the first command of path is ready, in the given mode
+static double time_to_first(const char *path, int mode)
+{
+  Script s;
+  double t0 = now_seconds();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || script_read(&s, fd, path) != 0)
+  {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  if (mode == MODE_PARSE || scache_load(&s, path) != 0)
+  {
+    if (mode == MODE_WARM)
+    {
+      fprintf(stderr, "scache_bench: warm run missed the cache\n");
+      exit(EXIT_FAILURE);
+    }
+    if (script_parse(&s) != 0)
+      exit(EXIT_FAILURE);
+    if (mode == MODE_COLD)
+      scache_store(&s, path);
+  }
+  double t = now_seconds() - t0;
+  if (s.ncmds == 0 || s.cmds[0].stages[0].argv[0] == NULL)
+    exit(EXIT_FAILURE);
+  script_free(&s);
+  return t;
+}
+
+int main(int argc, char **argv)
+{
+  long lines = argc > 1 ? strtol(argv[1], NULL, 10) : DEFAULT_LINES;
+  int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+  char dir[] = "/tmp/scache_benchXXXXXX";
+  char path[256], cache[256];
+  const char *names[] = {"parse only", "cold cache", "warm cache"};
+
+  if (mkdtemp(dir) == NULL)
+  {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  snprintf(path, sizeof(path), "%s/script.pss", dir);
+  snprintf(cache, sizeof(cache), "%s/cache", dir);
+  setenv(SCACHE_DIR_ENV, cache, 1);
+  write_script(path, lines);
+
+  printf("%ld-line script, median of %d runs\n", lines, runs);
+  for (int mode = MODE_PARSE; mode <= MODE_WARM; mode++)
+  {
+    double *t = malloc(runs * sizeof(double));
+    for (int i = 0; i < runs; i++)
+    {
+      if (mode == MODE_COLD)
+        clear_cache(cache);
+      t[i] = time_to_first(path, mode);
+    }
+    qsort(t, runs, sizeof(double), compare);
+    printf("  %-10s %9.3f ms\n", names[mode], t[runs / 2] * 1e3);
+    free(t);
+  }
+
+  clear_cache(cache);
+  rmdir(cache);
+  unlink(path);
+  rmdir(dir);
+  return EXIT_SUCCESS;
+}
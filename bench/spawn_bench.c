@@ -0,0 +1,97 @@
+// spawn_bench.c
+//
+// Compares the latency of starting a command the old way (fork + execvp +
+// waitpid) with spawn_run in src/spawn.c, while the benchmark process holds
+// increasingly large amounts of touched memory, standing in for a shell with
+// big in-memory indexes.
+//
+// Usage: spawn_bench [max_rss_mb] [runs]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "../src/spawn.h"
+
+#define DEFAULT_MAX_RSS_MB 1024
+#define DEFAULT_RUNS 200
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int launch_fork(char **argv)
+{
+  int status;
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  if (pid < 0)
+    return -1;
+  waitpid(pid, &status, 0);
+  return 0;
+}
+
+// Average microseconds per launch
+static double time_launches(int use_spawn, int runs)
+{
+  char *argv[] = {"true", NULL};
+  double t0 = now_seconds();
+  for (int i = 0; i < runs; i++)
+  {
+    if (use_spawn)
+      spawn_run(argv, NULL);
+    else
+      launch_fork(argv);
+  }
+  return (now_seconds() - t0) * 1e6 / runs;
+}
+
+int main(int argc, char **argv)
+{
+  size_t max_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MAX_RSS_MB;
+  int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+  char *ballast = NULL;
+  size_t held_mb = 0;
+
+  printf("launching \"true\" %d times per measurement\n", runs);
+  printf("%10s %14s %14s %9s\n", "rss (MB)", "fork (us)", "spawn (us)", "speedup");
+
+  // Warm the command hash and the page cache
+  time_launches(0, 10);
+  time_launches(1, 10);
+
+  for (size_t mb = 0;; mb = mb ? mb * 4 : 64)
+  {
+    if (mb > max_mb)
+      break;
+    if (mb > held_mb)
+    {
+      char *grown = realloc(ballast, mb << 20);
+      if (!grown)
+      {
+        perror("realloc");
+        break;
+      }
+      ballast = grown;
+      // Touch every page so it is really resident
+      memset(ballast + (held_mb << 20), 1, (mb - held_mb) << 20);
+      held_mb = mb;
+    }
+
+    double t_fork = time_launches(0, runs);
+    double t_spawn = time_launches(1, runs);
+    printf("%10zu %14.1f %14.1f %8.2fx\n", mb, t_fork, t_spawn, t_fork / t_spawn);
+  }
+
+  free(ballast);
+  return 0;
+}
@@ -0,0 +1,187 @@
+// suggest_bench.c
+//
+// "Did you mean" lookups: how long it takes to find the closest names to a
+// mistyped command among a given number of candidates, comparing a scan
+// that measures the distance to every name with the symmetric delete index
+// the shell uses (symdel.h). Queries are candidate names with one or two
+// typos, plus words close to nothing, which cost a scan just as much.
+//
+// Usage: suggest_bench [names] [queries]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/symdel.h"
+
+#define DEFAULT_NAMES 20000
+#define DEFAULT_QUERIES 500
+
+typedef struct
+{
+  unsigned best;
+  size_t found; // Names at that distance
+} Result;
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A command-like name: a few syllables, sometimes a digit or a dash
+static void make_name(char *buf, size_t size)
+{
+  static const char *parts[] = {"git", "py", "th", "on", "ls", "gr", "ep", "ma", "ke", "x", "z", "ip",
+                                "cat", "ch", "mod", "run", "sys", "ctl", "net", "d", "lib", "conf", "s", "u"};
+  size_t n = 1 + rand() % 4, len = 0;
+  buf[0] = '\0';
+  for (size_t i = 0; i < n && len + 8 < size; i++)
+    len += snprintf(buf + len, size - len, "%s", parts[rand() % (sizeof(parts) / sizeof(parts[0]))]);
+  if (rand() % 4 == 0 && len + 3 < size)
+    len += snprintf(buf + len, size - len, "%c%d", rand() % 2 ? '-' : '.', rand() % 10);
+}
+
+// One random edit: drop, add, change or swap a character
+static void typo(char *word)
+{
+  size_t len = strlen(word);
+  size_t at = rand() % (len + 1);
+  switch (rand() % 4)
+  {
+  case 0:
+    if (len > 2)
+      memmove(word + at, word + at + 1, len - at);
+    break;
+  case 1:
+    memmove(word + at + 1, word + at, len - at + 1);
+    word[at] = 'a' + rand() % 26;
+    break;
+  case 2:
+    if (at < len)
+      word[at] = 'a' + rand() % 26;
+    break;
+  default:
+    if (at + 1 < len)
+    {
+      char c = word[at];
+      word[at] = word[at + 1];
+      word[at + 1] = c;
+    }
+  }
+}
+
+static unsigned radius(size_t len)
+{
+  return len <= 4 ? 1 : 2;
+}
+
+static unsigned keep_best(uint32_t node, unsigned dist, void *ctx)
+{
+  Result *r = ctx;
+  (void)node;
+  if (dist < r->best)
+  {
+    r->best = dist;
+    r->found = 0;
+  }
+  r->found += dist == r->best;
+  return r->best;
+}
+
+static Result linear_find(char **names, size_t n, const char *q)
+{
+  size_t qlen = strlen(q);
+  Result r = {radius(qlen) + 1, 0};
+  for (size_t i = 0; i < n; i++)
+  {
+    size_t len = strlen(names[i]);
+    unsigned d = symdel_distance(q, qlen, names[i], len, radius(qlen));
+    if (d <= radius(qlen))
+      keep_best(0, d, &r);
+  }
+  return r;
+}
+
+static Result index_find(SymDel *ix, const char *q)
+{
+  size_t qlen = strlen(q);
+  Result r = {radius(qlen) + 1, 0};
+  symdel_search(ix, q, qlen, radius(qlen), keep_best, &r);
+  return r;
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_NAMES;
+  long nqueries = argc > 2 ? strtol(argv[2], NULL, 10) : DEFAULT_QUERIES;
+  char **names = malloc(n * sizeof(char *));
+  SymDel ix;
+
+  srand(1);
+  symdel_init(&ix);
+  for (size_t i = 0; i < n; i++)
+  {
+    char buf[SYMDEL_MAX_LEN];
+    make_name(buf, sizeof(buf));
+    names[i] = strdup(buf);
+  }
+  double t0 = now_seconds();
+  for (size_t i = 0; i < n; i++)
+    symdel_add(&ix, names[i], strlen(names[i]));
+  double build = now_seconds() - t0;
+
+  char **queries = malloc(nqueries * sizeof(char *));
+  for (long i = 0; i < nqueries; i++)
+  {
+    char buf[SYMDEL_MAX_LEN + 8];
+    if (i % 4 == 3)
+      snprintf(buf, sizeof(buf), "qqv%ldwj", i);
+    else
+    {
+      snprintf(buf, sizeof(buf), "%s", names[rand() % n]);
+      typo(buf);
+      if (i % 4 == 2)
+        typo(buf);
+    }
+    queries[i] = strdup(buf);
+  }
+
+  long found = 0, disagreed = 0;
+  for (long i = 0; i < nqueries; i++)
+  {
+    Result a = linear_find(names, n, queries[i]), b = index_find(&ix, queries[i]);
+    if (a.best != b.best)
+      disagreed++;
+    found += a.best <= radius(strlen(queries[i]));
+  }
+  if (disagreed)
+  {
+    fprintf(stderr, "suggest_bench: scan and index disagree on %ld queries\n", disagreed);
+    return EXIT_FAILURE;
+  }
+
+  printf("%zu names (%zu distinct), index built in %.1f ms, %ld of %ld queries close to one\n", n, ix.count,
+         build * 1e3, found, nqueries);
+  t0 = now_seconds();
+  for (long i = 0; i < nqueries; i++)
+    linear_find(names, n, queries[i]);
+  double linear = now_seconds() - t0;
+  t0 = now_seconds();
+  for (long i = 0; i < nqueries; i++)
+    index_find(&ix, queries[i]);
+  double searched = now_seconds() - t0;
+
+  printf("  linear scan  %10.2f us/query\n", linear / nqueries * 1e6);
+  printf("  delete index %10.2f us/query\n", searched / nqueries * 1e6);
+
+  symdel_free(&ix);
+  for (size_t i = 0; i < n; i++)
+    free(names[i]);
+  for (long i = 0; i < nqueries; i++)
+    free(queries[i]);
+  free(names);
+  free(queries);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,546 @@
+// alias.c
+//
+// Aliases. An alias is split into words and parsed when it is defined, and
+// kept that way in one block of memory together with its text, so using it
+// only takes copying its argv arrays into the command being run. Aliases
+// live in an open-addressing hash table keyed by name. They are saved as
+// "name=text" lines in a small file next to the history, which is not read
+// until an alias is first looked up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include "alias.h"
+#include "status.h"
+
+#define ALIAS_INITIAL_CAPACITY 16
+// Characters an alias name may not contain
+#define ALIAS_BAD_CHARS " \t\r\n\a|&<>;()'\"\\$`=/#"
+
+typedef struct Alias Alias;
+
+// One allocation holds the alias, its stages, argv arrays, redirections,
+// word flags, name, text and the parsed copy of the text the words point
+// into
+struct Alias
+{
+  const char *name;
+  const char *text; // As defined
+  Pipeline pl; // text, parsed
+  uint32_t hash;
+  Alias *next_retired;
+};
+
+static Alias **alias_slots;
+static size_t alias_cap, alias_count;
+static char *alias_path; // NULL until alias_init
+static int alias_loaded;
+// Replaced or removed while a command may still point into them; freed
+// when the next command starts
+static Alias *alias_retired;
+
+static void *alias_xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+// 32-bit FNV-1a
+static uint32_t alias_hash(const char *s)
+{
+  uint32_t h = 2166136261u;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+// Parse text as the alias name, into a block of its own. Returns NULL
+// after printing why it cannot be an alias.
+static Alias *alias_compile(const char *name, const char *text)
+{
+  Arena scratch;
+  Pipeline pl;
+  size_t nlen = strlen(name), tlen = strlen(text);
+
+  arena_init(&scratch);
+  char *line = arena_strndup(&scratch, text, tlen);
+  if (pipeline_parse(line, &pl, &scratch) != 0)
+  {
+    arena_free(&scratch);
+    return NULL;
+  }
+  if (pl.nstages == 0 || pl.background)
+  {
+    fprintf(stderr, "lsh: alias: %s: %s\n", name, pl.nstages == 0 ? "empty alias" : "cannot end with '&'");
+    arena_free(&scratch);
+    return NULL;
+  }
+
+  size_t size = sizeof(Alias) + pl.nstages * sizeof(PipelineStage);
+  for (size_t s = 0; s < pl.nstages; s++)
+  {
+    const PipelineStage *st = &pl.stages[s];
+    size += (st->argc + 1) * sizeof(char *) + st->nredirs * sizeof(Redir) + (st->flags ? st->argc : 0);
+  }
+  size += nlen + 1 + 2 * (tlen + 1);
+
+  Alias *al = alias_xrealloc(NULL, size);
+  PipelineStage *stages = (PipelineStage *)(al + 1);
+  char **argv = (char **)(stages + pl.nstages);
+  char *p = (char *)argv;
+  for (size_t s = 0; s < pl.nstages; s++)
+    p += (pl.stages[s].argc + 1) * sizeof(char *);
+  Redir *redirs = (Redir *)p;
+  for (size_t s = 0; s < pl.nstages; s++)
+    p += pl.stages[s].nredirs * sizeof(Redir);
+  unsigned char *flags = (unsigned char *)p;
+  for (size_t s = 0; s < pl.nstages; s++)
+    p += pl.stages[s].flags ? pl.stages[s].argc : 0;
+  char *block_name = p;
+  char *block_text = block_name + nlen + 1;
+  char *block_line = block_text + tlen + 1;
+  memcpy(block_name, name, nlen + 1);
+  memcpy(block_text, text, tlen + 1);
+  memcpy(block_line, line, tlen + 1); // Split into words, NULs and all
+
+  // Copy the parsed pipeline, moving its words over to block_line
+  for (size_t s = 0; s < pl.nstages; s++)
+  {
+    const PipelineStage *st = &pl.stages[s];
+    stages[s] = *st;
+    stages[s].argv = argv;
+    for (size_t k = 0; k < st->argc; k++)
+      *argv++ = block_line + (st->argv[k] - line);
+    *argv++ = NULL;
+    stages[s].redirs = st->nredirs ? redirs : NULL;
+    for (size_t k = 0; k < st->nredirs; k++)
+    {
+      *redirs = st->redirs[k];
+      if (redirs->path)
+        redirs->path = block_line + (st->redirs[k].path - line);
+      redirs++;
+    }
+    if (st->flags)
+    {
+      stages[s].flags = flags;
+      memcpy(flags, st->flags, st->argc);
+      flags += st->argc;
+    }
+  }
+  al->name = block_name;
+  al->text = block_text;
+  al->pl = pl;
+  al->pl.stages = stages;
+  al->hash = alias_hash(name);
+  al->next_retired = NULL;
+  arena_free(&scratch);
+  return al;
+}
+
+static void alias_retire(Alias *al)
+{
+  al->next_retired = alias_retired;
+  alias_retired = al;
+}
+
+// Slot of name, or of the empty slot where it would go
+static size_t alias_slot(const char *name, uint32_t h)
+{
+  size_t i = h & (alias_cap - 1);
+  while (alias_slots[i] && (alias_slots[i]->hash != h || strcmp(alias_slots[i]->name, name) != 0))
+    i = (i + 1) & (alias_cap - 1);
+  return i;
+}
+
+static void alias_put(Alias *al)
+{
+  if ((alias_count + 1) * 2 > alias_cap)
+  {
+    Alias **old = alias_slots;
+    size_t old_cap = alias_cap;
+    alias_cap = alias_cap ? alias_cap * 2 : ALIAS_INITIAL_CAPACITY;
+    alias_slots = alias_xrealloc(NULL, alias_cap * sizeof(Alias *));
+    memset(alias_slots, 0, alias_cap * sizeof(Alias *));
+    for (size_t i = 0; i < old_cap; i++)
+    {
+      if (old[i])
+        alias_slots[alias_slot(old[i]->name, old[i]->hash)] = old[i];
+    }
+    free(old);
+  }
+  size_t i = alias_slot(al->name, al->hash);
+  if (alias_slots[i])
+    alias_retire(alias_slots[i]);
+  else
+    alias_count++;
+  alias_slots[i] = al;
+}
+
+static int alias_remove(const char *name)
+{
+  if (alias_count == 0)
+    return -1;
+  size_t i = alias_slot(name, alias_hash(name));
+  if (!alias_slots[i])
+    return -1;
+  alias_retire(alias_slots[i]);
+  alias_slots[i] = NULL;
+  alias_count--;
+  // Shift later entries of the probe run back so lookups still find them
+  for (size_t j = (i + 1) & (alias_cap - 1); alias_slots[j]; j = (j + 1) & (alias_cap - 1))
+  {
+    size_t home = alias_slots[j]->hash & (alias_cap - 1);
+    if (((j - home) & (alias_cap - 1)) >= ((j - i) & (alias_cap - 1)))
+    {
+      alias_slots[i] = alias_slots[j];
+      alias_slots[j] = NULL;
+      i = j;
+    }
+  }
+  return 0;
+}
+
+void alias_init(void)
+{
+  char cwd[PATH_MAX];
+  if (alias_path)
+    return;
+  // Like the history, in the directory the shell started in
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    strcpy(cwd, ".");
+  alias_path = alias_xrealloc(NULL, strlen(cwd) + 1 + strlen(ALIAS_FILE_NAME) + 1);
+  sprintf(alias_path, "%s/%s", cwd, ALIAS_FILE_NAME);
+}
+
+static void alias_load(void)
+{
+  char *line = NULL;
+  size_t cap = 0, lineno = 0;
+  ssize_t len;
+
+  alias_loaded = 1;
+  FILE *f = alias_path ? fopen(alias_path, "r") : NULL;
+  if (!f)
+    return;
+  while ((len = getline(&line, &cap, f)) > 0)
+  {
+    lineno++;
+    if (line[len - 1] == '\n')
+      line[--len] = '\0';
+    char *eq = strchr(line, '=');
+    if (!eq || eq == line)
+      continue;
+    *eq = '\0';
+    pipeline_set_source(alias_path, lineno);
+    Alias *al = alias_compile(line, eq + 1);
+    pipeline_set_source(NULL, 0);
+    if (al)
+      alias_put(al);
+  }
+  free(line);
+  fclose(f);
+}
+
+static const Alias *alias_find(const char *name)
+{
+  if (!alias_loaded)
+    alias_load();
+  if (alias_count == 0)
+    return NULL;
+  return alias_slots[alias_slot(name, alias_hash(name))];
+}
+
+void alias_each(void (*fn)(const char *name, void *ctx), void *ctx)
+{
+  if (!alias_loaded)
+    alias_load();
+  for (size_t i = 0; i < alias_cap; i++)
+  {
+    if (alias_slots[i])
+      fn(alias_slots[i]->name, ctx);
+  }
+}
+
+static int alias_compare(const void *a, const void *b)
+{
+  return strcmp((*(const Alias *const *)a)->name, (*(const Alias *const *)b)->name);
+}
+
+// Every alias, sorted by name, in a malloc'ed array of alias_count
+static const Alias **alias_sorted(void)
+{
+  const Alias **list = alias_xrealloc(NULL, (alias_count + 1) * sizeof(Alias *));
+  size_t n = 0;
+  for (size_t i = 0; i < alias_cap; i++)
+  {
+    if (alias_slots[i])
+      list[n++] = alias_slots[i];
+  }
+  qsort(list, n, sizeof(Alias *), alias_compare);
+  return list;
+}
+
+// Rewrite the alias file. Returns 0, or -1 after printing why not.
+static int alias_save(void)
+{
+  char tmp[PATH_MAX + 32];
+  if (!alias_path)
+    return 0;
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", alias_path, (int)getpid());
+  FILE *f = fopen(tmp, "w");
+  if (!f)
+  {
+    fprintf(stderr, "lsh: %s: %s\n", tmp, strerror(errno));
+    return -1;
+  }
+  const Alias **list = alias_sorted();
+  for (size_t i = 0; i < alias_count; i++)
+    fprintf(f, "%s=%s\n", list[i]->name, list[i]->text);
+  free(list);
+  if (fclose(f) != 0 || rename(tmp, alias_path) != 0)
+  {
+    fprintf(stderr, "lsh: %s: %s\n", alias_path, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+// The alias a stage's command word names, if any. A word that still holds
+// quotes for expansion is never an alias.
+static const Alias *alias_of(const PipelineStage *st)
+{
+  if (st->argc == 0 || (st->flags && (st->flags[0] & PIPELINE_WORD_EXPAND)))
+    return NULL;
+  return alias_find(st->argv[0]);
+}
+
+// tmpl followed by the words of rest after its command word, and rest's
+// redirections
+static PipelineStage alias_merge(const PipelineStage *tmpl, const PipelineStage *rest, Arena *arena)
+{
+  PipelineStage st;
+  st.argc = tmpl->argc + rest->argc - 1;
+  st.argv = arena_alloc(arena, (st.argc + 1) * sizeof(char *));
+  memcpy(st.argv, tmpl->argv, tmpl->argc * sizeof(char *));
+  memcpy(st.argv + tmpl->argc, rest->argv + 1, rest->argc * sizeof(char *)); // With the NULL
+  st.flags = NULL;
+  if (tmpl->flags || rest->flags)
+  {
+    st.flags = arena_alloc(arena, st.argc + 1);
+    for (size_t k = 0; k < st.argc; k++)
+    {
+      if (k < tmpl->argc)
+        st.flags[k] = tmpl->flags ? tmpl->flags[k] : 0;
+      else
+        st.flags[k] = rest->flags ? rest->flags[k - tmpl->argc + 1] : 0;
+    }
+  }
+  st.nredirs = tmpl->nredirs + rest->nredirs;
+  st.redirs = NULL;
+  if (st.nredirs)
+  {
+    st.redirs = arena_alloc(arena, st.nredirs * sizeof(Redir));
+    memcpy(st.redirs, tmpl->redirs, tmpl->nredirs * sizeof(Redir));
+    memcpy(st.redirs + tmpl->nredirs, rest->redirs, rest->nredirs * sizeof(Redir));
+  }
+  return st;
+}
+
+int alias_apply(const Pipeline *pl, Pipeline *out, Arena *arena)
+{
+  size_t s;
+
+  while (alias_retired)
+  {
+    Alias *next = alias_retired->next_retired;
+    free(alias_retired);
+    alias_retired = next;
+  }
+  *out = *pl;
+  for (s = 0; s < pl->nstages && !alias_of(&pl->stages[s]); s++)
+    ;
+  if (s == pl->nstages)
+    return 0; // Nothing to do, and nothing allocated
+
+  PipelineStage *stages = NULL;
+  size_t n = 0, cap = 0;
+  for (s = 0; s < pl->nstages; s++)
+  {
+    PipelineStage cur = pl->stages[s];
+    // Stages that follow cur once it is fully expanded, last first
+    PipelineStage tail[ALIAS_MAX_DEPTH * 4];
+    size_t ntail = 0;
+    const Alias *used[ALIAS_MAX_DEPTH];
+    size_t nused = 0;
+    const Alias *al;
+
+    while (nused < ALIAS_MAX_DEPTH && (al = alias_of(&cur)) != NULL)
+    {
+      size_t k = 0;
+      while (k < nused && used[k] != al)
+        k++;
+      if (k < nused)
+        break; // Already expanded: the word is the command itself
+      size_t m = al->pl.nstages;
+      if (ntail + m - 1 > sizeof(tail) / sizeof(tail[0]))
+        break;
+      used[nused++] = al;
+      out->expand |= al->pl.expand;
+      if (m == 1)
+      {
+        cur = alias_merge(&al->pl.stages[0], &cur, arena);
+        continue;
+      }
+      tail[ntail++] = alias_merge(&al->pl.stages[m - 1], &cur, arena);
+      for (size_t j = m - 2; j > 0; j--)
+        tail[ntail++] = al->pl.stages[j];
+      cur = al->pl.stages[0];
+    }
+
+    for (size_t j = 0; j <= ntail; j++)
+    {
+      if (n == cap)
+      {
+        stages = arena_grow(arena, stages, cap * sizeof(PipelineStage), (cap ? cap * 2 : 8) * sizeof(PipelineStage));
+        cap = cap ? cap * 2 : 8;
+      }
+      stages[n++] = j == 0 ? cur : tail[ntail - j];
+    }
+  }
+  out->stages = stages;
+  out->nstages = n;
+  return 1;
+}
+
+// As a command that defines it again
+static void alias_print(const Alias *al)
+{
+  printf("alias %s='", al->name);
+  for (const char *p = al->text; *p; p++)
+  {
+    if (*p == '\'')
+      fputs("'\\''", stdout);
+    else
+      putchar(*p);
+  }
+  printf("'\n");
+}
+
+/**
+   @brief Builtin command: alias.
+   @param args List of args. With none, lists every alias; "name=text"
+   defines one, a plain name shows it.
+   @return Always returns 1, to continue executing.
+ */
+int lsh_alias(char **args)
+{
+  int changed = 0;
+
+  if (!alias_loaded)
+    alias_load();
+  if (args[1] == NULL)
+  {
+    const Alias **list = alias_sorted();
+    for (size_t i = 0; i < alias_count; i++)
+    {
+      alias_print(list[i]);
+    }
+    free(list);
+    return 1;
+  }
+
+  for (int i = 1; args[i] != NULL; i++)
+  {
+    char *eq = strchr(args[i], '=');
+    if (eq == NULL)
+    {
+      const Alias *al = alias_find(args[i]);
+      if (al)
+        alias_print(al);
+      else
+      {
+        fprintf(stderr, "lsh: alias: %s: not found\n", args[i]);
+        builtin_fail(1);
+      }
+      continue;
+    }
+    size_t nlen = eq - args[i];
+    char name[nlen + 1];
+    memcpy(name, args[i], nlen);
+    name[nlen] = '\0';
+    if (nlen == 0 || name[strcspn(name, ALIAS_BAD_CHARS)] != '\0')
+    {
+      fprintf(stderr, "lsh: alias: `%s': invalid alias name\n", name);
+      builtin_fail(1);
+      continue;
+    }
+    Alias *al = alias_compile(name, eq + 1);
+    if (al)
+    {
+      alias_put(al);
+      changed = 1;
+    }
+    else
+      builtin_fail(1);
+  }
+  if (changed)
+    alias_save();
+  return 1;
+}
+
+/**
+   @brief Builtin command: unalias.
+   @param args List of args: the aliases to remove, or -a for all of them.
+   @return Always returns 1, to continue executing.
+ */
+int lsh_unalias(char **args)
+{
+  int changed = 0;
+
+  if (!alias_loaded)
+    alias_load();
+  if (args[1] == NULL)
+  {
+    fprintf(stderr, "unalias: usage: unalias [-a] name [name ...]\n");
+    return builtin_fail(1);
+  }
+  if (strcmp(args[1], "-a") == 0)
+  {
+    for (size_t i = 0; i < alias_cap; i++)
+    {
+      if (alias_slots[i])
+      {
+        alias_retire(alias_slots[i]);
+        alias_slots[i] = NULL;
+      }
+    }
+    changed = alias_count > 0;
+    alias_count = 0;
+  }
+  else
+  {
+    for (int i = 1; args[i] != NULL; i++)
+    {
+      if (alias_remove(args[i]) == 0)
+        changed = 1;
+      else
+      {
+        fprintf(stderr, "lsh: unalias: %s: not found\n", args[i]);
+        builtin_fail(1);
+      }
+    }
+  }
+  if (changed)
+    alias_save();
+  return 1;
+}
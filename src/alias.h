@@ -0,0 +1,29 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include "pipeline.h"
+#include "arena.h"
+
+// File the aliases are kept in, in the directory the shell started in
+#define ALIAS_FILE_NAME ".pss_aliases"
+// Aliases expanding to aliases: how deep before giving up
+#define ALIAS_MAX_DEPTH 16
+
+// Note where the alias file is. It is only read when an alias is first
+// needed, so startup does not wait for it.
+void alias_init(void);
+
+// Replace the command word of each stage of pl that names an alias with the
+// alias, giving out; the words after it are added to the alias's last
+// stage. An alias whose expansion starts with another alias is expanded
+// again, but never twice, so "alias ls='ls -F'" works. Returns 1 if
+// anything was replaced (out then comes from arena), 0 if not (out is pl).
+int alias_apply(const Pipeline *pl, Pipeline *out, Arena *arena);
+
+// Call fn with the name of every alias, in no particular order
+void alias_each(void (*fn)(const char *name, void *ctx), void *ctx);
+
+int lsh_alias(char **args);
+int lsh_unalias(char **args);
+
+#endif // ALIAS_H
@@ -0,0 +1,78 @@
+// allocstats.c
+//
+// Counting allocator for the stats build. glibc lets a program replace
+// malloc and friends by defining them itself, and then calls the new ones
+// from inside libc too (strdup, stdio buffers, posix_spawn file actions),
+// so the count covers every heap allocation the shell causes, as an
+// LD_PRELOAD counter would. The memory still comes from glibc's allocator,
+// through its __libc_ entry points.
+
+#include <errno.h>
+#include <stdlib.h>
+#include "allocstats.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+// Updated from the search and watcher threads as well
+static size_t allocstats_calls;
+
+static void allocstats_note(void)
+{
+  __atomic_fetch_add(&allocstats_calls, 1, __ATOMIC_RELAXED);
+}
+
+size_t allocstats_count(void)
+{
+  return __atomic_load_n(&allocstats_calls, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+  allocstats_note();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  allocstats_note();
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  // realloc(ptr, 0) frees
+  if (ptr == NULL || size > 0)
+    allocstats_note();
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+  allocstats_note();
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+  if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  void *p = memalign(alignment, size);
+  if (p == NULL)
+    return ENOMEM;
+  *ptr = p;
+  return 0;
+}
+
+void free(void *ptr)
+{
+  __libc_free(ptr);
+}
@@ -0,0 +1,13 @@
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+#include <stddef.h>
+
+// Heap allocations made so far by the whole process, libc's own included:
+// every call to malloc, calloc, realloc or an aligned allocator. Only the
+// stats build (make stats) links allocstats.o, which replaces those
+// functions with counting ones; in the normal shell allocstats_count is
+// NULL.
+size_t allocstats_count(void) __attribute__((weak));
+
+#endif // ALLOCSTATS_H
@@ -0,0 +1,111 @@
+// arena.c
+//
+// Bump allocation in chunks. A command line is split into words, expanded
+// and turned into a pipeline with a handful of small arrays that all die
+// together when the command is done; taking them from an arena costs a
+// pointer bump each, and the whole lot is released by resetting one offset.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+struct ArenaChunk
+{
+  ArenaChunk *next; // Older chunk
+  size_t cap;
+  _Alignas(ARENA_ALIGN) char data[];
+};
+
+static ArenaChunk *arena_new_chunk(Arena *a, size_t cap, ArenaChunk *next)
+{
+  ArenaChunk *c = malloc(sizeof(ArenaChunk) + cap);
+  if (!c)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  c->next = next;
+  c->cap = cap;
+  a->heap_allocs++;
+  a->reserved += cap;
+  return c;
+}
+
+void arena_init(Arena *a)
+{
+  memset(a, 0, sizeof(*a));
+}
+
+void *arena_alloc(Arena *a, size_t size)
+{
+  size_t start = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (a->chunk == NULL || start + size > a->chunk->cap)
+  {
+    size_t cap = a->chunk ? a->chunk->cap * 2 : ARENA_INITIAL_SIZE;
+    while (cap < size)
+      cap *= 2;
+    a->chunk = arena_new_chunk(a, cap, a->chunk);
+    start = 0;
+  }
+  a->used = start + size;
+  a->in_use += size;
+  if (a->in_use > a->high_water)
+    a->high_water = a->in_use;
+  a->last = a->chunk->data + start;
+  return a->last;
+}
+
+void *arena_grow(Arena *a, void *ptr, size_t old_size, size_t new_size)
+{
+  if (ptr && ptr == a->last && (char *)ptr + new_size <= a->chunk->data + a->chunk->cap)
+  {
+    a->used = (char *)ptr - a->chunk->data + new_size;
+    a->in_use += new_size - old_size;
+    if (a->in_use > a->high_water)
+      a->high_water = a->in_use;
+    return ptr;
+  }
+  void *p = arena_alloc(a, new_size);
+  if (ptr)
+    memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+  return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t len)
+{
+  char *copy = arena_alloc(a, len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+void arena_reset(Arena *a)
+{
+  a->resets++;
+  a->in_use = 0;
+  a->used = 0;
+  a->last = NULL;
+  if (a->chunk && a->chunk->next)
+  {
+    // Outgrew the first chunk: keep one chunk holding everything instead
+    size_t cap = a->reserved;
+    arena_free(a);
+    a->chunk = arena_new_chunk(a, cap, NULL);
+  }
+}
+
+void arena_free(Arena *a)
+{
+  while (a->chunk)
+  {
+    ArenaChunk *next = a->chunk->next;
+    free(a->chunk);
+    a->chunk = next;
+  }
+  a->reserved = 0;
+  a->used = 0;
+  a->last = NULL;
+}
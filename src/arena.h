@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Size of the first chunk of an arena
+#define ARENA_INITIAL_SIZE (16 * 1024)
+
+typedef struct ArenaChunk ArenaChunk;
+
+// Bump allocator for memory that lives exactly as long as one command line
+// (or one script). Nothing is freed on its own; arena_reset makes all of it
+// available again at once.
+typedef struct
+{
+  ArenaChunk *chunk; // Newest chunk; older ones hang off it
+  size_t used; // Bytes taken from the newest chunk
+  void *last; // Most recent allocation, which arena_grow may extend
+  size_t in_use; // Bytes handed out since the last reset
+  // Counters
+  size_t heap_allocs; // Chunks taken from malloc over the arena's life
+  size_t reserved; // Bytes in all current chunks
+  size_t high_water; // Most bytes in use between two resets
+  size_t resets;
+} Arena;
+
+void arena_init(Arena *a);
+// size bytes, aligned for any type. Never returns NULL.
+void *arena_alloc(Arena *a, size_t size);
+// Resize ptr, the block of old_size bytes allocated last, in place if it
+// was the most recent allocation and there is room, by copying otherwise
+void *arena_grow(Arena *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strndup(Arena *a, const char *s, size_t len);
+// Forget every allocation. If the arena had to grow past its first chunk,
+// the chunks are replaced by a single one big enough for all of them, so a
+// steady workload stops allocating after the first few commands.
+void arena_reset(Arena *a);
+void arena_free(Arena *a);
+
+#endif // ARENA_H
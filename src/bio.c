@@ -0,0 +1,150 @@
+// bio.c
+//
+// Builtin output. A builtin may be writing to the terminal, a file or a
+// pipeline stage (see pipeline.c); bytes that already sit in a file are
+// handed to the kernel with splice or sendfile, and formatted output is
+// gathered into large blocks instead of going out line by line through a
+// line-buffered stdout.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "bio.h"
+
+int bio_write(int fd, const void *data, size_t len)
+{
+  const char *p = data;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+void bio_open(BioBuffer *b, int fd)
+{
+  fflush(stdout);
+  b->fd = fd;
+  b->len = 0;
+}
+
+int bio_flush(BioBuffer *b)
+{
+  int rc = bio_write(b->fd, b->data, b->len);
+  b->len = 0;
+  return rc;
+}
+
+void bio_append(BioBuffer *b, const void *data, size_t len)
+{
+  if (b->len + len > sizeof(b->data))
+  {
+    bio_flush(b);
+    if (len > sizeof(b->data))
+    {
+      bio_write(b->fd, data, len);
+      return;
+    }
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+void bio_printf(BioBuffer *b, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(b->data + b->len, sizeof(b->data) - b->len, fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return;
+  if ((size_t)n < sizeof(b->data) - b->len)
+  {
+    b->len += n;
+    return;
+  }
+
+  // Did not fit: flush and format again, into the empty buffer if it fits
+  bio_flush(b);
+  char *big = b->data;
+  if ((size_t)n >= sizeof(b->data))
+  {
+    big = malloc(n + 1);
+    if (!big)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  va_start(ap, fmt);
+  vsnprintf(big, n + 1, fmt, ap);
+  va_end(ap);
+  if (big == b->data)
+    b->len = n;
+  else
+  {
+    bio_write(b->fd, big, n);
+    free(big);
+  }
+}
+
+// Fallback when the kernel cannot move the data for us
+static long bio_copy_read(int out_fd, int in_fd, off_t off, size_t len)
+{
+  char buf[BIO_BUFFER_SIZE];
+  size_t done = 0;
+  while (done < len)
+  {
+    size_t want = len - done < sizeof(buf) ? len - done : sizeof(buf);
+    ssize_t n = pread(in_fd, buf, want, off + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    if (bio_write(out_fd, buf, n) != 0)
+      return -1;
+    done += n;
+  }
+  return done;
+}
+
+long bio_copy(int out_fd, int in_fd, off_t off, size_t len)
+{
+  struct stat st;
+  int to_pipe = fstat(out_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+  size_t done = 0;
+
+  fflush(stdout);
+  while (done < len)
+  {
+    ssize_t n;
+    if (to_pipe)
+      n = splice(in_fd, &off, out_fd, NULL, len - done, SPLICE_F_MORE);
+    else
+      n = sendfile(out_fd, in_fd, &off, len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && done == 0 && (errno == EINVAL || errno == ENOSYS))
+      return bio_copy_read(out_fd, in_fd, off, len);
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break; // The file is shorter than expected
+    done += n;
+  }
+  return done;
+}
@@ -0,0 +1,35 @@
+#ifndef BIO_H
+#define BIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define BIO_BUFFER_SIZE (64 * 1024)
+
+// Output buffer for builtins that print a lot. Data goes to the file
+// descriptor in BIO_BUFFER_SIZE blocks with write(), not through stdio.
+typedef struct
+{
+  int fd;
+  size_t len;
+  char data[BIO_BUFFER_SIZE];
+} BioBuffer;
+
+// Start writing to fd. Flushes stdout first, so the output lands after
+// anything already printf'ed.
+void bio_open(BioBuffer *b, int fd);
+void bio_append(BioBuffer *b, const void *data, size_t len);
+void bio_printf(BioBuffer *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// Write out whatever is buffered. Returns 0, or -1 if the reader went away.
+int bio_flush(BioBuffer *b);
+
+// Write all of data to fd. Returns 0 or -1.
+int bio_write(int fd, const void *data, size_t len);
+
+// Copy len bytes at offset off of in_fd, a regular file, to out_fd without
+// bringing them into user space: splice when out_fd is a pipe, sendfile
+// otherwise, plain reads and writes if neither is possible. Flushes stdout
+// first. Returns the number of bytes copied, or -1.
+long bio_copy(int out_fd, int in_fd, off_t off, size_t len);
+
+#endif // BIO_H
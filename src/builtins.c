@@ -0,0 +1,67 @@
+// builtins.c
+//
+// The builtin registry. Each builtin is one entry in builtins.def, carrying
+// its handler and its help, so the dispatch table, "help", "learn" and
+// completion cannot disagree about what exists. Looking a command up happens
+// for every command run; it goes through a perfect hash generated from the
+// same file at build time (tools/phash_gen.c, see phash.h), which costs one
+// hash of the name and one string comparison whatever the number of
+// builtins.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "builtins.h"
+#include "phash.h"
+#include "scf.h"
+#include "utils.h"
+#include "hist.h"
+#include "cmdhash.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "alias.h"
+#include "builtins_phash.h" // Generated
+
+// Colours for help texts
+#define RESET "\033[0m"
+#define BOLD "\033[1m"
+#define BLUE "\033[34m"
+#define GREEN "\033[32m"
+#define CYAN "\033[36m"
+#define YELLOW "\033[33m"
+
+static const Builtin builtin_table[] = {
+#define BUILTIN(name, fn, usage, summary, help) {name, fn, usage, summary, help},
+#include "builtins.def"
+#undef BUILTIN
+};
+
+#define BUILTIN_COUNT (sizeof(builtin_table) / sizeof(builtin_table[0]))
+
+// Fails to compile if the generated table is out of date
+typedef char builtin_phash_matches_table[BUILTIN_COUNT == BUILTINS_PHASH_KEYS ? 1 : -1];
+
+const Builtin *builtin_find(const char *name)
+{
+  uint32_t slot = phash_slot(BUILTINS_PHASH_SEED, BUILTINS_PHASH_BUCKETS, builtins_phash_disp,
+                             BUILTINS_PHASH_SLOTS, name);
+  int i = builtins_phash_slots[slot];
+  if (strcmp(builtin_table[i].name, name) != 0)
+    return NULL;
+  return &builtin_table[i];
+}
+
+const Builtin *builtin_list(size_t *count)
+{
+  *count = BUILTIN_COUNT;
+  return builtin_table;
+}
+
+void builtin_print_help(const Builtin *b)
+{
+  printf(BOLD CYAN "%s:\n" RESET, b->name);
+  printf("    " BLUE "%s\n" RESET, b->summary);
+  printf("    Usage: %s\n", b->usage);
+  fputs(b->help, stdout);
+  printf("\n");
+}
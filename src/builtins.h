@@ -0,0 +1,29 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stddef.h>
+
+// A builtin command and its documentation. The table is in builtins.def.
+typedef struct
+{
+  const char *name;
+  int (*fn)(char **args); // Returns 0 to end the shell, 1 to go on
+  const char *usage; // Synopsis
+  const char *summary; // One sentence
+  const char *help; // Details for "help <name>"
+} Builtin;
+
+// The builtin called name, or NULL if there is none
+const Builtin *builtin_find(const char *name);
+
+// Every builtin, in the order "help" lists them; sets *count
+const Builtin *builtin_list(size_t *count);
+
+// What "help <name>" shows
+void builtin_print_help(const Builtin *b);
+
+// Builtins of the shell itself, in main.c
+int lsh_help(char **args);
+int lsh_exit(char **args);
+
+#endif // BUILTINS_H
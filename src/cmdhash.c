@@ -0,0 +1,385 @@
+// cmdhash.c
+//
+// Command hash table, like the one in bash. execvp walks every PATH entry for
+// every command it runs; here the first run of a command resolves its full
+// path once and later runs go straight to execv. A remembered path depends on
+// the directory it was found in and on every directory before it in PATH
+// (a new file there would shadow it), so each PATH directory keeps the mtime
+// it had when last looked at. When one of them changes, every command found
+// in it or after it is forgotten. Directories are stat'ed at most once every
+// CMDHASH_RECHECK_MS, so slow mounts are not hit on every command.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cmdhash.h"
+#include "status.h"
+
+#define CMDHASH_INITIAL_CAPACITY 64
+
+typedef struct
+{
+  char *path;
+  size_t len;
+  struct timespec mtime; // As last seen; zero if it could not be stat'ed
+  struct timespec checked; // When mtime was last read, monotonic
+} CmdHashDir;
+
+typedef struct
+{
+  char *name; // NULL for an empty slot
+  char *path;
+  size_t dir; // Index into cmdhash_dirs of the directory it was found in
+  unsigned long hits;
+} CmdHashEntry;
+
+static CmdHashDir *cmdhash_dirs;
+static size_t cmdhash_ndirs;
+static int cmdhash_loaded; // cmdhash_dirs reflects the current PATH
+
+static CmdHashEntry *cmdhash_table;
+static size_t cmdhash_cap, cmdhash_count;
+static unsigned long cmdhash_hits, cmdhash_misses;
+
+static void *cmdhash_xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static char *cmdhash_strdup(const char *s, size_t len)
+{
+  char *copy = cmdhash_xmalloc(len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+static uint32_t cmdhash_hash(const char *s)
+{
+  uint32_t h = 2166136261u;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+static long cmdhash_elapsed_ms(const struct timespec *since, const struct timespec *now)
+{
+  return (now->tv_sec - since->tv_sec) * 1000L + (now->tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+static void cmdhash_stat_dir(CmdHashDir *d, const struct timespec *now)
+{
+  struct stat st;
+  if (stat(d->path, &st) == 0)
+    d->mtime = st.st_mtim;
+  else
+    memset(&d->mtime, 0, sizeof(d->mtime));
+  d->checked = *now;
+}
+
+// Split PATH into cmdhash_dirs. An empty entry means the current directory,
+// as it does for execvp.
+static void cmdhash_load_dirs(void)
+{
+  const char *path = getenv("PATH");
+  struct timespec now;
+
+  if (path == NULL)
+    path = "/bin:/usr/bin"; // execvp's default
+  cmdhash_ndirs = 1;
+  for (const char *p = path; *p; p++)
+    cmdhash_ndirs += *p == ':';
+  cmdhash_dirs = cmdhash_xmalloc(cmdhash_ndirs * sizeof(CmdHashDir));
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (size_t i = 0; i < cmdhash_ndirs; i++)
+  {
+    const char *end = strchr(path, ':');
+    size_t len = end ? (size_t)(end - path) : strlen(path);
+    CmdHashDir *d = &cmdhash_dirs[i];
+    d->path = len ? cmdhash_strdup(path, len) : cmdhash_strdup(".", 1);
+    d->len = len ? len : 1;
+    cmdhash_stat_dir(d, &now);
+    path += len + (end != NULL);
+  }
+  cmdhash_loaded = 1;
+}
+
+static void cmdhash_remove_at(size_t pos)
+{
+  free(cmdhash_table[pos].name);
+  free(cmdhash_table[pos].path);
+  cmdhash_table[pos].name = NULL;
+  cmdhash_count--;
+
+  // Shift later members of the probe run back so lookups still find them
+  size_t hole = pos;
+  for (size_t i = (pos + 1) & (cmdhash_cap - 1); cmdhash_table[i].name; i = (i + 1) & (cmdhash_cap - 1))
+  {
+    size_t home = cmdhash_hash(cmdhash_table[i].name) & (cmdhash_cap - 1);
+    // Move it if its home is not between the hole and it, cyclically
+    if (((i - home) & (cmdhash_cap - 1)) >= ((i - hole) & (cmdhash_cap - 1)))
+    {
+      cmdhash_table[hole] = cmdhash_table[i];
+      cmdhash_table[i].name = NULL;
+      hole = i;
+    }
+  }
+}
+
+// Forget every command found in directory first or later in PATH
+static void cmdhash_forget_from(size_t first)
+{
+  size_t i = 0;
+  while (i < cmdhash_cap)
+  {
+    // Removal may shift an entry back into slot i, so look at it again
+    if (cmdhash_table[i].name && cmdhash_table[i].dir >= first)
+      cmdhash_remove_at(i);
+    else
+      i++;
+  }
+}
+
+static void cmdhash_forget_all(void)
+{
+  for (size_t i = 0; i < cmdhash_cap; i++)
+  {
+    if (cmdhash_table[i].name == NULL)
+      continue;
+    free(cmdhash_table[i].name);
+    free(cmdhash_table[i].path);
+    cmdhash_table[i].name = NULL;
+  }
+  cmdhash_count = 0;
+}
+
+void cmdhash_invalidate(void)
+{
+  cmdhash_forget_all();
+  for (size_t i = 0; i < cmdhash_ndirs; i++)
+    free(cmdhash_dirs[i].path);
+  free(cmdhash_dirs);
+  cmdhash_dirs = NULL;
+  cmdhash_ndirs = 0;
+  cmdhash_loaded = 0;
+}
+
+// Re-stat directories 0..last that are due, forgetting whatever a change in
+// one of them may have made stale
+static void cmdhash_recheck(size_t last)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (size_t i = 0; i <= last && i < cmdhash_ndirs; i++)
+  {
+    CmdHashDir *d = &cmdhash_dirs[i];
+    if (cmdhash_elapsed_ms(&d->checked, &now) < CMDHASH_RECHECK_MS)
+      continue;
+    struct timespec before = d->mtime;
+    cmdhash_stat_dir(d, &now);
+    if (before.tv_sec != d->mtime.tv_sec || before.tv_nsec != d->mtime.tv_nsec)
+    {
+      cmdhash_forget_from(i);
+      return;
+    }
+  }
+}
+
+static size_t cmdhash_find(const char *name)
+{
+  size_t pos = cmdhash_hash(name) & (cmdhash_cap - 1);
+  while (cmdhash_table[pos].name && strcmp(cmdhash_table[pos].name, name) != 0)
+    pos = (pos + 1) & (cmdhash_cap - 1);
+  return pos;
+}
+
+static void cmdhash_grow(void)
+{
+  CmdHashEntry *old = cmdhash_table;
+  size_t old_cap = cmdhash_cap;
+
+  cmdhash_cap = old_cap ? old_cap * 2 : CMDHASH_INITIAL_CAPACITY;
+  cmdhash_table = calloc(cmdhash_cap, sizeof(CmdHashEntry));
+  if (!cmdhash_table)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    if (old[i].name)
+      cmdhash_table[cmdhash_find(old[i].name)] = old[i];
+  }
+  free(old);
+}
+
+int cmdhash_forget(const char *name)
+{
+  if (cmdhash_cap == 0)
+    return -1;
+  size_t pos = cmdhash_find(name);
+  if (cmdhash_table[pos].name == NULL)
+    return -1;
+  cmdhash_remove_at(pos);
+  return 0;
+}
+
+// Walk PATH for name. Returns the malloc'ed full path and sets *dir, or NULL.
+static char *cmdhash_resolve(const char *name, size_t *dir)
+{
+  size_t name_len = strlen(name);
+  for (size_t i = 0; i < cmdhash_ndirs; i++)
+  {
+    const CmdHashDir *d = &cmdhash_dirs[i];
+    if (d->mtime.tv_sec == 0 && d->mtime.tv_nsec == 0)
+      continue; // Missing when last looked at
+    char *path = cmdhash_xmalloc(d->len + name_len + 2);
+    memcpy(path, d->path, d->len);
+    path[d->len] = '/';
+    memcpy(path + d->len + 1, name, name_len + 1);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0)
+    {
+      *dir = i;
+      return path;
+    }
+    free(path);
+  }
+  return NULL;
+}
+
+const char *cmdhash_lookup(const char *name)
+{
+  static char *uncached; // A result that must not be remembered
+
+  if (strchr(name, '/') != NULL)
+    return name;
+  if (!cmdhash_loaded)
+    cmdhash_load_dirs();
+  if (cmdhash_cap == 0)
+    cmdhash_grow();
+
+  size_t pos = cmdhash_find(name);
+  if (cmdhash_table[pos].name)
+  {
+    cmdhash_recheck(cmdhash_table[pos].dir);
+    pos = cmdhash_find(name);
+    if (cmdhash_table[pos].name)
+    {
+      cmdhash_hits++;
+      cmdhash_table[pos].hits++;
+      return cmdhash_table[pos].path;
+    }
+  }
+  else
+  {
+    cmdhash_recheck(cmdhash_ndirs - 1);
+  }
+
+  cmdhash_misses++;
+  size_t dir;
+  char *path = cmdhash_resolve(name, &dir);
+  if (path == NULL)
+    return NULL;
+  if (cmdhash_dirs[dir].path[0] != '/')
+  {
+    // Relative PATH entries depend on the current directory
+    free(uncached);
+    uncached = path;
+    return path;
+  }
+
+  if ((cmdhash_count + 1) * 2 > cmdhash_cap)
+  {
+    cmdhash_grow();
+    pos = cmdhash_find(name);
+  }
+  cmdhash_table[pos].name = cmdhash_strdup(name, strlen(name));
+  cmdhash_table[pos].path = path;
+  cmdhash_table[pos].dir = dir;
+  cmdhash_table[pos].hits = 1;
+  cmdhash_count++;
+  return path;
+}
+
+static int cmdhash_compare(const void *a, const void *b)
+{
+  const CmdHashEntry *x = *(const CmdHashEntry *const *)a;
+  const CmdHashEntry *y = *(const CmdHashEntry *const *)b;
+  return strcmp(x->name, y->name);
+}
+
+static void cmdhash_list(void)
+{
+  CmdHashEntry **sorted = cmdhash_xmalloc((cmdhash_count + 1) * sizeof(CmdHashEntry *));
+  size_t n = 0;
+  for (size_t i = 0; i < cmdhash_cap; i++)
+  {
+    if (cmdhash_table[i].name)
+      sorted[n++] = &cmdhash_table[i];
+  }
+  qsort(sorted, n, sizeof(CmdHashEntry *), cmdhash_compare);
+
+  if (n == 0)
+    printf("hash: hash table empty\n");
+  else
+    printf("hits\tcommand\n");
+  for (size_t i = 0; i < n; i++)
+    printf("%4lu\t%s\n", sorted[i]->hits, sorted[i]->path);
+  printf("%lu hits, %lu misses\n", cmdhash_hits, cmdhash_misses);
+  free(sorted);
+}
+
+int lsh_hash(char **args)
+{
+  if (args[1] == NULL)
+  {
+    cmdhash_list();
+    return 1;
+  }
+  if (strcmp(args[1], "-r") == 0)
+  {
+    cmdhash_forget_all();
+    cmdhash_hits = cmdhash_misses = 0;
+    return 1;
+  }
+  if (strcmp(args[1], "-d") == 0)
+  {
+    if (args[2] == NULL)
+    {
+      fprintf(stderr, "lsh: usage: hash -d <name>...\n");
+      return builtin_fail(1);
+    }
+    for (int i = 2; args[i] != NULL; i++)
+    {
+      if (cmdhash_forget(args[i]) != 0)
+      {
+        fprintf(stderr, "lsh: hash: %s: not found\n", args[i]);
+        builtin_fail(1);
+      }
+    }
+    return 1;
+  }
+
+  for (int i = 1; args[i] != NULL; i++)
+  {
+    if (cmdhash_lookup(args[i]) == NULL)
+    {
+      fprintf(stderr, "lsh: hash: %s: not found\n", args[i]);
+      builtin_fail(1);
+    }
+  }
+  return 1;
+}
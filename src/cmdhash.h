@@ -0,0 +1,24 @@
+#ifndef CMDHASH_H
+#define CMDHASH_H
+
+// A PATH directory is stat'ed again at most this often, in milliseconds, to
+// see whether commands were added to or removed from it
+#define CMDHASH_RECHECK_MS 1000
+
+// Full path of the command name, resolved through PATH on first use and
+// remembered from then on. Names containing a '/' are returned as they are.
+// Returns NULL if no PATH directory has an executable of that name. The
+// string stays valid until the next cmdhash call.
+const char *cmdhash_lookup(const char *name);
+
+// Forget the remembered path of name, if any. Returns 0 if there was one.
+int cmdhash_forget(const char *name);
+
+// Forget every remembered path and re-read PATH; call when PATH changes
+void cmdhash_invalidate(void);
+
+// "hash" builtin: list remembered commands with their hit counts, "-r" to
+// forget them all, "-d <name>" to forget one, or "<name>..." to look names up
+int lsh_hash(char **args);
+
+#endif // CMDHASH_H
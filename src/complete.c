@@ -0,0 +1,371 @@
+// complete.c
+//
+// Tab completion. The line up to the cursor is scanned the way the parser
+// splits it, to find the word being completed and what it is: a command
+// name, the argument of a builtin that takes names of its own, or a path.
+// Directories, PATH ones included, come from the listing cache (dircache.h),
+// which keeps their names sorted, so the candidates for a prefix are found
+// by binary search however many names a directory holds. Everything built
+// for one completion lives in an arena that the next one starts by resetting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "complete.h"
+#include "dircache.h"
+#include "arena.h"
+#include "builtins.h"
+#include "alias.h"
+#include "scf.h"
+#include "pipeline.h"
+
+// Characters the parser would take for something else inside a name
+#define COMPLETE_ESCAPE " \t\r\n\a\\'\"|&<>$#"
+
+typedef enum
+{
+  COMPLETE_FILES,
+  COMPLETE_COMMANDS,
+  COMPLETE_SSH,
+  COMPLETE_DEFINE,
+  COMPLETE_BUILTINS,
+  COMPLETE_ALIASES
+} CompleteKind;
+
+typedef struct
+{
+  const char *name;
+  DirListing *dir; // Where name was listed, for dircache_is_dir; or NULL
+  size_t index;
+} CompleteMatch;
+
+typedef struct
+{
+  const char *prefix;
+  size_t len;
+} CompletePrefix;
+
+static Arena complete_arena;
+static int complete_ready;
+static CompleteMatch *complete_matches;
+static size_t complete_count, complete_cap;
+
+static void *complete_xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void complete_add(const char *name, DirListing *dir, size_t index)
+{
+  if (complete_count == complete_cap)
+  {
+    complete_cap = complete_cap ? complete_cap * 2 : 256;
+    complete_matches = complete_xrealloc(complete_matches, complete_cap * sizeof(CompleteMatch));
+  }
+  complete_matches[complete_count++] = (CompleteMatch){name, dir, index};
+}
+
+// Add a copy of name if it starts with the prefix; for names whose storage
+// does not outlive the call that hands them over
+static void complete_add_copy(const char *name, size_t len, void *ctx)
+{
+  const CompletePrefix *p = ctx;
+  if (len >= p->len && strncmp(name, p->prefix, p->len) == 0)
+    complete_add(arena_strndup(&complete_arena, name, len), NULL, 0);
+}
+
+static void complete_add_alias(const char *name, void *ctx)
+{
+  complete_add_copy(name, strlen(name), ctx);
+}
+
+static void complete_builtins(const CompletePrefix *p)
+{
+  size_t n;
+  const Builtin *b = builtin_list(&n);
+  for (size_t i = 0; i < n; i++)
+  {
+    if (strncmp(b[i].name, p->prefix, p->len) == 0)
+      complete_add(b[i].name, NULL, 0);
+  }
+}
+
+// Executables starting with the prefix in each absolute PATH directory.
+// Names are copied, since a long PATH can push its first listings out of the
+// cache before the last ones are read.
+static void complete_path(const CompletePrefix *p)
+{
+  const char *path = getenv("PATH");
+  if (path == NULL)
+    return;
+  while (*path)
+  {
+    size_t len = strcspn(path, ":");
+    if (len > 0 && path[0] == '/')
+    {
+      char *dir = arena_strndup(&complete_arena, path, len);
+      DirListing *l = dircache_get(dir);
+      size_t first, n = l ? dircache_prefix(l, p->prefix, p->len, &first) : 0;
+      for (size_t i = first; i < first + n; i++)
+      {
+        if (dircache_is_exec(l, i))
+          complete_add_copy(l->entries[i].name, strlen(l->entries[i].name), (void *)p);
+      }
+    }
+    path += len;
+    if (*path == ':')
+      path++;
+  }
+}
+
+// Names in directory dir (as typed, empty for cwd) that start with base.
+// Hidden names only show up once base asks for them.
+static void complete_files(const char *dir, const char *base, const char *cwd)
+{
+  const char *path = dir[0] ? dir : cwd;
+  if (dir[0] && dir[0] != '/')
+  {
+    size_t len = strlen(cwd) + 1 + strlen(dir) + 1;
+    char *full = arena_alloc(&complete_arena, len);
+    snprintf(full, len, "%s/%s", cwd, dir);
+    path = full;
+  }
+
+  DirListing *l = dircache_get(path);
+  size_t first, n = l ? dircache_prefix(l, base, strlen(base), &first) : 0;
+  for (size_t i = first; i < first + n; i++)
+  {
+    if (l->entries[i].name[0] != '.' || base[0] == '.')
+      complete_add(l->entries[i].name, l, i);
+  }
+}
+
+static int complete_compare(const void *a, const void *b)
+{
+  return strcmp(((const CompleteMatch *)a)->name, ((const CompleteMatch *)b)->name);
+}
+
+// Sort the candidates and drop repeats, such as a command that is in two
+// PATH directories
+static void complete_sort(void)
+{
+  size_t n = 0;
+  qsort(complete_matches, complete_count, sizeof(CompleteMatch), complete_compare);
+  for (size_t i = 0; i < complete_count; i++)
+  {
+    if (n == 0 || strcmp(complete_matches[n - 1].name, complete_matches[i].name) != 0)
+      complete_matches[n++] = complete_matches[i];
+  }
+  complete_count = n;
+}
+
+// Append s to out with the characters the parser treats specially escaped
+static char *complete_escape(char *out, const char *s, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    if (strchr(COMPLETE_ESCAPE, s[i]) && s[i] != '\0')
+      *out++ = '\\';
+    *out++ = s[i];
+  }
+  return out;
+}
+
+static int complete_is_dir(size_t i)
+{
+  CompleteMatch *m = &complete_matches[i];
+  return m->dir ? dircache_is_dir(m->dir, m->index) : 0;
+}
+
+// Find the word that ends at pos and what should complete it. Sets *start to
+// where its text begins in line, *word to it without quotes and escapes
+// (allocated from the arena), and returns its kind; -1 if it cannot be
+// completed, as in a comment or a word with a substitution.
+static int complete_scan(const char *line, size_t pos, size_t *start, char **word)
+{
+  char *text = arena_alloc(&complete_arena, pos + 1);
+  char command[16] = "";
+  size_t len = 0, words = 0; // Words before this one in this command
+  int in_word = 0, redirect = 0, sq = 0, dq = 0, expand = 0;
+
+  *start = pos;
+  for (size_t i = 0; i < pos; i++)
+  {
+    char c = line[i];
+    if (!in_word && !sq && !dq)
+    {
+      if (strchr(PIPELINE_DELIM, c))
+        continue;
+      if (c == '|' || c == '&')
+      {
+        words = 0;
+        redirect = 0;
+        continue;
+      }
+      if (c == '<' || c == '>')
+      {
+        redirect = 1;
+        continue;
+      }
+      if (c == '#')
+        return -1;
+      in_word = 1;
+      *start = i;
+      len = 0;
+      expand = 0;
+    }
+
+    if (sq)
+    {
+      if (c == '\'')
+        sq = 0;
+      else
+        text[len++] = c;
+      continue;
+    }
+    if (c == '\\' && i + 1 < pos)
+    {
+      text[len++] = line[++i];
+      continue;
+    }
+    if (c == '"')
+    {
+      dq = !dq;
+      continue;
+    }
+    if (c == '\'' && !dq)
+    {
+      sq = 1;
+      continue;
+    }
+    if (c == '$')
+      expand = 1;
+    if (!dq && (strchr(PIPELINE_DELIM, c) || c == '|' || c == '&' || c == '<' || c == '>'))
+    {
+      // End of a word: note it, then take c as if between words
+      text[len] = '\0';
+      if (redirect)
+        redirect = 0;
+      else if (words++ == 0)
+        snprintf(command, sizeof(command), "%s", text);
+      in_word = 0;
+      *start = pos;
+      i--;
+      continue;
+    }
+    text[len++] = c;
+  }
+
+  if (!in_word)
+    len = 0;
+  text[len] = '\0';
+  *word = text;
+  if (expand)
+    return -1;
+  if (redirect || strchr(text, '/'))
+    return COMPLETE_FILES;
+  if (words == 0)
+    return COMPLETE_COMMANDS;
+  if (words > 1)
+    return COMPLETE_FILES;
+  if (strcmp(command, "ssh") == 0)
+    return COMPLETE_SSH;
+  if (strcmp(command, "define") == 0)
+    return COMPLETE_DEFINE;
+  if (strcmp(command, "help") == 0)
+    return COMPLETE_BUILTINS;
+  if (strcmp(command, "unalias") == 0 || strcmp(command, "alias") == 0)
+    return COMPLETE_ALIASES;
+  return COMPLETE_FILES;
+}
+
+size_t complete_line(const char *line, size_t len, size_t pos, const char *cwd, Completion *c)
+{
+  char *word, *base;
+
+  if (!complete_ready)
+  {
+    arena_init(&complete_arena);
+    complete_ready = 1;
+  }
+  arena_reset(&complete_arena);
+  complete_count = 0;
+  memset(c, 0, sizeof(*c));
+  if (pos > len)
+    pos = len;
+  if (cwd == NULL || cwd[0] == '\0')
+    cwd = ".";
+
+  int kind = complete_scan(line, pos, &c->start, &word);
+  if (kind < 0)
+    return 0;
+  c->end = pos;
+
+  // Only the name after the last '/' is completed; the directory stays
+  base = strrchr(word, '/');
+  base = base ? base + 1 : word;
+  CompletePrefix p = {base, strlen(base)};
+
+  switch (kind)
+  {
+  case COMPLETE_COMMANDS:
+    complete_builtins(&p);
+    alias_each(complete_add_alias, &p);
+    complete_path(&p);
+    complete_sort();
+    break;
+  case COMPLETE_SSH:
+    scf_ssh_names(complete_add_copy, &p);
+    complete_sort();
+    break;
+  case COMPLETE_DEFINE:
+    scf_define_terms(p.prefix, p.len, complete_add_copy, &p);
+    complete_sort();
+    break;
+  case COMPLETE_BUILTINS:
+    complete_builtins(&p);
+    complete_sort();
+    break;
+  case COMPLETE_ALIASES:
+    alias_each(complete_add_alias, &p);
+    complete_sort();
+    break;
+  default:
+  {
+    size_t dir_len = base - word;
+    char *dir = arena_strndup(&complete_arena, word, dir_len);
+    complete_files(dir_len > 0 ? dir : "", base, cwd);
+    break;
+  }
+  }
+  c->count = complete_count;
+  if (complete_count == 0)
+    return 0;
+
+  // As far as the candidates agree; sorted, the first and last differ most
+  const char *first = complete_matches[0].name, *last = complete_matches[complete_count - 1].name;
+  size_t common = 0;
+  while (first[common] && first[common] == last[common])
+    common++;
+
+  char *out = arena_alloc(&complete_arena, 2 * ((base - word) + common) + 2);
+  char *end = complete_escape(out, word, base - word);
+  end = complete_escape(end, first, common);
+  if (complete_count == 1)
+    *end++ = complete_is_dir(0) ? '/' : ' ';
+  *end = '\0';
+  c->text = out;
+  return complete_count;
+}
+
+const char *complete_candidate(size_t i, int *is_dir)
+{
+  *is_dir = complete_is_dir(i);
+  return complete_matches[i].name;
+}
@@ -0,0 +1,30 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stddef.h>
+
+// Most candidates listed under the line when Tab is pressed twice
+#define COMPLETE_MAX_SHOWN 100
+
+typedef struct
+{
+  size_t start, end; // The bytes of the line that text replaces
+  const char *text; // NUL terminated, escaped for the parser
+  size_t count; // Candidates found
+} Completion;
+
+// Complete the word that ends at pos in line (len bytes), in directory cwd.
+// A command name is completed from the builtins, the aliases and the PATH
+// executables; the word after "ssh" from the saved connections, after
+// "define" from the defined terms, after "help" or "unalias" from the
+// builtins or aliases; anything else as a file path. The word is completed
+// as far as every candidate agrees, and a single candidate is finished with
+// '/' for a directory or a space. Returns the number of candidates; text
+// and the candidates stay valid until the next call.
+size_t complete_line(const char *line, size_t len, size_t pos, const char *cwd, Completion *c);
+
+// Candidate i of the last complete_line, in sorted order. *is_dir is set
+// for directories.
+const char *complete_candidate(size_t i, int *is_dir);
+
+#endif // COMPLETE_H
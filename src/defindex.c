@@ -0,0 +1,419 @@
+// defindex.c
+//
+// Full-text search of definitions. Each definition's text is split into
+// lowercased words, and every word keeps the list of definitions holding it
+// (a posting list) with how many times it occurs in each. A query only reads
+// the lists of its own words, scoring the definitions on them with BM25: a
+// word counts more the fewer definitions hold it and the more often it
+// occurs in one, less in long definitions than in short ones.
+//
+// Nothing is built until the first search. From then on the index follows
+// the store (defstore.h) as records are read, so storing, deleting, and
+// other shells' changes cost a few list appends, not a rebuild. A removed
+// definition is only marked dead; once dead ones outnumber the live ones,
+// the next search starts again from the store.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "defindex.h"
+#include "defstore.h"
+
+#define DEFINDEX_INITIAL_CAPACITY 1024
+// Below this many dead definitions the index is never rebuilt to drop them
+#define DEFINDEX_REBUILD_MIN 4096
+
+typedef struct
+{
+  uint32_t doc; // Definition id
+  uint32_t tf; // Times the word occurs in it
+} DefPosting;
+
+// A word and its posting list. len 0 marks an empty slot.
+typedef struct
+{
+  uint32_t hash;
+  uint32_t off; // Of the word in defindex_pool
+  uint32_t len;
+  uint32_t df; // Live definitions holding the word
+  uint32_t mark; // Last removal or query that counted the word
+  uint32_t count, cap;
+  DefPosting *postings; // By increasing definition id
+} DefWord;
+
+typedef struct
+{
+  uint32_t term_off; // Of the term in defindex_terms
+  uint32_t term_len;
+  uint32_t len; // Words in the text
+  uint32_t alive;
+} DefDoc;
+
+static int defindex_built, defindex_stale;
+
+static DefWord *defindex_words;
+static size_t defindex_cap, defindex_used;
+static char *defindex_pool;
+static size_t defindex_pool_len, defindex_pool_cap;
+static uint32_t defindex_mark;
+
+// Definitions by id
+static DefDoc *defindex_docs;
+static size_t defindex_docs_cap;
+static char *defindex_terms;
+static size_t defindex_terms_len, defindex_terms_cap;
+static size_t defindex_live, defindex_dead;
+static uint64_t defindex_total_len; // Words in the live definitions
+
+// Query scratch: score per definition, and which ones have one
+static double *defindex_scores;
+static uint32_t *defindex_touched;
+static size_t defindex_scores_cap;
+
+static void *defindex_xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint32_t defindex_hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return h;
+}
+
+// Letters, digits, and every byte of a multibyte character
+static int defindex_is_word(unsigned char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+// Next word of s at or after *pos, lowercased into word (at most
+// DEFINDEX_MAX_WORD bytes of it). Returns its length, 0 when there is none.
+static size_t defindex_next_word(const char *s, size_t len, size_t *pos, char *word)
+{
+  size_t i = *pos, n = 0;
+  while (i < len && !defindex_is_word((unsigned char)s[i]))
+    i++;
+  for (; i < len && defindex_is_word((unsigned char)s[i]); i++)
+  {
+    if (n < DEFINDEX_MAX_WORD)
+      word[n++] = s[i] >= 'A' && s[i] <= 'Z' ? s[i] - 'A' + 'a' : s[i];
+  }
+  *pos = i;
+  return n;
+}
+
+// Slot of word, or the empty slot where it would go
+static size_t defindex_find(const char *word, size_t len, uint32_t h)
+{
+  size_t pos = h & (defindex_cap - 1);
+  while (defindex_words[pos].len != 0)
+  {
+    const DefWord *w = &defindex_words[pos];
+    if (w->hash == h && w->len == len && memcmp(defindex_pool + w->off, word, len) == 0)
+      break;
+    pos = (pos + 1) & (defindex_cap - 1);
+  }
+  return pos;
+}
+
+static void defindex_grow(void)
+{
+  DefWord *old = defindex_words;
+  size_t old_cap = defindex_cap;
+
+  defindex_cap = old_cap ? old_cap * 2 : DEFINDEX_INITIAL_CAPACITY;
+  defindex_words = calloc(defindex_cap, sizeof(DefWord));
+  if (!defindex_words)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    if (old[i].len == 0)
+      continue;
+    size_t pos = old[i].hash & (defindex_cap - 1);
+    while (defindex_words[pos].len != 0)
+      pos = (pos + 1) & (defindex_cap - 1);
+    defindex_words[pos] = old[i];
+  }
+  free(old);
+}
+
+// The word's entry, added if it is new
+static DefWord *defindex_intern(const char *word, size_t len)
+{
+  if ((defindex_used + 1) * 10 > defindex_cap * 7)
+    defindex_grow();
+  uint32_t h = defindex_hash(word, len);
+  DefWord *w = &defindex_words[defindex_find(word, len, h)];
+  if (w->len != 0)
+    return w;
+
+  if (defindex_pool_len + len > defindex_pool_cap)
+  {
+    while (defindex_pool_len + len > defindex_pool_cap)
+      defindex_pool_cap = defindex_pool_cap ? defindex_pool_cap * 2 : 4096;
+    defindex_pool = defindex_xrealloc(defindex_pool, defindex_pool_cap);
+  }
+  memcpy(defindex_pool + defindex_pool_len, word, len);
+  memset(w, 0, sizeof(*w));
+  w->hash = h;
+  w->off = (uint32_t)defindex_pool_len;
+  w->len = (uint32_t)len;
+  defindex_pool_len += len;
+  defindex_used++;
+  return w;
+}
+
+// The word's entry, or NULL if no definition ever held it
+static DefWord *defindex_lookup(const char *word, size_t len)
+{
+  if (defindex_cap == 0)
+    return NULL;
+  DefWord *w = &defindex_words[defindex_find(word, len, defindex_hash(word, len))];
+  return w->len != 0 ? w : NULL;
+}
+
+static void defindex_add(const DefEntry *e)
+{
+  char word[DEFINDEX_MAX_WORD];
+  size_t pos = 0, len;
+
+  if (!defindex_built)
+    return;
+  if (e->id >= defindex_docs_cap)
+  {
+    size_t cap = defindex_docs_cap ? defindex_docs_cap : DEFINDEX_INITIAL_CAPACITY;
+    while (cap <= e->id)
+      cap *= 2;
+    defindex_docs = defindex_xrealloc(defindex_docs, cap * sizeof(DefDoc));
+    memset(defindex_docs + defindex_docs_cap, 0, (cap - defindex_docs_cap) * sizeof(DefDoc));
+    defindex_docs_cap = cap;
+  }
+  if (defindex_terms_len + e->term_len > defindex_terms_cap)
+  {
+    while (defindex_terms_len + e->term_len > defindex_terms_cap)
+      defindex_terms_cap = defindex_terms_cap ? defindex_terms_cap * 2 : 4096;
+    defindex_terms = defindex_xrealloc(defindex_terms, defindex_terms_cap);
+  }
+
+  DefDoc *d = &defindex_docs[e->id];
+  memcpy(defindex_terms + defindex_terms_len, e->term, e->term_len);
+  d->term_off = (uint32_t)defindex_terms_len;
+  d->term_len = (uint32_t)e->term_len;
+  d->len = 0;
+  d->alive = 1;
+  defindex_terms_len += e->term_len;
+
+  while ((len = defindex_next_word(e->def, e->def_len, &pos, word)) > 0)
+  {
+    DefWord *w = defindex_intern(word, len);
+    d->len++;
+    // The postings of one definition are added together, so a word seen
+    // before in this one has it last
+    if (w->count > 0 && w->postings[w->count - 1].doc == e->id)
+    {
+      w->postings[w->count - 1].tf++;
+      continue;
+    }
+    if (w->count == w->cap)
+    {
+      w->cap = w->cap ? w->cap * 2 : 2;
+      w->postings = defindex_xrealloc(w->postings, w->cap * sizeof(DefPosting));
+    }
+    w->postings[w->count++] = (DefPosting){e->id, 1};
+    w->df++;
+  }
+  defindex_live++;
+  defindex_total_len += d->len;
+}
+
+static void defindex_remove(const DefEntry *e)
+{
+  char word[DEFINDEX_MAX_WORD];
+  size_t pos = 0, len;
+
+  if (!defindex_built || e->id >= defindex_docs_cap || !defindex_docs[e->id].alive)
+    return;
+  // Each word of the text once: it no longer counts towards df
+  defindex_mark++;
+  while ((len = defindex_next_word(e->def, e->def_len, &pos, word)) > 0)
+  {
+    DefWord *w = defindex_lookup(word, len);
+    if (w && w->mark != defindex_mark)
+    {
+      w->mark = defindex_mark;
+      w->df--;
+    }
+  }
+  DefDoc *d = &defindex_docs[e->id];
+  d->alive = 0;
+  defindex_live--;
+  defindex_dead++;
+  defindex_total_len -= d->len;
+  if (defindex_dead >= DEFINDEX_REBUILD_MIN && defindex_dead > defindex_live)
+    defindex_stale = 1;
+}
+
+static void defindex_free(void)
+{
+  for (size_t i = 0; i < defindex_cap; i++)
+    free(defindex_words[i].postings);
+  free(defindex_words);
+  free(defindex_pool);
+  free(defindex_docs);
+  free(defindex_terms);
+  defindex_words = NULL;
+  defindex_pool = NULL;
+  defindex_docs = NULL;
+  defindex_terms = NULL;
+  defindex_cap = defindex_used = defindex_pool_len = defindex_pool_cap = 0;
+  defindex_docs_cap = defindex_terms_len = defindex_terms_cap = 0;
+  defindex_live = defindex_dead = 0;
+  defindex_total_len = 0;
+  defindex_built = defindex_stale = 0;
+}
+
+// The store was emptied: so is the index, until the next search
+static void defindex_reset(void)
+{
+  if (defindex_built)
+    defindex_free();
+}
+
+static void defindex_add_each(const DefEntry *e, void *ctx)
+{
+  (void)ctx;
+  defindex_add(e);
+}
+
+static void defindex_build(void)
+{
+  defindex_free();
+  defindex_built = 1;
+  defstore_set_watch(defindex_add, defindex_remove, defindex_reset);
+  defstore_each(defindex_add_each, NULL);
+}
+
+// Keep the best max hits seen in a min-heap on score, the worst on top
+static void defindex_sift_down(DefIndexHit *heap, size_t n, size_t i)
+{
+  for (;;)
+  {
+    size_t least = i, l = 2 * i + 1, r = l + 1;
+    if (l < n && heap[l].score < heap[least].score)
+      least = l;
+    if (r < n && heap[r].score < heap[least].score)
+      least = r;
+    if (least == i)
+      return;
+    DefIndexHit t = heap[i];
+    heap[i] = heap[least];
+    heap[least] = t;
+    i = least;
+  }
+}
+
+static void defindex_offer(DefIndexHit *heap, size_t *n, size_t max, const DefIndexHit *hit)
+{
+  if (*n < max)
+  {
+    size_t i = (*n)++;
+    heap[i] = *hit;
+    while (i > 0 && heap[(i - 1) / 2].score > heap[i].score)
+    {
+      DefIndexHit t = heap[i];
+      heap[i] = heap[(i - 1) / 2];
+      heap[(i - 1) / 2] = t;
+      i = (i - 1) / 2;
+    }
+  }
+  else if (hit->score > heap[0].score)
+  {
+    heap[0] = *hit;
+    defindex_sift_down(heap, *n, 0);
+  }
+}
+
+static int defindex_compare_hits(const void *a, const void *b)
+{
+  const DefIndexHit *x = a, *y = b;
+  if (x->score != y->score)
+    return x->score < y->score ? 1 : -1;
+  size_t n = x->term_len < y->term_len ? x->term_len : y->term_len;
+  int c = memcmp(x->term, y->term, n);
+  return c != 0 ? c : (x->term_len > y->term_len) - (x->term_len < y->term_len);
+}
+
+size_t defindex_search(const char *query, DefIndexHit *hits, size_t max)
+{
+  char word[DEFINDEX_MAX_WORD];
+  size_t pos = 0, len, ntouched = 0, nhits = 0;
+
+  if (!defindex_built || defindex_stale)
+    defindex_build();
+  if (defindex_live == 0 || max == 0)
+    return 0;
+  if (defindex_scores_cap < defindex_docs_cap)
+  {
+    defindex_scores_cap = defindex_docs_cap;
+    free(defindex_scores);
+    defindex_scores = calloc(defindex_scores_cap, sizeof(double));
+    defindex_touched = defindex_xrealloc(defindex_touched, defindex_scores_cap * sizeof(uint32_t));
+    if (!defindex_scores)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  double n = (double)defindex_live, avg_len = (double)defindex_total_len / n;
+  if (avg_len <= 0)
+    avg_len = 1;
+  defindex_mark++;
+  while ((len = defindex_next_word(query, strlen(query), &pos, word)) > 0)
+  {
+    DefWord *w = defindex_lookup(word, len);
+    if (w == NULL || w->df == 0 || w->mark == defindex_mark)
+      continue; // Nowhere, or already counted
+    w->mark = defindex_mark;
+    double idf = log(1 + (n - w->df + 0.5) / (w->df + 0.5));
+    for (uint32_t i = 0; i < w->count; i++)
+    {
+      const DefPosting *p = &w->postings[i];
+      const DefDoc *d = &defindex_docs[p->doc];
+      if (!d->alive)
+        continue;
+      double tf = p->tf;
+      double norm = DEFINDEX_K1 * (1 - DEFINDEX_B + DEFINDEX_B * d->len / avg_len);
+      if (defindex_scores[p->doc] == 0)
+        defindex_touched[ntouched++] = p->doc;
+      defindex_scores[p->doc] += idf * tf * (DEFINDEX_K1 + 1) / (tf + norm);
+    }
+  }
+
+  for (size_t i = 0; i < ntouched; i++)
+  {
+    uint32_t doc = defindex_touched[i];
+    const DefDoc *d = &defindex_docs[doc];
+    DefIndexHit hit = {defindex_terms + d->term_off, d->term_len, defindex_scores[doc]};
+    defindex_offer(hits, &nhits, max, &hit);
+    defindex_scores[doc] = 0;
+  }
+  qsort(hits, nhits, sizeof(DefIndexHit), defindex_compare_hits);
+  return nhits;
+}
@@ -0,0 +1,30 @@
+#ifndef DEFINDEX_H
+#define DEFINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Most results "define search" prints
+#define DEFINDEX_MAX_RESULTS 20
+// Longest word indexed; longer ones are cut to this
+#define DEFINDEX_MAX_WORD 32
+// BM25 parameters: how fast repeating a word stops counting, and how much a
+// long definition is marked down
+#define DEFINDEX_K1 1.2
+#define DEFINDEX_B 0.75
+
+typedef struct
+{
+  const char *term; // Not NUL terminated; valid until the store changes
+  size_t term_len;
+  double score;
+} DefIndexHit;
+
+// Rank the definitions (of the store last brought up to date with
+// defstore_open) by how well their text matches the words of query, best
+// first, into hits. A definition matches if it holds any of the words.
+// The index is built on first use, then kept up to date as definitions are
+// added and removed. Returns the number of hits.
+size_t defindex_search(const char *query, DefIndexHit *hits, size_t max);
+
+#endif // DEFINDEX_H
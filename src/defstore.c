@@ -0,0 +1,532 @@
+// defstore.c
+//
+// Definitions for the define builtin. The file is a log of one record per
+// line, the newest record for a term being the one that counts:
+//
+//   term = definition     defines term
+//   term =                deletes it
+//
+// which keeps files written before the log was introduced readable as they
+// are. The file is mapped and read once into an open-addressing hash table
+// of terms, whose slots hold where each term's live record is; after that,
+// only what was appended since is read. Storing or deleting appends a record
+// under an flock, so other shells' updates are picked up the same way.
+// Superseded records are counted as dead bytes, and once those are most of
+// the file it is rewritten with the live records alone, sorted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "defstore.h"
+
+#define DEFSTORE_INITIAL_CAPACITY 1024
+
+// Where a term's live record is. term_len 0 marks an empty slot.
+typedef struct
+{
+  uint64_t off; // Of the record in the file
+  uint32_t term_len;
+  uint32_t def_len;
+  uint32_t hash;
+  uint32_t id;
+} DefSlot;
+
+static char *defstore_path; // As given to defstore_open
+static int defstore_fd = -1;
+static dev_t defstore_dev;
+static ino_t defstore_ino;
+static char *defstore_map;
+static size_t defstore_map_len;
+static size_t defstore_parsed; // Bytes of whole lines read so far
+static size_t defstore_dead; // Bytes of those that no longer count
+
+static DefSlot *defstore_slots;
+static size_t defstore_cap, defstore_used;
+// Slot numbers in term order, when defstore_ordered
+static uint32_t *defstore_order;
+static int defstore_ordered;
+static uint32_t defstore_next_id;
+
+static void (*defstore_on_added)(const DefEntry *e);
+static void (*defstore_on_removed)(const DefEntry *e);
+static void (*defstore_on_reset)(void);
+
+static void *defstore_xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint32_t defstore_hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return h;
+}
+
+static size_t defstore_record_len(const DefSlot *s)
+{
+  return s->term_len + 3 + s->def_len + 1; // "term = def\n"
+}
+
+static const char *defstore_term(const DefSlot *s)
+{
+  return defstore_map + s->off;
+}
+
+static void defstore_entry(const DefSlot *s, DefEntry *out)
+{
+  out->term = defstore_term(s);
+  out->term_len = s->term_len;
+  out->def = out->term + s->term_len + 3;
+  out->def_len = s->def_len;
+  out->id = s->id;
+}
+
+// Slot holding term, or the empty slot where it would go
+static size_t defstore_find(const char *term, size_t len, uint32_t h)
+{
+  size_t pos = h & (defstore_cap - 1);
+  while (defstore_slots[pos].term_len != 0)
+  {
+    const DefSlot *s = &defstore_slots[pos];
+    if (s->hash == h && s->term_len == len && memcmp(defstore_term(s), term, len) == 0)
+      break;
+    pos = (pos + 1) & (defstore_cap - 1);
+  }
+  return pos;
+}
+
+static void defstore_grow(void)
+{
+  DefSlot *old = defstore_slots;
+  size_t old_cap = defstore_cap;
+
+  defstore_cap = old_cap ? old_cap * 2 : DEFSTORE_INITIAL_CAPACITY;
+  defstore_slots = calloc(defstore_cap, sizeof(DefSlot));
+  if (!defstore_slots)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    if (old[i].term_len == 0)
+      continue;
+    size_t pos = old[i].hash & (defstore_cap - 1);
+    while (defstore_slots[pos].term_len != 0)
+      pos = (pos + 1) & (defstore_cap - 1);
+    defstore_slots[pos] = old[i];
+  }
+  free(old);
+}
+
+// Empty the slot at pos, moving later slots of the same probe run back so
+// that no lookup has to step over a hole
+static void defstore_remove_slot(size_t pos)
+{
+  size_t mask = defstore_cap - 1, next = (pos + 1) & mask;
+  while (defstore_slots[next].term_len != 0)
+  {
+    size_t home = defstore_slots[next].hash & mask;
+    // Can the slot at next move to pos? Only if its home is not in (pos, next].
+    if (((next - home) & mask) >= ((next - pos) & mask))
+    {
+      defstore_slots[pos] = defstore_slots[next];
+      pos = next;
+    }
+    next = (next + 1) & mask;
+  }
+  defstore_slots[pos].term_len = 0;
+  defstore_used--;
+}
+
+// Take in the record on the line at off, len bytes without its newline
+static void defstore_apply(size_t off, size_t len)
+{
+  const char *line = defstore_map + off;
+  const char *eq = memmem(line, len, " = ", 3);
+  size_t term_len;
+
+  if (eq && eq > line)
+    term_len = eq - line;
+  else if (len > 2 && line[len - 2] == ' ' && line[len - 1] == '=')
+    term_len = len - 2;
+  else
+  {
+    defstore_dead += len + 1; // Not a record at all
+    return;
+  }
+  if (term_len > UINT32_MAX || len > UINT32_MAX)
+  {
+    defstore_dead += len + 1;
+    return;
+  }
+
+  if ((defstore_used + 1) * 10 > defstore_cap * 7)
+    defstore_grow();
+  uint32_t h = defstore_hash(line, term_len);
+  size_t pos = defstore_find(line, term_len, h);
+  DefSlot *s = &defstore_slots[pos];
+  DefEntry e;
+  if (s->term_len != 0)
+  {
+    defstore_dead += defstore_record_len(s);
+    if (defstore_on_removed)
+    {
+      defstore_entry(s, &e);
+      defstore_on_removed(&e);
+    }
+  }
+
+  if (eq && eq > line)
+  {
+    if (s->term_len == 0)
+      defstore_used++;
+    *s = (DefSlot){off, (uint32_t)term_len, (uint32_t)(len - term_len - 3), h, defstore_next_id++};
+    if (defstore_on_added)
+    {
+      defstore_entry(s, &e);
+      defstore_on_added(&e);
+    }
+  }
+  else
+  {
+    defstore_dead += len + 1; // A delete is dead as soon as it is applied
+    if (s->term_len != 0)
+      defstore_remove_slot(pos);
+  }
+  defstore_ordered = 0;
+}
+
+static void defstore_reset(void)
+{
+  if (defstore_map)
+    munmap(defstore_map, defstore_map_len);
+  if (defstore_fd >= 0)
+    close(defstore_fd);
+  defstore_map = NULL;
+  defstore_map_len = 0;
+  defstore_fd = -1;
+  defstore_parsed = defstore_dead = 0;
+  if (defstore_slots)
+    memset(defstore_slots, 0, defstore_cap * sizeof(DefSlot));
+  defstore_used = 0;
+  defstore_ordered = 0;
+  defstore_next_id = 0;
+  if (defstore_on_reset)
+    defstore_on_reset();
+}
+
+void defstore_set_watch(void (*added)(const DefEntry *e), void (*removed)(const DefEntry *e), void (*reset)(void))
+{
+  defstore_on_added = added;
+  defstore_on_removed = removed;
+  defstore_on_reset = reset;
+}
+
+int defstore_open(const char *path, int create)
+{
+  struct stat st;
+  int missing;
+
+  if (defstore_path == NULL || strcmp(defstore_path, path) != 0)
+  {
+    defstore_reset();
+    free(defstore_path);
+    defstore_path = defstore_xrealloc(NULL, strlen(path) + 1);
+    strcpy(defstore_path, path);
+  }
+  missing = stat(path, &st) != 0;
+  if (missing && !(errno == ENOENT && create))
+  {
+    int saved = errno;
+    defstore_reset(); // The file is gone, or it is another directory's
+    errno = saved;
+    return -1;
+  }
+
+  // Another file than the one read (another directory, or rewritten by
+  // another shell), or one that shrank: start over
+  if (missing || defstore_fd < 0 || st.st_dev != defstore_dev || st.st_ino != defstore_ino ||
+      (size_t)st.st_size < defstore_parsed)
+  {
+    defstore_reset();
+    defstore_fd = open(path, O_RDWR | O_APPEND | (create ? O_CREAT : 0), 0644);
+    if (defstore_fd < 0 && errno == EACCES && !create)
+      defstore_fd = open(path, O_RDONLY);
+    if (defstore_fd < 0 || fstat(defstore_fd, &st) != 0)
+    {
+      int saved = errno;
+      defstore_reset();
+      errno = saved;
+      return -1;
+    }
+    defstore_dev = st.st_dev;
+    defstore_ino = st.st_ino;
+  }
+  if (defstore_cap == 0)
+    defstore_grow();
+  if ((size_t)st.st_size == defstore_map_len)
+    return 0;
+
+  // Map the whole file again, then read the lines added to it
+  char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, defstore_fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  if (defstore_map)
+    munmap(defstore_map, defstore_map_len);
+  defstore_map = map;
+  defstore_map_len = st.st_size;
+
+  size_t off = defstore_parsed;
+  const char *nl;
+  while ((nl = memchr(map + off, '\n', defstore_map_len - off)) != NULL)
+  {
+    defstore_apply(off, nl - (map + off));
+    off = nl + 1 - map;
+  }
+  defstore_parsed = off; // Anything after is a record still being written
+  return 0;
+}
+
+int defstore_get(const char *term, size_t len, DefEntry *out)
+{
+  if (defstore_cap == 0 || len == 0)
+    return 0;
+  const DefSlot *s = &defstore_slots[defstore_find(term, len, defstore_hash(term, len))];
+  if (s->term_len == 0)
+    return 0;
+  defstore_entry(s, out);
+  return 1;
+}
+
+static int defstore_write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int defstore_compare(const void *a, const void *b)
+{
+  const DefSlot *x = &defstore_slots[*(const uint32_t *)a], *y = &defstore_slots[*(const uint32_t *)b];
+  size_t n = x->term_len < y->term_len ? x->term_len : y->term_len;
+  int c = memcmp(defstore_term(x), defstore_term(y), n);
+  if (c != 0)
+    return c;
+  return (x->term_len > y->term_len) - (x->term_len < y->term_len);
+}
+
+static void defstore_sort(void)
+{
+  size_t n = 0;
+  if (defstore_ordered)
+    return;
+  defstore_order = defstore_xrealloc(defstore_order, (defstore_used ? defstore_used : 1) * sizeof(uint32_t));
+  for (size_t i = 0; i < defstore_cap; i++)
+  {
+    if (defstore_slots[i].term_len != 0)
+      defstore_order[n++] = (uint32_t)i;
+  }
+  qsort(defstore_order, n, sizeof(uint32_t), defstore_compare);
+  defstore_ordered = 1;
+}
+
+// Rewrite the file with only the live records, in term order, and swap it
+// in for the old one. Other shells see a new file and read it afresh.
+static void defstore_compact(void)
+{
+  size_t len = strlen(defstore_path);
+  char *tmp = defstore_xrealloc(NULL, len + 5);
+  memcpy(tmp, defstore_path, len);
+  strcpy(tmp + len, ".tmp");
+
+  defstore_sort();
+  FILE *out = fopen(tmp, "w");
+  if (out != NULL)
+  {
+    int ok = 1;
+    for (size_t i = 0; i < defstore_used && ok; i++)
+    {
+      const DefSlot *s = &defstore_slots[defstore_order[i]];
+      ok = fwrite(defstore_term(s), 1, defstore_record_len(s), out) == defstore_record_len(s);
+    }
+    ok = fflush(out) == 0 && ok && fsync(fileno(out)) == 0;
+    if (fclose(out) != 0 || !ok || rename(tmp, defstore_path) != 0)
+      unlink(tmp);
+  }
+  free(tmp);
+  defstore_reset();
+  defstore_open(defstore_path, 0);
+}
+
+// Append one record under the file lock. A file rewritten by another shell
+// is opened afresh first, so the record is not written to the old one.
+static int defstore_append(const char *rec, size_t len)
+{
+  struct stat fd_st, path_st;
+
+  for (int tries = 0; tries < 3; tries++)
+  {
+    if (defstore_fd < 0 && defstore_open(defstore_path, 1) != 0)
+      return -1;
+    if ((fcntl(defstore_fd, F_GETFL) & O_ACCMODE) == O_RDONLY)
+    {
+      errno = EACCES; // Opened read-only, for lookups
+      return -1;
+    }
+    if (flock(defstore_fd, LOCK_EX) != 0)
+      return -1;
+    if (fstat(defstore_fd, &fd_st) != 0 || stat(defstore_path, &path_st) != 0 ||
+        fd_st.st_ino != path_st.st_ino || fd_st.st_dev != path_st.st_dev)
+    {
+      flock(defstore_fd, LOCK_UN);
+      defstore_reset();
+      continue;
+    }
+
+    // A record cut short by a crash must not swallow this one
+    char last = '\n';
+    int rc = 0;
+    if (fd_st.st_size > 0 && pread(defstore_fd, &last, 1, fd_st.st_size - 1) == 1 && last != '\n')
+      rc = defstore_write_all(defstore_fd, "\n", 1);
+    if (rc == 0)
+      rc = defstore_write_all(defstore_fd, rec, len);
+    int saved = errno;
+    flock(defstore_fd, LOCK_UN);
+    if (rc != 0)
+    {
+      errno = saved;
+      return -1;
+    }
+    if (defstore_open(defstore_path, 0) != 0)
+      return -1;
+    if (defstore_dead >= DEFSTORE_COMPACT_MIN && defstore_dead * 2 > defstore_parsed)
+      defstore_compact();
+    return 0;
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+int defstore_set(const char *term, size_t term_len, const char *def, size_t def_len)
+{
+  // The term has to read back as the text before the first " = "
+  if (term_len == 0 || memchr(term, '\n', term_len) || memmem(term, term_len, " =", 2) ||
+      term_len > UINT32_MAX || def_len > UINT32_MAX)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  size_t len = term_len + 3 + def_len + 1;
+  char *rec = defstore_xrealloc(NULL, len);
+  memcpy(rec, term, term_len);
+  memcpy(rec + term_len, " = ", 3);
+  for (size_t i = 0; i < def_len; i++)
+    rec[term_len + 3 + i] = def[i] == '\n' || def[i] == '\r' ? ' ' : def[i];
+  rec[len - 1] = '\n';
+  int rc = defstore_append(rec, len);
+  free(rec);
+  return rc;
+}
+
+int defstore_delete(const char *term, size_t len)
+{
+  DefEntry e;
+  if (!defstore_get(term, len, &e))
+    return 1;
+
+  char *rec = defstore_xrealloc(NULL, len + 3);
+  memcpy(rec, term, len);
+  memcpy(rec + len, " =\n", 3);
+  int rc = defstore_append(rec, len + 3);
+  free(rec);
+  return rc;
+}
+
+size_t defstore_count(void)
+{
+  return defstore_used;
+}
+
+void defstore_each(void (*fn)(const DefEntry *e, void *ctx), void *ctx)
+{
+  DefEntry e;
+  for (size_t i = 0; i < defstore_cap; i++)
+  {
+    if (defstore_slots[i].term_len == 0)
+      continue;
+    defstore_entry(&defstore_slots[i], &e);
+    fn(&e, ctx);
+  }
+}
+
+void defstore_sorted(size_t i, DefEntry *out)
+{
+  defstore_sort();
+  defstore_entry(&defstore_slots[defstore_order[i]], out);
+}
+
+// Compare the first len bytes of slot s's term with prefix
+static int defstore_compare_prefix(const DefSlot *s, const char *prefix, size_t len)
+{
+  size_t n = s->term_len < len ? s->term_len : len;
+  int c = memcmp(defstore_term(s), prefix, n);
+  if (c != 0 || s->term_len >= len)
+    return c;
+  return -1; // A shorter term that prefix starts with comes before it
+}
+
+size_t defstore_prefix(const char *prefix, size_t len, size_t *first)
+{
+  size_t lo = 0, hi = defstore_used;
+
+  defstore_sort();
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (defstore_compare_prefix(&defstore_slots[defstore_order[mid]], prefix, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *first = lo;
+  hi = defstore_used;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (defstore_compare_prefix(&defstore_slots[defstore_order[mid]], prefix, len) == 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - *first;
+}
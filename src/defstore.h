@@ -0,0 +1,57 @@
+#ifndef DEFSTORE_H
+#define DEFSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The file is rewritten without its dead records once they take at least
+// this many bytes and more than half of it
+#define DEFSTORE_COMPACT_MIN (64 * 1024)
+
+// One definition. Neither string is NUL terminated; both point into the
+// mapped file and stay valid until the next defstore call that changes or
+// reloads the store.
+typedef struct
+{
+  const char *term;
+  size_t term_len;
+  const char *def;
+  size_t def_len;
+  uint32_t id; // New with every record read, so a redefined term gets another
+} DefEntry;
+
+// Bring the store up to date with the file at path (relative paths are
+// taken from the current directory, so another directory means another
+// store). Only what was appended since the last call is read; a file that
+// was replaced is read again from the start. With create set, a missing
+// file is created. Returns 0, or -1 with errno set.
+int defstore_open(const char *path, int create);
+
+// Exact lookup. Returns 1 and fills *out if term is defined, 0 if not.
+int defstore_get(const char *term, size_t len, DefEntry *out);
+
+// Define term, replacing any earlier definition, or delete it. Each
+// appends one record to the file. Returns 0 on success (for delete, 1 if
+// term was not defined), -1 with errno set on failure.
+int defstore_set(const char *term, size_t term_len, const char *def, size_t def_len);
+int defstore_delete(const char *term, size_t len);
+
+// Definitions sorted by term: how many there are, and the i-th. The order
+// is worked out on first use after a change.
+size_t defstore_count(void);
+void defstore_sorted(size_t i, DefEntry *out);
+
+// Every definition, in no particular order
+void defstore_each(void (*fn)(const DefEntry *e, void *ctx), void *ctx);
+
+// Be told of changes as records are read from the file, including those
+// other shells appended: a definition was added, or one was removed (by a
+// delete, or a newer definition of its term, which is then added). reset
+// means every definition was dropped, and those read afterwards are new.
+void defstore_set_watch(void (*added)(const DefEntry *e), void (*removed)(const DefEntry *e), void (*reset)(void));
+
+// Sorted definitions whose terms start with prefix: returns how many, and
+// the index of the first in *first
+size_t defstore_prefix(const char *prefix, size_t len, size_t *first);
+
+#endif // DEFSTORE_H
@@ -0,0 +1,38 @@
+// dict.c
+//
+// The built-in dictionary. Its terms and definitions are a table generated
+// at build time (tools/dict_gen.c, "make dict") and compiled in as constant
+// data, so there is nothing to read or parse when the shell starts, and the
+// pages are only touched when a term is looked up. A lookup is a minimal
+// perfect hash of the term (phash.h), which gives the index of its entry,
+// and one comparison.
+
+#include <stdint.h>
+#include <string.h>
+#include "dict.h"
+#include "phash.h"
+
+typedef struct
+{
+  uint32_t term_off, term_len; // In dict_strings
+  uint32_t def_off, def_len;
+} DictEntry;
+
+#include "dict_table.h" // Generated
+
+int dict_lookup(const char *term, const char **def, size_t *def_len)
+{
+  if (DICT_KEYS == 0)
+    return 0;
+  const DictEntry *e = &dict_entries[phash_slot(DICT_SEED, DICT_BUCKETS, dict_disp, DICT_SLOTS, term)];
+  if (strlen(term) != e->term_len || memcmp(dict_strings + e->term_off, term, e->term_len) != 0)
+    return 0;
+  *def = dict_strings + e->def_off;
+  *def_len = e->def_len;
+  return 1;
+}
+
+size_t dict_count(void)
+{
+  return DICT_KEYS;
+}
@@ -0,0 +1,15 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include <stddef.h>
+
+// The built-in dictionary, compiled into the shell from a definitions file
+// at build time (see tools/dict_gen.c). Returns 1 and points *def at the
+// definition of term (def_len bytes, not NUL terminated) if it has one, 0
+// if not.
+int dict_lookup(const char *term, const char **def, size_t *def_len);
+
+// Number of terms in it
+size_t dict_count(void);
+
+#endif // DICT_H
@@ -0,0 +1,191 @@
+// dircache.c
+//
+// Directory listings for Tab completion. A directory is read once, its names
+// sorted, and the listing kept until the directory's mtime changes, which
+// happens whenever a name is added, removed or renamed in it. Completing a
+// prefix is then two binary searches, however big the directory is; the
+// only system call left is the stat that checks the mtime.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dircache.h"
+
+static DirListing dircache_dirs[DIRCACHE_MAX_DIRS];
+static unsigned long dircache_clock;
+
+static void *dircache_xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static int dircache_compare(const void *a, const void *b)
+{
+  return strcmp(((const DirEntry *)a)->name, ((const DirEntry *)b)->name);
+}
+
+static void dircache_clear(DirListing *l)
+{
+  free(l->path);
+  free(l->entries);
+  free(l->pool);
+  memset(l, 0, sizeof(*l));
+}
+
+// Read the directory into l. Names go into the pool first and are pointed
+// at once it has stopped moving.
+static int dircache_read(DirListing *l, const char *path)
+{
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return -1;
+
+  size_t pool_len = 0, pool_cap = 0, cap = 0;
+  struct dirent *e;
+  while ((e = readdir(dir)) != NULL)
+  {
+    if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+      continue;
+    size_t len = strlen(e->d_name) + 1;
+    if (pool_len + len > pool_cap)
+    {
+      while (pool_len + len > pool_cap)
+        pool_cap = pool_cap ? pool_cap * 2 : 4096;
+      l->pool = dircache_xrealloc(l->pool, pool_cap);
+    }
+    if (l->count == cap)
+    {
+      cap = cap ? cap * 2 : 64;
+      l->entries = dircache_xrealloc(l->entries, cap * sizeof(DirEntry));
+    }
+    memcpy(l->pool + pool_len, e->d_name, len);
+    l->entries[l->count].name = (const char *)(uintptr_t)pool_len;
+    l->entries[l->count].type = e->d_type;
+    l->entries[l->count].flags = 0;
+    l->count++;
+    pool_len += len;
+  }
+  closedir(dir);
+
+  for (size_t i = 0; i < l->count; i++)
+    l->entries[i].name = l->pool + (uintptr_t)l->entries[i].name;
+  qsort(l->entries, l->count, sizeof(DirEntry), dircache_compare);
+  return 0;
+}
+
+DirListing *dircache_get(const char *path)
+{
+  struct stat st;
+  DirListing *l = NULL, *oldest = &dircache_dirs[0];
+
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    return NULL;
+  for (size_t i = 0; i < DIRCACHE_MAX_DIRS; i++)
+  {
+    DirListing *d = &dircache_dirs[i];
+    if (d->path && strcmp(d->path, path) == 0)
+    {
+      l = d;
+      break;
+    }
+    if (d->used < oldest->used)
+      oldest = d;
+  }
+
+  if (l && (l->mtime.tv_sec != st.st_mtim.tv_sec || l->mtime.tv_nsec != st.st_mtim.tv_nsec))
+  {
+    dircache_clear(l); // Changed since it was listed
+    oldest = l;
+    l = NULL;
+  }
+  if (l == NULL)
+  {
+    l = oldest;
+    dircache_clear(l);
+    if (dircache_read(l, path) != 0)
+    {
+      dircache_clear(l);
+      return NULL;
+    }
+    l->path = dircache_xrealloc(NULL, strlen(path) + 1);
+    strcpy(l->path, path);
+    l->mtime = st.st_mtim;
+  }
+  l->used = ++dircache_clock;
+  return l;
+}
+
+size_t dircache_prefix(const DirListing *l, const char *prefix, size_t len, size_t *first)
+{
+  size_t lo = 0, hi = l->count;
+
+  // First name not before prefix...
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strncmp(l->entries[mid].name, prefix, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *first = lo;
+  // ...and first one after every name starting with it
+  hi = l->count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strncmp(l->entries[mid].name, prefix, len) == 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - *first;
+}
+
+static void dircache_stat(DirListing *l, size_t i)
+{
+  DirEntry *e = &l->entries[i];
+  struct stat st;
+  char path[PATH_MAX];
+
+  if (e->flags & DIRCACHE_STATED)
+    return;
+  e->flags |= DIRCACHE_STATED;
+  snprintf(path, sizeof(path), "%s/%s", l->path, e->name);
+  if (stat(path, &st) != 0)
+    return;
+  if (S_ISDIR(st.st_mode))
+    e->flags |= DIRCACHE_IS_DIR;
+  else if (S_ISREG(st.st_mode) && (st.st_mode & 0111))
+    e->flags |= DIRCACHE_IS_EXEC;
+}
+
+int dircache_is_dir(DirListing *l, size_t i)
+{
+  uint8_t type = l->entries[i].type;
+  if (type == DT_DIR)
+    return 1;
+  if (type != DT_LNK && type != DT_UNKNOWN)
+    return 0;
+  dircache_stat(l, i);
+  return (l->entries[i].flags & DIRCACHE_IS_DIR) != 0;
+}
+
+int dircache_is_exec(DirListing *l, size_t i)
+{
+  uint8_t type = l->entries[i].type;
+  if (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN)
+    return 0;
+  dircache_stat(l, i);
+  return (l->entries[i].flags & DIRCACHE_IS_EXEC) != 0;
+}
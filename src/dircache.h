@@ -0,0 +1,48 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Most directory listings kept at once; the least recently used goes first
+#define DIRCACHE_MAX_DIRS 64
+
+// DirEntry flags, filled in the first time they are asked for
+#define DIRCACHE_STATED 1
+#define DIRCACHE_IS_DIR 2
+#define DIRCACHE_IS_EXEC 4
+
+typedef struct
+{
+  const char *name;
+  uint8_t type; // d_type, as readdir gave it
+  uint8_t flags;
+} DirEntry;
+
+typedef struct
+{
+  char *path;
+  struct timespec mtime; // Of the directory when it was listed
+  DirEntry *entries; // Sorted by name, "." and ".." left out
+  size_t count;
+  char *pool; // The names
+  unsigned long used; // When last handed out, for eviction
+} DirListing;
+
+// Listing of the directory at path (absolute), read again if the directory
+// changed since it was cached. Returns NULL if it cannot be read. The
+// listing stays valid until DIRCACHE_MAX_DIRS other directories have been
+// asked for.
+DirListing *dircache_get(const char *path);
+
+// Entries whose names start with prefix: returns how many, and the index of
+// the first in *first. They are consecutive, since entries are sorted.
+size_t dircache_prefix(const DirListing *l, const char *prefix, size_t len, size_t *first);
+
+// Whether entry i is a directory, or an executable regular file, following
+// symlinks. Only what readdir could not tell costs a stat, once.
+int dircache_is_dir(DirListing *l, size_t i);
+int dircache_is_exec(DirListing *l, size_t i);
+
+#endif // DIRCACHE_H
@@ -0,0 +1,489 @@
+// hist.c
+//
+// Command history. Commands are queued in memory and appended to the binary
+// store in histdb.c in batches: once enough of them have piled up, once the
+// oldest is HIST_FLUSH_INTERVAL_MS old, at exit, or when the shell is told to
+// terminate (back at the prompt, not in the signal handler, which may have
+// interrupted anything). The "history" builtin answers its queries straight from the
+// store's mapped index.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "hist.h"
+#include "histdb.h"
+#include "hsearch.h"
+#include "match.h"
+#include "bio.h"
+#include "status.h"
+
+#define HIST_TIMESTAMP_LEN 19 // YYYY-MM-DD HH:MM:SS
+
+// A queued command; offsets point into hist_buf
+typedef struct
+{
+  int64_t time;
+  size_t cmd_off, cmd_len;
+  size_t dir_off, dir_len;
+} HistPending;
+
+static HistDb *hist_db;
+static HistSearch *hist_search; // Only built for interactive sessions
+static pid_t hist_owner; // Forked children must not flush the parent's queue
+static char *hist_dir;
+static HistSyncMode hist_sync = HIST_SYNC_NEVER;
+
+static char hist_buf[HIST_FLUSH_BYTES];
+static size_t hist_len;
+static HistPending hist_pending[HIST_FLUSH_RECORDS];
+static size_t hist_records;
+static struct timespec hist_oldest;
+static volatile sig_atomic_t hist_signal; // SIGTERM or SIGHUP not yet acted on
+
+static long hist_elapsed_ms(const struct timespec *since)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+int hist_flush(void)
+{
+  HistEntry entries[HIST_FLUSH_RECORDS];
+  int rc;
+
+  if (hist_db == NULL || getpid() != hist_owner)
+    return -1;
+  for (size_t i = 0; i < hist_records; i++)
+  {
+    entries[i].time = hist_pending[i].time;
+    entries[i].cmd = hist_buf + hist_pending[i].cmd_off;
+    entries[i].cmd_len = hist_pending[i].cmd_len;
+    entries[i].dir = hist_buf + hist_pending[i].dir_off;
+    entries[i].dir_len = hist_pending[i].dir_len;
+  }
+  rc = histdb_append(hist_db, entries, hist_records, hist_sync != HIST_SYNC_NEVER);
+  hist_len = 0;
+  hist_records = 0;
+  return rc;
+}
+
+long hist_flush_idle(void)
+{
+  if (hist_signal)
+  {
+    int sig = hist_signal;
+    hist_close();
+    signal(sig, SIG_DFL);
+    raise(sig);
+  }
+  if (hist_records == 0)
+    return -1;
+  long left = HIST_FLUSH_INTERVAL_MS - hist_elapsed_ms(&hist_oldest);
+  if (left > 0)
+    return left;
+  hist_flush();
+  return -1;
+}
+
+// Writing the queue takes a lock on the store and may allocate, so it waits
+// for hist_flush_idle
+static void hist_on_signal(int sig)
+{
+  hist_signal = sig;
+}
+
+static void hist_at_exit(void)
+{
+  hist_close();
+}
+
+int hist_open(void)
+{
+  char cwd[PATH_MAX];
+  int created = 0;
+  if (hist_db)
+    return 0;
+
+  // Resolve the directory now so "cd" does not scatter history stores around
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    strcpy(cwd, ".");
+  hist_dir = strdup(cwd);
+  if (!hist_dir)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const char *mode = getenv(HIST_SYNC_ENV);
+  if (mode && strcmp(mode, "batch") == 0)
+    hist_sync = HIST_SYNC_BATCH;
+  else if (mode && strcmp(mode, "always") == 0)
+    hist_sync = HIST_SYNC_ALWAYS;
+  else
+    hist_sync = HIST_SYNC_NEVER;
+
+  hist_db = histdb_open(hist_dir, &created);
+  if (hist_db == NULL)
+  {
+    fprintf(stderr, "lsh: cannot open history in %s\n", hist_dir);
+    return -1;
+  }
+  hist_owner = getpid();
+
+  // Carry the old text history over the first time the store is created
+  if (created)
+  {
+    char *text = malloc(strlen(hist_dir) + 1 + strlen(HIST_FILE_NAME) + 1);
+    if (text)
+    {
+      sprintf(text, "%s/%s", hist_dir, HIST_FILE_NAME);
+      if (access(text, R_OK) == 0)
+      {
+        long n = histdb_import_text(hist_db, text);
+        if (n > 0)
+          fprintf(stderr, "lsh: imported %ld commands from %s\n", n, HIST_FILE_NAME);
+      }
+      free(text);
+    }
+  }
+
+  // No SA_RESTART: the signal must interrupt the prompt's wait for a key, so
+  // that it calls hist_flush_idle
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = hist_on_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  atexit(hist_at_exit);
+  return 0;
+}
+
+void hist_add(const char *line, const char *cwd)
+{
+  if (hist_db == NULL)
+    return;
+
+  size_t line_len = strlen(line), cwd_len = strlen(cwd);
+  if (hist_search)
+    hsearch_add(hist_search, line, line_len, cwd, cwd_len);
+
+  int same_dir = hist_records > 0 && hist_pending[hist_records - 1].dir_len == cwd_len &&
+                 memcmp(hist_buf + hist_pending[hist_records - 1].dir_off, cwd, cwd_len) == 0;
+  size_t need = line_len + (same_dir ? 0 : cwd_len);
+
+  if (need > sizeof(hist_buf))
+  {
+    // Too big to queue: write out the queue and then this entry on its own
+    HistEntry e = {time(NULL), cwd, cwd_len, line, line_len};
+    hist_flush();
+    histdb_append(hist_db, &e, 1, hist_sync != HIST_SYNC_NEVER);
+    return;
+  }
+
+  if (need > sizeof(hist_buf) - hist_len || hist_records == HIST_FLUSH_RECORDS)
+  {
+    hist_flush();
+    same_dir = 0;
+    need = line_len + cwd_len;
+  }
+
+  HistPending *p = &hist_pending[hist_records];
+  p->time = time(NULL);
+  if (same_dir)
+  {
+    p->dir_off = hist_pending[hist_records - 1].dir_off;
+  }
+  else
+  {
+    p->dir_off = hist_len;
+    memcpy(hist_buf + hist_len, cwd, cwd_len);
+    hist_len += cwd_len;
+  }
+  p->dir_len = cwd_len;
+  p->cmd_off = hist_len;
+  p->cmd_len = line_len;
+  memcpy(hist_buf + hist_len, line, line_len);
+  hist_len += line_len;
+
+  if (hist_records++ == 0)
+    clock_gettime(CLOCK_MONOTONIC, &hist_oldest);
+
+  if (hist_sync == HIST_SYNC_ALWAYS || hist_records >= HIST_FLUSH_RECORDS ||
+      hist_elapsed_ms(&hist_oldest) >= HIST_FLUSH_INTERVAL_MS)
+    hist_flush();
+}
+
+int hist_clear(void)
+{
+  hist_len = 0;
+  hist_records = 0;
+  if (hist_search)
+  {
+    hsearch_free(hist_search);
+    hist_search = hsearch_new();
+  }
+  return hist_db ? histdb_clear(hist_db) : -1;
+}
+
+HistSearch *hist_search_index(void)
+{
+  if (hist_search || hist_db == NULL)
+    return hist_search;
+
+  // Replay the store oldest first, so each command ends up at its last use
+  HistSearch *hs = hsearch_new();
+  if (hs == NULL)
+    return NULL;
+  uint32_t n = histdb_count(hist_db);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    HistEntry e;
+    histdb_get(hist_db, i, &e);
+    hsearch_add(hs, e.cmd, e.cmd_len, e.dir, e.dir_len);
+  }
+  for (size_t i = 0; i < hist_records; i++)
+  {
+    hsearch_add(hs, hist_buf + hist_pending[i].cmd_off, hist_pending[i].cmd_len,
+                hist_buf + hist_pending[i].dir_off, hist_pending[i].dir_len);
+  }
+  hist_search = hs;
+  return hs;
+}
+
+HistDb *hist_store(void)
+{
+  if (hist_db)
+  {
+    hist_flush();
+    histdb_refresh(hist_db);
+  }
+  return hist_db;
+}
+
+void hist_close(void)
+{
+  if (hist_db == NULL || getpid() != hist_owner)
+    return;
+  hist_flush();
+  histdb_close(hist_db);
+  hist_db = NULL;
+  hsearch_free(hist_search);
+  hist_search = NULL;
+}
+
+/*
+  The "history" builtin.
+*/
+
+// Parse "YYYY-MM-DD [HH:MM[:SS]]", a Unix time, or an age like 30m, 2h, 7d.
+// Consumes one or two arguments; returns the number used, 0 on error.
+static int hist_parse_since(char **args, int64_t *out)
+{
+  struct tm tm;
+  char *end;
+
+  long n = strtol(args[0], &end, 10);
+  if (end != args[0] && end[0] != '\0' && end[1] == '\0' && strchr("smhdw", end[0]))
+  {
+    static const long unit[] = {1, 60, 3600, 86400, 604800};
+    *out = time(NULL) - n * unit[strchr("smhdw", end[0]) - "smhdw"];
+    return 1;
+  }
+  if (end != args[0] && *end == '\0')
+  {
+    *out = n;
+    return 1;
+  }
+
+  memset(&tm, 0, sizeof(tm));
+  end = strptime(args[0], "%Y-%m-%d", &tm);
+  if (end == NULL || *end != '\0')
+    return 0;
+  int used = 1;
+  if (args[1] != NULL)
+  {
+    struct tm with_time = tm;
+    end = strptime(args[1], "%H:%M:%S", &with_time);
+    if (end == NULL || *end != '\0')
+      end = strptime(args[1], "%H:%M", &with_time);
+    if (end != NULL && *end == '\0')
+    {
+      tm = with_time;
+      used = 2;
+    }
+  }
+  tm.tm_isdst = -1;
+  *out = mktime(&tm);
+  return used;
+}
+
+static void hist_print(BioBuffer *out, const HistDb *db, uint32_t i)
+{
+  // localtime + strftime once per second of history rather than per line
+  static int64_t stamp_time = INT64_MIN;
+  static char stamp[HIST_TIMESTAMP_LEN + 1];
+  HistEntry e;
+
+  histdb_get(db, i, &e);
+  if (e.time != stamp_time)
+  {
+    time_t t = (time_t)e.time;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    stamp_time = e.time;
+  }
+  bio_printf(out, "[%s] [%.*s] %.*s\n", stamp, (int)e.dir_len, e.dir, (int)e.cmd_len, e.cmd);
+}
+
+/**
+ * @brief Builtin command: display history of all commands used.
+ * @param args List of args. Filters may be combined:
+ *             -n <N>            only the last N matching commands
+ *             --dir <path>      only commands run in path
+ *             --since <time>    only commands run at or after time
+ *             grep <text>       only commands containing text
+ *             -c                clear the history
+ *             --import <file>   append a "[time] [cwd] cmd" text history
+ * @return Always returns 1, to continue executing.
+ */
+int lsh_history(char **args)
+{
+  uint32_t limit = HISTDB_NONE;
+  const char *dir = NULL;
+  const char *text = NULL;
+  int64_t since = INT64_MIN;
+
+  for (int i = 1; args[i] != NULL; i++)
+  {
+    if (strcasecmp(args[i], "-c") == 0)
+    {
+      if (hist_clear() != 0)
+      {
+        perror("Error clearing history");
+        return builtin_fail(1);
+      }
+      else
+        printf("History cleared successfully.\n");
+      return 1;
+    }
+    else if (strcmp(args[i], "--import") == 0 && args[i + 1] != NULL)
+    {
+      HistDb *db = hist_store();
+      long n = db ? histdb_import_text(db, args[i + 1]) : -1;
+      if (n < 0)
+      {
+        perror("history: import");
+        return builtin_fail(1);
+      }
+      else
+        printf("Imported %ld commands from %s\n", n, args[i + 1]);
+      return 1;
+    }
+    else if (strcmp(args[i], "-n") == 0 && args[i + 1] != NULL)
+    {
+      char *end;
+      long n = strtol(args[++i], &end, 10);
+      if (*end != '\0' || n < 0)
+      {
+        fprintf(stderr, "history: invalid count: %s\n", args[i]);
+        return builtin_fail(1);
+      }
+      limit = n > (long)HISTDB_NONE - 1 ? HISTDB_NONE - 1 : (uint32_t)n;
+    }
+    else if (strcmp(args[i], "--dir") == 0 && args[i + 1] != NULL)
+    {
+      dir = args[++i];
+    }
+    else if (strcmp(args[i], "--since") == 0 && args[i + 1] != NULL)
+    {
+      int used = hist_parse_since(args + i + 1, &since);
+      if (used == 0)
+      {
+        fprintf(stderr, "history: invalid time: %s\n", args[i + 1]);
+        return builtin_fail(1);
+      }
+      i += used;
+    }
+    else if (strcmp(args[i], "grep") == 0 && args[i + 1] != NULL)
+    {
+      text = args[++i];
+    }
+    else
+    {
+      fprintf(stderr, "Invalid option: %s\n", args[i]);
+      fprintf(stderr, "Usage: history [-n N] [--dir <path>] [--since <time>] [grep <text>] | -c | --import <file>\n");
+      return builtin_fail(1);
+    }
+  }
+
+  HistDb *db = hist_store();
+  if (db == NULL || histdb_count(db) == 0)
+  {
+    fprintf(stderr, "No history found.\n");
+    return 1;
+  }
+
+  // Candidates are visited newest first: every record, or one directory's chain
+  uint32_t cur = histdb_count(db) - 1;
+  int by_dir = 0;
+  char resolved[PATH_MAX];
+  if (dir != NULL)
+  {
+    if (realpath(dir, resolved) != NULL)
+      dir = resolved;
+    uint32_t id = histdb_find_dir(db, dir, strlen(dir));
+    cur = id == HISTDB_NONE ? HISTDB_NONE : histdb_dir_last(db, id);
+    by_dir = 1;
+  }
+  uint32_t first = since == INT64_MIN ? 0 : histdb_first_since(db, since);
+
+  uint32_t *hits = NULL;
+  size_t nhits = 0, cap = 0;
+  size_t text_len = text ? strlen(text) : 0;
+  while (cur != HISTDB_NONE && cur >= first && nhits < limit)
+  {
+    HistEntry e;
+    histdb_get(db, cur, &e);
+    if (text == NULL || match_find(e.cmd, e.cmd_len, text, text_len) != NULL)
+    {
+      if (nhits == cap)
+      {
+        cap = cap ? cap * 2 : 256;
+        uint32_t *grown = realloc(hits, cap * sizeof(uint32_t));
+        if (!grown)
+        {
+          fprintf(stderr, "lsh: allocation error\n");
+          exit(EXIT_FAILURE);
+        }
+        hits = grown;
+      }
+      hits[nhits++] = cur;
+    }
+    if (by_dir)
+      cur = histdb_dir_prev(db, cur);
+    else
+      cur = cur == 0 ? HISTDB_NONE : cur - 1;
+  }
+
+  // Print oldest first, like the file used to read, in large blocks rather
+  // than a write per line when going to a pipe or file
+  BioBuffer *out = malloc(sizeof(BioBuffer));
+  if (!out)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  bio_open(out, STDOUT_FILENO);
+  bio_printf(out, "History of commands used:\n");
+  while (nhits > 0)
+    hist_print(out, db, hits[--nhits]);
+  bio_flush(out);
+  free(out);
+  free(hits);
+  return 1;
+}
@@ -0,0 +1,59 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include "histdb.h"
+#include "hsearch.h"
+
+// Text history written by older versions, imported when the store is created
+#define HIST_FILE_NAME "history.txt"
+// Pending records are written out once they reach this many bytes...
+#define HIST_FLUSH_BYTES (64 * 1024)
+// ...or this many records...
+#define HIST_FLUSH_RECORDS 256
+// ...or once the oldest of them is this old, in milliseconds
+#define HIST_FLUSH_INTERVAL_MS 1000
+// Environment variable selecting the fsync policy: "never" (default),
+// "batch" (fdatasync after every flush) or "always" (flush and fdatasync
+// after every command)
+#define HIST_SYNC_ENV "PSS_HISTORY_SYNC"
+
+typedef enum
+{
+  HIST_SYNC_NEVER,
+  HIST_SYNC_BATCH,
+  HIST_SYNC_ALWAYS
+} HistSyncMode;
+
+// Open the history store in the directory the shell starts in, once for an
+// interactive session. Pending records are also flushed at exit and on
+// SIGTERM/SIGHUP. Returns 0 on success, -1 if the store cannot be opened
+// (commands are then simply not recorded).
+int hist_open(void);
+
+// Queue line, run in cwd, for writing
+void hist_add(const char *line, const char *cwd);
+
+// Append every pending record to the store. Returns 0 on success.
+int hist_flush(void);
+
+// For an idle prompt: flush if the oldest pending record is
+// HIST_FLUSH_INTERVAL_MS old. Returns how many milliseconds until it will
+// be, or -1 if nothing is pending. After a SIGTERM or SIGHUP, it closes the
+// store and lets the signal end the shell instead.
+long hist_flush_idle(void);
+
+// Drop pending records and empty the store
+int hist_clear(void);
+
+// The store, with everything queued so far written to it, or NULL
+HistDb *hist_store(void);
+
+// Fuzzy index for Ctrl+R, built from the store on first use and kept up to
+// date by hist_add from then on. NULL if there is no store.
+HistSearch *hist_search_index(void);
+
+void hist_close(void);
+
+int lsh_history(char **args);
+
+#endif // HIST_H
@@ -0,0 +1,653 @@
+// histdb.c
+//
+// Binary command history. The store is three append-only files:
+//
+//   .pss_history       HistDbHeader, then command text and directory names
+//   .pss_history.idx   HistDbHeader, then one fixed-size HistDbRecord per
+//                      command, in the order the commands were run
+//   .pss_history.dirs  HistDbHeader, then one HistDbDir per distinct directory
+//
+// Every file is mapped read-only, so a record is found by index in O(1) and
+// the records of one directory are chained newest-to-oldest through
+// prev_in_dir, starting at the directory's last_record. last_record is the
+// only field ever rewritten in place.
+//
+// Appends take an flock on the index file, so several shells can share one
+// store. Within an append the text goes out first, then new directories, then
+// records, then last_record updates; a crash part-way leaves at most a tail
+// that histdb_open trims or repairs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "histdb.h"
+
+#define HISTDB_DIR_TABLE_MIN 64
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+} HistDbHeader;
+
+typedef struct
+{
+  int64_t time;
+  uint64_t cmd_off; // Into the text file
+  uint32_t cmd_len;
+  uint32_t dir;
+  uint32_t prev_in_dir;
+  uint32_t reserved;
+} HistDbRecord;
+
+typedef struct
+{
+  uint64_t name_off; // Into the text file
+  uint32_t name_len;
+  uint32_t last_record;
+} HistDbDir;
+
+// One mapped file
+typedef struct
+{
+  int fd;
+  char *map;
+  size_t len;
+} HistDbFile;
+
+struct HistDb
+{
+  HistDbFile text, idx, dirs;
+  const HistDbRecord *records;
+  uint32_t nrecords;
+  const HistDbDir *dir_entries;
+  uint32_t ndirs;
+  // Open-addressing hash of directory ids, keyed by name
+  uint32_t *dir_table;
+  size_t dir_table_cap;
+  uint32_t dir_table_count; // Directories [0, dir_table_count) are hashed
+  // Kept from one append to the next, so a steady trickle of commands does
+  // not allocate: the pending records and directories of a batch, and what
+  // it writes to the text and dirs files
+  void *batch, *out;
+  size_t batch_cap, out_cap;
+};
+
+static uint32_t histdb_hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h;
+}
+
+static char *histdb_path(const char *dir, const char *suffix)
+{
+  size_t dlen = strlen(dir);
+  char *path = malloc(dlen + 1 + strlen(HISTDB_FILE_NAME) + strlen(suffix) + 1);
+  if (!path)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(path, "%s/%s%s", dir, HISTDB_FILE_NAME, suffix);
+  return path;
+}
+
+static int histdb_pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+  const char *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = pwrite(fd, p, len, off);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+    off += n;
+  }
+  return 0;
+}
+
+// Open one file, writing a header if it is new. Returns 1 if it was created.
+static int histdb_open_file(HistDbFile *f, const char *dir, const char *suffix, uint32_t record_size)
+{
+  char *path = histdb_path(dir, suffix);
+  int created = 0;
+
+  f->fd = open(path, O_RDWR | O_CLOEXEC);
+  if (f->fd < 0 && errno == ENOENT)
+  {
+    f->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    created = 1;
+  }
+  free(path);
+  f->map = NULL;
+  f->len = 0;
+  if (f->fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(f->fd, &st) != 0)
+    return -1;
+  if (st.st_size == 0)
+  {
+    // New (or emptied by a crash before the header made it out)
+    HistDbHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HISTDB_MAGIC, sizeof(h.magic));
+    h.version = HISTDB_VERSION;
+    h.record_size = record_size;
+    if (histdb_pwrite_all(f->fd, &h, sizeof(h), 0) != 0)
+      return -1;
+    return 1;
+  }
+  return created;
+}
+
+static int histdb_check_header(const HistDbFile *f, uint32_t record_size)
+{
+  const HistDbHeader *h = (const HistDbHeader *)f->map;
+  return f->len >= sizeof(HistDbHeader) && memcmp(h->magic, HISTDB_MAGIC, sizeof(h->magic)) == 0 &&
+         h->version == HISTDB_VERSION && h->record_size == record_size;
+}
+
+// Map f at its current size
+static int histdb_map(HistDbFile *f)
+{
+  struct stat st;
+  if (fstat(f->fd, &st) != 0)
+    return -1;
+  if ((size_t)st.st_size == f->len)
+    return 0;
+  if (f->map)
+    munmap(f->map, f->len);
+  f->map = NULL;
+  f->len = 0;
+  if (st.st_size == 0)
+    return 0;
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, f->fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  f->map = map;
+  f->len = st.st_size;
+  return 0;
+}
+
+static void histdb_hash_dir(HistDb *db, uint32_t id)
+{
+  if ((size_t)(db->dir_table_count + 1) * 2 > db->dir_table_cap)
+  {
+    // Grow and rehash everything hashed so far
+    size_t cap = db->dir_table_cap ? db->dir_table_cap * 2 : HISTDB_DIR_TABLE_MIN;
+    uint32_t *table = malloc(cap * sizeof(uint32_t));
+    if (!table)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < cap; i++)
+      table[i] = HISTDB_NONE;
+    free(db->dir_table);
+    db->dir_table = table;
+    db->dir_table_cap = cap;
+    uint32_t count = db->dir_table_count;
+    db->dir_table_count = 0;
+    for (uint32_t i = 0; i < count; i++)
+      histdb_hash_dir(db, i);
+  }
+
+  const HistDbDir *d = &db->dir_entries[id];
+  size_t slot = histdb_hash(db->text.map + d->name_off, d->name_len) & (db->dir_table_cap - 1);
+  while (db->dir_table[slot] != HISTDB_NONE)
+    slot = (slot + 1) & (db->dir_table_cap - 1);
+  db->dir_table[slot] = id;
+  db->dir_table_count++;
+}
+
+int histdb_refresh(HistDb *db)
+{
+  if (histdb_map(&db->text) != 0 || histdb_map(&db->idx) != 0 || histdb_map(&db->dirs) != 0)
+    return -1;
+  if (!histdb_check_header(&db->text, 1) || !histdb_check_header(&db->idx, sizeof(HistDbRecord)) ||
+      !histdb_check_header(&db->dirs, sizeof(HistDbDir)))
+    return -1;
+
+  size_t text_len = db->text.len;
+  db->records = (const HistDbRecord *)(db->idx.map + sizeof(HistDbHeader));
+  db->dir_entries = (const HistDbDir *)(db->dirs.map + sizeof(HistDbHeader));
+  uint32_t ndirs = (db->dirs.len - sizeof(HistDbHeader)) / sizeof(HistDbDir);
+  uint32_t nrecords = (db->idx.len - sizeof(HistDbHeader)) / sizeof(HistDbRecord);
+
+  // Ignore a torn tail: entries pointing past the data that reached the disk
+  while (ndirs > 0 && db->dir_entries[ndirs - 1].name_off + db->dir_entries[ndirs - 1].name_len > text_len)
+    ndirs--;
+  while (nrecords > 0 && (db->records[nrecords - 1].cmd_off + db->records[nrecords - 1].cmd_len > text_len ||
+                          db->records[nrecords - 1].dir >= ndirs))
+    nrecords--;
+
+  if (ndirs < db->dir_table_count || nrecords < db->nrecords)
+  {
+    // The store was cleared under us; start the hash over
+    db->dir_table_count = 0;
+    for (size_t i = 0; i < db->dir_table_cap; i++)
+      db->dir_table[i] = HISTDB_NONE;
+  }
+  db->ndirs = ndirs;
+  db->nrecords = nrecords;
+  while (db->dir_table_count < ndirs)
+    histdb_hash_dir(db, db->dir_table_count);
+  return 0;
+}
+
+// Make last_record right for the records of a batch that may have been cut
+// short. Called with the lock held.
+static void histdb_repair(HistDb *db)
+{
+  uint32_t from = db->nrecords > HISTDB_MAX_BATCH ? db->nrecords - HISTDB_MAX_BATCH : 0;
+
+  for (uint32_t d = 0; d < db->ndirs; d++)
+  {
+    uint32_t last = db->dir_entries[d].last_record;
+    if (last != HISTDB_NONE && last >= db->nrecords)
+    {
+      // Points at a record that was never written; walk back to one that was
+      uint32_t fixed = HISTDB_NONE;
+      for (uint32_t i = db->nrecords; i > from; i--)
+      {
+        if (db->records[i - 1].dir == d)
+        {
+          fixed = i - 1;
+          break;
+        }
+      }
+      histdb_pwrite_all(db->dirs.fd, &fixed, sizeof(fixed),
+                        sizeof(HistDbHeader) + (off_t)d * sizeof(HistDbDir) + offsetof(HistDbDir, last_record));
+    }
+  }
+  for (uint32_t i = from; i < db->nrecords; i++)
+  {
+    uint32_t d = db->records[i].dir;
+    uint32_t last = db->dir_entries[d].last_record;
+    if (last == HISTDB_NONE || last < i)
+    {
+      histdb_pwrite_all(db->dirs.fd, &i, sizeof(i),
+                        sizeof(HistDbHeader) + (off_t)d * sizeof(HistDbDir) + offsetof(HistDbDir, last_record));
+    }
+  }
+}
+
+HistDb *histdb_open(const char *dir, int *created)
+{
+  HistDb *db = calloc(1, sizeof(HistDb));
+  if (!db)
+    return NULL;
+  db->text.fd = db->idx.fd = db->dirs.fd = -1;
+
+  int c1 = histdb_open_file(&db->text, dir, "", 1);
+  int c2 = histdb_open_file(&db->idx, dir, ".idx", sizeof(HistDbRecord));
+  int c3 = histdb_open_file(&db->dirs, dir, ".dirs", sizeof(HistDbDir));
+  if (c1 < 0 || c2 < 0 || c3 < 0)
+  {
+    histdb_close(db);
+    return NULL;
+  }
+  if (created)
+    *created = c2 == 1;
+
+  flock(db->idx.fd, LOCK_EX);
+  int rc = histdb_refresh(db);
+  if (rc == 0)
+  {
+    histdb_repair(db);
+    // Drop any torn tail so the next append starts on a clean boundary
+    ftruncate(db->idx.fd, sizeof(HistDbHeader) + (off_t)db->nrecords * sizeof(HistDbRecord));
+    ftruncate(db->dirs.fd, sizeof(HistDbHeader) + (off_t)db->ndirs * sizeof(HistDbDir));
+    rc = histdb_refresh(db);
+  }
+  flock(db->idx.fd, LOCK_UN);
+
+  if (rc != 0)
+  {
+    fprintf(stderr, "lsh: ignoring damaged history store in %s\n", dir);
+    histdb_close(db);
+    return NULL;
+  }
+  return db;
+}
+
+void histdb_close(HistDb *db)
+{
+  if (!db)
+    return;
+
+  HistDbFile *files[] = {&db->text, &db->idx, &db->dirs};
+  for (int i = 0; i < 3; i++)
+  {
+    if (files[i]->map)
+      munmap(files[i]->map, files[i]->len);
+    if (files[i]->fd >= 0)
+      close(files[i]->fd);
+  }
+  free(db->dir_table);
+  free(db->batch);
+  free(db->out);
+  free(db);
+}
+
+uint32_t histdb_find_dir(const HistDb *db, const char *dir, size_t len)
+{
+  if (db->dir_table_cap == 0)
+    return HISTDB_NONE;
+  size_t slot = histdb_hash(dir, len) & (db->dir_table_cap - 1);
+  while (db->dir_table[slot] != HISTDB_NONE)
+  {
+    const HistDbDir *d = &db->dir_entries[db->dir_table[slot]];
+    if (d->name_len == len && memcmp(db->text.map + d->name_off, dir, len) == 0)
+      return db->dir_table[slot];
+    slot = (slot + 1) & (db->dir_table_cap - 1);
+  }
+  return HISTDB_NONE;
+}
+
+// Directory ids handed out within one append, before they are on disk
+typedef struct
+{
+  const char *name;
+  size_t len;
+  uint32_t id;
+  uint32_t last;
+} HistDbPendingDir;
+
+// At least size bytes in *buf, which is grown and never shrunk. Returns
+// NULL if it cannot be.
+static void *histdb_scratch(void **buf, size_t *cap, size_t size)
+{
+  if (size > *cap || *buf == NULL)
+  {
+    size_t grown = *cap ? *cap : 4096;
+    while (grown < size)
+      grown *= 2;
+    void *p = realloc(*buf, grown);
+    if (!p)
+      return NULL;
+    *buf = p;
+    *cap = grown;
+  }
+  return *buf;
+}
+
+static int histdb_append_batch(HistDb *db, const HistEntry *entries, size_t n, int sync)
+{
+  // Both are multiples of 8 bytes, so the records after the directories stay aligned
+  char *batch = histdb_scratch(&db->batch, &db->batch_cap, n * (sizeof(HistDbPendingDir) + sizeof(HistDbRecord)));
+  size_t ntouched = 0, nnew = 0, text_len = 0;
+  int rc = -1;
+
+  if (!batch)
+    return -1;
+  HistDbPendingDir *touched = (HistDbPendingDir *)batch;
+  HistDbRecord *recs = (HistDbRecord *)(batch + n * sizeof(HistDbPendingDir));
+  memset(recs, 0, n * sizeof(HistDbRecord));
+
+  // Assign directory ids and chain each record to the previous one in its dir
+  for (size_t i = 0; i < n; i++)
+  {
+    size_t t;
+    for (t = 0; t < ntouched; t++)
+    {
+      if (touched[t].len == entries[i].dir_len && memcmp(touched[t].name, entries[i].dir, touched[t].len) == 0)
+        break;
+    }
+    if (t == ntouched)
+    {
+      touched[t].name = entries[i].dir;
+      touched[t].len = entries[i].dir_len;
+      touched[t].id = histdb_find_dir(db, entries[i].dir, entries[i].dir_len);
+      if (touched[t].id == HISTDB_NONE)
+      {
+        touched[t].id = db->ndirs + nnew++;
+        touched[t].last = HISTDB_NONE;
+        text_len += entries[i].dir_len;
+      }
+      else
+      {
+        touched[t].last = db->dir_entries[touched[t].id].last_record;
+      }
+      ntouched++;
+    }
+    recs[i].time = entries[i].time;
+    recs[i].cmd_len = entries[i].cmd_len;
+    recs[i].dir = touched[t].id;
+    recs[i].prev_in_dir = touched[t].last;
+    touched[t].last = db->nrecords + i;
+    text_len += entries[i].cmd_len;
+  }
+
+  // Lay out the text: commands, then the names of new directories
+  HistDbDir *new_dirs = histdb_scratch(&db->out, &db->out_cap, nnew * sizeof(HistDbDir) + text_len);
+  if (!new_dirs)
+    return -1;
+  char *text = (char *)(new_dirs + nnew);
+  off_t text_off = db->text.len;
+  size_t pos = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    memcpy(text + pos, entries[i].cmd, entries[i].cmd_len);
+    recs[i].cmd_off = text_off + pos;
+    pos += entries[i].cmd_len;
+  }
+  for (size_t t = 0; t < ntouched; t++)
+  {
+    if (touched[t].id < db->ndirs)
+      continue;
+    HistDbDir *d = &new_dirs[touched[t].id - db->ndirs];
+    memcpy(text + pos, touched[t].name, touched[t].len);
+    d->name_off = text_off + pos;
+    d->name_len = touched[t].len;
+    d->last_record = touched[t].last;
+    pos += touched[t].len;
+  }
+
+  // Append right after the last valid entry, over any torn tail
+  rc = histdb_pwrite_all(db->text.fd, text, text_len, text_off);
+  if (rc == 0 && nnew > 0)
+    rc = histdb_pwrite_all(db->dirs.fd, new_dirs, nnew * sizeof(HistDbDir),
+                           sizeof(HistDbHeader) + (off_t)db->ndirs * sizeof(HistDbDir));
+  if (rc == 0)
+    rc = histdb_pwrite_all(db->idx.fd, recs, n * sizeof(HistDbRecord),
+                           sizeof(HistDbHeader) + (off_t)db->nrecords * sizeof(HistDbRecord));
+  for (size_t t = 0; rc == 0 && t < ntouched; t++)
+  {
+    if (touched[t].id >= db->ndirs)
+      continue;
+    rc = histdb_pwrite_all(db->dirs.fd, &touched[t].last, sizeof(uint32_t),
+                           sizeof(HistDbHeader) + (off_t)touched[t].id * sizeof(HistDbDir) +
+                               offsetof(HistDbDir, last_record));
+  }
+  if (rc == 0 && sync)
+  {
+    fdatasync(db->text.fd);
+    fdatasync(db->dirs.fd);
+    fdatasync(db->idx.fd);
+  }
+  return rc;
+}
+
+int histdb_append(HistDb *db, const HistEntry *entries, size_t n, int sync)
+{
+  int rc = 0;
+  if (n == 0)
+    return 0;
+
+  flock(db->idx.fd, LOCK_EX);
+  for (size_t i = 0; rc == 0 && i < n; i += HISTDB_MAX_BATCH)
+  {
+    // Another shell may have appended since we last looked
+    rc = histdb_refresh(db);
+    if (rc == 0)
+      rc = histdb_append_batch(db, entries + i, n - i < HISTDB_MAX_BATCH ? n - i : HISTDB_MAX_BATCH, sync);
+  }
+  flock(db->idx.fd, LOCK_UN);
+  if (rc == 0)
+    rc = histdb_refresh(db);
+  return rc;
+}
+
+int histdb_clear(HistDb *db)
+{
+  int rc = 0;
+  flock(db->idx.fd, LOCK_EX);
+  if (ftruncate(db->idx.fd, sizeof(HistDbHeader)) != 0 || ftruncate(db->dirs.fd, sizeof(HistDbHeader)) != 0 ||
+      ftruncate(db->text.fd, sizeof(HistDbHeader)) != 0)
+    rc = -1;
+  flock(db->idx.fd, LOCK_UN);
+  if (histdb_refresh(db) != 0)
+    rc = -1;
+  return rc;
+}
+
+long histdb_import_text(HistDb *db, const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  HistEntry *batch = malloc(HISTDB_MAX_BATCH * sizeof(HistEntry));
+  char **lines = calloc(HISTDB_MAX_BATCH, sizeof(char *));
+  size_t *caps = calloc(HISTDB_MAX_BATCH, sizeof(size_t));
+  size_t n = 0;
+  long imported = 0;
+  if (!batch || !lines || !caps)
+  {
+    fclose(fp);
+    free(batch);
+    free(lines);
+    free(caps);
+    return -1;
+  }
+
+  for (;;)
+  {
+    ssize_t len = getline(&lines[n], &caps[n], fp);
+    if (len >= 0)
+    {
+      char *line = lines[n];
+      if (len > 0 && line[len - 1] == '\n')
+        line[--len] = '\0';
+      if (len == 0)
+        continue;
+
+      HistEntry *e = &batch[n];
+      struct tm tm;
+      memset(&tm, 0, sizeof(tm));
+      char *after_ts = line[0] == '[' ? strptime(line + 1, "%Y-%m-%d %H:%M:%S", &tm) : NULL;
+      char *dir_end = after_ts && strncmp(after_ts, "] [", 3) == 0 ? strstr(after_ts + 3, "] ") : NULL;
+      if (dir_end)
+      {
+        tm.tm_isdst = -1;
+        e->time = mktime(&tm);
+        e->dir = after_ts + 3;
+        e->dir_len = dir_end - e->dir;
+        e->cmd = dir_end + 2;
+        e->cmd_len = line + len - e->cmd;
+      }
+      else
+      {
+        e->time = 0;
+        e->dir = "";
+        e->dir_len = 0;
+        e->cmd = line;
+        e->cmd_len = len;
+      }
+      n++;
+    }
+
+    if (n == HISTDB_MAX_BATCH || (len < 0 && n > 0))
+    {
+      if (histdb_append(db, batch, n, 0) != 0)
+        break;
+      imported += n;
+      n = 0;
+    }
+    if (len < 0)
+      break;
+  }
+
+  for (size_t i = 0; i < HISTDB_MAX_BATCH; i++)
+    free(lines[i]);
+  free(lines);
+  free(caps);
+  free(batch);
+  fclose(fp);
+  return imported;
+}
+
+uint32_t histdb_count(const HistDb *db)
+{
+  return db->nrecords;
+}
+
+void histdb_get(const HistDb *db, uint32_t i, HistEntry *out)
+{
+  const HistDbRecord *r = &db->records[i];
+  const HistDbDir *d = &db->dir_entries[r->dir];
+  out->time = r->time;
+  out->cmd = db->text.map + r->cmd_off;
+  out->cmd_len = r->cmd_len;
+  out->dir = db->text.map + d->name_off;
+  out->dir_len = d->name_len;
+}
+
+uint32_t histdb_dir_of(const HistDb *db, uint32_t i)
+{
+  return db->records[i].dir;
+}
+
+uint32_t histdb_dir_last(const HistDb *db, uint32_t dir_id)
+{
+  uint32_t last = db->dir_entries[dir_id].last_record;
+  if (last == HISTDB_NONE || last < db->nrecords)
+    return last;
+
+  // Another shell appended after our last refresh and the shared mapping
+  // already shows its update; find the newest record we can see instead
+  for (uint32_t i = db->nrecords; i > 0; i--)
+  {
+    if (db->records[i - 1].dir == dir_id)
+      return i - 1;
+  }
+  return HISTDB_NONE;
+}
+
+uint32_t histdb_dir_prev(const HistDb *db, uint32_t i)
+{
+  return db->records[i].prev_in_dir;
+}
+
+uint32_t histdb_first_since(const HistDb *db, int64_t t)
+{
+  // Records are appended in time order, so a binary search finds the start
+  uint32_t lo = 0, hi = db->nrecords;
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (db->records[mid].time < t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
@@ -0,0 +1,67 @@
+#ifndef HISTDB_H
+#define HISTDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Base name of the store; the record index and directory table live next to
+// it with ".idx" and ".dirs" appended
+#define HISTDB_FILE_NAME ".pss_history"
+#define HISTDB_MAGIC "PSSHIST"
+#define HISTDB_VERSION 1
+// Largest number of records written by one locked append. A crash can only
+// lose the directory updates of the last such batch, so this is also how far
+// back histdb_open looks to repair them.
+#define HISTDB_MAX_BATCH 1024
+// "No record" / "no directory"
+#define HISTDB_NONE UINT32_MAX
+
+// One history entry. Strings are not NUL terminated; entries returned by
+// histdb_get point into the mapped store and stay valid until the next
+// histdb_refresh, histdb_append or histdb_clear.
+typedef struct
+{
+  int64_t time;
+  const char *dir;
+  size_t dir_len;
+  const char *cmd;
+  size_t cmd_len;
+} HistEntry;
+
+typedef struct HistDb HistDb;
+
+// Open (creating if needed) the store in dir. *created is set when the store
+// did not exist before. Returns NULL if it cannot be opened.
+HistDb *histdb_open(const char *dir, int *created);
+void histdb_close(HistDb *db);
+
+// Append entries under an exclusive lock shared with other shells. With sync
+// set, the files are fdatasync'ed before returning. Returns 0 on success.
+int histdb_append(HistDb *db, const HistEntry *entries, size_t n, int sync);
+
+// Remove every record
+int histdb_clear(HistDb *db);
+
+// Append the entries of a "[YYYY-MM-DD HH:MM:SS] [cwd] command" text file.
+// Lines in any other shape are kept as commands with no time or directory.
+// Returns the number of entries imported, or -1 if path cannot be read.
+long histdb_import_text(HistDb *db, const char *path);
+
+// Pick up records appended by other processes
+int histdb_refresh(HistDb *db);
+
+uint32_t histdb_count(const HistDb *db);
+void histdb_get(const HistDb *db, uint32_t i, HistEntry *out);
+
+// Record queries, all answered from the mapped index:
+// directory id of dir, or HISTDB_NONE if no command was run there
+uint32_t histdb_find_dir(const HistDb *db, const char *dir, size_t len);
+// Directory id of record i
+uint32_t histdb_dir_of(const HistDb *db, uint32_t i);
+// Newest record run in dir_id, and the one run there before record i
+uint32_t histdb_dir_last(const HistDb *db, uint32_t dir_id);
+uint32_t histdb_dir_prev(const HistDb *db, uint32_t i);
+// Index of the first record at or after t (histdb_count if none)
+uint32_t histdb_first_since(const HistDb *db, int64_t t);
+
+#endif // HISTDB_H
@@ -0,0 +1,645 @@
+// hsearch.c
+//
+// Fuzzy search over the command history for Ctrl+R. Every distinct command
+// is kept once, in order of last use, as two parallel arrays: a 64-bit
+// summary of the bytes it contains, and the command itself. A command that
+// is run again moves to the end; the slot it leaves behind is reclaimed by
+// an occasional compaction. The text of the commands is kept in an arena,
+// since none is freed before the whole index, so adding one costs a heap
+// allocation only when a chunk fills up.
+//
+// The newest HSEARCH_RECENT commands are scanned in full, since that is
+// where the recency boost still counts. Further back, only the bonuses for
+// consecutive characters and word starts can lift a match above the rest,
+// and both need a pair of adjacent characters from the query to appear in
+// the command: the pair itself, or a separator followed by the character.
+// Each such pair has a posting list of the commands containing it, oldest
+// first. A query merges the lists of its own pairs newest first; the lists
+// a command turns up in bound its score, so most candidates are dropped
+// without being scored, and the walk stops once even a perfect match could
+// no longer enter the results. A query common enough to need more than
+// HSEARCH_MAX_POSTINGS list entries sees only that far back, which keeps a
+// refresh well under a millisecond at any history size. Older commands
+// that match only as a scattered subsequence are not found.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "hsearch.h"
+#include "arena.h"
+
+#define HSEARCH_INITIAL_CAPACITY 1024
+#define HSEARCH_EMPTY UINT32_MAX
+
+// Scoring, per matched query character
+#define SCORE_MATCH 16
+#define SCORE_CONSECUTIVE 12
+#define SCORE_WORD_START 10
+#define SCORE_GAP_CAP 8 // Most a single gap can cost
+// Per command
+#define SCORE_RECENCY 32     // Boost for the newest command...
+#define SCORE_RECENCY_HALF 64 // ...halved this many commands back
+#define SCORE_SAME_DIR 24
+// Extra start positions tried after the first, at word starts
+#define HSEARCH_EXTRA_STARTS 3
+
+// Newest commands scanned in full; the recency boost is under 2 beyond
+#define HSEARCH_RECENT 1024
+// Most posting list entries one query walks through, and most of the
+// candidates found there that it scores
+#define HSEARCH_MAX_POSTINGS (1 << 14)
+#define HSEARCH_MAX_SCORED 2048
+// Longest query, and the highest bound a command can have over its matches
+#define HSEARCH_MAX_QUERY 256
+#define HSEARCH_MAX_BOUND \
+  (HSEARCH_MAX_QUERY * (SCORE_CONSECUTIVE + SCORE_WORD_START) + SCORE_RECENCY + SCORE_SAME_DIR)
+
+// Character classes of the pair lists: 26 letters either case, 10 digits,
+// the separators that start a word, and everything else. A pair is keyed by
+// the class of its first byte and its second byte, which must be a letter or
+// a digit. The start of a command counts as a separator.
+#define HSEARCH_CLASS_SEP 36
+#define HSEARCH_CLASS_OTHER 37
+#define HSEARCH_CLASSES 38
+#define HSEARCH_ALNUM 36
+#define HSEARCH_KEYS (HSEARCH_CLASSES * HSEARCH_ALNUM)
+#define HSEARCH_KEY_WORDS ((HSEARCH_KEYS + 63) / 64)
+
+typedef struct
+{
+  char *cmd; // NULL once the command has moved to a newer slot
+  char *lower; // Lowercase copy, stored with cmd
+  uint32_t len;
+  uint32_t dir_hash; // Directory it was last run in
+} HistSearchSlot;
+
+// Slots containing one pair, ascending. Entries for slots a command has
+// since moved out of stay until the next compaction.
+typedef struct
+{
+  uint32_t *ids;
+  uint32_t len, cap;
+} HistSearchList;
+
+struct HistSearch
+{
+  uint64_t *masks; // 0 for an empty slot, which no query can match
+  HistSearchSlot *slots;
+  size_t n, cap, live;
+  uint32_t *table; // Open-addressing hash of slot indexes, keyed by command
+  size_t table_cap;
+  Arena text; // Every command and its lowercase copy
+  HistSearchList lists[HSEARCH_KEYS];
+  // Query scratch, allocated on the first query that reaches past the
+  // newest commands: the bonus each slot has gathered from the lists (zero
+  // between queries), and the candidates as bound << 32 | slot, as found
+  // and in falling bound order
+  uint16_t *bonus;
+  size_t bonus_cap;
+  uint64_t *cand, *cand_sorted;
+};
+
+static uint32_t hsearch_hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h;
+}
+
+static void *hsearch_xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static int hsearch_lower(int c)
+{
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Bit for byte c: one per letter (either case) and digit, the rest hashed
+static uint64_t hsearch_bit(unsigned char c)
+{
+  int l = hsearch_lower(c);
+  if (l >= 'a' && l <= 'z')
+    return 1ull << (l - 'a');
+  if (c >= '0' && c <= '9')
+    return 1ull << (26 + c - '0');
+  return 1ull << (36 + c % 28);
+}
+
+static uint64_t hsearch_mask(const char *s, size_t len)
+{
+  uint64_t mask = 0;
+  for (size_t i = 0; i < len; i++)
+    mask |= hsearch_bit((unsigned char)s[i]);
+  return mask;
+}
+
+static int hsearch_is_separator(char c)
+{
+  return c == ' ' || c == '/' || c == '-' || c == '_' || c == '.' || c == '=' || c == '\'' || c == '"';
+}
+
+static int hsearch_class(unsigned char c)
+{
+  int l = hsearch_lower(c);
+  if (l >= 'a' && l <= 'z')
+    return l - 'a';
+  if (c >= '0' && c <= '9')
+    return 26 + c - '0';
+  return hsearch_is_separator((char)c) ? HSEARCH_CLASS_SEP : HSEARCH_CLASS_OTHER;
+}
+
+// List key of the pair (prev, c), or -1 if c is not a letter or digit
+static int hsearch_key(int prev_class, unsigned char c)
+{
+  int cls = hsearch_class(c);
+  return cls < HSEARCH_ALNUM ? prev_class * HSEARCH_ALNUM + cls : -1;
+}
+
+// Add slot id to the list of every pair in its command
+static void hsearch_index(HistSearch *hs, uint32_t id)
+{
+  const HistSearchSlot *slot = &hs->slots[id];
+  uint64_t seen[HSEARCH_KEY_WORDS] = { 0 };
+  int prev = HSEARCH_CLASS_SEP;
+
+  for (uint32_t i = 0; i < slot->len; i++)
+  {
+    unsigned char c = (unsigned char)slot->lower[i];
+    int key = hsearch_key(prev, c);
+    prev = hsearch_class(c);
+    if (key < 0 || (seen[key / 64] >> (key % 64)) & 1)
+      continue;
+    seen[key / 64] |= 1ull << (key % 64);
+
+    HistSearchList *list = &hs->lists[key];
+    if (list->len == list->cap)
+    {
+      list->cap = list->cap ? list->cap * 2 : 16;
+      list->ids = hsearch_xrealloc(list->ids, list->cap * sizeof(uint32_t));
+    }
+    list->ids[list->len++] = id;
+  }
+}
+
+HistSearch *hsearch_new(void)
+{
+  HistSearch *hs = calloc(1, sizeof(HistSearch));
+  if (!hs)
+    return NULL;
+  arena_init(&hs->text);
+  hs->cap = HSEARCH_INITIAL_CAPACITY;
+  hs->masks = hsearch_xrealloc(NULL, hs->cap * sizeof(uint64_t));
+  hs->slots = hsearch_xrealloc(NULL, hs->cap * sizeof(HistSearchSlot));
+  hs->table_cap = HSEARCH_INITIAL_CAPACITY * 2;
+  hs->table = hsearch_xrealloc(NULL, hs->table_cap * sizeof(uint32_t));
+  for (size_t i = 0; i < hs->table_cap; i++)
+    hs->table[i] = HSEARCH_EMPTY;
+  return hs;
+}
+
+void hsearch_free(HistSearch *hs)
+{
+  if (!hs)
+    return;
+  arena_free(&hs->text);
+  for (size_t i = 0; i < HSEARCH_KEYS; i++)
+    free(hs->lists[i].ids);
+  free(hs->bonus);
+  free(hs->cand);
+  free(hs->cand_sorted);
+  free(hs->masks);
+  free(hs->slots);
+  free(hs->table);
+  free(hs);
+}
+
+static void hsearch_rehash(HistSearch *hs, size_t table_cap)
+{
+  if (table_cap != hs->table_cap)
+  {
+    hs->table = hsearch_xrealloc(hs->table, table_cap * sizeof(uint32_t));
+    hs->table_cap = table_cap;
+  }
+  for (size_t i = 0; i < hs->table_cap; i++)
+    hs->table[i] = HSEARCH_EMPTY;
+  for (size_t i = 0; i < hs->n; i++)
+  {
+    if (hs->slots[i].cmd == NULL)
+      continue;
+    size_t pos = hsearch_hash(hs->slots[i].cmd, hs->slots[i].len) & (hs->table_cap - 1);
+    while (hs->table[pos] != HSEARCH_EMPTY)
+      pos = (pos + 1) & (hs->table_cap - 1);
+    hs->table[pos] = i;
+  }
+}
+
+// Make room for one more slot at the end
+static void hsearch_reserve(HistSearch *hs)
+{
+  if (hs->n < hs->cap)
+    return;
+  if (hs->n - hs->live >= hs->n / 2)
+  {
+    // Mostly moved-out slots: squeeze them out, keeping the order, so the
+    // lists stay ascending once renumbered
+    uint32_t *moved = hsearch_xrealloc(NULL, hs->n * sizeof(uint32_t));
+    size_t k = 0;
+    for (size_t i = 0; i < hs->n; i++)
+    {
+      moved[i] = HSEARCH_EMPTY;
+      if (hs->slots[i].cmd == NULL)
+        continue;
+      hs->slots[k] = hs->slots[i];
+      hs->masks[k] = hs->masks[i];
+      moved[i] = k++;
+    }
+    hs->n = k;
+    for (size_t key = 0; key < HSEARCH_KEYS; key++)
+    {
+      HistSearchList *list = &hs->lists[key];
+      uint32_t kept = 0;
+      for (uint32_t j = 0; j < list->len; j++)
+      {
+        if (moved[list->ids[j]] != HSEARCH_EMPTY)
+          list->ids[kept++] = moved[list->ids[j]];
+      }
+      list->len = kept;
+    }
+    free(moved);
+    hsearch_rehash(hs, hs->table_cap);
+    return;
+  }
+  hs->cap *= 2;
+  hs->masks = hsearch_xrealloc(hs->masks, hs->cap * sizeof(uint64_t));
+  hs->slots = hsearch_xrealloc(hs->slots, hs->cap * sizeof(HistSearchSlot));
+}
+
+void hsearch_add(HistSearch *hs, const char *cmd, size_t len, const char *dir, size_t dir_len)
+{
+  if (len == 0 || len > UINT32_MAX)
+    return;
+
+  hsearch_reserve(hs);
+  if ((hs->live + 1) * 2 > hs->table_cap)
+    hsearch_rehash(hs, hs->table_cap * 2);
+
+  size_t pos = hsearch_hash(cmd, len) & (hs->table_cap - 1);
+  while (hs->table[pos] != HSEARCH_EMPTY)
+  {
+    HistSearchSlot *old = &hs->slots[hs->table[pos]];
+    if (old->len == len && memcmp(old->cmd, cmd, len) == 0)
+      break;
+    pos = (pos + 1) & (hs->table_cap - 1);
+  }
+
+  HistSearchSlot *slot = &hs->slots[hs->n];
+  if (hs->table[pos] != HSEARCH_EMPTY)
+  {
+    // Seen before: move it to the newest position
+    uint32_t from = hs->table[pos];
+    *slot = hs->slots[from];
+    hs->masks[hs->n] = hs->masks[from];
+    hs->slots[from].cmd = NULL;
+    hs->masks[from] = 0;
+  }
+  else
+  {
+    slot->cmd = arena_alloc(&hs->text, 2 * (len + 1));
+    slot->lower = slot->cmd + len + 1;
+    memcpy(slot->cmd, cmd, len);
+    slot->cmd[len] = '\0';
+    for (size_t i = 0; i <= len; i++)
+      slot->lower[i] = (char)hsearch_lower((unsigned char)slot->cmd[i]);
+    slot->len = len;
+    hs->masks[hs->n] = hsearch_mask(cmd, len);
+    hs->live++;
+  }
+  slot->dir_hash = hsearch_hash(dir, dir_len);
+  hsearch_index(hs, hs->n);
+  hs->table[pos] = hs->n++;
+}
+
+static int hsearch_is_word_start(const char *s, size_t i)
+{
+  return i == 0 || hsearch_is_separator(s[i - 1]);
+}
+
+// Greedy subsequence match of query in text starting at text[start], which
+// must match query[0]. cmd is the original text, used for word boundaries.
+// Returns INT_MIN if the rest of query does not follow.
+static int hsearch_score_from(const char *cmd, const char *text, size_t len, size_t start,
+                              const char *query, size_t qlen)
+{
+  int score = SCORE_MATCH + (hsearch_is_word_start(cmd, start) ? SCORE_WORD_START : 0);
+  size_t prev = start, qi = 1;
+
+  for (size_t i = start + 1; i < len && qi < qlen; i++)
+  {
+    if (text[i] != query[qi])
+      continue;
+    score += SCORE_MATCH;
+    if (i == prev + 1)
+      score += SCORE_CONSECUTIVE;
+    else
+      score -= i - prev - 1 < SCORE_GAP_CAP ? (int)(i - prev - 1) : SCORE_GAP_CAP;
+    if (hsearch_is_word_start(cmd, i))
+      score += SCORE_WORD_START;
+    prev = i;
+    qi++;
+  }
+  return qi == qlen ? score : INT_MIN;
+}
+
+// query is already lowercased unless the search is case sensitive
+static int hsearch_score(const HistSearchSlot *slot, const char *query, size_t qlen, int case_sensitive)
+{
+  const char *text = case_sensitive ? slot->cmd : slot->lower;
+  const char *end = text + slot->len;
+  const char *p = text;
+  int best = INT_MIN, starts = 0;
+
+  while ((p = memchr(p, query[0], end - p)) != NULL)
+  {
+    size_t i = p - text;
+    p++;
+    // The first occurrence, then a few later ones that start a word
+    if (best != INT_MIN && !hsearch_is_word_start(slot->cmd, i))
+      continue;
+    int s = hsearch_score_from(slot->cmd, text, slot->len, i, query, qlen);
+    if (s == INT_MIN)
+      break; // A later start cannot find what an earlier one did not
+    if (s > best)
+      best = s;
+    if (++starts > HSEARCH_EXTRA_STARTS)
+      break;
+  }
+  return best;
+}
+
+// Highest score hsearch_score can give query: every character a word start
+// or right after the previous one
+static int hsearch_best_score(const char *query, size_t qlen)
+{
+  int best = SCORE_MATCH + SCORE_WORD_START;
+  for (size_t i = 1; i < qlen; i++)
+    best += SCORE_MATCH + SCORE_CONSECUTIVE + (hsearch_is_word_start(query, i) ? SCORE_WORD_START : 0);
+  return best;
+}
+
+static int hsearch_recency(size_t age)
+{
+  return (int)((size_t)SCORE_RECENCY * SCORE_RECENCY_HALF / (SCORE_RECENCY_HALF + age));
+}
+
+// Keep out sorted by score, best first, holding at most max results
+static void hsearch_offer(HistSearchResult *out, size_t *found, size_t max, const HistSearchSlot *slot,
+                          int score)
+{
+  if (*found == max && score <= out[max - 1].score)
+    return;
+  size_t k = *found < max ? (*found)++ : max - 1;
+  while (k > 0 && out[k - 1].score < score)
+  {
+    out[k] = out[k - 1];
+    k--;
+  }
+  out[k].cmd = slot->cmd;
+  out[k].len = slot->len;
+  out[k].score = score;
+}
+
+// One pair list of a query, up to the slots the full scan has seen
+typedef struct
+{
+  const uint32_t *ids;
+  uint32_t end;
+  int weight; // Bonus a command can only get if it has the pair
+} HistSearchPair;
+
+// Index of the first of ids[0..len) that is at least id
+static uint32_t hsearch_lower_bound(const uint32_t *ids, uint32_t len, uint32_t id)
+{
+  uint32_t lo = 0, hi = len;
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (ids[mid] < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Bonuses of query that need a pair of characters in the command, one
+// entry per distinct pair with slots below below; *unlisted gets the
+// bonuses no list can rule out
+static size_t hsearch_pairs(const HistSearch *hs, const char *query, size_t qlen, uint32_t below,
+                            HistSearchPair *pairs, int *unlisted)
+{
+  int weights[HSEARCH_KEYS] = { 0 };
+  int keys[2 * HSEARCH_MAX_QUERY], nkeys = 0;
+
+  *unlisted = 0;
+  for (size_t i = 0; i < qlen; i++)
+  {
+    // A word start needs a separator before the character, and a
+    // consecutive match needs the previous query character there
+    int word = hsearch_key(HSEARCH_CLASS_SEP, (unsigned char)query[i]);
+    if (word < 0)
+    {
+      *unlisted += SCORE_WORD_START + (i > 0 ? SCORE_CONSECUTIVE : 0);
+      continue;
+    }
+    if (weights[word] == 0)
+      keys[nkeys++] = word;
+    weights[word] += SCORE_WORD_START;
+    if (i > 0)
+    {
+      int pair = hsearch_key(hsearch_class((unsigned char)query[i - 1]), (unsigned char)query[i]);
+      if (weights[pair] == 0)
+        keys[nkeys++] = pair;
+      weights[pair] += SCORE_CONSECUTIVE;
+    }
+  }
+
+  size_t n = 0;
+  for (int k = 0; k < nkeys; k++)
+  {
+    const HistSearchList *list = &hs->lists[keys[k]];
+    uint32_t end = hsearch_lower_bound(list->ids, list->len, below);
+    if (end == 0)
+      continue;
+    pairs[n].ids = list->ids;
+    pairs[n].end = end;
+    pairs[n].weight = weights[keys[k]];
+    n++;
+  }
+  return n;
+}
+
+// List entries of pairs at or above slot from
+static size_t hsearch_postings_from(const HistSearchPair *pairs, size_t npairs, uint32_t from)
+{
+  size_t total = 0;
+  for (size_t p = 0; p < npairs; p++)
+    total += pairs[p].end - hsearch_lower_bound(pairs[p].ids, pairs[p].end, from);
+  return total;
+}
+
+size_t hsearch_query(HistSearch *hs, const char *query, size_t len, const char *cwd,
+                     HistSearchResult *out, size_t max)
+{
+  char folded[HSEARCH_MAX_QUERY];
+  if (len == 0 || max == 0)
+    return 0;
+  if (len > sizeof(folded))
+    len = sizeof(folded); // Nothing that long is typed into Ctrl+R
+
+  int case_sensitive = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (query[i] >= 'A' && query[i] <= 'Z')
+      case_sensitive = 1;
+  }
+  for (size_t i = 0; i < len; i++)
+    folded[i] = case_sensitive ? query[i] : (char)hsearch_lower((unsigned char)query[i]);
+
+  uint64_t qmask = hsearch_mask(query, len);
+  uint32_t cwd_hash = hsearch_hash(cwd, strlen(cwd));
+  int best_fuzzy = hsearch_best_score(folded, len);
+  size_t found = 0;
+
+  // The newest commands, in full
+  size_t recent = hs->n > HSEARCH_RECENT ? hs->n - HSEARCH_RECENT : 0;
+  for (size_t i = hs->n; i > recent; i--)
+  {
+    if ((hs->masks[i - 1] & qmask) != qmask)
+      continue;
+
+    // Results are kept sorted, so out[max - 1] is the one to beat. Older
+    // commands only get a smaller boost, so once not even a perfect match
+    // in cwd could beat it, nothing further back can either.
+    int recency = hsearch_recency(hs->n - i);
+    const HistSearchSlot *slot = &hs->slots[i - 1];
+    int same_dir = slot->dir_hash == cwd_hash ? SCORE_SAME_DIR : 0;
+    if (found == max)
+    {
+      if (best_fuzzy + recency + SCORE_SAME_DIR <= out[max - 1].score)
+        return found;
+      if (best_fuzzy + recency + same_dir <= out[max - 1].score)
+        continue;
+    }
+
+    int score = hsearch_score(slot, folded, len, case_sensitive);
+    if (score != INT_MIN)
+      hsearch_offer(out, &found, max, slot, score + recency + same_dir);
+  }
+
+  // Further back, the commands sharing a pair with the query. A command
+  // scores at most the matches, the bonuses no list rules out and those of
+  // the lists it turns up in, plus its recency and directory boosts; that
+  // extra over the matches is its bound.
+  HistSearchPair pairs[2 * HSEARCH_MAX_QUERY];
+  int unlisted;
+  size_t npairs = recent ? hsearch_pairs(hs, folded, len, (uint32_t)recent, pairs, &unlisted) : 0;
+  if (npairs == 0)
+    return found;
+  int base = (int)len * SCORE_MATCH + unlisted;
+
+  // Only the newest HSEARCH_MAX_POSTINGS entries of the lists
+  uint32_t from = 0;
+  if (hsearch_postings_from(pairs, npairs, 0) > HSEARCH_MAX_POSTINGS)
+  {
+    uint32_t hi = (uint32_t)recent;
+    while (from < hi)
+    {
+      uint32_t mid = from + (hi - from) / 2;
+      if (hsearch_postings_from(pairs, npairs, mid) > HSEARCH_MAX_POSTINGS)
+        from = mid + 1;
+      else
+        hi = mid;
+    }
+  }
+
+  if (hs->bonus_cap < hs->n)
+  {
+    hs->bonus = hsearch_xrealloc(hs->bonus, hs->cap * sizeof(uint16_t));
+    memset(hs->bonus + hs->bonus_cap, 0, (hs->cap - hs->bonus_cap) * sizeof(uint16_t));
+    hs->bonus_cap = hs->cap;
+  }
+  if (!hs->cand)
+  {
+    hs->cand = hsearch_xrealloc(NULL, HSEARCH_MAX_POSTINGS * sizeof(uint64_t));
+    hs->cand_sorted = hsearch_xrealloc(NULL, HSEARCH_MAX_POSTINGS * sizeof(uint64_t));
+  }
+
+  // Gather each command's bonus, one list at a time
+  size_t ncand = 0;
+  for (size_t p = 0; p < npairs; p++)
+  {
+    for (uint32_t j = hsearch_lower_bound(pairs[p].ids, pairs[p].end, from); j < pairs[p].end; j++)
+    {
+      uint32_t id = pairs[p].ids[j];
+      if (hs->bonus[id] == 0)
+        hs->cand[ncand++] = id;
+      hs->bonus[id] += pairs[p].weight;
+    }
+  }
+
+  // Keep those that can still enter the results, clearing the bonuses
+  size_t kept = 0;
+  int top = 0;
+  for (size_t c = 0; c < ncand; c++)
+  {
+    uint32_t id = (uint32_t)hs->cand[c];
+    int bound = hs->bonus[id];
+    hs->bonus[id] = 0;
+    if ((hs->masks[id] & qmask) != qmask)
+      continue;
+    if (base + bound > best_fuzzy)
+      bound = best_fuzzy - base;
+    // Its directory is only looked up if it gets scored
+    bound += hsearch_recency(hs->n - 1 - id) + SCORE_SAME_DIR;
+    if (found == max && base + bound <= out[max - 1].score)
+      continue;
+    hs->cand[kept++] = (uint64_t)bound << 32 | id;
+    if (bound > top)
+      top = bound;
+  }
+
+  // Score the most promising first, so the results fill with strong matches
+  // early and the bound soon rules out the rest. The sort is by counting.
+  uint32_t counts[HSEARCH_MAX_BOUND + 2];
+  memset(counts, 0, (top + 2) * sizeof(uint32_t));
+  for (size_t c = 0; c < kept; c++)
+    counts[top - (int)(hs->cand[c] >> 32) + 1]++;
+  for (int b = 1; b <= top + 1; b++)
+    counts[b] += counts[b - 1];
+  for (size_t c = 0; c < kept; c++)
+    hs->cand_sorted[counts[top - (int)(hs->cand[c] >> 32)]++] = hs->cand[c];
+
+  for (size_t c = 0; c < kept && c < HSEARCH_MAX_SCORED; c++)
+  {
+    uint32_t id = (uint32_t)hs->cand_sorted[c];
+    int bound = (int)(hs->cand_sorted[c] >> 32);
+    if (found == max && base + bound <= out[max - 1].score)
+      break; // Bounds only fall from here
+    const HistSearchSlot *slot = &hs->slots[id];
+    int extra = hsearch_recency(hs->n - 1 - id) + (slot->dir_hash == cwd_hash ? SCORE_SAME_DIR : 0);
+    int score = hsearch_score(slot, folded, len, case_sensitive);
+    if (score != INT_MIN)
+      hsearch_offer(out, &found, max, slot, score + extra);
+  }
+  return found;
+}
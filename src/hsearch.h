@@ -0,0 +1,37 @@
+#ifndef HSEARCH_H
+#define HSEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Most results returned by one query (Ctrl+R cycles through them)
+#define HSEARCH_MAX_RESULTS 32
+
+// Fuzzy index over distinct history commands, most recently used last
+typedef struct HistSearch HistSearch;
+
+typedef struct
+{
+  const char *cmd; // NUL terminated; valid until the next hsearch_add
+  size_t len;
+  int score;
+} HistSearchResult;
+
+HistSearch *hsearch_new(void);
+void hsearch_free(HistSearch *hs);
+
+// Record that cmd (len bytes) was run in dir. A command seen before moves to
+// the most recent position and takes dir as its directory.
+void hsearch_add(HistSearch *hs, const char *cmd, size_t len, const char *dir, size_t dir_len);
+
+// Rank the commands containing query as a subsequence. Matches score higher
+// for consecutive characters and word starts, for being recent, and for
+// having last been run in cwd. Uppercase in query makes matching case
+// sensitive. Fills out (best first) and returns the number of results.
+// Beyond the newest commands only those sharing a word start or a pair of
+// adjacent characters with query are ranked, and a very common query only
+// looks back so far; see hsearch.c.
+size_t hsearch_query(HistSearch *hs, const char *query, size_t len, const char *cwd,
+                     HistSearchResult *out, size_t max);
+
+#endif // HSEARCH_H
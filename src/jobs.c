@@ -0,0 +1,861 @@
+// jobs.c
+//
+// Job control. Every command line that starts processes is a job; in an
+// interactive shell each job gets a process group of its own, and whichever
+// job is in the foreground owns the terminal, so Ctrl+C and Ctrl+Z reach it
+// and not the shell. Children are never polled for: a SIGCHLD handler writes
+// a byte to a non-blocking self-pipe, and the shell reaps with waitpid(-1,
+// WNOHANG) only when that pipe is readable, before each prompt or while it
+// waits on a foreground job. A reaped pid is matched to its job through a
+// hash table, and jobs are kept in an array indexed by job number, so
+// neither costs more with hundreds of jobs running.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "jobs.h"
+#include "status.h"
+
+#define JOBS_INITIAL_CAPACITY 16
+// Finished jobs kept for reuse, so running one command after another does
+// not allocate a job for each
+#define JOBS_SPARE_MAX 8
+
+typedef enum
+{
+  PROC_RUNNING,
+  PROC_STOPPED,
+  PROC_DONE
+} ProcState;
+
+typedef struct
+{
+  pid_t pid;
+  ProcState state;
+  int status; // From waitpid, once PROC_DONE
+} JobProc;
+
+struct Job
+{
+  int id; // 0 until it enters the job table
+  pid_t pgid;
+  JobProc *procs;
+  size_t nprocs, procs_cap;
+  size_t nlive; // Not yet PROC_DONE
+  size_t nstopped;
+  char *cmd;
+  size_t cmd_cap;
+  Job *next_spare;
+  int changed; // Finished or stopped since last reported
+  int has_tmodes;
+  struct termios tmodes; // Terminal settings it had when it stopped
+};
+
+typedef struct
+{
+  pid_t pid; // 0 for an empty slot
+  Job *job;
+  size_t index; // Into job->procs
+} JobsPid;
+
+static int jobs_interactive;
+static pid_t jobs_shell_pgid;
+static struct termios jobs_shell_tmodes;
+static int jobs_wake[2] = {-1, -1}; // Written to on SIGCHLD
+
+static Job **jobs_table; // Indexed by job number
+static size_t jobs_cap;
+static int jobs_max; // Highest job number in use
+static int jobs_current, jobs_previous; // %+ and %-
+static size_t jobs_pending; // Jobs with changed set
+
+static JobsPid *jobs_pids;
+static size_t jobs_pid_cap, jobs_pid_count;
+
+static Job *jobs_spare;
+static size_t jobs_nspare;
+static size_t jobs_allocs; // For jobs_allocations
+
+static void *jobs_xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static size_t jobs_pid_home(pid_t pid)
+{
+  return ((uint32_t)pid * 2654435761u) & (jobs_pid_cap - 1);
+}
+
+static JobsPid *jobs_pid_find(pid_t pid)
+{
+  if (jobs_pid_count == 0)
+    return NULL;
+  for (size_t i = jobs_pid_home(pid); jobs_pids[i].pid; i = (i + 1) & (jobs_pid_cap - 1))
+  {
+    if (jobs_pids[i].pid == pid)
+      return &jobs_pids[i];
+  }
+  return NULL;
+}
+
+static void jobs_pid_put(JobsPid *table, size_t cap, JobsPid entry)
+{
+  size_t i = ((uint32_t)entry.pid * 2654435761u) & (cap - 1);
+  while (table[i].pid)
+    i = (i + 1) & (cap - 1);
+  table[i] = entry;
+}
+
+static void jobs_pid_add(pid_t pid, Job *job, size_t index)
+{
+  if ((jobs_pid_count + 1) * 2 > jobs_pid_cap)
+  {
+    size_t cap = jobs_pid_cap ? jobs_pid_cap * 2 : JOBS_INITIAL_CAPACITY;
+    JobsPid *table = calloc(cap, sizeof(JobsPid));
+    jobs_allocs++;
+    if (!table)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < jobs_pid_cap; i++)
+    {
+      if (jobs_pids[i].pid)
+        jobs_pid_put(table, cap, jobs_pids[i]);
+    }
+    free(jobs_pids);
+    jobs_pids = table;
+    jobs_pid_cap = cap;
+  }
+  jobs_pid_put(jobs_pids, jobs_pid_cap, (JobsPid){pid, job, index});
+  jobs_pid_count++;
+}
+
+static void jobs_pid_remove(JobsPid *e)
+{
+  size_t hole = e - jobs_pids;
+  jobs_pids[hole].pid = 0;
+  jobs_pid_count--;
+
+  // Shift later members of the probe run back so lookups still find them
+  for (size_t i = (hole + 1) & (jobs_pid_cap - 1); jobs_pids[i].pid; i = (i + 1) & (jobs_pid_cap - 1))
+  {
+    size_t home = jobs_pid_home(jobs_pids[i].pid);
+    if (((i - home) & (jobs_pid_cap - 1)) >= ((i - hole) & (jobs_pid_cap - 1)))
+    {
+      jobs_pids[hole] = jobs_pids[i];
+      jobs_pids[i].pid = 0;
+      hole = i;
+    }
+  }
+}
+
+static void jobs_on_sigchld(int sig)
+{
+  (void)sig;
+  int saved = errno;
+  ssize_t rc = write(jobs_wake[1], "", 1); // Full pipe: a wakeup is pending anyway
+  (void)rc;
+  errno = saved;
+}
+
+void jobs_init(int interactive)
+{
+  struct sigaction sa;
+
+  if (pipe2(jobs_wake, O_NONBLOCK | O_CLOEXEC) != 0)
+  {
+    perror("lsh: pipe");
+    exit(EXIT_FAILURE);
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = jobs_on_sigchld;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+
+  if (!interactive)
+    return;
+
+  // Started in the background: wait until we are brought to the foreground
+  pid_t pgid;
+  while ((pgid = tcgetpgrp(STDIN_FILENO)) != getpgrp())
+  {
+    if (pgid < 0)
+      return; // No terminal after all
+    kill(-getpgrp(), SIGTTIN);
+  }
+
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+  jobs_shell_pgid = getpid();
+  if (getpgrp() != jobs_shell_pgid && setpgid(0, jobs_shell_pgid) < 0)
+  {
+    perror("lsh: setpgid");
+    return;
+  }
+  tcsetpgrp(STDIN_FILENO, jobs_shell_pgid);
+  tcgetattr(STDIN_FILENO, &jobs_shell_tmodes);
+  jobs_interactive = 1;
+}
+
+int jobs_control(void)
+{
+  return jobs_interactive;
+}
+
+Job *jobs_new(const char *cmd)
+{
+  Job *job = jobs_spare;
+  if (job)
+  {
+    jobs_spare = job->next_spare;
+    jobs_nspare--;
+    // Keep the buffers of the job it was
+    JobProc *procs = job->procs;
+    size_t procs_cap = job->procs_cap;
+    char *old_cmd = job->cmd;
+    size_t cmd_cap = job->cmd_cap;
+    memset(job, 0, sizeof(*job));
+    job->procs = procs;
+    job->procs_cap = procs_cap;
+    job->cmd = old_cmd;
+    job->cmd_cap = cmd_cap;
+  }
+  else
+  {
+    job = jobs_xrealloc(NULL, sizeof(Job));
+    memset(job, 0, sizeof(*job));
+    jobs_allocs++;
+  }
+  size_t len = strlen(cmd) + 1;
+  if (len > job->cmd_cap)
+  {
+    job->cmd_cap = len < 64 ? 64 : len;
+    job->cmd = jobs_xrealloc(job->cmd, job->cmd_cap);
+    jobs_allocs++;
+  }
+  memcpy(job->cmd, cmd, len);
+  return job;
+}
+
+size_t jobs_allocations(void)
+{
+  return jobs_allocs;
+}
+
+pid_t jobs_pgid(const Job *job)
+{
+  return job->pgid;
+}
+
+void jobs_add_process(Job *job, pid_t pid)
+{
+  if (job->nprocs == job->procs_cap)
+  {
+    job->procs_cap = job->procs_cap ? job->procs_cap * 2 : 4;
+    job->procs = jobs_xrealloc(job->procs, job->procs_cap * sizeof(JobProc));
+    jobs_allocs++;
+  }
+  if (job->pgid == 0)
+    job->pgid = pid;
+  // The child does this too; whichever runs first wins the race with exec
+  if (jobs_interactive)
+    setpgid(pid, job->pgid);
+  job->procs[job->nprocs] = (JobProc){pid, PROC_RUNNING, 0};
+  jobs_pid_add(pid, job, job->nprocs);
+  job->nprocs++;
+  job->nlive++;
+}
+
+static void jobs_free(Job *job)
+{
+  for (size_t i = 0; i < job->nprocs; i++)
+  {
+    JobsPid *e = job->procs[i].state != PROC_DONE ? jobs_pid_find(job->procs[i].pid) : NULL;
+    if (e)
+      jobs_pid_remove(e);
+  }
+  if (jobs_nspare < JOBS_SPARE_MAX)
+  {
+    job->next_spare = jobs_spare;
+    jobs_spare = job;
+    jobs_nspare++;
+    return;
+  }
+  free(job->procs);
+  free(job->cmd);
+  free(job);
+}
+
+static int jobs_stopped(const Job *job)
+{
+  return job->nlive > 0 && job->nstopped == job->nlive;
+}
+
+static void jobs_set_changed(Job *job, int changed)
+{
+  if (job->changed != changed)
+    jobs_pending += changed ? 1 : -1;
+  job->changed = changed;
+}
+
+static void jobs_make_current(Job *job)
+{
+  if (jobs_current != job->id)
+  {
+    jobs_previous = jobs_current;
+    jobs_current = job->id;
+  }
+}
+
+static void jobs_insert(Job *job)
+{
+  if (job->id)
+    return;
+  job->id = jobs_max + 1;
+  if ((size_t)job->id >= jobs_cap)
+  {
+    size_t cap = jobs_cap ? jobs_cap * 2 : JOBS_INITIAL_CAPACITY;
+    jobs_table = jobs_xrealloc(jobs_table, cap * sizeof(Job *));
+    jobs_allocs++;
+    memset(jobs_table + jobs_cap, 0, (cap - jobs_cap) * sizeof(Job *));
+    jobs_cap = cap;
+  }
+  jobs_table[job->id] = job;
+  jobs_max = job->id;
+}
+
+static void jobs_remove(Job *job)
+{
+  if (job->id == 0)
+    return;
+  jobs_set_changed(job, 0);
+  jobs_table[job->id] = NULL;
+  while (jobs_max > 0 && jobs_table[jobs_max] == NULL)
+    jobs_max--;
+
+  if (jobs_current == job->id)
+  {
+    jobs_current = jobs_previous;
+    jobs_previous = 0;
+  }
+  else if (jobs_previous == job->id)
+    jobs_previous = 0;
+  if (jobs_previous == 0)
+  {
+    // Fall back to the newest other job
+    for (int id = jobs_max; id > 0; id--)
+    {
+      if (jobs_table[id] && id != jobs_current)
+      {
+        jobs_previous = id;
+        break;
+      }
+    }
+  }
+  if (jobs_current == 0)
+  {
+    jobs_current = jobs_previous;
+    jobs_previous = 0;
+  }
+  job->id = 0;
+}
+
+// Collect the status of every child that exited, stopped or continued
+static void jobs_reap(void)
+{
+  char buf[256];
+  while (read(jobs_wake[0], buf, sizeof(buf)) > 0)
+    ;
+
+  for (;;)
+  {
+    int status;
+    pid_t pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED);
+    if (pid < 0 && errno == EINTR)
+      continue;
+    if (pid <= 0)
+      break;
+
+    JobsPid *e = jobs_pid_find(pid);
+    if (e == NULL)
+      continue; // Not started as part of a job
+    Job *job = e->job;
+    JobProc *p = &job->procs[e->index];
+    if (WIFSTOPPED(status))
+    {
+      if (p->state == PROC_RUNNING)
+      {
+        p->state = PROC_STOPPED;
+        job->nstopped++;
+      }
+    }
+    else if (WIFCONTINUED(status))
+    {
+      if (p->state == PROC_STOPPED)
+      {
+        p->state = PROC_RUNNING;
+        job->nstopped--;
+      }
+    }
+    else
+    {
+      if (p->state == PROC_STOPPED)
+        job->nstopped--;
+      p->state = PROC_DONE;
+      p->status = status;
+      job->nlive--;
+      jobs_pid_remove(e);
+    }
+    if (job->id && (job->nlive == 0 || jobs_stopped(job)))
+      jobs_set_changed(job, 1);
+  }
+}
+
+// Block until a child changes state
+static void jobs_sleep(void)
+{
+  struct pollfd pfd = {jobs_wake[0], POLLIN, 0};
+  poll(&pfd, 1, -1);
+}
+
+static void jobs_signal(Job *job, int sig)
+{
+  if (jobs_interactive)
+  {
+    kill(-job->pgid, sig);
+    return;
+  }
+  for (size_t i = 0; i < job->nprocs; i++)
+  {
+    if (job->procs[i].state != PROC_DONE)
+      kill(job->procs[i].pid, sig);
+  }
+}
+
+// Send SIGCONT, counting the job as running from now on
+static void jobs_continue(Job *job)
+{
+  for (size_t i = 0; i < job->nprocs; i++)
+  {
+    if (job->procs[i].state == PROC_STOPPED)
+      job->procs[i].state = PROC_RUNNING;
+  }
+  job->nstopped = 0;
+  jobs_set_changed(job, 0);
+  jobs_signal(job, SIGCONT);
+}
+
+// Exit status of the job's last process, as the shell reports it
+static int jobs_status(const Job *job)
+{
+  if (job->nprocs == 0)
+    return 0;
+  int status = job->procs[job->nprocs - 1].status;
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return 0;
+}
+
+static void jobs_describe_state(const Job *job, char *buf, size_t size)
+{
+  if (job->nlive > 0)
+  {
+    snprintf(buf, size, "%s", jobs_stopped(job) ? "Stopped" : "Running");
+    return;
+  }
+  int status = job->procs[job->nprocs - 1].status;
+  if (WIFSIGNALED(status))
+    snprintf(buf, size, "%s", strsignal(WTERMSIG(status)));
+  else if (WEXITSTATUS(status) != 0)
+    snprintf(buf, size, "Exit %d", WEXITSTATUS(status));
+  else
+    snprintf(buf, size, "Done");
+}
+
+static void jobs_print(const Job *job, int pids)
+{
+  char state[64];
+  char mark = job->id == jobs_current ? '+' : job->id == jobs_previous ? '-' : ' ';
+  jobs_describe_state(job, state, sizeof(state));
+  if (pids)
+    printf("[%d]%c %d  %-24s%s%s\n", job->id, mark, (int)job->pgid, state, job->cmd,
+           job->nlive > 0 && !jobs_stopped(job) ? " &" : "");
+  else
+    printf("[%d]%c  %-24s%s%s\n", job->id, mark, state, job->cmd,
+           job->nlive > 0 && !jobs_stopped(job) ? " &" : "");
+}
+
+// Wait for job while it owns the terminal. With cont, it is resumed first.
+static int jobs_wait_foreground(Job *job, int cont)
+{
+  if (job->nprocs == 0)
+  {
+    jobs_free(job);
+    return 0;
+  }
+  if (jobs_interactive)
+  {
+    if (cont && job->has_tmodes)
+      tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+  }
+  if (cont)
+    jobs_continue(job);
+
+  for (;;)
+  {
+    jobs_reap();
+    if (job->nlive == 0 || jobs_stopped(job))
+      break;
+    jobs_sleep();
+  }
+
+  if (jobs_interactive)
+  {
+    tcsetpgrp(STDIN_FILENO, jobs_shell_pgid);
+    if (job->nlive > 0)
+      job->has_tmodes = tcgetattr(STDIN_FILENO, &job->tmodes) == 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &jobs_shell_tmodes);
+  }
+
+  if (job->nlive > 0)
+  {
+    // Stopped: it becomes the current job, reported right away
+    jobs_insert(job);
+    jobs_make_current(job);
+    jobs_set_changed(job, 0);
+    printf("\n");
+    jobs_print(job, 0);
+    fflush(stdout);
+    return 128 + SIGTSTP;
+  }
+  // Like other shells, say so when a signal killed it; after Ctrl+C the
+  // prompt just needs a line of its own
+  int last = job->procs[job->nprocs - 1].status;
+  if (WIFSIGNALED(last) && WTERMSIG(last) != SIGPIPE)
+  {
+    if (WTERMSIG(last) == SIGINT)
+      printf("\n");
+    else
+      printf("%s\n", strsignal(WTERMSIG(last)));
+    fflush(stdout);
+  }
+  int status = jobs_status(job);
+  jobs_remove(job);
+  jobs_free(job);
+  return status;
+}
+
+int jobs_foreground(Job *job)
+{
+  return jobs_wait_foreground(job, 0);
+}
+
+void jobs_background(Job *job)
+{
+  if (job->nprocs == 0)
+  {
+    jobs_free(job);
+    return;
+  }
+  jobs_insert(job);
+  jobs_make_current(job);
+  if (jobs_interactive)
+    printf("[%d] %d\n", job->id, (int)job->pgid);
+}
+
+void jobs_notify(void)
+{
+  jobs_reap();
+  if (jobs_pending == 0)
+    return;
+  for (int id = 1; id <= jobs_max; id++)
+  {
+    Job *job = jobs_table[id];
+    if (job == NULL || !job->changed)
+      continue;
+    if (jobs_interactive)
+      jobs_print(job, 0);
+    jobs_set_changed(job, 0);
+    if (job->nlive == 0)
+    {
+      jobs_remove(job);
+      jobs_free(job);
+    }
+  }
+  fflush(stdout);
+}
+
+void jobs_shutdown(void)
+{
+  for (int id = 1; id <= jobs_max; id++)
+  {
+    Job *job = jobs_table[id];
+    if (job && job->nstopped > 0)
+    {
+      jobs_signal(job, SIGHUP);
+      jobs_signal(job, SIGCONT);
+    }
+  }
+}
+
+// Resolve a job spec: %N or N, %+ or %% (current), %- (previous), or %name
+// for the job whose command starts with name. NULL means the current job.
+static Job *jobs_find(const char *spec)
+{
+  int id;
+  if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+    id = jobs_current;
+  else if (strcmp(spec, "%-") == 0)
+    id = jobs_previous;
+  else
+  {
+    const char *p = spec[0] == '%' ? spec + 1 : spec;
+    char *end;
+    long n = strtol(p, &end, 10);
+    if (*p == '\0' || *end != '\0')
+    {
+      if (spec[0] != '%')
+        return NULL;
+      size_t len = strlen(p);
+      for (id = jobs_max; id > 0; id--)
+      {
+        if (jobs_table[id] && strncmp(jobs_table[id]->cmd, p, len) == 0)
+          break;
+      }
+    }
+    else
+      id = n > 0 && n <= jobs_max ? (int)n : 0;
+  }
+  return id > 0 && id <= jobs_max ? jobs_table[id] : NULL;
+}
+
+static Job *jobs_find_or_complain(const char *who, const char *spec)
+{
+  Job *job = jobs_find(spec);
+  if (job == NULL)
+    fprintf(stderr, "lsh: %s: %s: no such job\n", who, spec ? spec : "current");
+  return job;
+}
+
+/**
+   @brief Builtin command: list jobs.
+   @param args List of args.  "-l" adds process group ids, "-p" prints only
+   those; any other arguments select jobs.
+   @return Always returns 1, to continue executing.
+ */
+int lsh_jobs(char **args)
+{
+  int pids = 0, only_pids = 0;
+  char **spec = args + 1;
+  for (; *spec && (*spec)[0] == '-' && (*spec)[1]; spec++)
+  {
+    if (strcmp(*spec, "-l") == 0)
+      pids = 1;
+    else if (strcmp(*spec, "-p") == 0)
+      only_pids = 1;
+    else
+    {
+      fprintf(stderr, "lsh: jobs: %s: invalid option\n", *spec);
+      fprintf(stderr, "usage: jobs [-l | -p] [job ...]\n");
+      return builtin_fail(1);
+    }
+  }
+
+  jobs_reap();
+  for (int id = 1; id <= jobs_max; id++)
+  {
+    Job *job = jobs_table[id];
+    if (job == NULL)
+      continue;
+    if (*spec)
+    {
+      int wanted = 0;
+      for (char **s = spec; *s && !wanted; s++)
+        wanted = jobs_find(*s) == job;
+      if (!wanted)
+        continue;
+    }
+    if (only_pids)
+      printf("%d\n", (int)job->pgid);
+    else
+      jobs_print(job, pids);
+    if (job->nlive == 0)
+    {
+      // Listed as done now, so not again at the next prompt
+      jobs_remove(job);
+      jobs_free(job);
+    }
+    else if (job->changed && !only_pids)
+      jobs_set_changed(job, 0);
+  }
+  for (; *spec; spec++)
+  {
+    if (jobs_find(*spec) == NULL)
+    {
+      fprintf(stderr, "lsh: jobs: %s: no such job\n", *spec);
+      builtin_fail(1);
+    }
+  }
+  return 1;
+}
+
+/**
+   @brief Builtin command: bring a job to the foreground.
+   @param args List of args.  args[1] is the job, the current one if absent.
+   @return Always returns 1, to continue executing.
+ */
+int lsh_fg(char **args)
+{
+  if (!jobs_interactive)
+  {
+    fprintf(stderr, "lsh: fg: no job control\n");
+    return builtin_fail(1);
+  }
+  jobs_reap();
+  Job *job = jobs_find_or_complain("fg", args[1]);
+  if (job == NULL)
+    return builtin_fail(1);
+  if (job->nlive == 0)
+  {
+    fprintf(stderr, "lsh: fg: job has terminated\n");
+    return builtin_fail(1);
+  }
+  printf("%s\n", job->cmd);
+  fflush(stdout);
+  builtin_status = jobs_wait_foreground(job, 1);
+  return 1;
+}
+
+/**
+   @brief Builtin command: resume stopped jobs in the background.
+   @param args List of args.  Jobs to resume, the current one if none.
+   @return Always returns 1, to continue executing.
+ */
+int lsh_bg(char **args)
+{
+  char *current[] = {NULL};
+  char **spec = args[1] ? args + 1 : current;
+
+  jobs_reap();
+  do
+  {
+    Job *job = jobs_find_or_complain("bg", *spec);
+    if (job == NULL)
+    {
+      builtin_fail(1);
+      continue;
+    }
+    if (!jobs_stopped(job))
+    {
+      fprintf(stderr, "lsh: bg: job %d already in background\n", job->id);
+      builtin_fail(1);
+      continue;
+    }
+    jobs_make_current(job);
+    jobs_continue(job);
+    printf("[%d]%c %s &\n", job->id, job->id == jobs_current ? '+' : ' ', job->cmd);
+  } while (*spec && *++spec);
+  return 1;
+}
+
+// Wait until a process of a job finishes or stops; returns its status
+static int jobs_wait_pid(const JobsPid *e)
+{
+  const Job *job = e->job;
+  const JobProc *p = &job->procs[e->index];
+  for (;;)
+  {
+    jobs_reap();
+    if (p->state != PROC_RUNNING)
+      break;
+    jobs_sleep();
+  }
+  if (p->state == PROC_STOPPED)
+    return 128 + SIGTSTP;
+  return WIFEXITED(p->status) ? WEXITSTATUS(p->status) : 128 + WTERMSIG(p->status);
+}
+
+static int jobs_wait_job(Job *job)
+{
+  for (;;)
+  {
+    jobs_reap();
+    if (job->nlive == 0 || jobs_stopped(job))
+      break;
+    jobs_sleep();
+  }
+  return job->nlive > 0 ? 128 + SIGTSTP : jobs_status(job);
+}
+
+/**
+   @brief Builtin command: wait for background jobs to finish.
+   @param args List of args.  Jobs (%N) or process ids to wait for; every
+   running job if none are given. The exit status is that of the last one
+   given, or 127 if it is not a child of the shell.
+   @return Always returns 1, to continue executing.
+ */
+int lsh_wait(char **args)
+{
+  if (args[1] == NULL)
+  {
+    for (;;)
+    {
+      int running = 0;
+      jobs_reap();
+      for (int id = 1; id <= jobs_max && !running; id++)
+        running = jobs_table[id] && jobs_table[id]->nlive > 0 && !jobs_stopped(jobs_table[id]);
+      if (!running)
+        break;
+      jobs_sleep();
+    }
+    return 1;
+  }
+
+  for (char **arg = args + 1; *arg; arg++)
+  {
+    if ((*arg)[0] == '%')
+    {
+      Job *job = jobs_find_or_complain("wait", *arg);
+      builtin_status = job ? jobs_wait_job(job) : 127;
+      continue;
+    }
+    char *end;
+    long pid = strtol(*arg, &end, 10);
+    if (**arg == '\0' || *end != '\0' || pid <= 0)
+    {
+      fprintf(stderr, "lsh: wait: %s: not a pid or valid job spec\n", *arg);
+      builtin_fail(2);
+      continue;
+    }
+    jobs_reap();
+    JobsPid *e = jobs_pid_find((pid_t)pid);
+    if (e == NULL)
+    {
+      fprintf(stderr, "lsh: wait: pid %ld is not a running child of this shell\n", pid);
+      builtin_fail(127);
+      continue;
+    }
+    builtin_status = jobs_wait_pid(e);
+  }
+  return 1;
+}
@@ -0,0 +1,50 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+
+// A pipeline started by the shell: one process group, one or more processes
+typedef struct Job Job;
+
+// Set up child reaping, and for an interactive shell take control of the
+// terminal so that jobs can be moved between foreground and background.
+void jobs_init(int interactive);
+
+// Whether jobs get process groups and the terminal (interactive shells only)
+int jobs_control(void);
+
+// Start describing a new job, shown as cmd by "jobs"
+Job *jobs_new(const char *cmd);
+
+// Heap allocations made for jobs so far. Jobs are recycled, so this stops
+// growing once the shell has run a few.
+size_t jobs_allocations(void);
+
+// Process group the next process of job should join: 0 (a new group led by
+// that process) for the first one, the job's group after that
+pid_t jobs_pgid(const Job *job);
+
+// Record a process started for job
+void jobs_add_process(Job *job, pid_t pid);
+
+// Wait for job in the foreground, giving it the terminal. A job that stops
+// (Ctrl+Z) moves to the job table; one that finishes is freed. Returns the
+// exit status of its last process.
+int jobs_foreground(Job *job);
+
+// Put job in the job table and leave it running
+void jobs_background(Job *job);
+
+// Reap children that have exited or stopped, and report background jobs that
+// finished or stopped since the last prompt. Call before showing a prompt.
+void jobs_notify(void);
+
+// Hang up stopped jobs as the shell exits, so they do not linger
+void jobs_shutdown(void);
+
+int lsh_jobs(char **args);
+int lsh_fg(char **args);
+int lsh_bg(char **args);
+int lsh_wait(char **args);
+
+#endif // JOBS_H
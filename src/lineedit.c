@@ -0,0 +1,827 @@
+// lineedit.c
+//
+// Terminal line input. The terminal is put in raw mode for the duration of
+// one read, so keys arrive as they are typed. Input is read in bulk and
+// everything already buffered is handled before the screen is updated, so a
+// fast typist or a paste costs one redraw rather than one per byte. Edits
+// only rewrite the line from the first changed byte onwards. Bracketed paste
+// is turned on while reading, so a paste of any size goes into the line in
+// one pass instead of being taken for keystrokes; each line of a paste runs
+// as a command of its own, as if typed. Ctrl+R switches to a reverse
+// search that re-ranks the history (see hsearch.c) on every keystroke. Tab
+// completes the word before the cursor (see complete.c), and a second Tab
+// lists what it could be. While waiting for a key the editor can watch one
+// more descriptor, so that something like a reminder is printed above the
+// prompt as soon as it is due.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "lineedit.h"
+#include "hist.h"
+#include "hsearch.h"
+#include "complete.h"
+
+#define LINEEDIT_INITIAL_CAPACITY 256
+#define LINEEDIT_INPUT_SIZE (64 * 1024)
+// How long to wait for the rest of an escape sequence before taking ESC as
+// a key of its own
+#define LINEEDIT_ESC_TIMEOUT_MS 50
+#define LINEEDIT_DEFAULT_COLUMNS 80
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+
+// Keys that arrive as escape sequences, numbered past any byte
+enum
+{
+  KEY_LEFT = 256,
+  KEY_RIGHT,
+  KEY_UP,
+  KEY_DOWN,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE,
+  KEY_PASTE_START,
+  KEY_PASTE_END,
+  KEY_UNKNOWN
+};
+
+#define PASTE_END_SEQ "\033[201~"
+
+typedef struct
+{
+  char *data;
+  size_t len, cap;
+} LineBuffer;
+
+typedef struct
+{
+  LineBuffer line;
+  size_t pos; // Cursor, as a byte offset into line
+  const char *prompt;
+  size_t prompt_cols; // Width of the prompt on screen
+  size_t cols; // Terminal width
+  size_t cursor; // Where the terminal cursor is, in cells from the prompt start
+} LineEditor;
+
+// Bytes read from the terminal but not handled yet. Whatever is left when a
+// line ends (typed ahead, or the rest of a paste) belongs to the next line.
+static unsigned char input[LINEEDIT_INPUT_SIZE];
+static size_t input_pos, input_len;
+
+// Screen updates, written out in one go before waiting for input
+static LineBuffer output;
+
+// Watched alongside the terminal, and what to call when it is readable
+static int wake_fd = -1;
+static void (*wake_fn)(void);
+// Called while waiting, as often as it asks for
+static long (*idle_fn)(void);
+
+// A bracketed paste with a line break in it goes on into the next line:
+// set from that break until its end marker. paste_cr is set when the break
+// was a '\r', which a '\n' may follow.
+static int paste_open, paste_cr;
+
+// The line being edited. Its buffer is handed back and reused by the next
+// call, so reading a line allocates nothing once it is big enough.
+static LineBuffer line_kept;
+
+static void line_reserve(LineBuffer *b, size_t extra)
+{
+  if (b->len + extra + 1 <= b->cap)
+    return;
+  size_t cap = b->cap ? b->cap : LINEEDIT_INITIAL_CAPACITY;
+  while (cap < b->len + extra + 1)
+    cap *= 2;
+  b->data = realloc(b->data, cap);
+  if (!b->data)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  b->cap = cap;
+}
+
+static void line_set(LineBuffer *b, const char *s, size_t len)
+{
+  b->len = 0;
+  line_reserve(b, len);
+  memcpy(b->data, s, len);
+  b->len = len;
+}
+
+static void line_append(LineBuffer *b, const char *s, size_t len)
+{
+  line_reserve(b, len);
+  memcpy(b->data + b->len, s, len);
+  b->len += len;
+}
+
+static void term_flush(void)
+{
+  const char *s = output.data;
+  size_t len = output.len;
+  while (len > 0)
+  {
+    ssize_t n = write(STDOUT_FILENO, s, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    s += n;
+    len -= n;
+  }
+  output.len = 0;
+}
+
+static void term_puts(const char *s)
+{
+  line_append(&output, s, strlen(s));
+}
+
+// Refill the input buffer once it is empty. With timeout_ms >= 0, give up
+// after that long. Returns 1 if there is input, 0 on timeout, -1 at end of
+// input.
+static int term_fill(int timeout_ms)
+{
+  if (input_pos < input_len)
+    return 1;
+  term_flush();
+  if (timeout_ms >= 0)
+  {
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    int rc;
+    while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+      ;
+    if (rc == 0)
+      return 0;
+  }
+  for (;;)
+  {
+    ssize_t n = read(STDIN_FILENO, input, sizeof(input));
+    if (n > 0)
+    {
+      input_pos = 0;
+      input_len = n;
+      return 1;
+    }
+    if (n == 0 || errno != EINTR)
+      return -1;
+  }
+}
+
+// Next byte, or -1 at end of input (or on timeout, with timeout_ms >= 0)
+static int term_read_byte(int timeout_ms)
+{
+  if (term_fill(timeout_ms) <= 0)
+    return -1;
+  return input[input_pos++];
+}
+
+// Decode the escape sequence after an ESC that has just been read
+static int term_read_escape(void)
+{
+  int c = term_read_byte(LINEEDIT_ESC_TIMEOUT_MS);
+  if (c == 'O')
+  {
+    // SS3: Home and End on some terminals
+    c = term_read_byte(LINEEDIT_ESC_TIMEOUT_MS);
+    return c == 'H' ? KEY_HOME : c == 'F' ? KEY_END : KEY_UNKNOWN;
+  }
+  if (c != '[')
+    return c < 0 ? KEY_ESC : KEY_UNKNOWN;
+
+  // CSI: numeric parameters, then a final byte
+  int param = 0;
+  do
+  {
+    c = term_read_byte(LINEEDIT_ESC_TIMEOUT_MS);
+    if (c >= '0' && c <= '9')
+      param = param * 10 + (c - '0');
+  } while (c >= 0 && !(c >= '@' && c <= '~'));
+
+  switch (c)
+  {
+  case 'A':
+    return KEY_UP;
+  case 'B':
+    return KEY_DOWN;
+  case 'C':
+    return KEY_RIGHT;
+  case 'D':
+    return KEY_LEFT;
+  case 'H':
+    return KEY_HOME;
+  case 'F':
+    return KEY_END;
+  case '~':
+    switch (param)
+    {
+    case 1:
+    case 7:
+      return KEY_HOME;
+    case 4:
+    case 8:
+      return KEY_END;
+    case 3:
+      return KEY_DELETE;
+    case 200:
+      return KEY_PASTE_START;
+    case 201:
+      return KEY_PASTE_END;
+    }
+  }
+  return KEY_UNKNOWN;
+}
+
+// Next key, or -1 at end of input
+static int term_read_key(void)
+{
+  int c = term_read_byte(-1);
+  return c == KEY_ESC ? term_read_escape() : c;
+}
+
+static int is_continuation(unsigned char c)
+{
+  return (c & 0xc0) == 0x80;
+}
+
+// Cells taken by s on screen: one per character, none for escape sequences
+static size_t display_width(const char *s, size_t len)
+{
+  size_t w = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (s[i] == '\033' && i + 1 < len && s[i + 1] == '[')
+    {
+      i += 2;
+      while (i < len && !(s[i] >= '@' && s[i] <= '~'))
+        i++;
+    }
+    else if (!is_continuation((unsigned char)s[i]))
+      w++;
+  }
+  return w;
+}
+
+static size_t term_columns(void)
+{
+  struct winsize ws;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+    return ws.ws_col;
+  return LINEEDIT_DEFAULT_COLUMNS;
+}
+
+// Cell of line byte offset i
+static size_t ed_column(const LineEditor *ed, size_t i)
+{
+  return ed->prompt_cols + display_width(ed->line.data, i);
+}
+
+// Move the terminal cursor to cell col, which must already be on screen
+static void ed_move_to(LineEditor *ed, size_t col)
+{
+  char seq[32];
+  size_t from_row = ed->cursor / ed->cols, to_row = col / ed->cols;
+  if (to_row < from_row)
+  {
+    snprintf(seq, sizeof(seq), "\033[%zuA", from_row - to_row);
+    term_puts(seq);
+  }
+  else if (to_row > from_row)
+  {
+    snprintf(seq, sizeof(seq), "\033[%zuB", to_row - from_row);
+    term_puts(seq);
+  }
+  term_puts("\r");
+  if (col % ed->cols > 0)
+  {
+    snprintf(seq, sizeof(seq), "\033[%zuC", col % ed->cols);
+    term_puts(seq);
+  }
+  ed->cursor = col;
+}
+
+// Write s at the cursor and advance it
+static void ed_emit(LineEditor *ed, const char *s, size_t len)
+{
+  size_t w = display_width(s, len);
+  line_append(&output, s, len);
+  ed->cursor += w;
+  // A terminal holds the cursor in the last column after filling a row;
+  // start the next row so that the cursor is where we think it is
+  if (w > 0 && ed->cursor % ed->cols == 0)
+    term_puts("\r\n");
+}
+
+// Rewrite the line from byte offset from to the end, then put the cursor back
+static void ed_refresh_from(LineEditor *ed, size_t from)
+{
+  ed_move_to(ed, ed_column(ed, from));
+  ed_emit(ed, ed->line.data + from, ed->line.len - from);
+  term_puts("\033[J");
+  ed_move_to(ed, ed_column(ed, ed->pos));
+}
+
+// Redraw the prompt and the whole line
+static void ed_refresh(LineEditor *ed)
+{
+  ed_move_to(ed, 0);
+  ed->cols = term_columns();
+  ed->cursor = 0;
+  ed_emit(ed, ed->prompt, strlen(ed->prompt));
+  ed_refresh_from(ed, 0);
+}
+
+static void ed_insert(LineEditor *ed, const char *s, size_t len)
+{
+  line_reserve(&ed->line, len);
+  memmove(ed->line.data + ed->pos + len, ed->line.data + ed->pos, ed->line.len - ed->pos);
+  memcpy(ed->line.data + ed->pos, s, len);
+  ed->line.len += len;
+  ed->pos += len;
+}
+
+static void ed_delete(LineEditor *ed, size_t from, size_t to)
+{
+  memmove(ed->line.data + from, ed->line.data + to, ed->line.len - to);
+  ed->line.len -= to - from;
+  if (ed->pos >= to)
+    ed->pos -= to - from;
+  else if (ed->pos > from)
+    ed->pos = from;
+}
+
+static size_t ed_prev_char(const LineEditor *ed, size_t i)
+{
+  while (i > 0 && is_continuation((unsigned char)ed->line.data[--i]))
+    ;
+  return i;
+}
+
+static size_t ed_next_char(const LineEditor *ed, size_t i)
+{
+  if (i < ed->line.len)
+    i++;
+  while (i < ed->line.len && is_continuation((unsigned char)ed->line.data[i]))
+    i++;
+  return i;
+}
+
+// Insert text that was typed or pasted. Line breaks never get here (they end
+// the line); tabs and other control characters go in as spaces.
+static void ed_insert_text(LineEditor *ed, const unsigned char *s, size_t len)
+{
+  ed_insert(ed, (const char *)s, len);
+  for (size_t i = ed->pos - len; i < ed->pos; i++)
+  {
+    if ((unsigned char)ed->line.data[i] < ' ' || ed->line.data[i] == KEY_BACKSPACE)
+      ed->line.data[i] = ' ';
+  }
+}
+
+// Take a bracketed paste up to its end marker or its next line break.
+// Everything in the input buffer up to either goes into the line in one
+// piece, however big the paste is. A line break ends the line, as Enter
+// would, and the rest of the paste is taken by the next call, as the lines
+// that follow: pasting several commands runs them one after another.
+// Returns 0 at the end marker, 1 at a line break, -1 at end of input.
+static int ed_paste(LineEditor *ed)
+{
+  const size_t end_len = strlen(PASTE_END_SEQ);
+  paste_open = 1;
+  for (;;)
+  {
+    if (term_fill(-1) < 0)
+      return -1;
+    unsigned char *start = input + input_pos;
+    size_t avail = input_len - input_pos, n = 0;
+    if (paste_cr && start[0] == '\n')
+    {
+      // The rest of a "\r\n" line break
+      paste_cr = 0;
+      input_pos++;
+      continue;
+    }
+    paste_cr = 0;
+    while (n < avail && start[n] != KEY_ESC && start[n] != '\n' && start[n] != '\r')
+      n++;
+    ed_insert_text(ed, start, n);
+    input_pos += n;
+    if (n == avail)
+      continue;
+    if (start[n] != KEY_ESC)
+    {
+      paste_cr = start[n] == '\r';
+      input_pos++;
+      return 1;
+    }
+
+    // Is this the end marker? It may be split across reads.
+    size_t matched = 0;
+    while (matched < end_len)
+    {
+      int c = term_read_byte(-1);
+      if (c < 0)
+        return -1;
+      if (c != (unsigned char)PASTE_END_SEQ[matched])
+      {
+        // Not the marker: keep what was taken as text, and look at c again
+        ed_insert_text(ed, (const unsigned char *)PASTE_END_SEQ, matched);
+        input_pos--;
+        break;
+      }
+      matched++;
+    }
+    if (matched == end_len)
+    {
+      paste_open = 0;
+      return 0;
+    }
+  }
+}
+
+// Draw the search prompt in place of the line
+static void redraw_search(LineEditor *ed, const LineBuffer *query, const HistSearchResult *hit)
+{
+  const char *label = hit ? "(reverse-i-search)`" : "(failed reverse-i-search)`";
+  ed_move_to(ed, 0);
+  ed_emit(ed, label, strlen(label));
+  ed_emit(ed, query->data, query->len);
+  ed_emit(ed, "': ", 3);
+  if (hit)
+    ed_emit(ed, hit->cmd, hit->len);
+  term_puts("\033[J");
+}
+
+// Reverse search. Returns 1 if the line should be run as is, 0 to go back to
+// editing it, and -1 at end of input. The editor holds the result either way.
+static int reverse_search(LineEditor *ed, const char *cwd)
+{
+  HistSearch *hs = hist_search_index();
+  HistSearchResult results[HSEARCH_MAX_RESULTS];
+  LineBuffer query = {NULL, 0, 0};
+  size_t nresults = 0, sel = 0;
+  int rc = 0;
+
+  line_reserve(&query, 0);
+  redraw_search(ed, &query, NULL);
+  for (;;)
+  {
+    int c = term_read_key();
+    int requery = 0;
+
+    if (c < 0)
+    {
+      rc = -1;
+      break;
+    }
+    else if (c == KEY_CTRL('R'))
+    {
+      if (nresults > 0)
+        sel = (sel + 1) % nresults; // Next best match
+    }
+    else if (c == KEY_BACKSPACE || c == KEY_CTRL('H'))
+    {
+      if (query.len > 0)
+      {
+        query.len--;
+        requery = 1;
+      }
+    }
+    else if (c == '\r' || c == '\n')
+    {
+      if (nresults > 0)
+        line_set(&ed->line, results[sel].cmd, results[sel].len);
+      rc = 1;
+      break;
+    }
+    else if (c == KEY_CTRL('G') || c == KEY_CTRL('C'))
+    {
+      break; // Cancel: back to the line as it was
+    }
+    else if (c < ' ' || c > 0xff)
+    {
+      // Any other key accepts the match for editing
+      if (nresults > 0)
+        line_set(&ed->line, results[sel].cmd, results[sel].len);
+      break;
+    }
+    else
+    {
+      char ch = (char)c;
+      line_append(&query, &ch, 1);
+      requery = 1;
+    }
+
+    // Keep typing cheap: only search again once the keys typed so far are
+    // all handled
+    if (requery && input_pos < input_len)
+      continue;
+    if (requery)
+    {
+      nresults = hs ? hsearch_query(hs, query.data, query.len, cwd, results, HSEARCH_MAX_RESULTS) : 0;
+      sel = 0;
+    }
+    redraw_search(ed, &query, nresults > 0 ? &results[sel] : NULL);
+  }
+  free(query.data);
+  ed->pos = ed->line.len;
+  return rc;
+}
+
+// List the candidates of the last completion in columns below the line,
+// then draw the line again under them
+static void list_candidates(LineEditor *ed, size_t count)
+{
+  size_t shown = count < COMPLETE_MAX_SHOWN ? count : COMPLETE_MAX_SHOWN;
+  size_t width = 0;
+  int is_dir;
+
+  for (size_t i = 0; i < shown; i++)
+  {
+    const char *name = complete_candidate(i, &is_dir);
+    size_t w = display_width(name, strlen(name)) + is_dir;
+    if (w > width)
+      width = w;
+  }
+  width += 2;
+  size_t per_row = ed->cols / width ? ed->cols / width : 1;
+  size_t rows = (shown + per_row - 1) / per_row;
+
+  ed_move_to(ed, ed_column(ed, ed->line.len));
+  term_puts("\r\n");
+  // Down the columns, as ls does
+  for (size_t r = 0; r < rows; r++)
+  {
+    for (size_t col = 0; col < per_row; col++)
+    {
+      size_t i = col * rows + r;
+      if (i >= shown)
+        break;
+      const char *name = complete_candidate(i, &is_dir);
+      size_t w = display_width(name, strlen(name)) + is_dir;
+      term_puts(name);
+      if (is_dir)
+        term_puts("/");
+      if (i + rows < shown)
+      {
+        for (; w < width; w++)
+          term_puts(" ");
+      }
+    }
+    term_puts("\r\n");
+  }
+  if (count > shown)
+  {
+    char more[64];
+    snprintf(more, sizeof(more), "(%zu more)\r\n", count - shown);
+    term_puts(more);
+  }
+  ed->cursor = 0;
+  ed_refresh(ed);
+}
+
+void lineedit_set_wakeup(int fd, void (*fn)(void))
+{
+  wake_fd = fn ? fd : -1;
+  wake_fn = fn;
+}
+
+void lineedit_set_idle(long (*fn)(void))
+{
+  idle_fn = fn;
+}
+
+// Next key, or -1 at end of input. While no input is buffered, the wakeup
+// descriptor is watched too: when it fires, the line is cleared away for
+// whatever the wakeup function prints, then drawn again under it. The idle
+// function runs whenever the time it asked for is up.
+static int ed_read_key(LineEditor *ed)
+{
+  while ((wake_fd >= 0 || idle_fn) && input_pos == input_len)
+  {
+    struct pollfd pfd[2] = {{STDIN_FILENO, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    long timeout = idle_fn ? idle_fn() : -1;
+    term_flush();
+    int rc = poll(pfd, 2, timeout > INT_MAX ? INT_MAX : (int)timeout);
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (rc == 0)
+      continue; // Time for the idle function
+    if (pfd[0].revents != 0)
+      break; // Input, or end of it: term_read_key finds out which
+    if (!(pfd[1].revents & POLLIN))
+    {
+      wake_fd = -1; // Closed under us; stop watching it
+      break;
+    }
+    ed_move_to(ed, 0);
+    term_puts("\033[J");
+    term_flush();
+    wake_fn();
+    fflush(stdout);
+    ed->cursor = 0;
+    ed_refresh(ed);
+  }
+  return term_read_key();
+}
+
+char *lineedit_read(const char *prompt, const char *cwd)
+{
+  struct termios saved, raw;
+  LineEditor ed;
+  int eof = 0, last_tab = 0;
+
+  if (tcgetattr(STDIN_FILENO, &saved) != 0)
+    return NULL;
+  raw = saved;
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  raw.c_iflag &= ~(IXON | ICRNL);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  // TCSADRAIN, not TCSAFLUSH: keep whatever was typed ahead
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+  memset(&ed, 0, sizeof(ed));
+  ed.line = line_kept;
+  ed.line.len = 0;
+  line_reserve(&ed.line, 0);
+  ed.prompt = prompt;
+  ed.prompt_cols = display_width(prompt, strlen(prompt));
+  ed.cols = term_columns();
+
+  fflush(stdout);
+  term_puts("\033[?2004h"); // Bracketed paste on
+  term_puts("\r");
+  ed_refresh(&ed);
+  for (;;)
+  {
+    // The rest of a paste that ended the previous line comes first
+    int c = paste_open ? KEY_PASTE_START : ed_read_key(&ed);
+    size_t changed = ed.line.len + 1; // First byte to rewrite, if any
+    int tab = 0;
+
+    if (c < 0 || (c == KEY_CTRL('D') && ed.line.len == 0))
+    {
+      eof = 1;
+      break;
+    }
+    if (c == '\r' || c == '\n')
+      break;
+
+    if (c == KEY_CTRL('R'))
+    {
+      int rc = reverse_search(&ed, cwd);
+      if (rc < 0)
+      {
+        eof = 1;
+        break;
+      }
+      ed_refresh(&ed);
+      if (rc == 1)
+        break;
+    }
+    else if (c == '\t')
+    {
+      Completion comp;
+      tab = 1;
+      if (complete_line(ed.line.data, ed.line.len, ed.pos, cwd, &comp) == 0)
+        term_puts("\a");
+      else if (strlen(comp.text) != comp.end - comp.start ||
+               memcmp(comp.text, ed.line.data + comp.start, comp.end - comp.start) != 0)
+      {
+        // Completed further: the word is replaced by its escaped form
+        changed = comp.start;
+        ed_delete(&ed, comp.start, comp.end);
+        ed_insert(&ed, comp.text, strlen(comp.text));
+      }
+      else if (last_tab)
+        list_candidates(&ed, comp.count);
+      else
+        term_puts("\a");
+    }
+    else if (c == KEY_PASTE_START)
+    {
+      changed = ed.pos;
+      int rc = ed_paste(&ed);
+      if (rc < 0)
+      {
+        eof = 1;
+        break;
+      }
+      if (rc == 1)
+      {
+        // A line break in the paste: show the line, then run it
+        ed_refresh_from(&ed, changed);
+        break;
+      }
+    }
+    else if (c == KEY_BACKSPACE || c == KEY_CTRL('H'))
+    {
+      if (ed.pos > 0)
+      {
+        changed = ed_prev_char(&ed, ed.pos);
+        ed_delete(&ed, changed, ed.pos);
+      }
+    }
+    else if (c == KEY_DELETE || c == KEY_CTRL('D'))
+    {
+      if (ed.pos < ed.line.len)
+      {
+        changed = ed.pos;
+        ed_delete(&ed, ed.pos, ed_next_char(&ed, ed.pos));
+      }
+    }
+    else if (c == KEY_LEFT || c == KEY_CTRL('B'))
+      ed.pos = ed_prev_char(&ed, ed.pos);
+    else if (c == KEY_RIGHT || c == KEY_CTRL('F'))
+      ed.pos = ed_next_char(&ed, ed.pos);
+    else if (c == KEY_HOME || c == KEY_CTRL('A'))
+      ed.pos = 0;
+    else if (c == KEY_END || c == KEY_CTRL('E'))
+      ed.pos = ed.line.len;
+    else if (c == KEY_CTRL('K'))
+    {
+      changed = ed.pos;
+      ed.line.len = ed.pos;
+    }
+    else if (c == KEY_CTRL('U'))
+    {
+      changed = 0;
+      ed_delete(&ed, 0, ed.pos);
+    }
+    else if (c == KEY_CTRL('W'))
+    {
+      // Delete the word before the cursor, and the spaces after it
+      size_t i = ed.pos;
+      while (i > 0 && ed.line.data[i - 1] == ' ')
+        i--;
+      while (i > 0 && ed.line.data[i - 1] != ' ')
+        i--;
+      changed = i;
+      ed_delete(&ed, i, ed.pos);
+    }
+    else if (c == KEY_CTRL('L'))
+    {
+      term_puts("\033[H\033[2J");
+      ed.cursor = 0;
+      ed_refresh(&ed);
+    }
+    else if (c == KEY_CTRL('C'))
+    {
+      // Abandon the line, like an interactive shell does
+      ed.pos = ed.line.len;
+      ed_move_to(&ed, ed_column(&ed, ed.pos));
+      term_puts("^C");
+      ed.line.len = 0;
+      break;
+    }
+    else if (c >= ' ' && c <= 0xff && c != KEY_BACKSPACE)
+    {
+      // Take every printable byte already read along with this one
+      size_t n = 0;
+      while (input_pos + n < input_len && input[input_pos + n] >= ' ' && input[input_pos + n] != KEY_BACKSPACE)
+        n++;
+      unsigned char ch = (unsigned char)c;
+      changed = ed.pos;
+      ed_insert_text(&ed, &ch, 1);
+      ed_insert_text(&ed, input + input_pos, n);
+      input_pos += n;
+    }
+
+    last_tab = tab;
+    if (changed <= ed.line.len)
+      ed_refresh_from(&ed, changed);
+    else
+      ed_move_to(&ed, ed_column(&ed, ed.pos));
+  }
+
+  ed.pos = ed.line.len;
+  ed_move_to(&ed, ed_column(&ed, ed.pos));
+  term_puts("\033[?2004l"); // Bracketed paste off
+  if (ed.cursor % ed.cols != 0)
+    term_puts("\r\n"); // Otherwise ed_emit already started a new row
+  term_flush();
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+  line_kept = ed.line;
+  if (eof && ed.line.len == 0)
+    return NULL;
+  ed.line.data[ed.line.len] = '\0';
+  return ed.line.data;
+}
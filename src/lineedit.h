@@ -0,0 +1,25 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+// Read one line from the terminal in raw mode, after printing prompt.
+// Supports cursor movement (arrows, Home/End, Ctrl+A/E/B/F), Delete,
+// Ctrl+K/U/W, Ctrl+L and bracketed paste. Ctrl+R starts a fuzzy reverse
+// search of the history, ranked for cwd. Tab completes commands and paths,
+// relative to cwd; twice, it lists the candidates.
+// Returns the line without its newline, or NULL at end of input. The line
+// is the editor's own buffer: it may be modified, and stays valid until the
+// next call.
+char *lineedit_read(const char *prompt, const char *cwd);
+
+// While lineedit_read waits for a key, also watch fd (-1 for none): once it
+// is readable, the line is taken off the screen, fn is called to print what
+// it has to, and the prompt and line are drawn again below. fn must leave fd
+// unreadable.
+void lineedit_set_wakeup(int fd, void (*fn)(void));
+
+// While lineedit_read waits for a key, call fn, then again after as many
+// milliseconds as it returns (-1: not before the next key). fn must not
+// print anything.
+void lineedit_set_idle(long (*fn)(void));
+
+#endif // LINEEDIT_H
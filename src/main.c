@@ -4,116 +4,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
 #include "scf.h" // Include header
 #include "utils.h"
-
-/*
-  Function Declarations for builtin shell commands:
- */
-int lsh_cd(char **args);
-int lsh_help(char **args);
-int lsh_exit(char **args);
-int lsh_history(char **args);
-
-/*
-  List of builtin commands, followed by their corresponding functions.
- */
-// Add these new commands to the list of built-ins
-char *builtin_str[] = {
-    "cd",
-    "help",
-    "exit",
-    "history",
-    "remind",
-    "search",
-    "run",
-    "learn",
-    "ssh",
-    "define",
-    "preview",
-    "compress",
-    "env"};
-
-int (*builtin_func[])(char **) = {
-    &lsh_cd,
-    &lsh_help,
-    &lsh_exit,
-    &lsh_history,
-    &lsh_set_reminder, // For "remind"
-    &lsh_search,       // For "search"
-    &lsh_run_code,     // For "run"
-    &lsh_learn,        // For "learn"
-    &lsh_ssh,
-    &lsh_define,
-    &lsh_preview,
-    &lsh_compress,
-    &lsh_env};
-
-int lsh_num_builtins()
-{
-  return sizeof(builtin_str) / sizeof(char *);
-}
+#include "hist.h"
+#include "lineedit.h"
+#include "cmdhash.h"
+#include "pipeline.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "script.h"
+#include "scache.h"
+#include "builtins.h"
+#include "alias.h"
+#include "suggest.h"
+#include "remind.h"
+#include "swatch.h"
+#include "status.h"
+#include "allocstats.h"
 
 /*
   Builtin function implementations.
 */
 
-/**
-   @brief Builtin command: display history of all commands used.
-   @param args List of args.  Not examined.
-   @return Always returns 1, to continue executing.
- */
-int lsh_history(char **args)
-{
-  FILE *fp;
-  char *line = NULL;
-  size_t len = 0;
-
-  // If an argument is provided
-  if (args[1] != NULL)
-  {
-    // Check if the argument is "-c" (case-insensitive)
-    if (strcasecmp(args[1], "-c") == 0)
-    {
-      // Attempt to remove the history file
-      if (remove("history.txt") != 0)
-      {
-        perror("Error clearing history");
-      }
-      else
-      {
-        printf("History cleared successfully.\n");
-      }
-      return 1;
-    }
-    else
-    {
-      fprintf(stderr, "Invalid option: %s\n", args[1]);
-      fprintf(stderr, "Usage: history [-c]\n");
-      return 1;
-    }
-  }
-
-  // Default behavior: display history
-  printf("History of commands used:\n");
-  fp = fopen("history.txt", "r");
-  if (fp == NULL)
-  {
-    fprintf(stderr, "No history found.\n");
-    return 1;
-  }
-
-  while (getline(&line, &len, fp) != -1)
-  {
-    printf("%s", line);
-  }
-
-  fclose(fp);
-  if (line)
-    free(line);
-  return 1;
-}
-
 /**
    @brief Bultin command: change directory.
    @param args List of args.  args[0] is "cd".  args[1] is the directory.
@@ -124,6 +38,7 @@ int lsh_cd(char **args)
   if (args[1] == NULL)
   {
     fprintf(stderr, "lsh: expected argument to \"cd\"\n");
+    builtin_fail(1);
   }
   else
   {
@@ -132,6 +47,7 @@ int lsh_cd(char **args)
     if (chdir(args[1]) != 0) // system call to change directory
     {
       perror("lsh");
+      builtin_fail(1);
     }
   }
   return 1;
@@ -146,175 +62,77 @@ int lsh_cd(char **args)
 
 int lsh_help(char **args)
 {
+  const Builtin *b = args[1] ? builtin_find(args[1]) : NULL;
+
   // If no argument is passed, print the general help message
   if (args[1] == NULL)
   {
     printf(BOLD GREEN "Kritarth Dande's LSH - A Custom Shell\n" RESET);
     printf(BLUE "Welcome to the interactive shell! Here are some helpful details about each command:\n" RESET);
     printf("You can type program names and arguments, and hit enter to execute them.\n");
+    printf("Commands can be chained with '|' and redirected with '<', '>', '>>' and '2>&1'.\n");
+    printf("End a command with '&' to run it in the background; see 'jobs', 'fg', 'bg' and 'wait'.\n");
+    printf("Quote arguments with spaces: 'as is' or \"with $VARIABLES\"; $? is the last exit status.\n");
+    printf("Lines starting with '#' are comments. 'my_shell <script>' and 'my_shell -c <commands>' run\n");
+    printf("commands without prompts, as does piping them in; the exit status is the last command's.\n");
     printf("The following are built-in commands available to you:\n\n");
 
     // List of all built-ins with color
-    for (int i = 0; i < sizeof(builtin_str) / sizeof(builtin_str[0]); i++)
+    size_t count;
+    const Builtin *list = builtin_list(&count);
+    for (size_t i = 0; i < count; i++)
     {
-      printf("  " CYAN "%s" RESET "\n", builtin_str[i]);
+      printf("  " CYAN "%-10s" RESET " %s\n", list[i].name, list[i].summary);
     }
-
     printf("\nFor more information about external programs, use the 'man' command.\n");
     printf(YELLOW "Example: " RESET "man ls\n");
   }
-  // If the user enters "help cd", provide specific help for the "cd" command
-  else if (strcmp(args[1], "cd") == 0)
+  // "help cd" and the like: the builtin's own help
+  else if (b != NULL)
   {
-    printf(BOLD CYAN "cd:\n" RESET);
-    printf("    " BLUE "Changes the current working directory.\n" RESET);
-    printf("    Usage: cd <path>\n");
-    printf("    Example: " YELLOW "cd /home/user/projects\n" RESET);
-    printf("    This command will change the current directory to the specified path.\n\n");
-  }
-  // If the user enters "help help", provide specific help for the "help" command
-  else if (strcmp(args[1], "help") == 0)
-  {
-    printf(BOLD CYAN "help:\n" RESET);
-    printf("    " BLUE "Displays information about shell built-in commands and other external commands.\n" RESET);
-    printf("    Usage: help [command]\n");
-    printf("    Example: " YELLOW "help ls\n" RESET);
-    printf("    If no command is specified, a list of all built-in commands will be shown.\n\n");
-  }
-  // If the user enters "help exit", provide specific help for the "exit" command
-  else if (strcmp(args[1], "exit") == 0)
-  {
-    printf(BOLD CYAN "exit:\n" RESET);
-    printf("    " BLUE "Exits the shell program.\n" RESET);
-    printf("    Usage: exit\n");
-    printf("    Example: " YELLOW "exit\n" RESET);
-    printf("    This command will terminate the shell session.\n\n");
-  }
-  // If the user enters "help history", provide specific help for the "history" command
-  else if (strcmp(args[1], "history") == 0)
-  {
-    printf(BOLD CYAN "history:\n" RESET);
-    printf("    " BLUE "Displays the history of previously executed commands.\n" RESET);
-    printf("    Usage: history\n");
-    printf("    Example: " YELLOW "history\n" RESET);
-    printf("    This command will show the list of commands you have previously entered.\n\n");
-  }
-  // If the user enters "help remind", provide specific help for the "remind" command
-  else if (strcmp(args[1], "remind") == 0)
-  {
-    printf(BOLD CYAN "remind:\n" RESET);
-    printf("    " BLUE "Sets a reminder for a specific task or event.\n" RESET);
-    printf("    Usage: remind <task> <YYYY-MM-DD HH:MM:SS>\n");
-    printf("    Example: " YELLOW "remind 'Meeting with Bob' 2025-01-10 14:30:00\n" RESET);
-    printf("    This command will set a reminder for the given task at the specified time.\n\n");
-  }
-  // If the user enters "help search", provide specific help for the "search" command
-  else if (strcmp(args[1], "search") == 0)
-  {
-    printf(BOLD CYAN "search:\n" RESET);
-    printf("    " BLUE "Searches for a given query in all files within a specified directory.\n" RESET);
-    printf("    Usage: search <query> <dir>\n");
-    printf("    Example: " YELLOW "search 'function' /home/user/code\n" RESET);
-    printf("    This command will recursively search through the directory and list lines in files\n");
-    printf("    that match the given query string.\n\n");
-  }
-  // If the user enters "help run", provide specific help for the "run" command
-  else if (strcmp(args[1], "run") == 0)
-  {
-    printf(BOLD CYAN "run:\n" RESET);
-    printf("    " BLUE "Executes a code file (.c or .py) in the shell.\n" RESET);
-    printf("    Usage: run <filename>\n");
-    printf("    Example: " YELLOW "run script.py\n" RESET);
-    printf("    This command compiles and runs a C program or executes a Python script.\n\n");
-  }
-  // If the user enters "help learn", provide specific help for the "learn" command
-  else if (strcmp(args[1], "learn") == 0)
-  {
-    printf(BOLD CYAN "learn:\n" RESET);
-    printf("    " BLUE "Provides a tutorial or description for built-in commands like 'ls', 'cd', etc.\n" RESET);
-    printf("    Usage: help learn <command>\n");
-    printf("    Example: " YELLOW "help learn ls\n" RESET);
-    printf("    This will provide a tutorial for the specified command.\n\n");
-  }
-  else if (strcmp(args[1], "ssh") == 0)
-  {
-    printf(BOLD CYAN "ssh:\n" RESET);
-    printf("    " BLUE "The ssh command allows you to securely connect to remote machines over the network.\n" RESET);
-    printf("    Usage: ssh <hostname> [options]\n");
-    printf("    Example: " YELLOW "ssh user@hostname\n" RESET);
-    printf("    This command will initiate an SSH connection to the specified remote host.\n");
-    printf("    You can also provide a custom name for SSH connections and store passwords with '-s'.\n\n");
-
-    printf(BOLD CYAN "Options:\n" RESET);
-    printf("    -s    " BLUE "Store the SSH connection with a custom name and password.\n" RESET);
-    printf("          Usage: ssh <hostname> -s\n");
-    printf("          Example: " YELLOW "ssh user@hostname -s\n" RESET);
-    printf("          This option saves the SSH connection details for later use.\n\n");
-
-    printf("    " BOLD CYAN "Managing Saved Connections:\n" RESET);
-    printf("    " BLUE "When using ssh without any options, you'll be presented with a list of saved connections.\n" RESET);
-    printf("    You can choose to connect to any saved connection or create a new one.\n");
-    printf("    Use the connection name to quickly connect to a saved host without needing to type the full hostname.\n\n\n");
-  }
-  else if (strcmp(args[1], "define") == 0)
-  {
-    printf(BOLD CYAN "define:\n" RESET);
-    printf("    " BLUE "Stores and retrieves custom definitions for programming terms or concepts.\n" RESET);
-    printf("    Usage:\n");
-    printf("        " YELLOW "define <term> <definition>\n" RESET);
-    printf("            " GREEN "Stores a definition for the specified term.\n" RESET);
-    printf("        " YELLOW "define all\n" RESET);
-    printf("            " GREEN "Displays all stored definitions.\n" RESET);
-    printf("        " YELLOW "define <term>\n" RESET);
-    printf("            " GREEN "Retrieves the definition for the specified term.\n" RESET);
-    printf("    Example:\n");
-    printf("        " YELLOW "define variable A container for storing data in a program.\n" RESET);
-    printf("        " YELLOW "define all\n" RESET);
-    printf("        " YELLOW "define variable\n" RESET);
-    printf("    " BLUE "Definitions are stored in a hidden file and can be accessed at any time.\n\n" RESET);
-  }
-  else if (strcmp(args[1], "preview") == 0)
-  {
-    printf(BOLD CYAN "preview:\n" RESET);
-    printf("    " BLUE "Displays the first few lines of a file for a quick preview.\n" RESET);
-    printf("    Usage: preview <file> [-n <lines>]\n");
-    printf("    Example: " YELLOW "preview example.txt -n 5\n" RESET);
-    printf("    This will show the first 5 lines of 'example.txt'.\n\n");
-  }
-  else if (strcmp(args[1], "env") == 0)
-  {
-    printf(BOLD CYAN "env:\n" RESET);
-    printf("    " BLUE "Manages and displays environment variables.\n" RESET);
-    printf("    Usage: env [options]\n");
-    printf("    Options:\n");
-    printf("      " YELLOW "search <VAR_NAME>" RESET " : Search for a specific environment variable\n");
-    printf("      " YELLOW "set <VAR_NAME> <VALUE>" RESET " : Set a new environment variable\n");
-    printf("      " YELLOW "unset <VAR_NAME>" RESET " : Remove an environment variable\n");
-    printf("      " YELLOW "list" RESET " : List all environment variables\n");
-    printf("    Example: " YELLOW "env search PATH\n" RESET);
-    printf("    This will search for the environment variable 'PATH'.\n");
-    printf("    Example: " YELLOW "env set MY_VAR my_value\n" RESET);
-    printf("    This will set a new environment variable 'MY_VAR' with the value 'my_value'.\n");
-    printf("    Example: " YELLOW "env unset MY_VAR\n" RESET);
-    printf("    This will remove the environment variable 'MY_VAR'.\n");
-    printf("\n");
+    builtin_print_help(b);
   }
   // If the user enters "help <other command>", print a default message for unknown commands
   else
   {
     printf("No specific help available for '%s'. Use 'help' for a general list of commands.\n", args[1]);
+    builtin_fail(1);
   }
 
   return 1;
 }
 
+// Exit status of the last command, which is also the shell's own
+static int lsh_status;
+
+// Memory for the command being run: its words, pipeline and expansions.
+// Reset before the next command, so a running shell does not allocate.
+static Arena lsh_arena;
+
+// Set to print allocation counts when the shell exits. Only the stats build
+// (see allocstats.h) counts every heap allocation, libc's included.
+#define LSH_ALLOC_STATS_ENV "PSS_ALLOC_STATS"
+
 /**
    @brief Builtin command: exit.
-   @param args List of args.  Not examined.
+   @param args List of args.  args[1], if given, is the exit status; the
+   default is that of the last command.
    @return Always returns 0, to terminate execution.
  */
 int lsh_exit(char **args)
 {
+  builtin_status = lsh_status;
+  if (args[1] != NULL)
+  {
+    char *end;
+    long code = strtol(args[1], &end, 10);
+    if (args[1][0] == '\0' || *end != '\0')
+    {
+      fprintf(stderr, "lsh: exit: %s: numeric argument required\n", args[1]);
+      code = SCRIPT_SYNTAX_ERROR;
+    }
+    builtin_status = (int)(code & 0xff);
+  }
   return 0;
 }
 
@@ -325,42 +143,19 @@ int lsh_exit(char **args)
  */
 int lsh_launch(char **args)
 {
-  pid_t pid, wpid;
-  int status;
-
   /**
-   * fork() creates a new process by duplicating the calling process.
-   * The new process, known as the child, is an exact copy of the parent process
-   * except for the returned value. In the child process, fork() returns 0,
-   * while in the parent process, it returns the child's process ID.
-   * This allows both processes to execute concurrently.
+   * The program runs as a one-command pipeline, so it becomes a job that can
+   * be stopped with Ctrl+Z. It is started with posix_spawn rather than fork()
+   * and exec: the child borrows the shell's memory until the program replaces
+   * it, so nothing has to be copied however large the shell has grown.
    */
-  pid = fork();
-  if (pid == 0)
-  {
-    // Child process
-    /**
-     * Executes a program, replacing the current process image.
-     */
-    if (execvp(args[0], args) == -1)
-    {
-      perror("lsh");
-    }
-    exit(EXIT_FAILURE);
-  }
-  else if (pid < 0)
-  {
-    // Error forking
-    perror("lsh");
-  }
-  else
-  {
-    // Parent process
-    do
-    {
-      wpid = waitpid(pid, &status, WUNTRACED);
-    } while (!WIFEXITED(status) && !WIFSIGNALED(status));
-  }
+  size_t argc = 0;
+  while (args[argc])
+    argc++;
+  PipelineStage stage = {args, argc, NULL, NULL, 0};
+  Pipeline pl = {&stage, 1, 0, 0};
+  pipeline_run(&pl, NULL, &lsh_arena);
+  lsh_status = pipeline_status();
 
   return 1;
 }
@@ -372,7 +167,7 @@ int lsh_launch(char **args)
  */
 int lsh_execute(char **args)
 {
-  int i;
+  const Builtin *b;
 
   if (args[0] == NULL)
   {
@@ -380,110 +175,109 @@ int lsh_execute(char **args)
     return 1;
   }
 
-  for (i = 0; i < lsh_num_builtins(); i++)
+  b = builtin_find(args[0]);
+  if (b != NULL)
   {
-    if (strcmp(args[0], builtin_str[i]) == 0)
-    {
-      return (*builtin_func[i])(args);
-    }
+    builtin_status = 0;
+    int rc = b->fn(args);
+    lsh_status = builtin_status;
+    return rc;
   }
 
   return lsh_launch(args);
 }
 
-#define LSH_RL_BUFSIZE 1024
 /**
-   @brief Read a line of input from stdin.
-   @return The line from stdin.
+   @brief Run a builtin stage of a pipeline as a process of its own (see
+   PIPELINE_BUILTIN_OPTION in pipeline.h).
+   @param args Null terminated list of arguments; args[0] is the builtin.
+   @return The builtin's exit status.
  */
-char *lsh_read_line(void)
+int lsh_run_builtin_stage(char **args)
 {
-  int bufsize = LSH_RL_BUFSIZE;
-  int position = 0;
-  char *buffer = malloc(sizeof(char) * bufsize);
-  int c;
-
-  if (!buffer)
+  const Builtin *b = builtin_find(args[0]);
+  if (b == NULL)
   {
-    fprintf(stderr, "lsh: allocation error\n");
-    exit(EXIT_FAILURE);
+    fprintf(stderr, "lsh: %s: not a builtin\n", args[0]);
+    return EXIT_FAILURE;
   }
+  alias_init();
+  jobs_init(0);
+  builtin_status = 0;
+  b->fn(args);
+  fflush(stdout);
+  return builtin_status;
+}
 
-  while (1)
-  {
-    // Read a character
-    c = getchar();
-
-    // If we hit EOF, replace it with a null character and return.
-    if (c == EOF || c == '\n')
-    {
-      buffer[position] = '\0';
-      return buffer;
-    }
-    else
-    {
-      buffer[position] = c;
-    }
-    position++;
+/**
+   @brief Look up a builtin by name.
+   @param name Command name.
+   @return The builtin's function, or NULL if name is not a builtin.
+ */
+PipelineBuiltin lsh_find_builtin(const char *name)
+{
+  const Builtin *b = builtin_find(name);
+  return b ? b->fn : NULL;
+}
 
-    // If we have exceeded the buffer, reallocate.
-    if (position >= bufsize)
+/**
+   @brief Run one parsed command line.
+   @param pl The pipeline; a plain command runs directly, anything else
+   needs the pipeline engine. Its variables are expanded first.
+   @return 1 if the shell should continue running, 0 if it should terminate
+ */
+int lsh_run(const Pipeline *pl)
+{
+  Pipeline expanded;
+  if (pl->expand)
+  {
+    if (pipeline_expand(pl, &expanded, &lsh_arena, lsh_status) != 0)
     {
-      bufsize += LSH_RL_BUFSIZE;
-      buffer = realloc(buffer, bufsize);
-      if (!buffer)
-      {
-        fprintf(stderr, "lsh: allocation error\n");
-        exit(EXIT_FAILURE);
-      }
+      lsh_status = 1;
+      return 1;
     }
+    pl = &expanded;
   }
+  if (pl->nstages == 0)
+    return 1;
+  if (pl->nstages == 1 && pl->stages[0].nredirs == 0 && !pl->background)
+    return lsh_execute(pl->stages[0].argv);
+  int status = pipeline_run(pl, lsh_find_builtin, &lsh_arena);
+  lsh_status = pipeline_status();
+  return status;
 }
 
-#define LSH_TOK_BUFSIZE 64
-#define LSH_TOK_DELIM " \t\r\n\a"
 /**
-   @brief Split a line into tokens (very naively).
-   @param line The line.
-   @return Null-terminated array of tokens.
+   @brief Run a script without prompts: parse all of it, then run each command.
+   @param script The script, as read.
+   @param path The script's file, if it has one. A script file that has run
+   before is loaded already parsed from the cache; otherwise it is parsed
+   and cached for next time.
  */
-char **lsh_split_line(char *line)
+void lsh_run_script(Script *script, const char *path)
 {
-  int bufsize = LSH_TOK_BUFSIZE, position = 0;
-  char **tokens = malloc(bufsize * sizeof(char *));
-  char *token;
-
-  if (!tokens)
-  {
-    fprintf(stderr, "lsh: allocation error\n");
-    exit(EXIT_FAILURE);
-  }
-
-  token = strtok(line, LSH_TOK_DELIM);
-  while (token != NULL)
+  if (path == NULL || scache_load(script, path) != 0)
   {
-    tokens[position] = token;
-    position++;
-
-    if (position >= bufsize)
+    if (script_parse(script) != 0)
     {
-      bufsize += LSH_TOK_BUFSIZE;
-      tokens = realloc(tokens, bufsize * sizeof(char *));
-      if (!tokens)
-      {
-        fprintf(stderr, "lsh: allocation error\n");
-        exit(EXIT_FAILURE);
-      }
+      lsh_status = SCRIPT_SYNTAX_ERROR;
+      return;
     }
-
-    token = strtok(NULL, LSH_TOK_DELIM);
+    if (path)
+      scache_store(script, path);
+  }
+  for (size_t i = 0; i < script->ncmds; i++)
+  {
+    jobs_notify(); // Reap background jobs that are done
+    int status = lsh_run(&script->cmds[i]);
+    arena_reset(&lsh_arena);
+    if (!status)
+      break;
   }
-  tokens[position] = NULL;
-  return tokens;
 }
 
 /**
-   @brief Loop getting input and executing it.
+   @brief Loop getting input from the terminal and executing it.
  */
 
 #define MAX_CWD_LENGTH 1024
@@ -491,11 +285,17 @@ char **lsh_split_line(char *line)
 void lsh_loop(void)
 {
   char *line;
-  char **args;
+  Pipeline pl;
   int status;
 
   do
   {
+    // Report background jobs that finished or stopped since the last prompt,
+    // and reminders that came due while a command ran
+    jobs_notify();
+    scf_deliver_reminders();
+    arena_reset(&lsh_arena);
+
     // Get the current user's username using getlogin
     char *username = getlogin();
     if (username == NULL)
@@ -511,39 +311,27 @@ void lsh_loop(void)
       strncpy(cwd, "unknown", sizeof(cwd)); // Fallback if getcwd fails
     }
 
-    // Print custom prompt: username@pss:/current/directory$
-    printf("\033[1;32m%s@pss:\033[0m\033[1;34m%s\033[0m $ ", username, cwd);
+    // Custom prompt: username@pss:/current/directory$
+    char prompt[MAX_CWD_LENGTH + 256];
+    snprintf(prompt, sizeof(prompt), "\033[1;32m%s@pss:\033[0m\033[1;34m%s\033[0m $ ", username, cwd);
 
-    line = lsh_read_line();
+    line = lineedit_read(prompt, cwd);
+    if (line == NULL)
+      break; // Ctrl+D
 
     if (line[0] != '\0') // Only write non-empty lines
     {
-      FILE *fp = fopen("history.txt", "a");
-      if (fp != NULL)
-      {
-        // Get the current working directory
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) == NULL)
-        {
-          perror("getcwd error");
-          strncpy(cwd, "unknown", sizeof(cwd)); // Fallback if getcwd fails
-        }
-
-        // Get the current timestamp
-        time_t now = time(NULL);
-        char timestamp[20]; // Format: YYYY-MM-DD HH:MM:SS
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
-
-        // Write the enhanced details to the file
-        fprintf(fp, "[%s] [%s] %s\n", timestamp, cwd, line);
-        fclose(fp);
-      }
+      // cwd is still current: nothing has run since the prompt was printed
+      hist_add(line, cwd);
+    }
+    // Split the line into commands joined by pipes, with their redirections
+    status = 1;
+    if (pipeline_parse(line, &pl, &lsh_arena) == 0)
+    {
+      Pipeline aliased;
+      alias_apply(&pl, &aliased, &lsh_arena);
+      status = lsh_run(&aliased);
     }
-    args = lsh_split_line(line);
-    status = lsh_execute(args);
-
-    free(line);
-    free(args);
   } while (status);
 }
 
@@ -603,12 +391,99 @@ void print_welcome_screen()
 
 int main(int argc, char **argv)
 {
-  // Print the enhanced welcome message with instructions
-  print_welcome_screen();
+  Script script;
+  const char *path = NULL;
+  int interactive = 0;
+
+  // A builtin stage of a pipeline run by another shell
+  if (argc > 2 && strcmp(argv[1], PIPELINE_BUILTIN_OPTION) == 0)
+    return lsh_run_builtin_stage(argv + 2);
 
-  // Run the command loop (the main logic of the shell)
-  lsh_loop();
+  // my_shell -c "commands", my_shell script.pss, or commands on stdin: from
+  // a terminal, with prompts; from anything else, as a script
+  if (argc > 1 && strcmp(argv[1], "-c") == 0)
+  {
+    if (argc < 3)
+    {
+      fprintf(stderr, "lsh: -c: option requires an argument\n");
+      fprintf(stderr, "usage: %s [-c commands | script]\n", argv[0]);
+      return SCRIPT_SYNTAX_ERROR;
+    }
+    script_from_string(&script, argv[2]);
+  }
+  else if (argc > 1)
+  {
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || script_read(&script, fd, argv[1]) != 0)
+    {
+      fprintf(stderr, "lsh: %s: %s\n", argv[1], strerror(errno));
+      return SCRIPT_NOT_FOUND;
+    }
+    close(fd);
+    path = argv[1];
+  }
+  else if (!isatty(STDIN_FILENO))
+  {
+    if (script_read(&script, STDIN_FILENO, NULL) != 0)
+    {
+      perror("lsh: stdin");
+      return EXIT_FAILURE;
+    }
+  }
+  else
+    interactive = 1;
+
+  alias_init();
+  pipeline_set_not_found(suggest_report);
+  jobs_init(interactive);
+
+  if (interactive)
+  {
+    // Print the enhanced welcome message with instructions
+    print_welcome_screen();
+
+    // Keep the history store open for the whole session. Only commands typed
+    // at the prompt are recorded, so -c, scripts and piped input leave no
+    // history files behind in the directory they run in.
+    hist_open();
+
+    // Have the Ctrl+R index ready before the first prompt
+    hist_search_index();
+
+    // Search indexes used in this session follow edits to their trees
+    swatch_enable();
+
+    // Someone at a terminal may sit at the prompt for hours; do not leave
+    // their last commands only in memory
+    lineedit_set_idle(hist_flush_idle);
+
+    // Reminders kept from earlier sessions, shown at the prompt when due
+    if (remind_open() != 0)
+      fprintf(stderr, "lsh: cannot read reminders: %s\n", strerror(errno));
+    lineedit_set_wakeup(remind_fd(), scf_deliver_reminders);
+
+    // Run the command loop (the main logic of the shell)
+    lsh_loop();
+  }
+  else
+  {
+    lsh_run_script(&script, path);
+    script_free(&script);
+  }
+
+  jobs_shutdown();
+  hist_close();
+
+  if (getenv(LSH_ALLOC_STATS_ENV))
+  {
+    fprintf(stderr, "lsh: %zu command lines; heap allocations: %zu for commands (%zu bytes held, %zu at most in use), %zu for jobs",
+            lsh_arena.resets, lsh_arena.heap_allocs, lsh_arena.reserved, lsh_arena.high_water, jobs_allocations());
+    if (allocstats_count)
+      fprintf(stderr, "; %zu in all", allocstats_count());
+    fprintf(stderr, "\n");
+  }
+  arena_free(&lsh_arena);
 
-  // Perform any shutdown/cleanup, if necessary (though not required in this example)
-  return EXIT_SUCCESS;
+  // The status of the last command, or the one given to exit
+  return lsh_status;
 }
@@ -0,0 +1,338 @@
+// match.c
+//
+// Literal substring kernel used by "search". Candidate positions are found by
+// comparing the first and the last byte of the needle against a whole vector
+// of the haystack at once; only positions where both agree are verified with
+// memcmp. Newlines are counted (also vectorised) only between hits, so a file
+// without matches is never split into lines at all.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "match.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCH_HAVE_X86 1
+#endif
+
+/*
+  Scalar kernels.
+*/
+
+static const char *find_scalar(const char *hay, size_t n, const char *needle, size_t m)
+{
+  const char first = needle[0];
+  const char last = needle[m - 1];
+
+  for (size_t i = 0; i + m <= n; i++)
+  {
+    if (hay[i] == first && hay[i + m - 1] == last && (m <= 2 || memcmp(hay + i + 1, needle + 1, m - 2) == 0))
+      return hay + i;
+  }
+  return NULL;
+}
+
+static size_t count_scalar(const char *buf, size_t len)
+{
+  size_t count = 0;
+  const char *p = buf, *end = buf + len;
+  while ((p = memchr(p, '\n', end - p)) != NULL)
+  {
+    count++;
+    p++;
+  }
+  return count;
+}
+
+#ifdef MATCH_HAVE_X86
+
+/*
+  SSE2 kernels. SSE2 is part of the x86-64 baseline, so these need no check.
+*/
+
+__attribute__((target("sse2"))) static const char *find_sse2(const char *hay, size_t n, const char *needle, size_t m)
+{
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+
+  for (; i + m - 1 + 16 <= n; i += 16)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask)
+    {
+      int bit = __builtin_ctz(mask);
+      if (m <= 2 || memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0)
+        return hay + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  if (i + m <= n)
+    return find_scalar(hay + i, n - i, needle, m);
+  return NULL;
+}
+
+__attribute__((target("sse2"))) static size_t count_sse2(const char *buf, size_t len)
+{
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t count = 0, i = 0;
+
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+  }
+  return count + count_scalar(buf + i, len - i);
+}
+
+/*
+  AVX2 kernels, selected at runtime when the CPU supports them.
+*/
+
+__attribute__((target("avx2"))) static const char *find_avx2(const char *hay, size_t n, const char *needle, size_t m)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+
+  for (; i + m - 1 + 32 <= n; i += 32)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+    while (mask)
+    {
+      int bit = __builtin_ctz(mask);
+      if (m <= 2 || memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0)
+        return hay + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  if (i + m <= n)
+    return find_sse2(hay + i, n - i, needle, m);
+  return NULL;
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t count_avx2(const char *buf, size_t len)
+{
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t count = 0, i = 0;
+
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+    count += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+  }
+  return count + count_sse2(buf + i, len - i);
+}
+
+#endif // MATCH_HAVE_X86
+
+/*
+  Runtime dispatch.
+*/
+
+typedef const char *(*find_fn)(const char *, size_t, const char *, size_t);
+typedef size_t (*count_fn)(const char *, size_t);
+
+static find_fn match_find_impl;
+static count_fn match_count_impl;
+static const char *match_kernel;
+
+static void match_select_kernel(void)
+{
+  // Benign race: every thread computes the same values
+  if (match_find_impl)
+    return;
+#ifdef MATCH_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    match_count_impl = count_avx2;
+    match_kernel = "avx2";
+    match_find_impl = find_avx2;
+    return;
+  }
+  match_count_impl = count_sse2;
+  match_kernel = "sse2";
+  match_find_impl = find_sse2;
+#else
+  match_count_impl = count_scalar;
+  match_kernel = "scalar";
+  match_find_impl = find_scalar;
+#endif
+}
+
+const char *match_kernel_name(void)
+{
+  match_select_kernel();
+  return match_kernel;
+}
+
+const char *match_find(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+  if (needle_len == 0)
+    return hay;
+  if (needle_len > hay_len)
+    return NULL;
+  if (needle_len == 1)
+    return memchr(hay, needle[0], hay_len);
+  match_select_kernel();
+  return match_find_impl(hay, hay_len, needle, needle_len);
+}
+
+size_t match_count_newlines(const char *buf, size_t len)
+{
+  match_select_kernel();
+  return match_count_impl(buf, len);
+}
+
+size_t match_scan_buffer(const char *buf, size_t len, const char *needle, size_t needle_len,
+                         size_t first_line, match_line_fn fn, void *ctx)
+{
+  const char *end = buf + len;
+  const char *pos = buf;     // Where the next search starts
+  const char *counted = buf; // Newlines before this point are already counted
+  size_t line_num = first_line;
+  size_t reported = 0;
+
+  while (pos < end)
+  {
+    const char *hit = match_find(pos, end - pos, needle, needle_len);
+    if (hit == NULL)
+      break;
+
+    // Only now pay for line bookkeeping, and only for the bytes skipped
+    line_num += match_count_newlines(counted, hit - counted);
+
+    const char *line = hit;
+    while (line > buf && line[-1] != '\n')
+      line--;
+    const char *eol = memchr(hit, '\n', end - hit);
+    if (eol == NULL)
+      eol = end;
+
+    fn(ctx, line_num, line, eol - line);
+    reported++;
+
+    counted = hit;
+    if (eol == end)
+      break;
+    line_num += match_count_newlines(counted, eol + 1 - counted);
+    counted = pos = eol + 1;
+  }
+  return reported;
+}
+
+// match_scan_fn adapter for a literal needle
+typedef struct
+{
+  const char *needle;
+  size_t len;
+} MatchLiteral;
+
+static size_t match_scan_literal(void *matcher, const char *buf, size_t len, size_t first_line,
+                                 match_line_fn fn, void *ctx)
+{
+  const MatchLiteral *lit = matcher;
+  return match_scan_buffer(buf, len, lit->needle, lit->len, first_line, fn, ctx);
+}
+
+static long match_scan_stream(int fd, match_scan_fn scan, void *matcher,
+                              MatchScratch *scratch, match_line_fn fn, void *ctx)
+{
+  size_t have = 0, line_num = 1;
+  long reported = 0;
+
+  if (scratch->cap < MATCH_STREAM_BLOCK)
+  {
+    char *buf = realloc(scratch->buf, MATCH_STREAM_BLOCK);
+    if (!buf)
+      return -1;
+    scratch->buf = buf;
+    scratch->cap = MATCH_STREAM_BLOCK;
+  }
+
+  for (;;)
+  {
+    if (have == scratch->cap)
+    {
+      // A single line longer than the buffer: grow instead of truncating it
+      char *buf = realloc(scratch->buf, scratch->cap * 2);
+      if (!buf)
+        return -1;
+      scratch->buf = buf;
+      scratch->cap *= 2;
+    }
+
+    ssize_t n = read(fd, scratch->buf + have, scratch->cap - have);
+    if (n < 0)
+      return -1;
+    if (n == 0)
+    {
+      // Whatever is left is the final, unterminated line
+      if (have > 0)
+        reported += scan(matcher, scratch->buf, have, line_num, fn, ctx);
+      return reported;
+    }
+    have += n;
+
+    // Scan up to the last complete line and carry the rest over
+    const char *last_nl = memrchr(scratch->buf, '\n', have);
+    if (last_nl == NULL)
+      continue;
+    size_t complete = last_nl + 1 - scratch->buf;
+    reported += scan(matcher, scratch->buf, complete, line_num, fn, ctx);
+    line_num += match_count_newlines(scratch->buf, complete);
+    memmove(scratch->buf, scratch->buf + complete, have - complete);
+    have -= complete;
+  }
+}
+
+long match_scan_file(const char *path, const char *needle, size_t needle_len,
+                     MatchScratch *scratch, match_line_fn fn, void *ctx)
+{
+  MatchLiteral lit = {needle, needle_len};
+  return match_scan_with(path, match_scan_literal, &lit, scratch, fn, ctx);
+}
+
+long match_scan_with(const char *path, match_scan_fn scan, void *matcher,
+                     MatchScratch *scratch, match_line_fn fn, void *ctx)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  long reported = -1;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size >= MATCH_MMAP_THRESHOLD)
+  {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      reported = scan(matcher, map, st.st_size, 1, fn, ctx);
+      munmap(map, st.st_size);
+      close(fd);
+      return reported;
+    }
+  }
+
+  // Small files (and anything mmap refuses) are streamed through scratch
+  reported = match_scan_stream(fd, scan, matcher, scratch, fn, ctx);
+  close(fd);
+  return reported;
+}
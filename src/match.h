@@ -0,0 +1,52 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+
+// Files at least this large are mapped with mmap; smaller ones are read
+#define MATCH_MMAP_THRESHOLD (64 * 1024)
+// Block size used when a file has to be streamed with read()
+#define MATCH_STREAM_BLOCK (1024 * 1024)
+
+// Called once for every line that contains the needle. line points at the
+// first byte of the line and len excludes the trailing newline.
+typedef void (*match_line_fn)(void *ctx, size_t line_num, const char *line, size_t len);
+
+// A line scanner with the contract of match_scan_buffer, used to plug other
+// matchers (see rx.h) into match_scan_with. matcher is the scanner's state.
+typedef size_t (*match_scan_fn)(void *matcher, const char *buf, size_t len, size_t first_line,
+                                match_line_fn fn, void *ctx);
+
+// Reusable scratch space for match_scan_file; one per thread
+typedef struct
+{
+  char *buf;
+  size_t cap;
+} MatchScratch;
+
+// Return a pointer to the first occurrence of needle in hay, or NULL
+const char *match_find(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+
+// Count the newline bytes in buf[0..len)
+size_t match_count_newlines(const char *buf, size_t len);
+
+// Report every line of buf that contains needle. Returns the number of lines
+// reported. first_line is the line number of the first byte of buf.
+size_t match_scan_buffer(const char *buf, size_t len, const char *needle, size_t needle_len,
+                         size_t first_line, match_line_fn fn, void *ctx);
+
+// Same as match_scan_buffer, for a whole file. Large files are mapped, small
+// ones are read into scratch, and files that cannot be mapped are streamed.
+// Returns the number of matching lines, or -1 if the file cannot be read.
+long match_scan_file(const char *path, const char *needle, size_t needle_len,
+                     MatchScratch *scratch, match_line_fn fn, void *ctx);
+
+// Same as match_scan_file, but lines are found by scan. scan only ever sees
+// whole lines, except for a final line that has no newline.
+long match_scan_with(const char *path, match_scan_fn scan, void *matcher,
+                     MatchScratch *scratch, match_line_fn fn, void *ctx);
+
+// Name of the vector kernel picked at runtime ("avx2", "sse2" or "scalar")
+const char *match_kernel_name(void);
+
+#endif // MATCH_H
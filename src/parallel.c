@@ -0,0 +1,501 @@
+// parallel.c
+//
+// The parallel builtin, a small xargs -P / GNU parallel. One command runs
+// per input, with at most N of them in flight; a new one is started through
+// the shell's spawn path as soon as a slot frees up. Each command's stdout
+// and stderr go to pipes the shell drains with poll(), and are written out
+// in one piece when the command ends, so the output of two commands never
+// interleaves. With -k the pieces come out in input order instead of
+// completion order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "parallel.h"
+#include "spawn.h"
+#include "bio.h"
+#include "status.h"
+
+#define PARALLEL_READ_SIZE (16 * 1024)
+// Exit status for this many failed commands or more, as in GNU parallel
+#define PARALLEL_MAX_FAILED 101
+
+typedef struct
+{
+  char *data;
+  size_t len, cap;
+} ParallelBuf;
+
+typedef struct
+{
+  pid_t pid; // 0 for a free slot
+  size_t seq; // Input number
+  int fds[2]; // Read ends for stdout and stderr, -1 once drained
+  ParallelBuf out[2];
+  struct timespec start;
+} ParallelSlot;
+
+// Output of a finished command waiting for earlier ones (-k)
+typedef struct
+{
+  ParallelBuf out[2];
+  int done;
+} ParallelHeld;
+
+typedef struct
+{
+  char **list; // Inputs given after ":::", or NULL to read lines
+  FILE *file;
+  char *line;
+  size_t cap;
+} ParallelInput;
+
+typedef struct
+{
+  char **cmd; // Command template
+  size_t ncmd;
+  int placeholder; // Some word of cmd contains "{}"
+  int keep_order, progress, stats;
+  size_t slots;
+
+  ParallelSlot *slot;
+  size_t running, started, finished, failed;
+  ParallelHeld *held;
+  size_t held_cap, next_emit;
+  double *durations; // Milliseconds, for each command that ran
+  size_t timed;
+} Parallel;
+
+static volatile sig_atomic_t parallel_interrupted;
+
+static void *parallel_xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void parallel_on_sigint(int sig)
+{
+  (void)sig;
+  parallel_interrupted = 1;
+}
+
+static double parallel_ms_since(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Next input, or NULL when there are no more
+static const char *parallel_next_input(ParallelInput *in)
+{
+  if (in->list)
+    return *in->list ? *in->list++ : NULL;
+  ssize_t len = getline(&in->line, &in->cap, in->file);
+  if (len < 0)
+    return NULL;
+  if (len > 0 && in->line[len - 1] == '\n')
+    in->line[len - 1] = '\0';
+  return in->line;
+}
+
+// Replace every "{}" in word with input
+static char *parallel_substitute(const char *word, const char *input)
+{
+  size_t n = 0, in_len = strlen(input);
+  for (const char *p = strstr(word, "{}"); p; p = strstr(p + 2, "{}"))
+    n++;
+  char *result = parallel_xrealloc(NULL, strlen(word) + n * in_len + 1);
+  char *q = result;
+  for (const char *p = word;;)
+  {
+    const char *hole = strstr(p, "{}");
+    size_t len = hole ? (size_t)(hole - p) : strlen(p);
+    memcpy(q, p, len);
+    q += len;
+    if (!hole)
+      break;
+    memcpy(q, input, in_len);
+    q += in_len;
+    p = hole + 2;
+  }
+  *q = '\0';
+  return result;
+}
+
+// Output a finished command's stdout, then its stderr
+static void parallel_emit(ParallelBuf out[2])
+{
+  for (int k = 0; k < 2; k++)
+  {
+    if (out[k].len)
+      bio_write(k == 0 ? STDOUT_FILENO : STDERR_FILENO, out[k].data, out[k].len);
+    free(out[k].data);
+    memset(&out[k], 0, sizeof(out[k]));
+  }
+}
+
+static void parallel_show_progress(const Parallel *par)
+{
+  if (par->progress)
+    fprintf(stderr, "\rparallel: %zu done, %zu running, %zu failed", par->finished, par->running, par->failed);
+}
+
+// Record the end of command seq, with its output (or none if it never ran)
+static void parallel_complete(Parallel *par, size_t seq, ParallelBuf out[2], int failed)
+{
+  par->finished++;
+  par->failed += failed;
+  if (!par->keep_order)
+    parallel_emit(out);
+  else
+  {
+    ParallelHeld *h = &par->held[seq];
+    h->out[0] = out[0];
+    h->out[1] = out[1];
+    h->done = 1;
+    while (par->next_emit < par->started && par->held[par->next_emit].done)
+      parallel_emit(par->held[par->next_emit++].out);
+  }
+  parallel_show_progress(par);
+}
+
+static void parallel_start(Parallel *par, ParallelSlot *s, const char *input)
+{
+  size_t seq = par->started++;
+  if (par->keep_order && seq >= par->held_cap)
+  {
+    size_t cap = par->held_cap ? par->held_cap * 2 : 64;
+    par->held = parallel_xrealloc(par->held, cap * sizeof(ParallelHeld));
+    memset(par->held + par->held_cap, 0, (cap - par->held_cap) * sizeof(ParallelHeld));
+    par->held_cap = cap;
+  }
+
+  char *argv[par->ncmd + 2];
+  size_t argc = 0;
+  for (size_t i = 0; i < par->ncmd; i++)
+    argv[argc++] = par->placeholder ? parallel_substitute(par->cmd[i], input) : par->cmd[i];
+  if (!par->placeholder)
+    argv[argc++] = (char *)input;
+  argv[argc] = NULL;
+
+  ParallelBuf none[2] = {{0}};
+  int out[2], err[2];
+  if (pipe2(out, O_CLOEXEC) != 0)
+  {
+    perror("lsh: parallel: pipe");
+    parallel_complete(par, seq, none, 1);
+    goto done;
+  }
+  if (pipe2(err, O_CLOEXEC) != 0)
+  {
+    perror("lsh: parallel: pipe");
+    close(out[0]);
+    close(out[1]);
+    parallel_complete(par, seq, none, 1);
+    goto done;
+  }
+
+  // Inputs may be coming from stdin, so commands do not get to read it
+  SpawnIo io;
+  spawn_io_init(&io);
+  spawn_io_open(&io, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  spawn_io_dup(&io, out[1], STDOUT_FILENO);
+  spawn_io_dup(&io, err[1], STDERR_FILENO);
+  clock_gettime(CLOCK_MONOTONIC, &s->start);
+  pid_t pid = spawn_start(argv, &io);
+  int saved = errno;
+  spawn_io_destroy(&io);
+  close(out[1]);
+  close(err[1]);
+  if (pid < 0)
+  {
+    fprintf(stderr, "lsh: parallel: %s: %s\n", argv[0], strerror(saved));
+    close(out[0]);
+    close(err[0]);
+    parallel_complete(par, seq, none, 1);
+    goto done;
+  }
+
+  s->pid = pid;
+  s->seq = seq;
+  s->fds[0] = out[0];
+  s->fds[1] = err[0];
+  memset(s->out, 0, sizeof(s->out));
+  par->running++;
+
+done:
+  if (par->placeholder)
+  {
+    for (size_t i = 0; i < par->ncmd; i++)
+      free(argv[i]);
+  }
+}
+
+// Both pipes are drained: collect the command's status and output
+static void parallel_finish(Parallel *par, ParallelSlot *s)
+{
+  int status = 0;
+  while (waitpid(s->pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  par->durations[par->timed++] = parallel_ms_since(&s->start);
+  s->pid = 0;
+  par->running--;
+  parallel_complete(par, s->seq, s->out, !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+}
+
+// Read what is waiting on one of a slot's pipes
+static void parallel_drain(Parallel *par, ParallelSlot *s, int k)
+{
+  ParallelBuf *b = &s->out[k];
+  if (b->cap - b->len < PARALLEL_READ_SIZE)
+  {
+    b->cap = b->cap ? b->cap * 2 : PARALLEL_READ_SIZE;
+    while (b->cap - b->len < PARALLEL_READ_SIZE)
+      b->cap *= 2;
+    b->data = parallel_xrealloc(b->data, b->cap);
+  }
+  ssize_t n = read(s->fds[k], b->data + b->len, b->cap - b->len);
+  if (n < 0 && errno == EINTR)
+    return;
+  if (n > 0)
+  {
+    b->len += n;
+    return;
+  }
+  close(s->fds[k]);
+  s->fds[k] = -1;
+  if (s->fds[0] < 0 && s->fds[1] < 0)
+    parallel_finish(par, s);
+}
+
+static int parallel_compare(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void parallel_print_stats(Parallel *par, double wall_ms)
+{
+  size_t ntimed = par->timed;
+  fprintf(stderr, "parallel: %zu jobs (%zu failed) in %.2f s, %.1f jobs/s", par->finished, par->failed,
+          wall_ms / 1e3, wall_ms > 0 ? par->finished * 1e3 / wall_ms : 0.0);
+  if (ntimed > 0)
+  {
+    // Nearest-rank percentiles of the commands that ran
+    qsort(par->durations, ntimed, sizeof(double), parallel_compare);
+    size_t p50 = (ntimed * 50 + 99) / 100, p99 = (ntimed * 99 + 99) / 100;
+    fprintf(stderr, "; duration p50 %.1f ms, p99 %.1f ms, max %.1f ms", par->durations[p50 - 1],
+            par->durations[p99 - 1], par->durations[ntimed - 1]);
+  }
+  fprintf(stderr, "\n");
+}
+
+static int parallel_usage(void)
+{
+  fprintf(stderr, "usage: parallel [-j N] [-k] [--progress] [--stats] [-a file] cmd [args...] [::: inputs...]\n");
+  return builtin_fail(1);
+}
+
+/**
+   @brief Builtin command: run a command once per input, N at a time.
+   @param args List of args.  Options, the command (where "{}" stands for the
+   input, which is otherwise added as a last argument), then optionally
+   ":::" and the inputs. Without ":::", inputs are the lines of the -a file
+   or of stdin.
+   @return Always returns 1, to continue executing. The exit status is the
+   number of commands that failed, at most PARALLEL_MAX_FAILED, or 130 when
+   interrupted.
+ */
+int lsh_parallel(char **args)
+{
+  Parallel par;
+  ParallelInput in = {0};
+  const char *input_path = NULL;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  char **a = args + 1;
+
+  memset(&par, 0, sizeof(par));
+  for (; *a && (*a)[0] == '-'; a++)
+  {
+    if (strcmp(*a, "--") == 0)
+    {
+      a++;
+      break;
+    }
+    else if (strncmp(*a, "-j", 2) == 0)
+    {
+      const char *n = (*a)[2] ? *a + 2 : *++a;
+      char *end;
+      if (n == NULL)
+        return parallel_usage();
+      jobs = strtol(n, &end, 10);
+      if (*n == '\0' || *end != '\0' || jobs < 0)
+      {
+        fprintf(stderr, "lsh: parallel: %s: invalid number of jobs\n", n);
+        return builtin_fail(1);
+      }
+      if (jobs == 0) // As with search: one per CPU
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    else if (strcmp(*a, "-k") == 0)
+      par.keep_order = 1;
+    else if (strcmp(*a, "--progress") == 0)
+      par.progress = 1;
+    else if (strcmp(*a, "--stats") == 0)
+      par.stats = 1;
+    else if (strcmp(*a, "-a") == 0)
+    {
+      if ((input_path = *++a) == NULL)
+        return parallel_usage();
+    }
+    else
+    {
+      fprintf(stderr, "lsh: parallel: %s: invalid option\n", *a);
+      return parallel_usage();
+    }
+  }
+
+  par.cmd = a;
+  while (*a && strcmp(*a, ":::") != 0)
+  {
+    par.placeholder |= strstr(*a, "{}") != NULL;
+    a++;
+  }
+  par.ncmd = a - par.cmd;
+  if (par.ncmd == 0)
+    return parallel_usage();
+  if (*a)
+  {
+    *a = NULL; // Ends the command template
+    in.list = a + 1;
+  }
+  else
+  {
+    // Not through stdin: its buffer may hold the shell's own input, read
+    // ahead of what fd 0 now points at
+    int fd = input_path ? open(input_path, O_RDONLY | O_CLOEXEC) : fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0 || (in.file = fdopen(fd, "r")) == NULL)
+    {
+      fprintf(stderr, "lsh: parallel: %s: %s\n", input_path ? input_path : "stdin", strerror(errno));
+      if (fd >= 0)
+        close(fd);
+      return builtin_fail(1);
+    }
+  }
+  par.slots = jobs < PARALLEL_MAX_SLOTS ? (size_t)jobs : PARALLEL_MAX_SLOTS;
+
+  par.slot = parallel_xrealloc(NULL, par.slots * sizeof(ParallelSlot));
+  memset(par.slot, 0, par.slots * sizeof(ParallelSlot));
+  struct pollfd *pfds = parallel_xrealloc(NULL, 2 * par.slots * sizeof(struct pollfd));
+  size_t *polled = parallel_xrealloc(NULL, 2 * par.slots * sizeof(size_t)); // Slot * 2 + pipe
+  size_t durations_cap = 64;
+  par.durations = parallel_xrealloc(NULL, durations_cap * sizeof(double));
+
+  // Ctrl+C stops this run, not the shell
+  struct sigaction sa, old_int;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = parallel_on_sigint;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, &old_int);
+  parallel_interrupted = 0;
+
+  struct timespec begin;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  fflush(stdout);
+  int inputs_left = 1;
+  for (;;)
+  {
+    // Keep every slot busy
+    for (size_t i = 0; i < par.slots && inputs_left && !parallel_interrupted; i++)
+    {
+      if (par.slot[i].pid)
+        continue;
+      const char *input = parallel_next_input(&in);
+      if (input == NULL)
+      {
+        inputs_left = 0;
+        break;
+      }
+      if (par.started + 1 > durations_cap)
+      {
+        durations_cap *= 2;
+        par.durations = parallel_xrealloc(par.durations, durations_cap * sizeof(double));
+      }
+      parallel_start(&par, &par.slot[i], input);
+    }
+    if (par.running == 0 && (!inputs_left || parallel_interrupted))
+      break;
+    if (par.running == 0)
+      continue; // Everything failed to start; try the next inputs
+
+    nfds_t nfds = 0;
+    for (size_t i = 0; i < par.slots; i++)
+    {
+      for (int k = 0; k < 2; k++)
+      {
+        if (par.slot[i].pid && par.slot[i].fds[k] >= 0)
+        {
+          polled[nfds] = i * 2 + k;
+          pfds[nfds++] = (struct pollfd){par.slot[i].fds[k], POLLIN, 0};
+        }
+      }
+    }
+    if (poll(pfds, nfds, -1) < 0)
+    {
+      if (errno == EINTR && parallel_interrupted)
+      {
+        for (size_t i = 0; i < par.slots; i++)
+        {
+          if (par.slot[i].pid)
+            kill(par.slot[i].pid, SIGTERM);
+        }
+      }
+      continue;
+    }
+
+    for (nfds_t j = 0; j < nfds; j++)
+    {
+      ParallelSlot *s = &par.slot[polled[j] / 2];
+      int k = polled[j] % 2;
+      if (pfds[j].revents && s->pid && s->fds[k] >= 0)
+        parallel_drain(&par, s, k);
+    }
+  }
+  double wall_ms = parallel_ms_since(&begin);
+  sigaction(SIGINT, &old_int, NULL);
+
+  if (par.progress)
+    fprintf(stderr, "\n");
+  if (parallel_interrupted)
+    fprintf(stderr, "lsh: parallel: interrupted after %zu jobs\n", par.finished);
+  if (par.stats)
+    parallel_print_stats(&par, wall_ms);
+
+  if (in.file)
+    fclose(in.file);
+  free(in.line);
+  free(par.slot);
+  free(pfds);
+  free(polled);
+  free(par.held);
+  free(par.durations);
+  if (parallel_interrupted)
+    builtin_status = 128 + SIGINT;
+  else
+    builtin_status = par.failed < PARALLEL_MAX_FAILED ? (int)par.failed : PARALLEL_MAX_FAILED;
+  return 1;
+}
@@ -0,0 +1,11 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Most commands kept running at once, whatever -j asks for
+#define PARALLEL_MAX_SLOTS 1024
+
+// Builtin: run a command once per input, several at a time.
+//   parallel [-j N] [-k] [--progress] [--stats] [-a file] cmd [args...] [::: inputs...]
+int lsh_parallel(char **args);
+
+#endif // PARALLEL_H
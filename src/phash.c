@@ -0,0 +1,169 @@
+// phash.c
+//
+// Building a minimal perfect hash table. Keys are spread over about half
+// as many buckets as there are keys; buckets are then placed largest first,
+// each trying displacements until all of its keys land in free slots. The
+// buckets with more than one key hold about seven keys in eight, so the
+// last of them still find room within a few dozen tries. Buckets of one key
+// come last and take the slots that are left, in order, storing the slot
+// itself instead of a displacement: searching for a displacement that hits
+// one of the last few free slots would take about as many tries as there
+// are keys. If a bucket cannot be placed, or two keys hash alike, the whole
+// thing starts over with a new seed.
+
+#include <stdlib.h>
+#include <string.h>
+#include "phash.h"
+
+#define PHASH_MAX_SEEDS 1000
+#define PHASH_MAX_DISP (1u << 20)
+#define PHASH_FREE UINT32_MAX
+
+typedef struct
+{
+  uint32_t bucket;
+  uint32_t size;
+} PhashBucket;
+
+static int phash_by_size(const void *a, const void *b)
+{
+  const PhashBucket *x = a, *y = b;
+  if (x->size != y->size)
+    return x->size < y->size ? 1 : -1;
+  return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
+
+// Try to place every bucket for one seed
+static int phash_try(Phash *ph, const uint64_t *hashes, size_t n, PhashBucket *order, uint32_t *start,
+                     uint32_t *members, uint32_t *placed)
+{
+  // Group the keys by bucket
+  memset(start, 0, (ph->nbuckets + 1) * sizeof(uint32_t));
+  for (size_t i = 0; i < n; i++)
+    start[(uint32_t)(hashes[i] >> 32) % ph->nbuckets + 1]++;
+  for (uint32_t b = 0; b < ph->nbuckets; b++)
+  {
+    order[b] = (PhashBucket){b, start[b + 1]};
+    start[b + 1] += start[b];
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    uint32_t b = (uint32_t)(hashes[i] >> 32) % ph->nbuckets;
+    members[start[b] + --order[b].size] = (uint32_t)i;
+  }
+  for (uint32_t b = 0; b < ph->nbuckets; b++)
+    order[b].size = start[b + 1] - start[b];
+  qsort(order, ph->nbuckets, sizeof(PhashBucket), phash_by_size);
+
+  for (uint32_t s = 0; s < ph->nslots; s++)
+    ph->slots[s] = PHASH_FREE;
+  memset(ph->disp, 0, ph->nbuckets * sizeof(uint32_t));
+  uint32_t k;
+  for (k = 0; k < ph->nbuckets && order[k].size > 1; k++)
+  {
+    uint32_t b = order[k].bucket, size = order[k].size;
+    const uint32_t *keys = members + start[b];
+    uint32_t d;
+    for (d = 0; d < PHASH_MAX_DISP; d++)
+    {
+      uint32_t j;
+      for (j = 0; j < size; j++)
+      {
+        placed[j] = phash_place(hashes[keys[j]], d, ph->nslots);
+        if (ph->slots[placed[j]] != PHASH_FREE)
+          break;
+        // Two keys of this bucket in the same slot
+        uint32_t i;
+        for (i = 0; i < j && placed[i] != placed[j]; i++)
+          ;
+        if (i < j)
+          break;
+      }
+      if (j == size)
+        break;
+    }
+    if (d == PHASH_MAX_DISP)
+      return -1;
+    ph->disp[b] = d;
+    for (uint32_t j = 0; j < size; j++)
+      ph->slots[placed[j]] = keys[j];
+  }
+
+  // As many free slots are left as there are single keys
+  uint32_t s = 0;
+  for (; k < ph->nbuckets && order[k].size == 1; k++)
+  {
+    uint32_t b = order[k].bucket;
+    while (ph->slots[s] != PHASH_FREE)
+      s++;
+    ph->disp[b] = PHASH_DIRECT | s;
+    ph->slots[s] = members[start[b]];
+  }
+  return 0;
+}
+
+static int phash_by_key(const void *a, const void *b)
+{
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Whether two of the keys are equal: sorted, they would be neighbours
+static int phash_has_duplicates(const char *const *keys, size_t n)
+{
+  const char **sorted = malloc((n + 1) * sizeof(char *));
+  int dup = 0;
+  if (!sorted)
+    return 1;
+  memcpy(sorted, keys, n * sizeof(char *));
+  qsort(sorted, n, sizeof(char *), phash_by_key);
+  for (size_t i = 1; i < n && !dup; i++)
+    dup = strcmp(sorted[i - 1], sorted[i]) == 0;
+  free(sorted);
+  return dup;
+}
+
+int phash_build(Phash *ph, const char *const *keys, size_t n)
+{
+  memset(ph, 0, sizeof(*ph));
+  if (n >= PHASH_DIRECT || phash_has_duplicates(keys, n))
+    return -1;
+
+  ph->nslots = (uint32_t)n;
+  ph->nbuckets = (uint32_t)(n / 2 + 1);
+  ph->disp = malloc(ph->nbuckets * sizeof(uint32_t));
+  ph->slots = malloc((n + 1) * sizeof(uint32_t));
+
+  uint64_t *hashes = malloc((n + 1) * sizeof(uint64_t));
+  PhashBucket *order = malloc(ph->nbuckets * sizeof(PhashBucket));
+  uint32_t *start = malloc((ph->nbuckets + 1) * sizeof(uint32_t));
+  uint32_t *members = malloc((n + 1) * sizeof(uint32_t));
+  uint32_t *placed = malloc((n + 1) * sizeof(uint32_t));
+  int rc = -1;
+
+  if (ph->disp && ph->slots && hashes && order && start && members && placed)
+  {
+    for (uint64_t seed = 1; seed <= PHASH_MAX_SEEDS && rc != 0; seed++)
+    {
+      ph->seed = seed * 0x9e3779b97f4a7c15ull;
+      for (size_t i = 0; i < n; i++)
+        hashes[i] = phash_hash(ph->seed, keys[i]);
+      rc = phash_try(ph, hashes, n, order, start, members, placed);
+    }
+  }
+  free(hashes);
+  free(order);
+  free(start);
+  free(members);
+  free(placed);
+  if (rc != 0)
+    phash_free(ph);
+  return rc;
+}
+
+void phash_free(Phash *ph)
+{
+  free(ph->disp);
+  free(ph->slots);
+  ph->disp = NULL;
+  ph->slots = NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef PHASH_H
+#define PHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bucket displacement flag: the bucket holds one key, which is in the slot
+// given by the other bits
+#define PHASH_DIRECT 0x80000000u
+
+// Minimal perfect hashing for a fixed set of names ("hash and displace"):
+// a key's hash picks a bucket, the bucket's displacement picks its slot, and
+// the displacements are chosen so that no two keys share a slot. There are
+// exactly as many slots as keys, so every slot holds one. Finding a key
+// costs one pass over it and one comparison.
+typedef struct
+{
+  uint64_t seed;
+  uint32_t nbuckets;
+  uint32_t nslots; // The number of keys
+  uint32_t *disp; // Per bucket
+  uint32_t *slots; // Key index in each slot
+} Phash;
+
+// Build a table for the n distinct keys. Returns 0, or -1 if two keys are
+// equal (or memory ran out).
+int phash_build(Phash *ph, const char *const *keys, size_t n);
+void phash_free(Phash *ph);
+
+static inline uint64_t phash_hash(uint64_t seed, const char *key)
+{
+  uint64_t h = 14695981039346656037ull ^ seed;
+  for (; *key; key++)
+    h = (h ^ (unsigned char)*key) * 1099511628211ull;
+  return h;
+}
+
+// Slot for hash h under displacement d, out of nslots. Murmur3's
+// finaliser, so that every displacement reshuffles all the bits, then a
+// multiply to bring the low 32 of them into range.
+static inline uint32_t phash_place(uint64_t h, uint32_t d, uint32_t nslots)
+{
+  uint64_t x = h ^ d;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return (uint32_t)(((x & 0xffffffffull) * nslots) >> 32);
+}
+
+// Slot of key in a table with the given parameters, which must hold at
+// least one key. Any string maps to some slot; only comparing it with the
+// key there tells whether it is in the set.
+static inline uint32_t phash_slot(uint64_t seed, uint32_t nbuckets, const uint32_t *disp, uint32_t nslots,
+                                  const char *key)
+{
+  uint64_t h = phash_hash(seed, key);
+  uint32_t d = disp[(uint32_t)(h >> 32) % nbuckets];
+  if (d & PHASH_DIRECT)
+    return d & ~PHASH_DIRECT;
+  return phash_place(h, d, nslots);
+}
+
+#endif // PHASH_H
@@ -0,0 +1,838 @@
+// pipeline.c
+//
+// Pipelines and redirections. A line is split in place into words, which
+// stay slices of the line: quotes and escapes are removed by moving the
+// rest of the word down, which never makes it longer. Only words with a
+// "$NAME" in them keep their quotes, to be expanded just before they run,
+// so that a parsed script (and its cached copy) stays valid whatever the
+// environment. Everything else a command needs comes from an arena that is
+// reset once it is done.
+//
+// Every stage is started before the shell waits for any of them, so data
+// flows through the whole pipeline at once. Programs are started with
+// spawn.c, their pipe ends and redirections set up as posix_spawn file
+// actions. Builtins are stages too. The first one runs in the shell with
+// fds 0-2 temporarily pointed at its pipes and files, which costs no process
+// at all; any other, and one in the background, is a new process of the
+// shell started the same way as a program, so that none waits for another.
+// It is never a fork of the shell, whose watcher and search threads may
+// hold a lock at that moment that nothing would release in the child. The
+// processes of a pipeline form one job (jobs.c), so they share a process
+// group and are waited for together.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "spawn.h"
+#include "jobs.h"
+#include "status.h"
+
+typedef enum
+{
+  TOKEN_WORD,
+  TOKEN_PIPE,
+  TOKEN_IN,
+  TOKEN_OUT,
+  TOKEN_APPEND,
+  TOKEN_DUP,
+  TOKEN_AMP
+} PipelineTokenKind;
+
+// How each token kind is written, for syntax errors
+static const char *pipeline_token_text[] = {"", "|", "<", ">", ">>", ">&", "&"};
+
+typedef struct
+{
+  PipelineTokenKind kind;
+  char *word; // TOKEN_WORD: a slice of the line
+  int expand; // TOKEN_WORD: still quoted, see PIPELINE_WORD_EXPAND
+  int fd; // Redirections
+  int from; // TOKEN_DUP
+} PipelineToken;
+
+static const char *pipeline_source_name;
+static size_t pipeline_source_line;
+static int pipeline_last_status;
+static void (*pipeline_not_found)(const char *name);
+
+static int pipeline_is_op(char c)
+{
+  return c == '|' || c == '<' || c == '>' || c == '&';
+}
+
+void pipeline_set_source(const char *name, size_t line)
+{
+  pipeline_source_name = name;
+  pipeline_source_line = line;
+}
+
+void pipeline_set_not_found(void (*hook)(const char *name))
+{
+  pipeline_not_found = hook;
+}
+
+static int pipeline_error(const char *message, const char *near)
+{
+  if (pipeline_source_line && pipeline_source_name)
+    fprintf(stderr, "lsh: %s: line %zu: ", pipeline_source_name, pipeline_source_line);
+  else if (pipeline_source_line)
+    fprintf(stderr, "lsh: line %zu: ", pipeline_source_line);
+  else
+    fprintf(stderr, "lsh: ");
+  fprintf(stderr, "%s `%s'\n", message, near);
+  return -1;
+}
+
+static int pipeline_syntax_error(const char *near)
+{
+  return pipeline_error("syntax error near", near);
+}
+
+// Length of the variable name at p, 0 if there is none
+static size_t pipeline_name_length(const char *p)
+{
+  size_t n = 0;
+  if (*p != '_' && (*p < 'A' || *p > 'Z') && (*p < 'a' || *p > 'z'))
+    return 0;
+  while (p[n] == '_' || (p[n] >= 'A' && p[n] <= 'Z') || (p[n] >= 'a' && p[n] <= 'z') || (p[n] >= '0' && p[n] <= '9'))
+    n++;
+  return n;
+}
+
+// Length of the substitution starting at the '$' at p: "$NAME", "${NAME}",
+// "$?" or "$$". 0 means the '$' is an ordinary character, -1 a malformed
+// "${...}".
+static int pipeline_var_length(const char *p)
+{
+  if (p[1] == '?' || p[1] == '$')
+    return 2;
+  if (p[1] == '{')
+  {
+    size_t n = p[2] == '?' || p[2] == '$' ? 1 : pipeline_name_length(p + 2);
+    if (n == 0 || p[2 + n] != '}')
+      return -1;
+    return (int)n + 3;
+  }
+  size_t n = pipeline_name_length(p + 1);
+  return n ? (int)n + 1 : 0;
+}
+
+// Value of the substitution of length len at p; buf holds numbers
+static const char *pipeline_var_value(const char *p, int len, char *buf, size_t size, int status)
+{
+  const char *name = p[1] == '{' ? p + 2 : p + 1;
+  size_t n = p[1] == '{' ? (size_t)len - 3 : (size_t)len - 1;
+  if (*name == '?')
+  {
+    snprintf(buf, size, "%d", status);
+    return buf;
+  }
+  if (*name == '$')
+  {
+    snprintf(buf, size, "%ld", (long)getpid());
+    return buf;
+  }
+  char key[n + 1];
+  memcpy(key, name, n);
+  key[n] = '\0';
+  const char *value = getenv(key);
+  return value ? value : "";
+}
+
+// Step over the '$' at *p and the substitution it starts, if any, setting
+// *expand for one. Returns 0, or -1 after printing an error.
+static int pipeline_scan_var(char **p, int *expand)
+{
+  int len = pipeline_var_length(*p);
+  if (len < 0)
+    return pipeline_error("bad substitution near", *p);
+  *expand |= len > 0;
+  *p += len > 0 ? len : 1;
+  return 0;
+}
+
+// Find the end of the word at p: the first unquoted blank, operator or end
+// of line. Sets *expand if it holds a substitution outside single quotes,
+// *quoted if it holds quotes or escapes. Returns NULL after printing an
+// error for an unterminated quote or a malformed "${...}".
+static char *pipeline_scan_word(char *p, int *expand, int *quoted)
+{
+  while (*p && !strchr(PIPELINE_DELIM, *p) && !pipeline_is_op(*p))
+  {
+    if (*p == '\'')
+    {
+      char *close = strchr(p + 1, '\'');
+      if (!close)
+      {
+        pipeline_error("unexpected end of line looking for matching", "'");
+        return NULL;
+      }
+      *quoted = 1;
+      p = close + 1;
+    }
+    else if (*p == '"')
+    {
+      *quoted = 1;
+      for (p++; *p != '"';)
+      {
+        if (*p == '\0')
+        {
+          pipeline_error("unexpected end of line looking for matching", "\"");
+          return NULL;
+        }
+        if (*p == '\\' && p[1])
+          p += 2;
+        else if (*p == '$')
+        {
+          if (pipeline_scan_var(&p, expand) != 0)
+            return NULL;
+        }
+        else
+          p++;
+      }
+      p++;
+    }
+    else if (*p == '\\')
+    {
+      *quoted = 1;
+      p += p[1] ? 2 : 1;
+    }
+    else if (*p == '$')
+    {
+      if (pipeline_scan_var(&p, expand) != 0)
+        return NULL;
+    }
+    else
+      p++;
+  }
+  return p;
+}
+
+// Copy the word src to dst without its quotes and escapes, substituting
+// variables if expand is set, and return its length. dst may be src itself
+// when nothing is substituted, since the result is then never longer, or
+// NULL to only measure.
+static size_t pipeline_unquote(const char *src, char *dst, int expand, int status)
+{
+  size_t n = 0;
+  int dq = 0;
+  char num[24];
+
+  for (const char *p = src; *p;)
+  {
+    if (*p == '\'' && !dq)
+    {
+      for (p++; *p && *p != '\''; p++, n++)
+      {
+        if (dst)
+          dst[n] = *p;
+      }
+      p += *p != '\0';
+      continue;
+    }
+    if (*p == '"')
+    {
+      dq = !dq;
+      p++;
+      continue;
+    }
+    if (*p == '\\')
+    {
+      p++;
+      if (dq && *p != '"' && *p != '\\' && *p != '$')
+      {
+        if (dst)
+          dst[n] = '\\';
+        n++;
+      }
+      if (*p == '\0')
+        break;
+    }
+    else if (*p == '$' && expand)
+    {
+      int len = pipeline_var_length(p);
+      if (len > 0)
+      {
+        const char *value = pipeline_var_value(p, len, num, sizeof(num), status);
+        size_t vlen = strlen(value);
+        if (dst)
+          memcpy(dst + n, value, vlen);
+        n += vlen;
+        p += len;
+        continue;
+      }
+    }
+    if (dst)
+      dst[n] = *p;
+    n++;
+    p++;
+  }
+  if (dst)
+    dst[n] = '\0';
+  return n;
+}
+
+// Split line into tokens, in place. Words stay where they are in the line,
+// their quotes and escapes removed, except those with substitutions, which
+// keep them for pipeline_expand. Returns 0, or -1 after printing an error.
+static int pipeline_lex(char *line, Arena *arena, PipelineToken **tokens, size_t *count)
+{
+  PipelineToken *toks = NULL;
+  size_t n = 0, cap = 0;
+  char *p = line;
+  char held = 0; // Operator whose character was taken by the end of a word
+  int fd = -1; // Number before a redirection, as in "2>"
+
+  for (;;)
+  {
+    char op = held;
+    int after_word = held != 0; // p is already past the operator
+    held = 0;
+    if (!op)
+    {
+      while (*p && strchr(PIPELINE_DELIM, *p))
+        p++;
+      if (*p == '\0' || *p == '#')
+        break;
+      op = *p;
+    }
+    if (n == cap)
+    {
+      toks = arena_grow(arena, toks, cap * sizeof(PipelineToken), (cap ? cap * 2 : 16) * sizeof(PipelineToken));
+      cap = cap ? cap * 2 : 16;
+    }
+    PipelineToken *t = &toks[n];
+    memset(t, 0, sizeof(*t));
+
+    if (!pipeline_is_op(op))
+    {
+      int expand = 0, quoted = 0;
+      char *word = p;
+      p = pipeline_scan_word(p, &expand, &quoted);
+      if (!p)
+        return -1;
+      char stop = *p;
+      if (stop)
+        *p++ = '\0';
+      if (pipeline_is_op(stop))
+        held = stop;
+      if (!quoted && (stop == '<' || stop == '>') && word[strspn(word, "0123456789")] == '\0')
+      {
+        fd = atoi(word);
+        continue;
+      }
+      if (!expand)
+        pipeline_unquote(word, word, 0, 0);
+      t->kind = TOKEN_WORD;
+      t->word = word;
+      t->expand = expand;
+      n++;
+      continue;
+    }
+
+    if (!after_word)
+      p++;
+    n++;
+    t->fd = fd >= 0 ? fd : op == '<' ? 0 : 1;
+    fd = -1;
+    if (op == '|')
+      t->kind = TOKEN_PIPE;
+    else if (op == '&')
+      t->kind = TOKEN_AMP;
+    else if (op == '<')
+      t->kind = TOKEN_IN;
+    else if (*p == '>')
+    {
+      t->kind = TOKEN_APPEND;
+      p++;
+    }
+    else if (*p == '&')
+    {
+      t->kind = TOKEN_DUP;
+      p++;
+      if (*p < '0' || *p > '9')
+        return pipeline_syntax_error(">&");
+      t->from = (int)strtol(p, &p, 10);
+      if (*p && !strchr(PIPELINE_DELIM, *p) && !pipeline_is_op(*p))
+        return pipeline_syntax_error(">&");
+    }
+    else
+      t->kind = TOKEN_OUT;
+  }
+  *tokens = toks;
+  *count = n;
+  return 0;
+}
+
+int pipeline_parse(char *line, Pipeline *pl, Arena *arena)
+{
+  PipelineToken *toks;
+  size_t ntoks, argc = 0;
+
+  memset(pl, 0, sizeof(*pl));
+  if (pipeline_lex(line, arena, &toks, &ntoks) != 0)
+    return -1;
+  if (ntoks == 0)
+    return 0;
+
+  // Check the grammar and count, so that every array gets its final size
+  pl->nstages = 1;
+  for (size_t i = 0; i < ntoks; i++)
+  {
+    switch (toks[i].kind)
+    {
+    case TOKEN_WORD:
+      argc++;
+      pl->expand |= toks[i].expand;
+      break;
+    case TOKEN_PIPE:
+      if (argc == 0)
+        return pipeline_syntax_error("|");
+      pl->nstages++;
+      argc = 0;
+      break;
+    case TOKEN_AMP:
+      // Only allowed at the very end of the line
+      if (i + 1 < ntoks || argc == 0)
+        return pipeline_syntax_error("&");
+      pl->background = 1;
+      break;
+    case TOKEN_DUP:
+      break;
+    default:
+      if (i + 1 == ntoks)
+        return pipeline_syntax_error("newline");
+      if (toks[i + 1].kind != TOKEN_WORD)
+        return pipeline_syntax_error(pipeline_token_text[toks[i + 1].kind]);
+      pl->expand |= toks[++i].expand;
+      break;
+    }
+  }
+  if (argc == 0)
+  {
+    int redirected = toks[ntoks - 1].kind != TOKEN_PIPE;
+    if (pl->nstages > 1 || redirected)
+      return pipeline_syntax_error(pl->nstages > 1 ? "|" : "newline");
+  }
+
+  pl->stages = arena_alloc(arena, pl->nstages * sizeof(PipelineStage));
+  memset(pl->stages, 0, pl->nstages * sizeof(PipelineStage));
+  PipelineStage *st = pl->stages;
+  for (size_t i = 0; i < ntoks; i++)
+  {
+    if (toks[i].kind == TOKEN_WORD)
+      st->argc++;
+    else if (toks[i].kind == TOKEN_PIPE)
+      st++;
+    else if (toks[i].kind != TOKEN_AMP)
+    {
+      st->nredirs++;
+      i += toks[i].kind != TOKEN_DUP; // The file name
+    }
+  }
+  for (size_t s = 0; s < pl->nstages; s++)
+  {
+    st = &pl->stages[s];
+    st->argv = arena_alloc(arena, (st->argc + 1) * sizeof(char *));
+    st->argv[st->argc] = NULL;
+    st->flags = pl->expand ? arena_alloc(arena, st->argc + 1) : NULL;
+    st->redirs = st->nredirs ? arena_alloc(arena, st->nredirs * sizeof(Redir)) : NULL;
+    st->argc = st->nredirs = 0;
+  }
+
+  st = pl->stages;
+  for (size_t i = 0; i < ntoks; i++)
+  {
+    PipelineToken *t = &toks[i];
+    if (t->kind == TOKEN_WORD)
+    {
+      if (st->flags)
+        st->flags[st->argc] = t->expand ? PIPELINE_WORD_EXPAND : 0;
+      st->argv[st->argc++] = t->word;
+    }
+    else if (t->kind == TOKEN_PIPE)
+      st++;
+    else if (t->kind != TOKEN_AMP)
+    {
+      Redir *r = &st->redirs[st->nredirs++];
+      memset(r, 0, sizeof(*r));
+      r->fd = t->fd;
+      r->from = t->from;
+      r->kind = t->kind == TOKEN_IN ? REDIR_IN : t->kind == TOKEN_OUT ? REDIR_OUT : t->kind == TOKEN_APPEND ? REDIR_APPEND : REDIR_DUP;
+      if (r->kind != REDIR_DUP)
+      {
+        r->path = toks[++i].word;
+        r->expand = toks[i].expand;
+      }
+    }
+  }
+  return 0;
+}
+
+int pipeline_expand(const Pipeline *pl, Pipeline *out, Arena *arena, int status)
+{
+  *out = *pl;
+  out->expand = 0;
+  out->stages = arena_alloc(arena, pl->nstages * sizeof(PipelineStage));
+  for (size_t s = 0; s < pl->nstages; s++)
+  {
+    const PipelineStage *st = &pl->stages[s];
+    PipelineStage *ost = &out->stages[s];
+    *ost = *st;
+    ost->flags = NULL;
+    if (st->flags)
+    {
+      ost->argv = arena_alloc(arena, (st->argc + 1) * sizeof(char *));
+      ost->argc = 0;
+      for (size_t k = 0; k < st->argc; k++)
+      {
+        const char *raw = st->argv[k];
+        if (!(st->flags[k] & PIPELINE_WORD_EXPAND))
+        {
+          ost->argv[ost->argc++] = st->argv[k];
+          continue;
+        }
+        size_t len = pipeline_unquote(raw, NULL, 1, status);
+        // An unquoted substitution that comes out empty is no word at all
+        if (len == 0 && !strpbrk(raw, "'\"\\"))
+          continue;
+        char *word = arena_alloc(arena, len + 1);
+        pipeline_unquote(raw, word, 1, status);
+        ost->argv[ost->argc++] = word;
+      }
+      ost->argv[ost->argc] = NULL;
+      if (ost->argc == 0 && pl->nstages > 1)
+      {
+        fprintf(stderr, "lsh: empty command\n");
+        return -1;
+      }
+    }
+    for (size_t k = 0; k < st->nredirs; k++)
+    {
+      if (!st->redirs[k].expand)
+        continue;
+      if (ost->redirs == st->redirs)
+      {
+        ost->redirs = arena_alloc(arena, st->nredirs * sizeof(Redir));
+        memcpy(ost->redirs, st->redirs, st->nredirs * sizeof(Redir));
+      }
+      size_t len = pipeline_unquote(st->redirs[k].path, NULL, 1, status);
+      char *path = arena_alloc(arena, len + 1);
+      pipeline_unquote(st->redirs[k].path, path, 1, status);
+      ost->redirs[k].path = path;
+      ost->redirs[k].expand = 0;
+    }
+  }
+  // A command that was nothing but empty substitutions does nothing
+  if (out->nstages == 1 && out->stages[0].argc == 0)
+    out->nstages = 0;
+  return 0;
+}
+
+int pipeline_status(void)
+{
+  return pipeline_last_status;
+}
+
+char *pipeline_describe(const Pipeline *pl, Arena *arena)
+{
+  size_t len = 0, need = 1;
+  char *text;
+
+  for (size_t i = 0; i < pl->nstages; i++)
+  {
+    const PipelineStage *st = &pl->stages[i];
+    // Worst case per word: separator, fd number, operator and the word
+    need += 8;
+    for (size_t k = 0; k < st->argc; k++)
+      need += strlen(st->argv[k]) + 1;
+    for (size_t k = 0; k < st->nredirs; k++)
+      need += 32 + (st->redirs[k].path ? strlen(st->redirs[k].path) : 0);
+  }
+  text = arena_alloc(arena, need);
+  text[0] = '\0';
+  for (size_t i = 0; i < pl->nstages; i++)
+  {
+    const PipelineStage *st = &pl->stages[i];
+    if (i > 0)
+      len += sprintf(text + len, " | ");
+    for (size_t k = 0; k < st->argc; k++)
+      len += sprintf(text + len, k ? " %s" : "%s", st->argv[k]);
+    for (size_t k = 0; k < st->nredirs; k++)
+    {
+      const Redir *r = &st->redirs[k];
+      int default_fd = r->kind == REDIR_IN ? 0 : 1;
+      if (r->fd != default_fd || r->kind == REDIR_DUP)
+        len += sprintf(text + len, " %d", r->fd);
+      else
+        len += sprintf(text + len, " ");
+      if (r->kind == REDIR_DUP)
+        len += sprintf(text + len, ">&%d", r->from);
+      else
+        len += sprintf(text + len, "%s %s", r->kind == REDIR_IN ? "<" : r->kind == REDIR_APPEND ? ">>" : ">", r->path);
+    }
+  }
+  return text;
+}
+
+// Open the files a stage redirects to, in files[] (-1 for REDIR_DUP).
+// Returns 0, or -1 after printing why one could not be opened.
+static int pipeline_open_redirs(const PipelineStage *st, int *files)
+{
+  for (size_t k = 0; k < st->nredirs; k++)
+  {
+    const Redir *r = &st->redirs[k];
+    int flags = O_CLOEXEC;
+    files[k] = -1;
+    if (r->kind == REDIR_DUP)
+      continue;
+    if (r->kind == REDIR_IN)
+      flags |= O_RDONLY;
+    else
+      flags |= O_WRONLY | O_CREAT | (r->kind == REDIR_APPEND ? O_APPEND : O_TRUNC);
+    files[k] = open(r->path, flags, 0666);
+    if (files[k] < 0)
+    {
+      fprintf(stderr, "lsh: %s: %s\n", r->path, strerror(errno));
+      while (k > 0)
+      {
+        if (files[--k] >= 0)
+          close(files[k]);
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void pipeline_close_files(const PipelineStage *st, const int *files)
+{
+  for (size_t k = 0; k < st->nredirs; k++)
+  {
+    if (files[k] >= 0)
+      close(files[k]);
+  }
+}
+
+// Point fds 0 and 1 at in and out, then apply the redirections in order
+static int pipeline_apply_fds(const PipelineStage *st, const int *files, int in, int out)
+{
+  if (in != STDIN_FILENO && dup2(in, STDIN_FILENO) < 0)
+    return -1;
+  if (out != STDOUT_FILENO && dup2(out, STDOUT_FILENO) < 0)
+    return -1;
+  for (size_t k = 0; k < st->nredirs; k++)
+  {
+    const Redir *r = &st->redirs[k];
+    if (dup2(r->kind == REDIR_DUP ? r->from : files[k], r->fd) < 0)
+    {
+      fprintf(stderr, "lsh: %d: %s\n", r->kind == REDIR_DUP ? r->from : r->fd, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Redirections of the stage being started, reused from one stage to the
+// next so that starting a program does not allocate
+static SpawnIo pipeline_io;
+static int pipeline_io_ready;
+
+// Start a stage as part of job, running argv: the stage's own words for a
+// program. The first stage of a foreground job takes the terminal from the
+// shell, before its fd 0 is replaced. Returns the pid, or -1 with errno set
+// after printing why the stage could not be started.
+static pid_t pipeline_spawn(const PipelineStage *st, char **argv, const int *files, int in, int out, Job *job, int foreground)
+{
+  SpawnIo *io = &pipeline_io;
+  if (pipeline_io_ready)
+    spawn_io_reset(io);
+  else
+    spawn_io_init(io);
+  pipeline_io_ready = 1;
+  if (jobs_control())
+    spawn_io_pgroup(io, jobs_pgid(job), foreground && jobs_pgid(job) == 0);
+  if (in != STDIN_FILENO)
+    spawn_io_dup(io, in, STDIN_FILENO);
+  if (out != STDOUT_FILENO)
+    spawn_io_dup(io, out, STDOUT_FILENO);
+  for (size_t k = 0; k < st->nredirs; k++)
+  {
+    const Redir *r = &st->redirs[k];
+    spawn_io_dup(io, r->kind == REDIR_DUP ? r->from : files[k], r->fd);
+  }
+  pid_t pid = spawn_start(argv, io);
+  if (pid < 0)
+  {
+    int err = errno;
+    fprintf(stderr, "lsh: %s: %s\n", st->argv[0], strerror(err));
+    if (err == ENOENT && argv == st->argv && pipeline_not_found)
+      pipeline_not_found(st->argv[0]);
+    errno = err;
+  }
+  else
+    jobs_add_process(job, pid);
+  return pid;
+}
+
+// The words that start a builtin stage as a process of its own:
+// PIPELINE_BUILTIN_OPTION before the stage's words
+static char **pipeline_builtin_argv(const PipelineStage *st, Arena *arena)
+{
+  static char self[] = "/proc/self/exe", option[] = PIPELINE_BUILTIN_OPTION;
+  char **argv = arena_alloc(arena, (st->argc + 3) * sizeof(char *));
+  argv[0] = self;
+  argv[1] = option;
+  memcpy(argv + 2, st->argv, (st->argc + 1) * sizeof(char *));
+  return argv;
+}
+
+// Run a builtin in the shell with its fds redirected, then put them back.
+// Its exit status is left in builtin_status.
+static int pipeline_run_here(const PipelineStage *st, PipelineBuiltin fn, int in, int out)
+{
+  int files[st->nredirs + 1];
+  int saved[3];
+  int rc = 1;
+
+  builtin_status = 1;
+  if (pipeline_open_redirs(st, files) != 0)
+    return 1;
+  fflush(stdout);
+  fflush(stderr);
+  for (int fd = 0; fd < 3; fd++)
+    saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+
+  // A reader that stops early must not kill the shell
+  void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+  if (pipeline_apply_fds(st, files, in, out) == 0)
+  {
+    builtin_status = 0;
+    rc = fn(st->argv);
+  }
+  fflush(stdout);
+  fflush(stderr);
+  signal(SIGPIPE, old_pipe);
+
+  for (int fd = 0; fd < 3; fd++)
+  {
+    if (saved[fd] >= 0)
+    {
+      dup2(saved[fd], fd);
+      close(saved[fd]);
+    }
+  }
+  clearerr(stdout); // A closed pipe leaves an error behind
+  pipeline_close_files(st, files);
+  return rc;
+}
+
+int pipeline_run(const Pipeline *pl, PipelineBuiltin (*find_builtin)(const char *name), Arena *arena)
+{
+  size_t n = pl->nstages;
+  if (n == 0)
+    return 1;
+
+  PipelineBuiltin *builtins = arena_alloc(arena, n * sizeof(PipelineBuiltin));
+  int (*pipes)[2] = arena_alloc(arena, n * sizeof(int[2]));
+  size_t here = n; // The stage run in the shell, if any
+  int status = 1;
+  int last = 0, last_ran = 0; // Status of the last stage if it is not a process
+  Job *job;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    builtins[i] = find_builtin ? find_builtin(pl->stages[i].argv[0]) : NULL;
+    if (builtins[i] && here == n)
+      here = i;
+  }
+  if (pl->background)
+    here = n;
+
+  for (size_t i = 0; i + 1 < n; i++)
+  {
+    if (pipe2(pipes[i], O_CLOEXEC) != 0)
+    {
+      perror("lsh: pipe");
+      while (i > 0)
+      {
+        i--;
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+      }
+      pipeline_last_status = 1;
+      return 1;
+    }
+  }
+
+  job = jobs_new(pipeline_describe(pl, arena));
+
+  fflush(stdout);
+  fflush(stderr);
+  for (size_t i = 0; i < n; i++)
+  {
+    const PipelineStage *st = &pl->stages[i];
+    int in = i > 0 ? pipes[i - 1][0] : STDIN_FILENO;
+    int out = i + 1 < n ? pipes[i][1] : STDOUT_FILENO;
+    int files[st->nredirs + 1];
+
+    pid_t pid;
+    if (i == here)
+      continue;
+    if (pipeline_open_redirs(st, files) != 0)
+    {
+      if (i + 1 == n)
+        last = 1;
+      continue;
+    }
+    char **argv = builtins[i] ? pipeline_builtin_argv(st, arena) : st->argv;
+    pid = pipeline_spawn(st, argv, files, in, out, job, !pl->background);
+    if (i + 1 == n)
+    {
+      last_ran = pid > 0;
+      last = builtins[i] ? 1 : spawn_error_status(errno);
+    }
+    pipeline_close_files(st, files);
+  }
+
+  // The shell only keeps the pipe ends of the stage it runs itself; every
+  // other one must go so that readers see end of file
+  for (size_t i = 0; i + 1 < n; i++)
+  {
+    if (here != i + 1)
+      close(pipes[i][0]);
+    if (here != i)
+      close(pipes[i][1]);
+  }
+  if (here < n)
+  {
+    int in = here > 0 ? pipes[here - 1][0] : STDIN_FILENO;
+    int out = here + 1 < n ? pipes[here][1] : STDOUT_FILENO;
+    status = pipeline_run_here(&pl->stages[here], builtins[here], in, out);
+    if (here + 1 == n)
+      last = builtin_status;
+    if (in != STDIN_FILENO)
+      close(in);
+    if (out != STDOUT_FILENO)
+      close(out);
+    if (n > 1)
+      status = 1; // Only a builtin on its own can end the shell
+  }
+
+  if (pl->background)
+  {
+    jobs_background(job);
+    pipeline_last_status = 0;
+  }
+  else
+  {
+    int fg = jobs_foreground(job);
+    pipeline_last_status = last_ran ? fg : last;
+  }
+  return status;
+}
@@ -0,0 +1,103 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include "arena.h"
+
+// Characters that separate words on a command line
+#define PIPELINE_DELIM " \t\r\n\a"
+
+typedef enum
+{
+  REDIR_IN,     // fd < path
+  REDIR_OUT,    // fd > path
+  REDIR_APPEND, // fd >> path
+  REDIR_DUP     // fd >& from
+} RedirKind;
+
+typedef struct
+{
+  RedirKind kind;
+  int fd;
+  int from; // REDIR_DUP only
+  const char *path; // Points into the parsed line
+  int expand; // path still needs pipeline_expand
+} Redir;
+
+// PipelineStage.flags of a word that has kept its quotes because it holds a
+// substitution, "$NAME", "${NAME}", "$?" (the last exit status) or "$$"
+#define PIPELINE_WORD_EXPAND 1
+
+// One command of a pipeline, with its redirections in the order given
+typedef struct
+{
+  char **argv; // NULL terminated, pointing into the parsed line
+  size_t argc;
+  unsigned char *flags; // Per word, or NULL if no word needs expanding
+  Redir *redirs;
+  size_t nredirs;
+} PipelineStage;
+
+typedef struct
+{
+  PipelineStage *stages;
+  size_t nstages; // 0 for an empty line
+  int background; // Ended with '&'
+  int expand; // Some word must go through pipeline_expand before running
+} Pipeline;
+
+typedef int (*PipelineBuiltin)(char **args);
+
+// A builtin stage that cannot run in the shell itself is started as
+// "<the shell> --builtin <name> <args>...", which must run that one builtin
+// and exit with its status. The shell has threads of its own by then, so a
+// plain fork could leave the child stuck on a lock one of them held.
+#define PIPELINE_BUILTIN_OPTION "--builtin"
+
+// Split line, in place, into commands separated by '|', each with its
+// arguments and redirections: "< f", "> f", ">> f", and "N>&M" (any of them
+// may start with a file descriptor number, as in "2> errors"). A trailing
+// '&' runs the pipeline in the background, and an unquoted '#' starting a
+// word begins a comment. Words may be quoted: nothing is special between
+// single quotes; between double quotes, only "$" substitutions and the
+// escapes \", \\ and \$. Outside quotes a backslash escapes any character.
+// The words point into line; the arrays come from arena. Returns 0, or -1
+// after printing a syntax error.
+int pipeline_parse(char *line, Pipeline *pl, Arena *arena);
+
+// Substitute the variables of a pipeline that has pl->expand set, giving
+// out, whose new words come from arena. status is what "$?" expands to.
+// An unquoted substitution that is empty does not make a word. Returns 0,
+// or -1 after printing an error.
+int pipeline_expand(const Pipeline *pl, Pipeline *out, Arena *arena, int status);
+
+// Where the lines parsed next come from, for syntax errors: they are then
+// reported as "lsh: name: line N: ...". Line 0 (the default) means input
+// typed at the prompt.
+void pipeline_set_source(const char *name, size_t line);
+
+// Called with the command name, after the error is printed, when a program
+// stage is not found; NULL (the default) for nothing more
+void pipeline_set_not_found(void (*hook)(const char *name));
+
+// Run every stage at once, connected by pipes, as one job (see jobs.h), and
+// wait for all of them unless the pipeline runs in the background.
+// find_builtin maps a command name to its builtin, or NULL for a program; it
+// may itself be NULL when every stage is a program. Builtins take part like
+// any other stage: the first one of a foreground pipeline runs in the shell
+// itself, with its input and output pointed at the pipes and files, and any
+// other is a new process of the shell (see PIPELINE_BUILTIN_OPTION). The
+// pipeline must have been expanded. Scratch memory comes from arena.
+// Returns 0 if a builtin asked the shell to exit, 1 otherwise.
+int pipeline_run(const Pipeline *pl, PipelineBuiltin (*find_builtin)(const char *name), Arena *arena);
+
+// Exit status of the last pipeline run: that of its last command (for a
+// builtin, what it left in builtin_status; see status.h), 0 for a pipeline
+// left in the background, 127 if the command does not exist and 126 if it
+// could not be run
+int pipeline_status(void);
+
+// The pipeline as text, for job listings, allocated from arena
+char *pipeline_describe(const Pipeline *pl, Arena *arena);
+
+#endif // PIPELINE_H
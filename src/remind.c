@@ -0,0 +1,699 @@
+// remind.c
+//
+// Reminders for the remind builtin. Pending reminders are kept in a binary
+// min-heap ordered by due time, so the next one due is always at the top and
+// scheduling or cancelling one costs O(log n); an open-addressing table from
+// id to reminder finds the one to cancel. One timerfd is armed for the top
+// of the heap and lineedit.c watches it, so a reminder comes up at the
+// prompt when it is due rather than after the next command.
+//
+// The file starts with a RemindHeader, then holds a log of records, each a
+// RemindRecord followed by its task padded to REMIND_ALIGN bytes:
+//
+//   {when, id, len}, task    schedules task at when
+//   {0, id, REMIND_DONE}     the reminder was delivered or cancelled
+//
+// As with the definitions (defstore.c), the file is read once and then only
+// what was appended since; changes are appended under an flock so several
+// shells share one set of reminders, and the shell that delivers a reminder
+// records it, so no other shell shows it again. Once dead records are most
+// of the file it is rewritten with the pending reminders alone.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "remind.h"
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#define REMIND_HAVE_TIMERFD 1
+#endif
+
+#define REMIND_MAGIC "PSSREMD" // With its NUL, 8 bytes
+#define REMIND_VERSION 1
+#define REMIND_ALIGN 8
+#define REMIND_DONE UINT32_MAX
+#define REMIND_INITIAL_CAPACITY 64
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t next_id; // Ids below this were given out before the last rewrite
+} RemindHeader;
+
+typedef struct
+{
+  int64_t when;
+  uint32_t id;
+  uint32_t len; // Of the task that follows, or REMIND_DONE
+} RemindRecord;
+
+typedef struct
+{
+  int64_t when;
+  uint32_t id;
+  uint32_t heap_pos;
+  uint32_t len;
+  char task[]; // NUL terminated
+} Reminder;
+
+static char *remind_path;
+static int remind_file = -1;
+static dev_t remind_dev;
+static ino_t remind_ino;
+static size_t remind_read_off; // Bytes of whole records read so far
+static size_t remind_dead; // Bytes of those that no longer count
+static uint32_t remind_next_id = 1;
+
+static Reminder **remind_heap;
+static size_t remind_heap_len, remind_heap_cap;
+// By id; NULL marks an empty slot
+static Reminder **remind_ids;
+static size_t remind_ids_cap;
+
+static int remind_timer = -1;
+static int64_t remind_armed = INT64_MIN; // Time the timer is set for, 0 for none
+
+static void *remind_xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static size_t remind_record_size(uint32_t len)
+{
+  if (len == REMIND_DONE)
+    return sizeof(RemindRecord);
+  return sizeof(RemindRecord) + ((len + REMIND_ALIGN - 1) & ~(size_t)(REMIND_ALIGN - 1));
+}
+
+static int remind_before(const Reminder *a, const Reminder *b)
+{
+  return a->when < b->when || (a->when == b->when && a->id < b->id);
+}
+
+static void remind_heap_set(size_t pos, Reminder *r)
+{
+  remind_heap[pos] = r;
+  r->heap_pos = (uint32_t)pos;
+}
+
+static void remind_sift_up(size_t pos)
+{
+  Reminder *r = remind_heap[pos];
+  while (pos > 0 && remind_before(r, remind_heap[(pos - 1) / 2]))
+  {
+    remind_heap_set(pos, remind_heap[(pos - 1) / 2]);
+    pos = (pos - 1) / 2;
+  }
+  remind_heap_set(pos, r);
+}
+
+static void remind_sift_down(size_t pos)
+{
+  Reminder *r = remind_heap[pos];
+  for (;;)
+  {
+    size_t child = 2 * pos + 1;
+    if (child >= remind_heap_len)
+      break;
+    if (child + 1 < remind_heap_len && remind_before(remind_heap[child + 1], remind_heap[child]))
+      child++;
+    if (!remind_before(remind_heap[child], r))
+      break;
+    remind_heap_set(pos, remind_heap[child]);
+    pos = child;
+  }
+  remind_heap_set(pos, r);
+}
+
+static void remind_heap_push(Reminder *r)
+{
+  if (remind_heap_len == remind_heap_cap)
+  {
+    remind_heap_cap = remind_heap_cap ? remind_heap_cap * 2 : REMIND_INITIAL_CAPACITY;
+    remind_heap = remind_xrealloc(remind_heap, remind_heap_cap * sizeof(Reminder *));
+  }
+  remind_heap[remind_heap_len++] = r;
+  remind_sift_up(remind_heap_len - 1);
+}
+
+static void remind_heap_remove(Reminder *r)
+{
+  size_t pos = r->heap_pos;
+  Reminder *last = remind_heap[--remind_heap_len];
+  if (last == r)
+    return;
+  remind_heap_set(pos, last);
+  if (pos > 0 && remind_before(last, remind_heap[(pos - 1) / 2]))
+    remind_sift_up(pos);
+  else
+    remind_sift_down(pos);
+}
+
+static size_t remind_id_home(uint32_t id)
+{
+  return (id * 2654435761u) & (remind_ids_cap - 1);
+}
+
+// Slot holding id, or the empty slot where it would go
+static size_t remind_id_find(uint32_t id)
+{
+  size_t pos = remind_id_home(id);
+  while (remind_ids[pos] != NULL && remind_ids[pos]->id != id)
+    pos = (pos + 1) & (remind_ids_cap - 1);
+  return pos;
+}
+
+static void remind_ids_grow(void)
+{
+  Reminder **old = remind_ids;
+  size_t old_cap = remind_ids_cap;
+
+  remind_ids_cap = old_cap ? old_cap * 2 : REMIND_INITIAL_CAPACITY;
+  remind_ids = calloc(remind_ids_cap, sizeof(Reminder *));
+  if (!remind_ids)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    if (old[i] != NULL)
+      remind_ids[remind_id_find(old[i]->id)] = old[i];
+  }
+  free(old);
+}
+
+// Empty the slot at pos, moving later slots of the same probe run back so
+// that no lookup has to step over a hole
+static void remind_id_remove(size_t pos)
+{
+  size_t mask = remind_ids_cap - 1, next = (pos + 1) & mask;
+  while (remind_ids[next] != NULL)
+  {
+    size_t home = remind_id_home(remind_ids[next]->id);
+    if (((next - home) & mask) >= ((next - pos) & mask))
+    {
+      remind_ids[pos] = remind_ids[next];
+      pos = next;
+    }
+    next = (next + 1) & mask;
+  }
+  remind_ids[pos] = NULL;
+}
+
+static Reminder *remind_get(uint32_t id)
+{
+  return remind_ids_cap ? remind_ids[remind_id_find(id)] : NULL;
+}
+
+// Take r out of the heap and the id table; the caller frees it
+static void remind_unlink(Reminder *r)
+{
+  remind_heap_remove(r);
+  remind_id_remove(remind_id_find(r->id));
+  remind_dead += remind_record_size(r->len);
+}
+
+// Take in one record whose task is at task
+static void remind_apply(const RemindRecord *rec, const char *task)
+{
+  Reminder *r = remind_get(rec->id);
+  if (r != NULL)
+  {
+    remind_unlink(r);
+    free(r);
+  }
+  if (rec->id >= remind_next_id)
+    remind_next_id = rec->id + 1;
+  if (rec->len == REMIND_DONE)
+  {
+    remind_dead += sizeof(RemindRecord);
+    return;
+  }
+
+  r = remind_xrealloc(NULL, sizeof(Reminder) + rec->len + 1);
+  r->when = rec->when;
+  r->id = rec->id;
+  r->len = rec->len;
+  memcpy(r->task, task, rec->len);
+  r->task[rec->len] = '\0';
+  if ((remind_heap_len + 1) * 10 > remind_ids_cap * 7)
+    remind_ids_grow();
+  remind_ids[remind_id_find(r->id)] = r;
+  remind_heap_push(r);
+}
+
+static void remind_reset(void)
+{
+  for (size_t i = 0; i < remind_heap_len; i++)
+    free(remind_heap[i]);
+  remind_heap_len = 0;
+  if (remind_ids)
+    memset(remind_ids, 0, remind_ids_cap * sizeof(Reminder *));
+  if (remind_file >= 0)
+    close(remind_file);
+  remind_file = -1;
+  remind_read_off = remind_dead = 0;
+  remind_next_id = 1;
+}
+
+static int remind_read_all(int fd, char *buf, size_t len, off_t off)
+{
+  while (len > 0)
+  {
+    ssize_t n = pread(fd, buf, len, off);
+    if (n <= 0)
+    {
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n == 0)
+        errno = EIO; // Shorter than it was a moment ago
+      return -1;
+    }
+    buf += n;
+    len -= n;
+    off += n;
+  }
+  return 0;
+}
+
+static int remind_write_all(int fd, const char *buf, size_t len, off_t off)
+{
+  while (len > 0)
+  {
+    ssize_t n = pwrite(fd, buf, len, off);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+    off += n;
+  }
+  return 0;
+}
+
+// Bring the reminders up to date with the file: read what was appended
+// since last time, or all of it again if it was replaced or shrank. A
+// missing file means no reminders; with create set it is created.
+static int remind_load(int create)
+{
+  struct stat st;
+
+  if (stat(remind_path, &st) != 0)
+  {
+    if (errno != ENOENT)
+      return -1;
+    remind_reset();
+    if (!create)
+      return 0;
+  }
+  if (remind_file < 0 || st.st_dev != remind_dev || st.st_ino != remind_ino ||
+      (size_t)st.st_size < remind_read_off)
+  {
+    remind_reset();
+    remind_file = open(remind_path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+    if (remind_file < 0 || fstat(remind_file, &st) != 0)
+    {
+      int saved = errno;
+      remind_reset();
+      errno = saved;
+      return saved == ENOENT ? 0 : -1;
+    }
+    remind_dev = st.st_dev;
+    remind_ino = st.st_ino;
+  }
+  if ((size_t)st.st_size == remind_read_off)
+    return 0;
+
+  if (remind_read_off == 0)
+  {
+    RemindHeader h;
+    if ((size_t)st.st_size < sizeof(h))
+      return 0; // Still being created
+    if (remind_read_all(remind_file, (char *)&h, sizeof(h), 0) != 0)
+      return -1;
+    if (memcmp(h.magic, REMIND_MAGIC, sizeof(h.magic)) != 0 || h.version != REMIND_VERSION)
+    {
+      errno = EBADMSG;
+      return -1;
+    }
+    if (h.next_id > remind_next_id)
+      remind_next_id = h.next_id;
+    remind_read_off = sizeof(h);
+  }
+
+  size_t len = st.st_size - remind_read_off, off = 0;
+  int bad = 0;
+  char *buf = remind_xrealloc(NULL, len ? len : 1);
+  if (remind_read_all(remind_file, buf, len, remind_read_off) != 0)
+  {
+    free(buf);
+    return -1;
+  }
+  while (len - off >= sizeof(RemindRecord))
+  {
+    RemindRecord rec;
+    memcpy(&rec, buf + off, sizeof(rec));
+    size_t size = remind_record_size(rec.len);
+    if (rec.len != REMIND_DONE && rec.len > REMIND_MAX_TASK)
+    {
+      bad = 1; // Not a record this version wrote
+      break;
+    }
+    if (size > len - off)
+      break; // Still being written
+    remind_apply(&rec, buf + off + sizeof(rec));
+    off += size;
+  }
+  free(buf);
+  remind_read_off += off;
+  if (bad)
+  {
+    errno = EBADMSG;
+    return -1;
+  }
+  return 0;
+}
+
+// Point the timer at the soonest reminder
+static void remind_arm(void)
+{
+#ifdef REMIND_HAVE_TIMERFD
+  int64_t when = remind_heap_len ? remind_heap[0]->when : 0;
+  if (remind_timer < 0 || when == remind_armed)
+    return;
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  // A time of 0 would disarm the timer; anything that old is due anyway
+  its.it_value.tv_sec = remind_heap_len ? (when > 0 ? when : 1) : 0;
+  // TFD_TIMER_CANCEL_ON_SET wakes us as well if the clock is set, when the
+  // reminder may have become due
+  if (timerfd_settime(remind_timer, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) == 0)
+    remind_armed = when;
+#endif
+}
+
+int remind_open(void)
+{
+  if (remind_path == NULL)
+  {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+      strcpy(cwd, ".");
+    remind_path = remind_xrealloc(NULL, strlen(cwd) + 1 + strlen(REMIND_FILE_NAME) + 1);
+    sprintf(remind_path, "%s/%s", cwd, REMIND_FILE_NAME);
+#ifdef REMIND_HAVE_TIMERFD
+    remind_timer = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+  }
+  int rc = remind_load(0);
+  remind_arm();
+  return rc;
+}
+
+// Take the file lock, with the reminders up to date. A file rewritten by
+// another shell is opened afresh first, so nothing is written to the old one.
+static int remind_lock(void)
+{
+  struct stat fd_st, path_st;
+
+  for (int tries = 0; tries < 3; tries++)
+  {
+    if (remind_load(1) != 0 || remind_file < 0)
+      return -1;
+    if (flock(remind_file, LOCK_EX) != 0)
+      return -1;
+    if (fstat(remind_file, &fd_st) != 0 || stat(remind_path, &path_st) != 0 ||
+        fd_st.st_ino != path_st.st_ino || fd_st.st_dev != path_st.st_dev)
+    {
+      flock(remind_file, LOCK_UN);
+      remind_reset();
+      continue;
+    }
+    // What came in while waiting for the lock
+    if (remind_load(0) != 0)
+    {
+      int saved = errno;
+      flock(remind_file, LOCK_UN);
+      errno = saved;
+      return -1;
+    }
+    // Nobody else is writing: anything past the last whole record was cut
+    // short by a crash
+    if ((size_t)fd_st.st_size > remind_read_off && remind_read_off > 0)
+      ftruncate(remind_file, remind_read_off);
+    if (remind_read_off == 0)
+    {
+      RemindHeader h;
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, REMIND_MAGIC, sizeof(h.magic));
+      h.version = REMIND_VERSION;
+      h.next_id = remind_next_id;
+      if (ftruncate(remind_file, 0) != 0 || remind_write_all(remind_file, (char *)&h, sizeof(h), 0) != 0)
+      {
+        int saved = errno;
+        flock(remind_file, LOCK_UN);
+        errno = saved;
+        return -1;
+      }
+      remind_read_off = sizeof(h);
+    }
+    return 0;
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+// Write the pending reminders alone to a new file and swap it in for the
+// old one. Called with the lock held; other shells see a new file and read
+// it afresh.
+static void remind_compact(void)
+{
+  size_t len = strlen(remind_path);
+  char *tmp = remind_xrealloc(NULL, len + 5);
+  memcpy(tmp, remind_path, len);
+  strcpy(tmp + len, ".tmp");
+
+  size_t size = sizeof(RemindHeader);
+  for (size_t i = 0; i < remind_heap_len; i++)
+    size += remind_record_size(remind_heap[i]->len);
+  char *buf = calloc(1, size);
+  int fd = buf ? open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : -1;
+  if (fd >= 0)
+  {
+    RemindHeader *h = (RemindHeader *)buf;
+    memcpy(h->magic, REMIND_MAGIC, sizeof(h->magic));
+    h->version = REMIND_VERSION;
+    h->next_id = remind_next_id;
+    size_t off = sizeof(RemindHeader);
+    for (size_t i = 0; i < remind_heap_len; i++)
+    {
+      const Reminder *r = remind_heap[i];
+      RemindRecord rec = {r->when, r->id, r->len};
+      memcpy(buf + off, &rec, sizeof(rec));
+      memcpy(buf + off + sizeof(rec), r->task, r->len);
+      off += remind_record_size(r->len);
+    }
+    struct stat st;
+    if (remind_write_all(fd, buf, size, 0) == 0 && fsync(fd) == 0 && fstat(fd, &st) == 0 &&
+        rename(tmp, remind_path) == 0)
+    {
+      // Carry on with the new file; what is in memory is what it holds
+      flock(remind_file, LOCK_UN);
+      close(remind_file);
+      remind_file = fd;
+      remind_dev = st.st_dev;
+      remind_ino = st.st_ino;
+      remind_read_off = size;
+      remind_dead = 0;
+      fd = -1;
+    }
+    else
+      unlink(tmp);
+    if (fd >= 0)
+      close(fd);
+  }
+  free(buf);
+  free(tmp);
+}
+
+static void remind_unlock(void)
+{
+  if (remind_dead >= REMIND_COMPACT_MIN && remind_dead * 2 > remind_read_off)
+    remind_compact();
+  flock(remind_file, LOCK_UN);
+}
+
+// Append records under the lock and take them in
+static int remind_append(const char *buf, size_t len)
+{
+  if (remind_write_all(remind_file, buf, len, remind_read_off) != 0)
+    return -1;
+  return remind_load(0);
+}
+
+int remind_add(time_t when, const char *task, uint32_t *id)
+{
+  size_t len = strlen(task);
+  if (len == 0 || len > REMIND_MAX_TASK)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (remind_open() != 0 || remind_lock() != 0)
+    return -1;
+
+  size_t size = remind_record_size((uint32_t)len);
+  char *buf = remind_xrealloc(NULL, size);
+  RemindRecord rec = {when, remind_next_id, (uint32_t)len};
+  memset(buf, 0, size);
+  memcpy(buf, &rec, sizeof(rec));
+  memcpy(buf + sizeof(rec), task, len);
+  int rc = remind_append(buf, size);
+  int saved = errno;
+  remind_unlock();
+  free(buf);
+  remind_arm();
+  if (rc != 0)
+  {
+    errno = saved;
+    return -1;
+  }
+  *id = rec.id;
+  return 0;
+}
+
+int remind_cancel(uint32_t id)
+{
+  if (remind_open() != 0)
+    return -1;
+  if (remind_get(id) == NULL)
+    return 1;
+  if (remind_lock() != 0)
+    return -1;
+  int rc = 1;
+  if (remind_get(id) != NULL) // Not delivered by another shell meanwhile
+  {
+    RemindRecord rec = {0, id, REMIND_DONE};
+    rc = remind_append((const char *)&rec, sizeof(rec));
+  }
+  int saved = errno;
+  remind_unlock();
+  remind_arm();
+  errno = saved;
+  return rc;
+}
+
+size_t remind_count(void)
+{
+  return remind_heap_len;
+}
+
+static int remind_compare(const void *a, const void *b)
+{
+  const Reminder *x = *(Reminder *const *)a, *y = *(Reminder *const *)b;
+  return remind_before(x, y) ? -1 : remind_before(y, x);
+}
+
+void remind_each(void (*fn)(const RemindEntry *e, void *ctx), void *ctx)
+{
+  if (remind_heap_len == 0)
+    return;
+  Reminder **sorted = remind_xrealloc(NULL, remind_heap_len * sizeof(Reminder *));
+  memcpy(sorted, remind_heap, remind_heap_len * sizeof(Reminder *));
+  qsort(sorted, remind_heap_len, sizeof(Reminder *), remind_compare);
+  for (size_t i = 0; i < remind_heap_len; i++)
+  {
+    RemindEntry e = {sorted[i]->id, (time_t)sorted[i]->when, sorted[i]->task};
+    fn(&e, ctx);
+  }
+  free(sorted);
+}
+
+int remind_fd(void)
+{
+  return remind_timer;
+}
+
+static int64_t remind_now(void)
+{
+  // Not time(), which may read a coarser clock than the timer's and so lag
+  // behind it by a tick
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec;
+}
+
+size_t remind_deliver(void (*fn)(const RemindEntry *e, void *ctx), void *ctx)
+{
+#ifdef REMIND_HAVE_TIMERFD
+  // Clear the timer. Whether it fired or the clock was set, it has to be
+  // set again.
+  uint64_t expirations;
+  if (remind_timer >= 0 && read(remind_timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN &&
+      errno != ECANCELED)
+    return 0;
+  remind_armed = INT64_MIN;
+#endif
+  if (remind_path == NULL || remind_open() != 0 || remind_heap_len == 0 || remind_heap[0]->when > remind_now())
+  {
+    remind_arm();
+    return 0;
+  }
+  if (remind_lock() != 0)
+  {
+    remind_arm();
+    return 0;
+  }
+
+  // Take every due reminder off the heap, soonest first, and record that
+  // they were delivered before handing them out
+  int64_t now = remind_now();
+  size_t n = 0, cap = 0;
+  Reminder **due = NULL;
+  RemindRecord *recs = NULL;
+  while (remind_heap_len > 0 && remind_heap[0]->when <= now)
+  {
+    if (n == cap)
+    {
+      cap = cap ? cap * 2 : 16;
+      due = remind_xrealloc(due, cap * sizeof(Reminder *));
+      recs = remind_xrealloc(recs, cap * sizeof(RemindRecord));
+    }
+    due[n] = remind_heap[0];
+    recs[n] = (RemindRecord){0, due[n]->id, REMIND_DONE};
+    remind_unlink(due[n]);
+    n++;
+  }
+  if (n > 0)
+    remind_append((const char *)recs, n * sizeof(RemindRecord));
+  remind_unlock();
+  remind_arm();
+
+  for (size_t i = 0; i < n; i++)
+  {
+    RemindEntry e = {due[i]->id, (time_t)due[i]->when, due[i]->task};
+    fn(&e, ctx);
+    free(due[i]);
+  }
+  free(due);
+  free(recs);
+  return n;
+}
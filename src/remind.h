@@ -0,0 +1,55 @@
+#ifndef REMIND_H
+#define REMIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// File the reminders are kept in, in the directory the shell started in
+#define REMIND_FILE_NAME ".pss_reminders"
+// Longest task text, in bytes
+#define REMIND_MAX_TASK 1024
+// The file is rewritten without its delivered and cancelled reminders once
+// they take at least this many bytes and more than half of it
+#define REMIND_COMPACT_MIN (64 * 1024)
+
+// One pending reminder. task is NUL terminated and stays valid until the
+// next remind call.
+typedef struct
+{
+  uint32_t id;
+  time_t when;
+  const char *task;
+} RemindEntry;
+
+// Load the reminders from REMIND_FILE_NAME in the current directory, which
+// is used from then on whatever directory the shell moves to. Safe to call
+// again. Returns 0, or -1 with errno set (EBADMSG if the file is not one
+// this version wrote). Every function that reads the file fails the same
+// way.
+int remind_open(void);
+
+// Schedule task at when, storing its id in *id. Returns 0, or -1 with errno
+// set (EINVAL for an empty task or one longer than REMIND_MAX_TASK).
+int remind_add(time_t when, const char *task, uint32_t *id);
+
+// Drop a pending reminder. Returns 0, 1 if there is none with that id, or
+// -1 with errno set.
+int remind_cancel(uint32_t id);
+
+// Pending reminders: how many there are, and each of them, soonest first
+size_t remind_count(void);
+void remind_each(void (*fn)(const RemindEntry *e, void *ctx), void *ctx);
+
+// A descriptor that becomes readable when the soonest reminder is due, for
+// poll(); -1 if the system has no timerfd, in which case only calls to
+// remind_deliver bring reminders up.
+int remind_fd(void);
+
+// Hand every reminder that is due to fn, soonest first, and remove it. The
+// file is read for what other shells have added, cancelled or delivered
+// first, so each reminder is delivered by one shell only. Returns how many
+// were delivered.
+size_t remind_deliver(void (*fn)(const RemindEntry *e, void *ctx), void *ctx);
+
+#endif // REMIND_H
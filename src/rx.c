@@ -0,0 +1,956 @@
+// rx.c
+//
+// Regular expressions for "search -e". A pattern is parsed into a small tree,
+// compiled into a Thompson NFA, and matched through a DFA whose states are
+// built lazily from sets of NFA states the first time a byte is seen in a
+// given state. There is no backtracking, so matching is linear in the input;
+// the DFA cache is bounded and simply rebuilt when it fills up.
+//
+// Matching is line oriented, like the literal search: a line matches if any
+// substring of it matches. ^ and $ anchor at line boundaries.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "rx.h"
+
+/*
+  Syntax tree.
+*/
+
+enum
+{
+  NODE_EMPTY,
+  NODE_CLASS, // Any byte of a 256-bit set
+  NODE_BOL,
+  NODE_EOL,
+  NODE_CAT,
+  NODE_ALT,
+  NODE_REPEAT // min..max copies; max < 0 means unbounded
+};
+
+typedef struct Node
+{
+  int type;
+  int cls;
+  int min, max;
+  struct Node *left, *right;
+} Node;
+
+typedef struct
+{
+  uint32_t bits[8];
+} ByteSet;
+
+enum
+{
+  OP_CLASS,
+  OP_SPLIT,
+  OP_JMP,
+  OP_BOL,
+  OP_EOL,
+  OP_MATCH
+};
+
+typedef struct
+{
+  int op;
+  int out, out1;
+  int cls;
+} Inst;
+
+struct RxProg
+{
+  Inst *insts;
+  int ninsts;
+  int start;
+  ByteSet *classes;
+  int nclasses;
+  char *prefix;
+  size_t prefix_len;
+};
+
+typedef struct
+{
+  const char *p;
+  const char *error;
+  Node **nodes; // Every node allocated, for cleanup
+  int nnodes, cap_nodes;
+  ByteSet *classes;
+  int nclasses, cap_classes;
+} Parser;
+
+static void set_add(ByteSet *s, unsigned char c)
+{
+  s->bits[c >> 5] |= 1u << (c & 31);
+}
+
+static int set_has(const ByteSet *s, unsigned char c)
+{
+  return (s->bits[c >> 5] >> (c & 31)) & 1;
+}
+
+static void set_add_range(ByteSet *s, unsigned char lo, unsigned char hi)
+{
+  for (int c = lo; c <= hi; c++)
+    set_add(s, (unsigned char)c);
+}
+
+static Node *new_node(Parser *ps, int type)
+{
+  Node *n = calloc(1, sizeof(Node));
+  if (!n || (ps->nnodes == ps->cap_nodes && !(ps->nodes = realloc(ps->nodes, (ps->cap_nodes = ps->cap_nodes ? ps->cap_nodes * 2 : 32) * sizeof(Node *)))))
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  ps->nodes[ps->nnodes++] = n;
+  n->type = type;
+  return n;
+}
+
+static int new_class(Parser *ps, const ByteSet *set)
+{
+  if (ps->nclasses == ps->cap_classes)
+  {
+    ps->cap_classes = ps->cap_classes ? ps->cap_classes * 2 : 16;
+    ps->classes = realloc(ps->classes, ps->cap_classes * sizeof(ByteSet));
+    if (!ps->classes)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  ps->classes[ps->nclasses] = *set;
+  return ps->nclasses++;
+}
+
+static Node *class_node(Parser *ps, const ByteSet *set)
+{
+  Node *n = new_node(ps, NODE_CLASS);
+  n->cls = new_class(ps, set);
+  return n;
+}
+
+static Node *binary(Parser *ps, int type, Node *left, Node *right)
+{
+  Node *n = new_node(ps, type);
+  n->left = left;
+  n->right = right;
+  return n;
+}
+
+// Fill set for the shorthand classes \d \w \s and their negations
+static int shorthand_class(char c, ByteSet *set)
+{
+  ByteSet s;
+  memset(&s, 0, sizeof(s));
+  switch (c)
+  {
+  case 'd':
+  case 'D':
+    set_add_range(&s, '0', '9');
+    break;
+  case 'w':
+  case 'W':
+    set_add_range(&s, '0', '9');
+    set_add_range(&s, 'a', 'z');
+    set_add_range(&s, 'A', 'Z');
+    set_add(&s, '_');
+    break;
+  case 's':
+  case 'S':
+    set_add(&s, ' ');
+    set_add_range(&s, '\t', '\r');
+    break;
+  default:
+    return 0;
+  }
+  if (c == 'D' || c == 'W' || c == 'S')
+  {
+    for (int i = 0; i < 8; i++)
+      s.bits[i] = ~s.bits[i];
+  }
+  for (int i = 0; i < 8; i++)
+    set->bits[i] |= s.bits[i];
+  return 1;
+}
+
+static unsigned char escape_char(char c)
+{
+  switch (c)
+  {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case 'r':
+    return '\r';
+  case 'f':
+    return '\f';
+  case 'v':
+    return '\v';
+  default:
+    return (unsigned char)c;
+  }
+}
+
+static Node *parse_alt(Parser *ps);
+
+static Node *parse_bracket(Parser *ps)
+{
+  ByteSet set;
+  int negate = 0;
+  memset(&set, 0, sizeof(set));
+
+  ps->p++; // '['
+  if (*ps->p == '^')
+  {
+    negate = 1;
+    ps->p++;
+  }
+  // A ']' right after '[' or '[^' is a literal
+  if (*ps->p == ']')
+  {
+    set_add(&set, ']');
+    ps->p++;
+  }
+
+  while (*ps->p && *ps->p != ']')
+  {
+    unsigned char lo;
+    if (*ps->p == '\\' && ps->p[1])
+    {
+      if (shorthand_class(ps->p[1], &set))
+      {
+        ps->p += 2;
+        continue;
+      }
+      lo = escape_char(ps->p[1]);
+      ps->p += 2;
+    }
+    else
+    {
+      lo = (unsigned char)*ps->p++;
+    }
+
+    if (*ps->p == '-' && ps->p[1] && ps->p[1] != ']')
+    {
+      unsigned char hi;
+      ps->p++;
+      if (*ps->p == '\\' && ps->p[1])
+      {
+        hi = escape_char(ps->p[1]);
+        ps->p += 2;
+      }
+      else
+      {
+        hi = (unsigned char)*ps->p++;
+      }
+      if (hi < lo)
+      {
+        ps->error = "invalid range in character class";
+        return NULL;
+      }
+      set_add_range(&set, lo, hi);
+    }
+    else
+    {
+      set_add(&set, lo);
+    }
+  }
+
+  if (*ps->p != ']')
+  {
+    ps->error = "missing ]";
+    return NULL;
+  }
+  ps->p++;
+
+  if (negate)
+  {
+    for (int i = 0; i < 8; i++)
+      set.bits[i] = ~set.bits[i];
+    // Lines never contain their newline, keep [^x] from "matching" it
+    set.bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+  }
+  return class_node(ps, &set);
+}
+
+static Node *parse_atom(Parser *ps)
+{
+  ByteSet set;
+  memset(&set, 0, sizeof(set));
+
+  switch (*ps->p)
+  {
+  case '(':
+  {
+    ps->p++;
+    if (ps->p[0] == '?' && ps->p[1] == ':')
+      ps->p += 2; // Non-capturing group; there are no captures anyway
+    Node *inner = parse_alt(ps);
+    if (!inner)
+      return NULL;
+    if (*ps->p != ')')
+    {
+      ps->error = "missing )";
+      return NULL;
+    }
+    ps->p++;
+    return inner;
+  }
+  case '[':
+    return parse_bracket(ps);
+  case '.':
+    ps->p++;
+    for (int c = 0; c < 256; c++)
+    {
+      if (c != '\n')
+        set_add(&set, (unsigned char)c);
+    }
+    return class_node(ps, &set);
+  case '^':
+    ps->p++;
+    return new_node(ps, NODE_BOL);
+  case '$':
+    ps->p++;
+    return new_node(ps, NODE_EOL);
+  case '\\':
+    if (ps->p[1] == '\0')
+    {
+      ps->error = "trailing backslash";
+      return NULL;
+    }
+    if (!shorthand_class(ps->p[1], &set))
+      set_add(&set, escape_char(ps->p[1]));
+    ps->p += 2;
+    return class_node(ps, &set);
+  case '*':
+  case '+':
+  case '?':
+    ps->error = "quantifier without operand";
+    return NULL;
+  default:
+    set_add(&set, (unsigned char)*ps->p++);
+    return class_node(ps, &set);
+  }
+}
+
+static int parse_number(Parser *ps, int *out)
+{
+  int n = 0, digits = 0;
+  while (*ps->p >= '0' && *ps->p <= '9')
+  {
+    n = n * 10 + (*ps->p++ - '0');
+    if (n > RX_MAX_REPEAT)
+      return -1;
+    digits++;
+  }
+  *out = n;
+  return digits;
+}
+
+static Node *parse_repeat(Parser *ps)
+{
+  Node *atom = parse_atom(ps);
+  if (!atom)
+    return NULL;
+
+  for (;;)
+  {
+    int min, max;
+    if (*ps->p == '*')
+    {
+      min = 0;
+      max = -1;
+      ps->p++;
+    }
+    else if (*ps->p == '+')
+    {
+      min = 1;
+      max = -1;
+      ps->p++;
+    }
+    else if (*ps->p == '?')
+    {
+      min = 0;
+      max = 1;
+      ps->p++;
+    }
+    else if (*ps->p == '{' && ps->p[1] >= '0' && ps->p[1] <= '9')
+    {
+      ps->p++;
+      if (parse_number(ps, &min) <= 0)
+      {
+        ps->error = "bad repetition count";
+        return NULL;
+      }
+      max = min;
+      if (*ps->p == ',')
+      {
+        ps->p++;
+        int digits = parse_number(ps, &max);
+        if (digits < 0)
+        {
+          ps->error = "bad repetition count";
+          return NULL;
+        }
+        if (digits == 0)
+          max = -1;
+      }
+      if (*ps->p != '}' || (max >= 0 && max < min))
+      {
+        ps->error = "bad repetition count";
+        return NULL;
+      }
+      ps->p++;
+    }
+    else
+    {
+      return atom;
+    }
+
+    Node *rep = new_node(ps, NODE_REPEAT);
+    rep->left = atom;
+    rep->min = min;
+    rep->max = max;
+    atom = rep;
+  }
+}
+
+static Node *parse_cat(Parser *ps)
+{
+  Node *result = NULL;
+  while (*ps->p && *ps->p != '|' && *ps->p != ')')
+  {
+    Node *n = parse_repeat(ps);
+    if (!n)
+      return NULL;
+    result = result ? binary(ps, NODE_CAT, result, n) : n;
+  }
+  return result ? result : new_node(ps, NODE_EMPTY);
+}
+
+static Node *parse_alt(Parser *ps)
+{
+  Node *left = parse_cat(ps);
+  while (left && *ps->p == '|')
+  {
+    ps->p++;
+    Node *right = parse_cat(ps);
+    if (!right)
+      return NULL;
+    left = binary(ps, NODE_ALT, left, right);
+  }
+  return left;
+}
+
+/*
+  NFA compilation. Each node is compiled with its continuation already known,
+  which avoids patch lists: compile(node, next) returns the node's entry.
+*/
+
+typedef struct
+{
+  Inst *insts;
+  int n, cap;
+} Builder;
+
+static int emit(Builder *b, int op, int out, int out1, int cls)
+{
+  if (b->n == b->cap)
+  {
+    b->cap = b->cap ? b->cap * 2 : 64;
+    b->insts = realloc(b->insts, b->cap * sizeof(Inst));
+    if (!b->insts)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  Inst *in = &b->insts[b->n];
+  in->op = op;
+  in->out = out;
+  in->out1 = out1;
+  in->cls = cls;
+  return b->n++;
+}
+
+static int compile_node(Builder *b, const Node *n, int next)
+{
+  switch (n->type)
+  {
+  case NODE_EMPTY:
+    return next;
+  case NODE_CLASS:
+    return emit(b, OP_CLASS, next, -1, n->cls);
+  case NODE_BOL:
+    return emit(b, OP_BOL, next, -1, -1);
+  case NODE_EOL:
+    return emit(b, OP_EOL, next, -1, -1);
+  case NODE_CAT:
+    return compile_node(b, n->left, compile_node(b, n->right, next));
+  case NODE_ALT:
+  {
+    int l = compile_node(b, n->left, next);
+    int r = compile_node(b, n->right, next);
+    return emit(b, OP_SPLIT, l, r, -1);
+  }
+  case NODE_REPEAT:
+  {
+    // Optional tail first: x{m,n} = x...x (x(x(x)?)?)?
+    int entry = next;
+    if (n->max < 0)
+    {
+      int split = emit(b, OP_SPLIT, -1, next, -1);
+      b->insts[split].out = compile_node(b, n->left, split);
+      entry = split;
+    }
+    else
+    {
+      for (int i = n->min; i < n->max; i++)
+      {
+        int body = compile_node(b, n->left, entry);
+        entry = emit(b, OP_SPLIT, body, next, -1);
+      }
+    }
+    for (int i = 0; i < n->min; i++)
+      entry = compile_node(b, n->left, entry);
+    return entry;
+  }
+  }
+  return next;
+}
+
+// Leading literal bytes that every match must start with
+static void collect_prefix(const Node *n, const ByteSet *classes, char *out, size_t *len, size_t cap, int *open)
+{
+  if (!*open || *len >= cap)
+    return;
+  switch (n->type)
+  {
+  case NODE_CAT:
+    collect_prefix(n->left, classes, out, len, cap, open);
+    collect_prefix(n->right, classes, out, len, cap, open);
+    return;
+  case NODE_BOL:
+    return; // Zero width; the prefix may continue after it
+  case NODE_CLASS:
+  {
+    int count = 0, byte = -1;
+    for (int c = 0; c < 256 && count < 2; c++)
+    {
+      if (set_has(&classes[n->cls], (unsigned char)c))
+      {
+        count++;
+        byte = c;
+      }
+    }
+    if (count == 1)
+    {
+      out[(*len)++] = (char)byte;
+      return;
+    }
+    *open = 0;
+    return;
+  }
+  case NODE_REPEAT:
+    if (n->min >= 1)
+    {
+      // The first copy is mandatory, but anything after it is not literal
+      collect_prefix(n->left, classes, out, len, cap, open);
+    }
+    *open = 0;
+    return;
+  default:
+    *open = 0;
+    return;
+  }
+}
+
+RxProg *rx_compile(const char *pattern, const char **error)
+{
+  Parser ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.p = pattern;
+
+  Node *root = parse_alt(&ps);
+  if (root && *ps.p == ')')
+    ps.error = "unmatched )";
+
+  RxProg *prog = NULL;
+  if (root && !ps.error)
+  {
+    prog = calloc(1, sizeof(RxProg));
+    size_t cap = strlen(pattern) + 1;
+    char *prefix = malloc(cap);
+    if (!prog || !prefix)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+
+    Builder b = {NULL, 0, 0};
+    int match = emit(&b, OP_MATCH, -1, -1, -1);
+    prog->start = compile_node(&b, root, match);
+    prog->insts = b.insts;
+    prog->ninsts = b.n;
+    prog->classes = ps.classes;
+    prog->nclasses = ps.nclasses;
+    ps.classes = NULL;
+
+    int open = 1;
+    size_t len = 0;
+    collect_prefix(root, prog->classes, prefix, &len, cap - 1, &open);
+    prefix[len] = '\0';
+    prog->prefix = prefix;
+    prog->prefix_len = len;
+  }
+  else if (error)
+  {
+    *error = ps.error ? ps.error : "invalid pattern";
+  }
+
+  for (int i = 0; i < ps.nnodes; i++)
+    free(ps.nodes[i]);
+  free(ps.nodes);
+  free(ps.classes);
+  return prog;
+}
+
+void rx_free(RxProg *prog)
+{
+  if (!prog)
+    return;
+  free(prog->insts);
+  free(prog->classes);
+  free(prog->prefix);
+  free(prog);
+}
+
+const char *rx_prefix(const RxProg *prog, size_t *len)
+{
+  *len = prog->prefix_len;
+  return prog->prefix;
+}
+
+/*
+  Lazy DFA.
+*/
+
+#define STATE_UNKNOWN -1
+
+typedef struct
+{
+  int *set; // Sorted NFA instruction indexes
+  int nset;
+  unsigned hash;
+  int matched;     // Contains OP_MATCH
+  int matched_eol; // Would match if the line ended here
+  int next[256];
+} DfaState;
+
+struct RxMatcher
+{
+  const RxProg *prog;
+  DfaState **states;
+  int nstates;
+  int *table; // Open-addressing hash of state indexes
+  int table_cap;
+  int start_bol; // Start state at the beginning of a line
+  // Scratch for closure computation
+  int *stack;
+  unsigned *mark;
+  unsigned mark_gen;
+  int *work;
+};
+
+static unsigned hash_set(const int *set, int n)
+{
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++)
+    h = (h ^ (unsigned)set[i]) * 16777619u;
+  return h;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+// Add the epsilon closure of pc to work[*n]. BOL assertions are passed only
+// when at_bol; EOL assertions stay in the set and are resolved at line end.
+static void closure(RxMatcher *m, int pc, int at_bol, int *n)
+{
+  const Inst *insts = m->prog->insts;
+  int sp = 0;
+  m->stack[sp++] = pc;
+  while (sp > 0)
+  {
+    int i = m->stack[--sp];
+    if (m->mark[i] == m->mark_gen)
+      continue;
+    m->mark[i] = m->mark_gen;
+
+    switch (insts[i].op)
+    {
+    case OP_SPLIT:
+      m->stack[sp++] = insts[i].out1;
+      m->stack[sp++] = insts[i].out;
+      break;
+    case OP_JMP:
+      m->stack[sp++] = insts[i].out;
+      break;
+    case OP_BOL:
+      if (at_bol)
+        m->stack[sp++] = insts[i].out;
+      break;
+    default:
+      m->work[(*n)++] = i;
+      break;
+    }
+  }
+}
+
+// Does the set reach OP_MATCH once the line ends here?
+static int matches_at_eol(RxMatcher *m, const int *set, int nset)
+{
+  const Inst *insts = m->prog->insts;
+  int *saved = malloc(m->prog->ninsts * sizeof(int));
+  int n = 0, found = 0;
+  if (!saved)
+    return 0;
+
+  m->mark_gen++;
+  for (int i = 0; i < nset && !found; i++)
+  {
+    if (insts[set[i]].op == OP_EOL)
+    {
+      int before = n;
+      int *work = m->work;
+      m->work = saved;
+      closure(m, insts[set[i]].out, 0, &n);
+      m->work = work;
+      for (int k = before; k < n; k++)
+      {
+        if (insts[saved[k]].op == OP_MATCH)
+          found = 1;
+        else if (insts[saved[k]].op == OP_EOL)
+        {
+          // $$ and friends: keep following zero-width EOLs
+          int w = saved[k];
+          int *work2 = m->work;
+          m->work = saved;
+          closure(m, insts[w].out, 0, &n);
+          m->work = work2;
+        }
+      }
+    }
+  }
+  free(saved);
+  return found;
+}
+
+static void dfa_flush(RxMatcher *m)
+{
+  for (int i = 0; i < m->nstates; i++)
+  {
+    free(m->states[i]->set);
+    free(m->states[i]);
+  }
+  m->nstates = 0;
+  for (int i = 0; i < m->table_cap; i++)
+    m->table[i] = -1;
+}
+
+// Find or create the state for work[0..n). Returns its index.
+static int dfa_intern(RxMatcher *m, int n)
+{
+  qsort(m->work, n, sizeof(int), compare_int);
+  unsigned h = hash_set(m->work, n);
+  unsigned slot = h & (m->table_cap - 1);
+
+  while (m->table[slot] >= 0)
+  {
+    DfaState *s = m->states[m->table[slot]];
+    if (s->hash == h && s->nset == n && memcmp(s->set, m->work, n * sizeof(int)) == 0)
+      return m->table[slot];
+    slot = (slot + 1) & (m->table_cap - 1);
+  }
+
+  DfaState *s = malloc(sizeof(DfaState));
+  int *set = malloc((n ? n : 1) * sizeof(int));
+  if (!s || !set)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(set, m->work, n * sizeof(int));
+  s->set = set;
+  s->nset = n;
+  s->hash = h;
+  s->matched = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (m->prog->insts[set[i]].op == OP_MATCH)
+      s->matched = 1;
+  }
+  s->matched_eol = s->matched || matches_at_eol(m, set, n);
+  for (int c = 0; c < 256; c++)
+    s->next[c] = STATE_UNKNOWN;
+
+  m->states[m->nstates] = s;
+  m->table[slot] = m->nstates;
+  return m->nstates++;
+}
+
+static int dfa_start(RxMatcher *m)
+{
+  int n = 0;
+  m->mark_gen++;
+  closure(m, m->prog->start, 1, &n);
+  return dfa_intern(m, n);
+}
+
+static int dfa_step(RxMatcher *m, int from, unsigned char c)
+{
+  if (m->nstates >= RX_MAX_STATES)
+  {
+    // Cache full: keep only the state we are in and start over
+    DfaState *cur = m->states[from];
+    int nset = cur->nset;
+    memcpy(m->work, cur->set, nset * sizeof(int));
+    int *keep = malloc((nset ? nset : 1) * sizeof(int));
+    if (!keep)
+      exit(EXIT_FAILURE);
+    memcpy(keep, cur->set, nset * sizeof(int));
+    dfa_flush(m);
+    memcpy(m->work, keep, nset * sizeof(int));
+    free(keep);
+    from = dfa_intern(m, nset);
+    m->start_bol = dfa_start(m);
+  }
+
+  const DfaState *s = m->states[from];
+  const Inst *insts = m->prog->insts;
+  const ByteSet *classes = m->prog->classes;
+  int n = 0;
+
+  m->mark_gen++;
+  for (int i = 0; i < s->nset; i++)
+  {
+    const Inst *in = &insts[s->set[i]];
+    if (in->op == OP_CLASS && set_has(&classes[in->cls], c))
+      closure(m, in->out, 0, &n);
+  }
+  // Unanchored search: a match may also start at the next byte
+  closure(m, m->prog->start, 0, &n);
+
+  int to = dfa_intern(m, n);
+  m->states[from]->next[c] = to;
+  return to;
+}
+
+RxMatcher *rx_matcher_new(const RxProg *prog)
+{
+  RxMatcher *m = calloc(1, sizeof(RxMatcher));
+  if (!m)
+    return NULL;
+  m->prog = prog;
+  m->table_cap = 1;
+  while (m->table_cap < RX_MAX_STATES * 2)
+    m->table_cap <<= 1;
+  m->states = malloc((RX_MAX_STATES + 1) * sizeof(DfaState *));
+  m->table = malloc(m->table_cap * sizeof(int));
+  m->stack = malloc(prog->ninsts * 2 * sizeof(int) + sizeof(int));
+  m->mark = calloc(prog->ninsts, sizeof(unsigned));
+  m->work = malloc(prog->ninsts * sizeof(int) + sizeof(int));
+  if (!m->states || !m->table || !m->stack || !m->mark || !m->work)
+  {
+    rx_matcher_free(m);
+    return NULL;
+  }
+  for (int i = 0; i < m->table_cap; i++)
+    m->table[i] = -1;
+  m->start_bol = dfa_start(m);
+  return m;
+}
+
+void rx_matcher_free(RxMatcher *m)
+{
+  if (!m)
+    return;
+  if (m->states)
+    dfa_flush(m);
+  free(m->states);
+  free(m->table);
+  free(m->stack);
+  free(m->mark);
+  free(m->work);
+  free(m);
+}
+
+int rx_match_line(RxMatcher *m, const char *line, size_t len)
+{
+  int s = m->start_bol;
+  if (m->states[s]->matched)
+    return 1;
+
+  const unsigned char *p = (const unsigned char *)line;
+  const unsigned char *end = p + len;
+  while (p < end)
+  {
+    int next = m->states[s]->next[*p];
+    if (next == STATE_UNKNOWN)
+      next = dfa_step(m, s, *p);
+    s = next;
+    if (m->states[s]->matched)
+      return 1;
+    p++;
+  }
+  return m->states[s]->matched_eol;
+}
+
+size_t rx_scan_buffer(void *matcher, const char *buf, size_t len, size_t first_line,
+                      match_line_fn fn, void *ctx)
+{
+  RxMatcher *m = matcher;
+  const char *end = buf + len;
+  const char *pos = buf;
+  const char *counted = buf;
+  size_t line_num = first_line;
+  size_t reported = 0;
+  size_t plen;
+  const char *prefix = rx_prefix(m->prog, &plen);
+
+  while (pos < end)
+  {
+    const char *line = pos;
+    if (plen > 0)
+    {
+      // Jump straight to the next line that contains the literal prefix
+      const char *hit = match_find(pos, end - pos, prefix, plen);
+      if (hit == NULL)
+        break;
+      line = hit;
+      while (line > pos && line[-1] != '\n')
+        line--;
+    }
+
+    const char *eol = memchr(line, '\n', end - line);
+    if (eol == NULL)
+      eol = end;
+
+    if (rx_match_line(m, line, eol - line))
+    {
+      line_num += match_count_newlines(counted, line - counted);
+      counted = line;
+      fn(ctx, line_num, line, eol - line);
+      reported++;
+    }
+    pos = eol + 1;
+  }
+  return reported;
+}
@@ -0,0 +1,39 @@
+#ifndef RX_H
+#define RX_H
+
+#include <stddef.h>
+#include "match.h"
+
+// Cached DFA states per matcher before the cache is flushed and rebuilt
+#define RX_MAX_STATES 4096
+// Largest bound accepted in a {m,n} repetition
+#define RX_MAX_REPEAT 1000
+
+// A compiled regular expression. Immutable, so it can be shared by threads.
+typedef struct RxProg RxProg;
+// Lazily built DFA over an RxProg. Not thread-safe; use one per thread.
+typedef struct RxMatcher RxMatcher;
+
+// Compile pattern. On error returns NULL and points *error at a message.
+// Supported syntax: literals, ., [...] and [^...] classes, \d \w \s \D \W \S,
+// escapes, ^ and $ (line anchors), grouping with ( ), alternation with |,
+// and the quantifiers * + ? {m} {m,} {m,n}.
+RxProg *rx_compile(const char *pattern, const char **error);
+void rx_free(RxProg *prog);
+
+// Literal text every match must start with (may be empty). Used to skip to
+// candidate lines and to narrow the search index.
+const char *rx_prefix(const RxProg *prog, size_t *len);
+
+RxMatcher *rx_matcher_new(const RxProg *prog);
+void rx_matcher_free(RxMatcher *m);
+
+// Does line (without its newline) contain a match?
+int rx_match_line(RxMatcher *m, const char *line, size_t len);
+
+// Line scanner with the same contract as match_scan_buffer; matcher is an
+// RxMatcher. Runs in time linear in len.
+size_t rx_scan_buffer(void *matcher, const char *buf, size_t len, size_t first_line,
+                      match_line_fn fn, void *ctx);
+
+#endif // RX_H
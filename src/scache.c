@@ -0,0 +1,386 @@
+// scache.c
+//
+// Cache of parsed scripts. A script run again and again should not be split
+// into words again every time, so once parsed its commands are written to a
+// file in the cache directory, and later runs map that file and point the
+// commands straight into it. The file only holds offsets, so it can be
+// mapped anywhere:
+//
+//   header | commands | stages | redirections | word offsets | strings
+//
+// There is one file per script path, named after a hash of the path; the
+// header records the hash and length of the script text and the build of
+// the shell that wrote it, and a copy that does not match is overwritten.
+// Words still waiting for variable expansion are stored as parsed, quotes
+// and all, and marked in the top bit of their offset.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "scache.h"
+
+#define SCACHE_NONE UINT32_MAX
+// Top bit of a string offset: the word needs pipeline_expand
+#define SCACHE_EXPAND 0x80000000u
+
+// ScacheCmd.flags
+#define SCACHE_CMD_BACKGROUND 1
+#define SCACHE_CMD_EXPAND 2
+
+typedef struct
+{
+  char magic[8];
+  uint32_t format;
+  uint32_t ncmds, nstages, nredirs, nwords;
+  uint32_t strings_len;
+  uint64_t text_hash;
+  uint64_t text_len;
+  char build[32]; // The shell that wrote it
+} ScacheHeader;
+
+typedef struct
+{
+  uint32_t line;
+  uint32_t first_stage, nstages;
+  uint32_t flags;
+} ScacheCmd;
+
+typedef struct
+{
+  uint32_t first_word, argc;
+  uint32_t first_redir, nredirs;
+} ScacheStage;
+
+typedef struct
+{
+  uint32_t kind;
+  int32_t fd, from;
+  uint32_t path; // Offset into the strings, or SCACHE_NONE; may have SCACHE_EXPAND
+} ScacheRedir;
+
+// What scache_load allocated for a script
+typedef struct
+{
+  void *map;
+  size_t map_len;
+} ScacheMap;
+
+// Changes whenever the shell is rebuilt; see the scache.o rule in the Makefile
+static const char scache_build[32] = __DATE__ " " __TIME__;
+
+static void *scache_xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t scache_hash(const char *s)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 1099511628211ull;
+  return h;
+}
+
+static int scache_dir(char *dir, size_t size)
+{
+  const char *env = getenv(SCACHE_DIR_ENV);
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  int n;
+
+  if (env && *env)
+    n = snprintf(dir, size, "%s", env);
+  else if (xdg && *xdg)
+    n = snprintf(dir, size, "%s/pss", xdg);
+  else if (home && *home)
+    n = snprintf(dir, size, "%s/.cache/pss", home);
+  else
+    return -1;
+  return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+// Cache file for the script at path
+static int scache_file(const char *path, char *file, size_t size)
+{
+  char dir[PATH_MAX], real[PATH_MAX];
+  if (scache_dir(dir, sizeof(dir)) != 0 || realpath(path, real) == NULL)
+    return -1;
+  int n = snprintf(file, size, "%s/%016llx.ast", dir, (unsigned long long)scache_hash(real));
+  return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+// mkdir -p for the cache directory
+static int scache_make_dir(const char *file)
+{
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", file);
+  char *slash = strrchr(dir, '/');
+  if (slash == NULL || slash == dir)
+    return 0;
+  *slash = '\0';
+  for (char *p = dir + 1; *p; p++)
+  {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+      return -1;
+    *p = '/';
+  }
+  return mkdir(dir, 0700) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+int scache_load(Script *s, const char *path)
+{
+  char file[PATH_MAX];
+  struct stat st;
+
+  if (scache_file(path, file, sizeof(file)) != 0)
+    return -1;
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ScacheHeader))
+  {
+    close(fd);
+    return -1;
+  }
+  size_t len = st.st_size;
+  // Private and writable: the strings become argv, which callers may modify
+  char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  const ScacheHeader *h = (const ScacheHeader *)map;
+  const ScacheCmd *cmds = (const ScacheCmd *)(h + 1);
+  const ScacheStage *stages = (const ScacheStage *)(cmds + h->ncmds);
+  const ScacheRedir *redirs = (const ScacheRedir *)(stages + h->nstages);
+  const uint32_t *words = (const uint32_t *)(redirs + h->nredirs);
+  char *strings = (char *)(words + h->nwords);
+
+  if (memcmp(h->magic, SCACHE_MAGIC, sizeof(SCACHE_MAGIC)) != 0 || h->format != SCACHE_FORMAT ||
+      memcmp(h->build, scache_build, sizeof(scache_build)) != 0 || h->text_hash != s->hash ||
+      h->text_len != s->len ||
+      sizeof(*h) + (uint64_t)h->ncmds * sizeof(*cmds) + (uint64_t)h->nstages * sizeof(*stages) +
+              (uint64_t)h->nredirs * sizeof(*redirs) + (uint64_t)h->nwords * sizeof(*words) +
+              h->strings_len !=
+          len ||
+      h->strings_len == 0 || strings[h->strings_len - 1] != '\0')
+    goto stale;
+
+  // Every offset is checked before anything points through it
+  for (uint32_t i = 0; i < h->ncmds; i++)
+  {
+    if (cmds[i].nstages == 0 || cmds[i].first_stage > h->nstages || cmds[i].nstages > h->nstages - cmds[i].first_stage)
+      goto stale;
+  }
+  for (uint32_t i = 0; i < h->nstages; i++)
+  {
+    const ScacheStage *st = &stages[i];
+    if (st->argc == 0 || st->first_word > h->nwords || st->argc > h->nwords - st->first_word ||
+        st->first_redir > h->nredirs || st->nredirs > h->nredirs - st->first_redir)
+      goto stale;
+  }
+  for (uint32_t i = 0; i < h->nredirs; i++)
+  {
+    if (redirs[i].kind > REDIR_DUP || (redirs[i].kind == REDIR_DUP) != (redirs[i].path == SCACHE_NONE) ||
+        (redirs[i].path != SCACHE_NONE && (redirs[i].path & ~SCACHE_EXPAND) >= h->strings_len))
+      goto stale;
+  }
+  for (uint32_t i = 0; i < h->nwords; i++)
+  {
+    if ((words[i] & ~SCACHE_EXPAND) >= h->strings_len)
+      goto stale;
+  }
+
+  // One block for the commands, their line numbers, stages, redirections,
+  // argv arrays (each with room for its NULL) and word flags
+  size_t size = sizeof(ScacheMap) + h->ncmds * (sizeof(Pipeline) + sizeof(size_t)) +
+                h->nstages * sizeof(PipelineStage) + h->nredirs * sizeof(Redir) +
+                (h->nwords + h->nstages) * sizeof(char *) + h->nwords;
+  char *block = scache_xmalloc(size);
+  ScacheMap *m = (ScacheMap *)block;
+  Pipeline *pl = (Pipeline *)(m + 1);
+  size_t *lines = (size_t *)(pl + h->ncmds);
+  PipelineStage *ps = (PipelineStage *)(lines + h->ncmds);
+  Redir *rd = (Redir *)(ps + h->nstages);
+  char **argv = (char **)(rd + h->nredirs);
+  unsigned char *flags = (unsigned char *)(argv + h->nwords + h->nstages);
+
+  m->map = map;
+  m->map_len = len;
+  for (uint32_t i = 0; i < h->nredirs; i++)
+  {
+    rd[i].kind = (RedirKind)redirs[i].kind;
+    rd[i].fd = redirs[i].fd;
+    rd[i].from = redirs[i].from;
+    rd[i].path = redirs[i].path == SCACHE_NONE ? NULL : strings + (redirs[i].path & ~SCACHE_EXPAND);
+    rd[i].expand = redirs[i].path != SCACHE_NONE && (redirs[i].path & SCACHE_EXPAND);
+  }
+  for (uint32_t i = 0; i < h->nstages; i++)
+  {
+    ps[i].argv = argv;
+    ps[i].argc = stages[i].argc;
+    ps[i].flags = flags;
+    for (uint32_t k = 0; k < stages[i].argc; k++)
+    {
+      uint32_t w = words[stages[i].first_word + k];
+      *argv++ = strings + (w & ~SCACHE_EXPAND);
+      *flags++ = w & SCACHE_EXPAND ? PIPELINE_WORD_EXPAND : 0;
+    }
+    *argv++ = NULL;
+    ps[i].redirs = stages[i].nredirs ? rd + stages[i].first_redir : NULL;
+    ps[i].nredirs = stages[i].nredirs;
+  }
+  for (uint32_t i = 0; i < h->ncmds; i++)
+  {
+    pl[i].stages = ps + cmds[i].first_stage;
+    pl[i].nstages = cmds[i].nstages;
+    pl[i].background = (cmds[i].flags & SCACHE_CMD_BACKGROUND) != 0;
+    pl[i].expand = (cmds[i].flags & SCACHE_CMD_EXPAND) != 0;
+    for (uint32_t j = 0; j < cmds[i].nstages && !pl[i].expand; j++)
+      pl[i].stages[j].flags = NULL;
+    lines[i] = cmds[i].line;
+  }
+
+  s->cache = m;
+  s->cmds = pl;
+  s->lines = lines;
+  s->ncmds = h->ncmds;
+  return 0;
+
+stale:
+  munmap(map, len);
+  return -1;
+}
+
+void scache_release(Script *s)
+{
+  ScacheMap *m = s->cache;
+  munmap(m->map, m->map_len);
+  free(m);
+  s->cache = NULL;
+  s->cmds = NULL;
+  s->lines = NULL;
+  s->ncmds = 0;
+}
+
+int scache_store(const Script *s, const char *path)
+{
+  char file[PATH_MAX], tmp[PATH_MAX + 32];
+  ScacheHeader h;
+  size_t strings_len = 0;
+
+  if (scache_file(path, file, sizeof(file)) != 0)
+    return -1;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SCACHE_MAGIC, sizeof(SCACHE_MAGIC));
+  h.format = SCACHE_FORMAT;
+  memcpy(h.build, scache_build, sizeof(scache_build));
+  h.text_hash = s->hash;
+  h.text_len = s->len;
+  h.ncmds = s->ncmds;
+  for (size_t i = 0; i < s->ncmds; i++)
+  {
+    const Pipeline *pl = &s->cmds[i];
+    h.nstages += pl->nstages;
+    for (size_t j = 0; j < pl->nstages; j++)
+    {
+      const PipelineStage *st = &pl->stages[j];
+      h.nwords += st->argc;
+      h.nredirs += st->nredirs;
+      for (size_t k = 0; k < st->argc; k++)
+        strings_len += strlen(st->argv[k]) + 1;
+      for (size_t k = 0; k < st->nredirs; k++)
+        strings_len += st->redirs[k].path ? strlen(st->redirs[k].path) + 1 : 0;
+    }
+  }
+  if (strings_len == 0 || strings_len >= SCACHE_EXPAND)
+    return -1;
+  h.strings_len = strings_len;
+
+  size_t size = sizeof(h) + h.ncmds * sizeof(ScacheCmd) + h.nstages * sizeof(ScacheStage) +
+                h.nredirs * sizeof(ScacheRedir) + h.nwords * sizeof(uint32_t) + strings_len;
+  char *buf = scache_xmalloc(size);
+  memcpy(buf, &h, sizeof(h));
+  ScacheCmd *cmds = (ScacheCmd *)(buf + sizeof(h));
+  ScacheStage *stages = (ScacheStage *)(cmds + h.ncmds);
+  ScacheRedir *redirs = (ScacheRedir *)(stages + h.nstages);
+  uint32_t *words = (uint32_t *)(redirs + h.nredirs);
+  char *strings = (char *)(words + h.nwords);
+  uint32_t nstages = 0, nredirs = 0, nwords = 0, off = 0;
+
+  for (size_t i = 0; i < s->ncmds; i++)
+  {
+    const Pipeline *pl = &s->cmds[i];
+    uint32_t flags = (pl->background ? SCACHE_CMD_BACKGROUND : 0) | (pl->expand ? SCACHE_CMD_EXPAND : 0);
+    cmds[i] = (ScacheCmd){(uint32_t)s->lines[i], nstages, (uint32_t)pl->nstages, flags};
+    for (size_t j = 0; j < pl->nstages; j++)
+    {
+      const PipelineStage *st = &pl->stages[j];
+      stages[nstages++] = (ScacheStage){nwords, (uint32_t)st->argc, nredirs, (uint32_t)st->nredirs};
+      for (size_t k = 0; k < st->argc; k++)
+      {
+        size_t n = strlen(st->argv[k]) + 1;
+        memcpy(strings + off, st->argv[k], n);
+        words[nwords++] = off | (st->flags && (st->flags[k] & PIPELINE_WORD_EXPAND) ? SCACHE_EXPAND : 0);
+        off += n;
+      }
+      for (size_t k = 0; k < st->nredirs; k++)
+      {
+        const Redir *r = &st->redirs[k];
+        uint32_t path_off = SCACHE_NONE;
+        if (r->path)
+        {
+          size_t n = strlen(r->path) + 1;
+          memcpy(strings + off, r->path, n);
+          path_off = off | (r->expand ? SCACHE_EXPAND : 0);
+          off += n;
+        }
+        redirs[nredirs++] = (ScacheRedir){r->kind, r->fd, r->from, path_off};
+      }
+    }
+  }
+
+  // Write a new file and rename it over the old one, so a script running
+  // at the same time never maps a half-written copy
+  int rc = -1;
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", file, (int)getpid());
+  if (scache_make_dir(file) == 0)
+  {
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0)
+    {
+      size_t done = 0;
+      while (done < size)
+      {
+        ssize_t n = write(fd, buf + done, size - done);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        done += n;
+      }
+      if (close(fd) == 0 && done == size && rename(tmp, file) == 0)
+        rc = 0;
+      else
+        unlink(tmp);
+    }
+  }
+  free(buf);
+  return rc;
+}
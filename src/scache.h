@@ -0,0 +1,27 @@
+#ifndef SCACHE_H
+#define SCACHE_H
+
+#include "script.h"
+
+// Environment variable naming the cache directory. Without it, cached
+// scripts go to $XDG_CACHE_HOME/pss, or ~/.cache/pss.
+#define SCACHE_DIR_ENV "PSS_CACHE_DIR"
+#define SCACHE_MAGIC "PSSAST"
+// Bump whenever the file layout or the meaning of a parsed pipeline changes
+#define SCACHE_FORMAT 2
+
+// Load the parsed commands of the script at path, which s holds as read
+// (not yet parsed), from the cache. A cached copy is used only if it was
+// written by this build of the shell for the same path and the same
+// content. The commands then point into the mapped cache file. Returns 0,
+// or -1 if there is no usable copy.
+int scache_load(Script *s, const char *path);
+
+// Write the parsed commands of the script at path to the cache, replacing
+// any older copy for that path. Returns 0, or -1 if they could not be saved.
+int scache_store(const Script *s, const char *path);
+
+// Unmap what scache_load set up; called by script_free
+void scache_release(Script *s);
+
+#endif // SCACHE_H
@@ -4,28 +4,41 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <dirent.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <errno.h>
 #include "scf.h" // Include the header file
-
-#define MAX_REMINDERS 10
-#define MAX_TASK_LENGTH 100
-
-// Array to store reminders
-Reminder reminders[MAX_REMINDERS];
-int reminder_count = 0;
+#include "search.h"
+#include "swatch.h"
+#include "spawn.h"
+#include "bio.h"
+#include "builtins.h"
+#include "defstore.h"
+#include "defindex.h"
+#include "dict.h"
+#include "remind.h"
+#include "status.h"
 
 // Function to provide help for built-in commands
 int lsh_learn(char **args)
 {
+  const Builtin *b;
+
   if (args[1] == NULL)
+  {
     printf("No command provided for help.\n");
+    return builtin_fail(1);
+  }
+  else if ((b = builtin_find(args[1])) != NULL)
+    printf("%s: %s\n", b->name, b->summary); // Same text as "help"
   else if (strcmp(args[1], "ls") == 0)
     printf("ls: Lists the files in the current directory.\n");
-  else if (strcmp(args[1], "cd") == 0)
-    printf("cd: Changes the current working directory.\n");
   else
+  {
     printf("No tutorial available for this command.\n");
+    return builtin_fail(1);
+  }
 
   return 1; // Continue executing
 }
@@ -36,147 +49,248 @@ int lsh_run_code(char **args)
   if (args[1] == NULL)
   {
     printf("lsh: expected argument to \"run\"\n");
-    return 1;
+    return builtin_fail(1);
   }
 
-  char command[256];
-  pid_t pid = fork(); // Create a new process
-
-  if (pid == 0)
+  if (strstr(args[1], ".c"))
   {
-    // Child process
-    if (strstr(args[1], ".c"))
-    {
-      // Compile C file
-      snprintf(command, sizeof(command), "gcc %s -o a.out", args[1]);
-      system(command);
-      // Execute compiled program
-      snprintf(command, sizeof(command), "./a.out");
-      system(command);
-    }
-    else if (strstr(args[1], ".py"))
-    {
-      // Execute Python script
-      snprintf(command, sizeof(command), "python3 %s", args[1]);
-      system(command);
-    }
-    else
-    {
-      printf("Unsupported file type.\n");
-    }
-    exit(0); // Exit child process
+    // Compile C file, then execute the compiled program
+    char *compile[] = {"gcc", args[1], "-o", "a.out", NULL};
+    char *program[] = {"./a.out", NULL};
+    builtin_status = spawn_run(compile, NULL);
+    if (builtin_status == 0)
+      builtin_status = spawn_run(program, NULL);
+  }
+  else if (strstr(args[1], ".py"))
+  {
+    // Execute Python script
+    char *script[] = {"python3", args[1], NULL};
+    builtin_status = spawn_run(script, NULL);
   }
   else
   {
-    // Parent process waits for child to finish
-    wait(NULL);
+    printf("Unsupported file type.\n");
+    builtin_fail(1);
   }
 
   return 1; // Continue executing
 }
 
-// Function to set a reminder with a task and time
-int lsh_set_reminder(char **args)
+// Parse a reminder time, YYYY-MM-DD HH:MM[:SS] in local time
+static int parse_reminder_time(const char *s, time_t *out)
 {
-  if (args[1] == NULL || args[2] == NULL)
+  struct tm tm_time;
+  const char *end;
+
+  memset(&tm_time, 0, sizeof(tm_time));
+  end = strptime(s, "%Y-%m-%d %H:%M:%S", &tm_time);
+  if (end == NULL || *end != '\0')
   {
-    printf("lsh: expected task and time arguments for \"remind\"\n");
-    return 1;
+    memset(&tm_time, 0, sizeof(tm_time));
+    end = strptime(s, "%Y-%m-%d %H:%M", &tm_time);
   }
+  if (end == NULL || *end != '\0')
+    return -1;
+  tm_time.tm_isdst = -1; // Whatever daylight saving time says for that date
+  *out = mktime(&tm_time);
+  return *out == (time_t)-1 ? -1 : 0;
+}
 
-  struct tm tm_time = {0};
-  // Parse the provided time string
-  strptime(args[2], "%Y-%m-%d %H:%M:%S", &tm_time);
-  // Convert to time_t and store in reminders array
-  reminders[reminder_count].reminder_time = mktime(&tm_time);
-  // Copy the task description
-  strcpy(reminders[reminder_count].task, args[1]);
-  reminder_count++;
+static void format_reminder_time(time_t when, char *buf, size_t size)
+{
+  struct tm tm_time;
+  localtime_r(&when, &tm_time);
+  strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm_time);
+}
 
-  printf("Reminder set: %s at %s\n", args[1], args[2]);
-  return 1; // Continue executing
+static void print_reminder(const RemindEntry *e, void *ctx)
+{
+  char when[32];
+  (void)ctx;
+  format_reminder_time(e->when, when, sizeof(when));
+  printf("%6u  %s  %s\n", e->id, when, e->task);
 }
 
-// Function to check and display due reminders
-int lsh_check_reminders(char **args)
+static void show_reminder(const RemindEntry *e, void *ctx)
 {
-  time_t current_time = time(NULL); // Get current time
-  int found = 0;
+  (void)ctx;
+  printf("Reminder: %s - Time: %s", e->task, ctime(&e->when));
+}
+
+void scf_deliver_reminders(void)
+{
+  remind_deliver(show_reminder, NULL);
+  fflush(stdout);
+}
+
+// Function to set, list or cancel reminders
+int lsh_set_reminder(char **args)
+{
+  if (remind_open() != 0)
+  {
+    fprintf(stderr, "lsh: cannot read reminders: %s\n", strerror(errno));
+    return builtin_fail(1);
+  }
+
+  // List the pending reminders, soonest first
+  if (args[1] == NULL)
+  {
+    if (remind_count() == 0)
+      printf("No reminders set.\n");
+    else
+      remind_each(print_reminder, NULL);
+    return 1;
+  }
 
-  // Iterate through all set reminders
-  for (int i = 0; i < reminder_count; i++)
+  // Cancel one by its id
+  char *end;
+  if (strcmp(args[1], "cancel") == 0 && args[2] != NULL && args[3] == NULL)
   {
-    if (reminders[i].reminder_time <= current_time)
+    unsigned long id = strtoul(args[2], &end, 10);
+    if (*args[2] != '\0' && *end == '\0' && id <= UINT32_MAX)
     {
-      // Display the reminder if due
-      printf("Reminder: %s - Time: %s", reminders[i].task, ctime(&reminders[i].reminder_time));
-      found = 1;
+      int rc = remind_cancel((uint32_t)id);
+      if (rc == 0)
+        printf("Reminder %lu cancelled.\n", id);
+      else if (rc == 1)
+        printf("lsh: no reminder %lu\n", id);
+      else
+        fprintf(stderr, "lsh: cannot cancel reminder: %s\n", strerror(errno));
+      return rc == 0 ? 1 : builtin_fail(1);
     }
   }
 
-  if (!found)
-    printf("No reminders due.\n");
+  if (args[2] == NULL || args[3] != NULL)
+  {
+    printf("lsh: expected task and time arguments for \"remind\"\n");
+    return builtin_fail(1);
+  }
+  time_t when;
+  if (parse_reminder_time(args[2], &when) != 0)
+  {
+    printf("lsh: remind: bad time '%s' (expected YYYY-MM-DD HH:MM:SS)\n", args[2]);
+    return builtin_fail(1);
+  }
+  size_t task_len = strlen(args[1]);
+  if (task_len == 0 || task_len > REMIND_MAX_TASK)
+  {
+    printf("lsh: remind: the task must be 1 to %d bytes long\n", REMIND_MAX_TASK);
+    return builtin_fail(1);
+  }
+  uint32_t id;
+  if (remind_add(when, args[1], &id) != 0)
+  {
+    fprintf(stderr, "lsh: cannot save reminder: %s\n", strerror(errno));
+    return builtin_fail(1);
+  }
 
+  char stamp[32];
+  format_reminder_time(when, stamp, sizeof(stamp));
+  printf("Reminder %u set: %s at %s\n", id, args[1], stamp);
   return 1; // Continue executing
 }
 
 /**
  * @brief Searches for a given query in all files within a specified directory.
- * @param args List of arguments. args[0] is "search", args[1] is the query, and args[2] is the directory.
+ * @param args List of arguments. args[0] is "search", optionally followed by
+ *             "-j <threads>" and "-e", then the query and the directory.
+ *             With -e the query is a regular expression (see rx.h).
  * @return Always returns 1, to continue executing.
  */
 int lsh_search(char **args)
 {
-  if (args[1] == NULL || args[2] == NULL)
+  SearchOptions opts = {NULL, NULL, 1, NULL, NULL};
+  int use_regex = 0;
+  int i = 1;
+
+  // Build the trigram index for a directory
+  if (args[1] != NULL && strcmp(args[1], "--index") == 0)
   {
-    printf("lsh: expected query and directory arguments for \"search\"\n");
+    SearchIndexStats stats;
+    if (args[2] == NULL)
+    {
+      printf("Usage: search --index <dir>\n");
+      return builtin_fail(1);
+    }
+    if (swatch_rebuild(args[2], &stats) != 0)
+      return builtin_fail(1);
+    printf("Indexed %u files (%llu bytes): %u trigrams, %llu postings, %llu byte index\n",
+           stats.files, (unsigned long long)stats.bytes_indexed, stats.trigrams,
+           (unsigned long long)stats.postings, (unsigned long long)stats.index_size);
     return 1;
   }
 
-  struct dirent *entry;
-  DIR *dp = opendir(args[2]); // Open the specified directory
+  // Parse options
+  while (args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0')
+  {
+    if (strcmp(args[i], "-j") == 0 && args[i + 1] != NULL)
+    {
+      char *end;
+      long jobs = strtol(args[i + 1], &end, 10);
+      if (*end != '\0' || jobs < 0 || jobs > SEARCH_MAX_JOBS)
+      {
+        printf("lsh: invalid thread count for \"search\": %s\n", args[i + 1]);
+        return builtin_fail(1);
+      }
+      // -j 0 means one thread per online CPU
+      opts.jobs = jobs == 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : (int)jobs;
+      i += 2;
+    }
+    else if (strcmp(args[i], "-e") == 0)
+    {
+      use_regex = 1;
+      i++;
+    }
+    else
+    {
+      break; // Not an option; treat it as the query
+    }
+  }
 
-  if (dp == NULL)
+  if (args[i] == NULL || args[i + 1] == NULL)
   {
-    perror("opendir"); // Print error if directory can't be opened
-    return 1;
+    printf("lsh: expected query and directory arguments for \"search\"\n");
+    return builtin_fail(1);
   }
 
-  // Iterate through directory entries
-  while ((entry = readdir(dp)) != NULL)
+  opts.query = args[i];
+
+  // The index can only be narrowed by text every match must contain: the
+  // whole query, or the literal prefix of a regex
+  const char *literal = opts.query;
+  size_t literal_len = strlen(opts.query);
+  RxProg *regex = NULL;
+  if (use_regex)
   {
-    if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+    const char *error = NULL;
+    regex = rx_compile(opts.query, &error);
+    if (regex == NULL)
     {
-      // If entry is a directory, construct new path and search recursively
-      char new_path[256];
-      snprintf(new_path, sizeof(new_path), "%s/%s", args[2], entry->d_name);
-      lsh_search(args); // Recursively search subdirectories
-    }
-    else if (entry->d_type == DT_REG)
-    {
-      // If entry is a regular file, open and search for the query
-      char file_path[256];
-      snprintf(file_path, sizeof(file_path), "%s/%s", args[2], entry->d_name);
-      FILE *file = fopen(file_path, "r");
-      if (file)
-      {
-        char line[256];
-        int line_num = 1;
-        // Read file line by line
-        while (fgets(line, sizeof(line), file))
-        {
-          if (strstr(line, args[1]))
-          {
-            // If query is found, print the matching line
-            printf("Match found in %s, Line %d: %s", file_path, line_num, line);
-          }
-          line_num++;
-        }
-        fclose(file); // Close the file after reading
-      }
+      printf("lsh: invalid regex for \"search\": %s\n", error);
+      return builtin_fail(1);
     }
+    opts.regex = regex;
+    literal = rx_prefix(regex, &literal_len);
   }
-  closedir(dp); // Close the directory stream
+
+  // Use the trigram index, if the directory has one, to skip files that
+  // cannot contain the query
+  SearchIndexView view = {NULL, NULL, NULL};
+  SearchIndexQuery *candidates = NULL;
+  if (swatch_acquire(args[i + 1], &view) == 0)
+    candidates = sindex_query(view.base, view.delta, args[i + 1], literal, literal_len);
+  if (candidates)
+  {
+    opts.skip_file = sindex_skip_file;
+    opts.skip_ctx = candidates;
+  }
+
+  if (search_run(args[i + 1], &opts) != 0)
+    builtin_fail(1);
+
+  sindex_query_free(candidates);
+  swatch_release(&view);
+  rx_free(regex);
 
   return 1; // Continue executing
 }
@@ -196,7 +310,7 @@ typedef struct
 // Function to load saved SSH connections from ssh.txt
 int load_ssh_connections(SSHConnection *connections)
 {
-  FILE *file = fopen(".ssh/ssh.txt", "r");
+  FILE *file = fopen(SSH_CONNECTIONS_FILE, "r");
   if (file == NULL)
   {
     perror("Could not open SSH file");
@@ -215,7 +329,7 @@ int load_ssh_connections(SSHConnection *connections)
 // Function to save SSH connections to ssh.txt
 void save_ssh_connections(SSHConnection *connections, int count)
 {
-  FILE *file = fopen(".ssh/ssh.txt", "w");
+  FILE *file = fopen(SSH_CONNECTIONS_FILE, "w");
   if (file == NULL)
   {
     perror("Could not open SSH file");
@@ -251,6 +365,7 @@ void delete_ssh_connection(SSHConnection *connections, int *count, int index)
   if (index < 0 || index >= *count)
   {
     printf("Invalid connection index.\n");
+    builtin_fail(1);
     return;
   }
 
@@ -265,6 +380,21 @@ void delete_ssh_connection(SSHConnection *connections, int *count, int index)
   printf("SSH connection deleted successfully.\n");
 }
 
+void scf_ssh_names(void (*fn)(const char *name, size_t len, void *ctx), void *ctx)
+{
+  FILE *file = fopen(SSH_CONNECTIONS_FILE, "r");
+  char line[MAX_SSH_LINE_LENGTH];
+  if (file == NULL)
+    return;
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    size_t len = strcspn(line, " \n");
+    if (len > 0)
+      fn(line, len, ctx);
+  }
+  fclose(file);
+}
+
 // Main SSH function to handle both saving, connecting, and deleting connections
 int lsh_ssh(char **args)
 {
@@ -285,7 +415,7 @@ int lsh_ssh(char **args)
     if (args[2] == NULL || args[3] == NULL)
     {
       printf("Usage: ssh -s <custom_name> <hostname>\n");
-      return 1;
+      return builtin_fail(1);
     }
 
     // Get custom name and hostname
@@ -298,10 +428,21 @@ int lsh_ssh(char **args)
 
     printf("Enter the password for %s (will not be shown): ", hostname);
     // Take password input without showing
-    system("stty -echo"); // Turn off echo to hide password
+    struct termios saved, noecho;
+    int have_tty = tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (have_tty)
+    {
+      noecho = saved;
+      noecho.c_lflag &= ~ECHO; // Turn off echo to hide password
+      tcsetattr(STDIN_FILENO, TCSANOW, &noecho);
+    }
     fgets(password, sizeof(password), stdin);
     password[strcspn(password, "\n")] = 0; // Remove the newline
-    system("stty echo");                   // Turn echo back on
+    if (have_tty)
+    {
+      tcsetattr(STDIN_FILENO, TCSANOW, &saved); // Turn echo back on
+      printf("\n");
+    }
 
     // Save the new connection
     strcpy(connections[count].custom_name, custom_name);
@@ -329,15 +470,13 @@ int lsh_ssh(char **args)
 
   // Otherwise, treat as normal ssh and connect using the provided hostname
   printf("Connecting to %s...\n", args[1]);
-  char ssh_command[MAX_SSH_LINE_LENGTH];
-  snprintf(ssh_command, sizeof(ssh_command), "ssh %s", args[1]);
-  system(ssh_command);
+  char *ssh_argv[] = {"ssh", args[1], NULL};
+  builtin_status = spawn_run(ssh_argv, NULL);
 
   return 1;
 }
 
 // Store functional definations
-#define DEFINITIONS_FILE ".definitions.txt"
 
 #define RED "\x1b[31m"
 #define GREEN "\x1b[32m"
@@ -350,113 +489,129 @@ int lsh_ssh(char **args)
 
 void store_definition(const char *keyword, const char *definition)
 {
-  FILE *file = fopen(DEFINITIONS_FILE, "a");
-  if (file == NULL)
+  if (defstore_open(DEFINITIONS_FILE, 1) != 0 ||
+      defstore_set(keyword, strlen(keyword), definition, strlen(definition)) != 0)
   {
-    perror("Could not open definitions file");
+    if (errno == EINVAL)
+      printf(RED "A term cannot contain \" =\" or a line break.\n" RESET);
+    else
+      perror("Could not open definitions file");
+    builtin_fail(1);
     return;
   }
 
-  // Store the keyword with its definition
-  fprintf(file, "%s = %s\n", keyword, definition);
-  fclose(file);
-
   printf(GREEN "Definition for '%s' stored successfully!\n" RESET, keyword);
 }
 
+// The user's own definitions first, then the built-in dictionary
 void retrieve_definition(const char *keyword)
 {
-  FILE *file = fopen(DEFINITIONS_FILE, "r");
-  if (file == NULL)
+  DefEntry e;
+  const char *def;
+  size_t def_len;
+
+  if (defstore_open(DEFINITIONS_FILE, 0) != 0)
   {
-    perror("Could not open definitions file");
-    return;
+    if (errno != ENOENT)
+      perror("Could not open definitions file");
   }
-
-  char line[512];
-  int found = 0;
-  while (fgets(line, sizeof(line), file) != NULL)
+  else if (defstore_get(keyword, strlen(keyword), &e))
   {
-    if (strncmp(line, keyword, strlen(keyword)) == 0)
-    {
-      printf(CYAN "Definition for '%s': %s" RESET, keyword, line + strlen(keyword) + 3); // Skip the keyword and "= "
-      found = 1;
-      break;
-    }
+    printf(CYAN "Definition for '%s': %.*s\n" RESET, keyword, (int)e.def_len, e.def);
+    return;
   }
 
-  if (!found)
+  if (dict_lookup(keyword, &def, &def_len))
+    printf(CYAN "Definition for '%s': %.*s\n" RESET, keyword, (int)def_len, def);
+  else
   {
     printf(RED "No definition found for '%s'.\n" RESET, keyword);
+    builtin_fail(1);
   }
-
-  fclose(file);
 }
 
 void delete_definition(const char *keyword)
 {
-  FILE *file = fopen(DEFINITIONS_FILE, "r");
-  if (file == NULL)
+  if (defstore_open(DEFINITIONS_FILE, 0) != 0)
   {
     perror("Could not open definitions file");
+    builtin_fail(1);
     return;
   }
 
-  FILE *temp_file = fopen("temp_defs.txt", "w");
-  if (temp_file == NULL)
-  {
-    perror("Could not open temporary file");
-    fclose(file);
-    return;
-  }
+  int rc = defstore_delete(keyword, strlen(keyword));
+  if (rc == 0)
+    printf(GREEN "Definition for '%s' deleted successfully.\n" RESET, keyword);
+  else if (rc > 0)
+    printf(RED "No definition found for '%s'.\n" RESET, keyword);
+  else
+    perror("Could not update definitions file");
+  if (rc != 0)
+    builtin_fail(1);
+}
 
-  char line[512];
-  int found = 0;
-  while (fgets(line, sizeof(line), file) != NULL)
+void scf_define_terms(const char *prefix, size_t len, void (*fn)(const char *name, size_t len, void *ctx), void *ctx)
+{
+  size_t first, n;
+  DefEntry e;
+  if (defstore_open(DEFINITIONS_FILE, 0) != 0)
+    return;
+  n = defstore_prefix(prefix, len, &first);
+  for (size_t i = first; i < first + n; i++)
   {
-    if (strncmp(line, keyword, strlen(keyword)) == 0)
-    {
-      found = 1; // Skip the line
-    }
-    else
-    {
-      fprintf(temp_file, "%s", line); // Copy the line to the temp file
-    }
+    defstore_sorted(i, &e);
+    fn(e.term, e.term_len, ctx);
   }
+}
 
-  if (found)
+void show_all_definitions()
+{
+  DefEntry e;
+  if (defstore_open(DEFINITIONS_FILE, 0) != 0)
   {
-    printf(GREEN "Definition for '%s' deleted successfully.\n" RESET, keyword);
-    remove(DEFINITIONS_FILE);
-    rename("temp_defs.txt", DEFINITIONS_FILE); // Replace the old file with the new one
+    perror("Could not open definitions file");
+    builtin_fail(1);
+    return;
   }
-  else
+
+  printf(BOLD CYAN "All Definitions:\n" RESET);
+  for (size_t i = 0; i < defstore_count(); i++)
   {
-    printf(RED "No definition found for '%s'.\n" RESET, keyword);
-    remove("temp_defs.txt");
+    defstore_sorted(i, &e);
+    printf(YELLOW "%.*s = %.*s\n" RESET, (int)e.term_len, e.term, (int)e.def_len, e.def);
   }
-
-  fclose(file);
-  fclose(temp_file);
 }
 
-void show_all_definitions()
+// Definitions whose text best matches the words, best first
+void search_definitions(char **words)
 {
-  FILE *file = fopen(DEFINITIONS_FILE, "r");
-  if (file == NULL)
+  DefIndexHit hits[DEFINDEX_MAX_RESULTS];
+  DefEntry e;
+  char query[1024];
+  size_t len = 0;
+
+  if (defstore_open(DEFINITIONS_FILE, 0) != 0)
   {
     perror("Could not open definitions file");
+    builtin_fail(1);
     return;
   }
+  query[0] = '\0';
+  for (int i = 0; words[i] != NULL && len < sizeof(query); i++)
+    len += snprintf(query + len, sizeof(query) - len, "%s%s", i ? " " : "", words[i]);
 
-  char line[512];
-  printf(BOLD CYAN "All Definitions:\n" RESET);
-  while (fgets(line, sizeof(line), file) != NULL)
+  size_t n = defindex_search(query, hits, DEFINDEX_MAX_RESULTS);
+  if (n == 0)
   {
-    printf(YELLOW "%s" RESET, line);
+    printf(RED "No definition mentions '%s'.\n" RESET, query);
+    builtin_fail(1);
+    return;
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    if (defstore_get(hits[i].term, hits[i].term_len, &e))
+      printf(YELLOW "%.*s" RESET " = %.*s\n", (int)e.term_len, e.term, (int)e.def_len, e.def);
   }
-
-  fclose(file);
 }
 
 int lsh_define(char **args)
@@ -468,7 +623,8 @@ int lsh_define(char **args)
     printf("or use 'define <keyword>' to retrieve a definition\n");
     printf("or use 'define delete <keyword>' to delete a definition\n");
     printf("or use 'define all' to list all definitions\n");
-    return 1;
+    printf("or use 'define search <words>' to find definitions mentioning them\n");
+    return builtin_fail(1);
   }
 
   // Show all definitions
@@ -476,6 +632,11 @@ int lsh_define(char **args)
   {
     show_all_definitions();
   }
+  // Search the definitions' text
+  else if (strcmp(args[1], "search") == 0 && args[2] != NULL)
+  {
+    search_definitions(args + 2);
+  }
   // Delete definition
   else if (strcmp(args[1], "delete") == 0 && args[2] != NULL)
   {
@@ -497,12 +658,37 @@ int lsh_define(char **args)
 
 #define DEFAULT_PREVIEW_LINES 10
 
+// Copy the first lines lines of fd to stdout with bio_copy
+static void preview_copy(int fd, int lines)
+{
+  char buf[BIO_BUFFER_SIZE];
+  off_t end = 0;
+  ssize_t n;
+
+  // Find where the last wanted line ends
+  while (lines > 0 && (n = pread(fd, buf, sizeof(buf), end)) > 0)
+  {
+    const char *p = buf, *stop = buf + n;
+    while (lines > 0 && (p = memchr(p, '\n', stop - p)) != NULL)
+    {
+      p++;
+      lines--;
+    }
+    end += lines > 0 ? n : p - buf;
+  }
+  if (bio_copy(STDOUT_FILENO, fd, 0, end) < 0 && errno != EPIPE)
+  {
+    perror("preview");
+    builtin_fail(1);
+  }
+}
+
 int lsh_preview(char **args)
 {
   if (args[1] == NULL)
   {
     printf("Usage: preview <file> [-n <lines>]\n");
-    return 1;
+    return builtin_fail(1);
   }
 
   char *file_name = args[1];
@@ -517,7 +703,7 @@ int lsh_preview(char **args)
       if (lines_to_show <= 0)
       {
         printf("Invalid number of lines: %s\n", args[i + 1]);
-        return 1;
+        return builtin_fail(1);
       }
       i++; // Skip the number
     }
@@ -528,6 +714,15 @@ int lsh_preview(char **args)
   if (file == NULL)
   {
     perror("Error opening file");
+    return builtin_fail(1);
+  }
+
+  // Feeding a file or another command: send the lines as they are, without
+  // the banner, and let the kernel move the bytes
+  if (!isatty(STDOUT_FILENO))
+  {
+    preview_copy(fileno(file), lines_to_show);
+    fclose(file);
     return 1;
   }
 
@@ -554,25 +749,25 @@ int lsh_preview(char **args)
   return 1;
 }
 
-#define ENCRYPT_CMD "openssl enc -aes-256-cbc -salt -in "
-#define DECRYPT_CMD "openssl enc -d -aes-256-cbc -salt -in "
+#define ENCRYPT_CMD "openssl", "enc", "-aes-256-cbc", "-salt"
+#define DECRYPT_CMD "openssl", "enc", "-d", "-aes-256-cbc", "-salt"
 
 int lsh_encrypt(char **args)
 {
   if (args[1] == NULL || args[2] == NULL)
   {
     printf("Usage: encrypt <input_file> <output_file>\n");
-    return 1;
+    return builtin_fail(1);
   }
 
-  char command[512];
   printf("Encrypting %s to %s...\n", args[1], args[2]);
 
   // Construct the encryption command
-  snprintf(command, sizeof(command), "%s%s -out %s", ENCRYPT_CMD, args[1], args[2]);
+  char *command[] = {ENCRYPT_CMD, "-in", args[1], "-out", args[2], NULL};
 
   // Execute the command
-  if (system(command) == 0)
+  builtin_status = spawn_run(command, NULL);
+  if (builtin_status == 0)
   {
     printf("File encrypted successfully: %s\n", args[2]);
   }
@@ -594,17 +789,17 @@ int lsh_decrypt(char **args)
   if (args[1] == NULL || args[2] == NULL)
   {
     printf("Usage: decrypt <input_file> <output_file>\n");
-    return 1;
+    return builtin_fail(1);
   }
 
-  char command[512];
   printf("Decrypting %s to %s...\n", args[1], args[2]);
 
   // Construct the decryption command
-  snprintf(command, sizeof(command), "%s%s -out %s", DECRYPT_CMD, args[1], args[2]);
+  char *command[] = {DECRYPT_CMD, "-in", args[1], "-out", args[2], NULL};
 
   // Execute the command
-  if (system(command) == 0)
+  builtin_status = spawn_run(command, NULL);
+  if (builtin_status == 0)
   {
     printf("File decrypted successfully: %s\n", args[2]);
   }
@@ -616,29 +811,35 @@ int lsh_decrypt(char **args)
   return 1;
 }
 
-#define COMPRESS_CMD "tar -czf " // Command to compress files using tar
+#define COMPRESS_CMD "tar", "-czf" // Command to compress files using tar
 int lsh_compress(char **args)
 {
   if (args[1] == NULL)
   {
     printf("Usage: compress <output_archive.tar.gz> <file1> <file2> ... <fileN>\n");
-    return 1;
+    return builtin_fail(1);
   }
 
-  char command[1024];
-  int i;
-
-  // Construct the command to compress files into a .tar.gz archive
-  snprintf(command, sizeof(command), "%s%s ", COMPRESS_CMD, args[1]);
+  char *prefix[] = {COMPRESS_CMD};
+  size_t nprefix = sizeof(prefix) / sizeof(prefix[0]);
+  size_t nargs = 0;
+  while (args[1 + nargs] != NULL)
+    nargs++;
 
-  // Add all input files to the command
-  for (i = 2; args[i] != NULL; i++)
+  // Construct the command to compress files into a .tar.gz archive: the
+  // archive name followed by all input files
+  char **command = malloc((nprefix + nargs + 1) * sizeof(char *));
+  if (!command)
   {
-    snprintf(command + strlen(command), sizeof(command) - strlen(command), "%s ", args[i]);
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
   }
+  memcpy(command, prefix, sizeof(prefix));
+  memcpy(command + nprefix, args + 1, (nargs + 1) * sizeof(char *));
 
   // Execute the command
-  if (system(command) == 0)
+  builtin_status = spawn_run(command, NULL);
+  if (builtin_status == 0)
   {
     printf("Files compressed successfully into %s\n", args[1]);
   }
@@ -646,6 +847,7 @@ int lsh_compress(char **args)
   {
     printf("Compression failed.\n");
   }
+  free(command);
 
   return 1;
 }
@@ -3,27 +3,30 @@
 
 #include <time.h>
 
-// Maximum number of reminders
-#define MAX_REMINDERS 10
-#define MAX_TASK_LENGTH 100
+// Files the saved ssh connections and the definitions are kept in, relative
+// to the current directory
+#define SSH_CONNECTIONS_FILE ".ssh/ssh.txt"
+#define DEFINITIONS_FILE ".definitions.txt"
 
-// Reminder structure
-typedef struct
-{
-  char task[MAX_TASK_LENGTH];
-  time_t reminder_time;
-} Reminder;
+// For Tab completion: call fn with the name of every saved ssh connection,
+// or with every defined term starting with prefix, in order
+void scf_ssh_names(void (*fn)(const char *name, size_t len, void *ctx), void *ctx);
+void scf_define_terms(const char *prefix, size_t len, void (*fn)(const char *name, size_t len, void *ctx), void *ctx);
+
+// Print the reminders that are due (see remind.h)
+void scf_deliver_reminders(void);
 
 // Function declarations for all built-ins (as before)
 int lsh_cd(char **args);
 int lsh_learn(char **args);
 int lsh_run_code(char **args);
 int lsh_set_reminder(char **args);
-int lsh_check_reminders(char **args);
 int lsh_search(char **args);
 int lsh_ssh(char **args);
 int lsh_define(char **args);
 int lsh_preview(char **args);
 int lsh_compress(char **args);
+int lsh_encrypt(char **args);
+int lsh_decrypt(char **args);
 
 #endif // SCF_H
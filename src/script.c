@@ -0,0 +1,134 @@
+// script.c
+//
+// Scripts: a file named on the command line, the text given to -c, or
+// whatever is piped into the shell. The whole script is read in large
+// blocks, split into lines and parsed before the first command runs, so a
+// syntax error anywhere stops it from running at all, and running it is
+// just a walk over the parsed pipelines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "script.h"
+#include "scache.h"
+
+// 64-bit FNV-1a
+static uint64_t script_hash(const char *text, size_t len)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)text[i]) * 1099511628211ull;
+  return h;
+}
+
+static void *script_xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+int script_read(Script *s, int fd, const char *name)
+{
+  struct stat st;
+  size_t cap = SCRIPT_READ_SIZE;
+
+  memset(s, 0, sizeof(*s));
+  s->name = name;
+  // A regular file is read into a buffer of the right size in one go
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= cap)
+    cap = st.st_size + 1;
+  s->text = script_xrealloc(NULL, cap);
+  for (;;)
+  {
+    if (s->len + 1 == cap)
+    {
+      cap *= 2;
+      s->text = script_xrealloc(s->text, cap);
+    }
+    ssize_t n = read(fd, s->text + s->len, cap - s->len - 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      int saved = errno;
+      script_free(s);
+      errno = saved;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    s->len += n;
+  }
+  s->text[s->len] = '\0';
+  s->hash = script_hash(s->text, s->len);
+  return 0;
+}
+
+void script_from_string(Script *s, const char *text)
+{
+  memset(s, 0, sizeof(*s));
+  s->name = "-c";
+  s->len = strlen(text);
+  s->text = script_xrealloc(NULL, s->len + 1);
+  memcpy(s->text, text, s->len + 1);
+  s->hash = script_hash(s->text, s->len);
+}
+
+int script_parse(Script *s)
+{
+  size_t cap = 0, lineno = 0;
+  char *line = s->text, *end = s->text + s->len;
+
+  while (line < end)
+  {
+    char *nl = memchr(line, '\n', end - line);
+    char *next = nl ? nl + 1 : end;
+    if (nl)
+      *nl = '\0';
+    lineno++;
+
+    char *p = line;
+    while (*p && strchr(PIPELINE_DELIM, *p))
+      p++;
+    line = next;
+    if (*p == '\0' || *p == '#')
+      continue;
+
+    if (s->ncmds == cap)
+    {
+      cap = cap ? cap * 2 : 64;
+      s->cmds = script_xrealloc(s->cmds, cap * sizeof(Pipeline));
+      s->lines = script_xrealloc(s->lines, cap * sizeof(size_t));
+    }
+    pipeline_set_source(s->name, lineno);
+    int rc = pipeline_parse(p, &s->cmds[s->ncmds], &s->arena);
+    pipeline_set_source(NULL, 0);
+    if (rc != 0)
+      return -1;
+    if (s->cmds[s->ncmds].nstages > 0)
+      s->lines[s->ncmds++] = lineno;
+  }
+  return 0;
+}
+
+void script_free(Script *s)
+{
+  if (s->cache)
+    scache_release(s);
+  else
+  {
+    free(s->cmds);
+    free(s->lines);
+  }
+  arena_free(&s->arena);
+  free(s->text);
+  memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,43 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pipeline.h"
+
+// Block size for reading a script
+#define SCRIPT_READ_SIZE (256 * 1024)
+
+// Exit statuses of a script that could not run, as in other shells
+#define SCRIPT_SYNTAX_ERROR 2
+#define SCRIPT_NOT_FOUND 127
+
+// A script read and parsed as a whole before any of it runs. Empty lines
+// and comments (lines starting with '#', such as "#!/path/to/my_shell") are
+// dropped; every other line is one pipeline.
+typedef struct
+{
+  const char *name; // For error messages; NULL when the script is stdin
+  char *text; // Every line, NUL terminated; the pipelines point into it
+  size_t len;
+  uint64_t hash; // Of the text as read, before parsing
+  void *cache; // Set when the commands were loaded from the cache (scache.h)
+  Pipeline *cmds;
+  Arena arena; // What the parsed pipelines need besides the text
+  size_t *lines; // Line number of each command
+  size_t ncmds;
+} Script;
+
+// Read all of fd. Returns 0, or -1 with errno set.
+int script_read(Script *s, int fd, const char *name);
+
+// Take a copy of text, as given to "-c"
+void script_from_string(Script *s, const char *text);
+
+// Parse every line. Returns 0, or -1 after printing the first syntax error
+// as "lsh: name: line N: ...".
+int script_parse(Script *s);
+
+void script_free(Script *s);
+
+#endif // SCRIPT_H
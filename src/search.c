@@ -0,0 +1,538 @@
+// search.c
+//
+// Parallel engine behind the "search" builtin. Directory traversal and file
+// scanning are split into small tasks that live on per-thread work-stealing
+// deques: a worker pushes and pops tasks at the bottom of its own deque and,
+// when that runs dry, steals from the top of another worker's deque. Matches
+// are buffered per file and printed in sorted path order once all workers are
+// done, so the output does not depend on the number of threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "search.h"
+#include "match.h"
+#include "sindex.h"
+#include "bio.h"
+
+#define DEQUE_INITIAL_CAPACITY 64
+#define RESULTS_INITIAL_CAPACITY 16
+#define IDLE_WAIT_MS 10
+
+// One unit of work: a directory to list or a regular file to scan
+typedef struct
+{
+  char *path;
+  int is_dir;
+} SearchTask;
+
+// Matches found in a single file
+typedef struct
+{
+  char *path;
+  char *text;
+  size_t len;
+} SearchResult;
+
+// Growable byte buffer used to collect the output for one file
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t cap;
+} SearchBuffer;
+
+// Per-worker double-ended queue. The owner works at the bottom, thieves take
+// from the top, which keeps the owner on the most recently discovered (and
+// therefore most cache-friendly) part of the tree.
+typedef struct
+{
+  pthread_mutex_t lock;
+  SearchTask *tasks;
+  size_t cap;
+  size_t top;    // Index of the oldest task
+  size_t bottom; // One past the newest task
+} SearchDeque;
+
+typedef struct SearchEngine SearchEngine;
+
+typedef struct
+{
+  SearchEngine *engine;
+  int id;
+  SearchDeque deque;
+  SearchResult *results;
+  size_t nresults;
+  size_t cap_results;
+  unsigned int steal_seed;
+  MatchScratch scratch; // Read buffer reused for every file this worker scans
+  RxMatcher *rx;        // This worker's DFA cache when searching for a regex
+} SearchWorker;
+
+struct SearchEngine
+{
+  const SearchOptions *opts;
+  SearchWorker *workers;
+  int nworkers;
+
+  long pending; // Tasks queued or running; the search is over at zero
+
+  pthread_mutex_t idle_lock;
+  pthread_cond_t idle_cond;
+  int sleepers;
+  unsigned long generation;
+};
+
+static void *search_xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void *search_xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static char *search_join_path(const char *dir, const char *name)
+{
+  size_t dlen = strlen(dir), nlen = strlen(name);
+  int need_slash = dlen > 0 && dir[dlen - 1] != '/';
+  char *path = search_xmalloc(dlen + need_slash + nlen + 1);
+  memcpy(path, dir, dlen);
+  if (need_slash)
+    path[dlen] = '/';
+  memcpy(path + dlen + need_slash, name, nlen + 1);
+  return path;
+}
+
+static void buffer_append(SearchBuffer *buf, const char *data, size_t len)
+{
+  if (buf->len + len + 1 > buf->cap)
+  {
+    size_t cap = buf->cap ? buf->cap : 256;
+    while (cap < buf->len + len + 1)
+      cap *= 2;
+    buf->data = search_xrealloc(buf->data, cap);
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+}
+
+static void buffer_printf(SearchBuffer *buf, const char *fmt, ...)
+{
+  char small[512];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(small, sizeof(small), fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return;
+  if ((size_t)n < sizeof(small))
+  {
+    buffer_append(buf, small, n);
+    return;
+  }
+  char *big = search_xmalloc(n + 1);
+  va_start(ap, fmt);
+  vsnprintf(big, n + 1, fmt, ap);
+  va_end(ap);
+  buffer_append(buf, big, n);
+  free(big);
+}
+
+/*
+  Work-stealing deque.
+*/
+
+static void deque_init(SearchDeque *dq)
+{
+  pthread_mutex_init(&dq->lock, NULL);
+  dq->cap = DEQUE_INITIAL_CAPACITY;
+  dq->tasks = search_xmalloc(dq->cap * sizeof(SearchTask));
+  dq->top = dq->bottom = 0;
+}
+
+static void deque_destroy(SearchDeque *dq)
+{
+  pthread_mutex_destroy(&dq->lock);
+  free(dq->tasks);
+}
+
+static void deque_push(SearchDeque *dq, SearchTask task)
+{
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom == dq->cap)
+  {
+    // Compact first; only grow when the deque is genuinely full
+    size_t live = dq->bottom - dq->top;
+    if (dq->top > 0)
+      memmove(dq->tasks, dq->tasks + dq->top, live * sizeof(SearchTask));
+    dq->top = 0;
+    dq->bottom = live;
+    if (live == dq->cap)
+    {
+      dq->cap *= 2;
+      dq->tasks = search_xrealloc(dq->tasks, dq->cap * sizeof(SearchTask));
+    }
+  }
+  dq->tasks[dq->bottom++] = task;
+  pthread_mutex_unlock(&dq->lock);
+}
+
+static int deque_pop(SearchDeque *dq, SearchTask *out)
+{
+  int found = 0;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom > dq->top)
+  {
+    *out = dq->tasks[--dq->bottom];
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+static int deque_steal(SearchDeque *dq, SearchTask *out)
+{
+  int found = 0;
+  // Never block on a busy victim; just move on to the next one
+  if (pthread_mutex_trylock(&dq->lock) != 0)
+    return 0;
+  if (dq->bottom > dq->top)
+  {
+    *out = dq->tasks[dq->top++];
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+/*
+  Engine scheduling.
+*/
+
+static void engine_wake(SearchEngine *engine)
+{
+  pthread_mutex_lock(&engine->idle_lock);
+  engine->generation++;
+  pthread_cond_broadcast(&engine->idle_cond);
+  pthread_mutex_unlock(&engine->idle_lock);
+}
+
+static void engine_submit(SearchWorker *worker, char *path, int is_dir)
+{
+  SearchEngine *engine = worker->engine;
+  SearchTask task = {path, is_dir};
+
+  __atomic_add_fetch(&engine->pending, 1, __ATOMIC_SEQ_CST);
+  deque_push(&worker->deque, task);
+  if (__atomic_load_n(&engine->sleepers, __ATOMIC_SEQ_CST) > 0)
+    engine_wake(engine);
+}
+
+static int engine_steal(SearchWorker *worker, SearchTask *out)
+{
+  SearchEngine *engine = worker->engine;
+  int n = engine->nworkers;
+  if (n < 2)
+    return 0;
+
+  // Start at a pseudo-random victim so thieves do not all gang up on worker 0
+  int start = rand_r(&worker->steal_seed) % n;
+  for (int i = 0; i < n; i++)
+  {
+    int victim = (start + i) % n;
+    if (victim == worker->id)
+      continue;
+    if (deque_steal(&engine->workers[victim].deque, out))
+      return 1;
+  }
+  return 0;
+}
+
+static int engine_find_task(SearchWorker *worker, SearchTask *out)
+{
+  return deque_pop(&worker->deque, out) || engine_steal(worker, out);
+}
+
+static void worker_add_result(SearchWorker *worker, char *path, SearchBuffer *buf)
+{
+  if (worker->nresults == worker->cap_results)
+  {
+    worker->cap_results = worker->cap_results ? worker->cap_results * 2 : RESULTS_INITIAL_CAPACITY;
+    worker->results = search_xrealloc(worker->results, worker->cap_results * sizeof(SearchResult));
+  }
+  SearchResult *r = &worker->results[worker->nresults++];
+  r->path = path;
+  r->text = buf->data;
+  r->len = buf->len;
+}
+
+/*
+  Task bodies.
+*/
+
+static void search_list_dir(SearchWorker *worker, const char *path)
+{
+  const SearchOptions *opts = worker->engine->opts;
+  DIR *dp = opendir(path);
+  struct dirent *entry;
+
+  if (dp == NULL)
+  {
+    fprintf(stderr, "search: %s: %s\n", path, strerror(errno));
+    return;
+  }
+
+  while ((entry = readdir(dp)) != NULL)
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    if (sindex_is_index_file(entry->d_name))
+      continue; // Never report matches inside a search index
+
+    int type = entry->d_type;
+    char *child = search_join_path(path, entry->d_name);
+
+    if (type == DT_UNKNOWN)
+    {
+      // Some filesystems do not fill in d_type; fall back to lstat
+      struct stat st;
+      if (lstat(child, &st) == 0)
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    if (type == DT_DIR)
+      engine_submit(worker, child, 1);
+    else if (type == DT_REG && opts->skip_file && opts->skip_file(opts->skip_ctx, child))
+      free(child); // The index proves this file cannot match
+    else if (type == DT_REG)
+      engine_submit(worker, child, 0);
+    else
+      free(child); // Symlinks, devices, sockets, ... are skipped
+  }
+  closedir(dp);
+}
+
+// Per-file state handed to the match callback
+typedef struct
+{
+  const char *path;
+  SearchBuffer *out;
+} SearchScanContext;
+
+static void search_on_match(void *ctx, size_t line_num, const char *line, size_t len)
+{
+  SearchScanContext *scan = ctx;
+  buffer_printf(scan->out, "Match found in %s, Line %zu: ", scan->path, line_num);
+  buffer_append(scan->out, line, len);
+  buffer_append(scan->out, "\n", 1);
+}
+
+static void search_scan_file(SearchWorker *worker, char *path)
+{
+  const SearchOptions *opts = worker->engine->opts;
+  SearchBuffer out = {NULL, 0, 0};
+  SearchScanContext scan = {path, &out};
+
+  if (opts->regex)
+  {
+    // Built on first use so DFA states learned on one file help the next
+    if (worker->rx == NULL)
+    {
+      worker->rx = rx_matcher_new(opts->regex);
+      if (worker->rx == NULL)
+      {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    match_scan_with(path, rx_scan_buffer, worker->rx, &worker->scratch, search_on_match, &scan);
+  }
+  else
+  {
+    match_scan_file(path, opts->query, strlen(opts->query), &worker->scratch, search_on_match, &scan);
+  }
+
+  if (out.len > 0)
+    worker_add_result(worker, path, &out);
+  else
+    free(path);
+}
+
+static void *search_worker_main(void *arg)
+{
+  SearchWorker *worker = arg;
+  SearchEngine *engine = worker->engine;
+  SearchTask task;
+
+  for (;;)
+  {
+    if (!engine_find_task(worker, &task))
+    {
+      // Announce that we are about to sleep, then look once more so a task
+      // pushed in between is not missed.
+      pthread_mutex_lock(&engine->idle_lock);
+      __atomic_add_fetch(&engine->sleepers, 1, __ATOMIC_SEQ_CST);
+      unsigned long gen = engine->generation;
+      pthread_mutex_unlock(&engine->idle_lock);
+
+      int found = engine_find_task(worker, &task);
+
+      pthread_mutex_lock(&engine->idle_lock);
+      if (!found)
+      {
+        while (!found && engine->generation == gen &&
+               __atomic_load_n(&engine->pending, __ATOMIC_SEQ_CST) > 0)
+        {
+          struct timeval now;
+          struct timespec deadline;
+          gettimeofday(&now, NULL);
+          deadline.tv_sec = now.tv_sec;
+          deadline.tv_nsec = now.tv_usec * 1000L + IDLE_WAIT_MS * 1000000L;
+          if (deadline.tv_nsec >= 1000000000L)
+          {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+          }
+          if (pthread_cond_timedwait(&engine->idle_cond, &engine->idle_lock, &deadline) == ETIMEDOUT)
+            break;
+        }
+      }
+      __atomic_sub_fetch(&engine->sleepers, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&engine->idle_lock);
+
+      if (!found)
+      {
+        if (__atomic_load_n(&engine->pending, __ATOMIC_SEQ_CST) == 0)
+          break;
+        continue;
+      }
+    }
+
+    if (task.is_dir)
+    {
+      search_list_dir(worker, task.path);
+      free(task.path);
+    }
+    else
+    {
+      search_scan_file(worker, task.path); // Takes ownership of the path
+    }
+
+    if (__atomic_sub_fetch(&engine->pending, 1, __ATOMIC_SEQ_CST) == 0)
+      engine_wake(engine);
+  }
+  return NULL;
+}
+
+static int compare_results(const void *a, const void *b)
+{
+  const SearchResult *ra = a, *rb = b;
+  return strcmp(ra->path, rb->path);
+}
+
+int search_run(const char *root, const SearchOptions *opts)
+{
+  struct stat st;
+  if (stat(root, &st) != 0)
+  {
+    perror("opendir");
+    return -1;
+  }
+
+  SearchEngine engine;
+  memset(&engine, 0, sizeof(engine));
+  engine.opts = opts;
+  engine.nworkers = opts->jobs < 1 ? 1 : opts->jobs > SEARCH_MAX_JOBS ? SEARCH_MAX_JOBS : opts->jobs;
+  engine.workers = calloc(engine.nworkers, sizeof(SearchWorker));
+  if (!engine.workers)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    return -1;
+  }
+  pthread_mutex_init(&engine.idle_lock, NULL);
+  pthread_cond_init(&engine.idle_cond, NULL);
+
+  for (int i = 0; i < engine.nworkers; i++)
+  {
+    engine.workers[i].engine = &engine;
+    engine.workers[i].id = i;
+    engine.workers[i].steal_seed = 0x9e3779b9u * (i + 1);
+    deque_init(&engine.workers[i].deque);
+  }
+
+  // Seed worker 0 with the root; the rest start out stealing
+  char *root_copy = search_xmalloc(strlen(root) + 1);
+  strcpy(root_copy, root);
+  engine_submit(&engine.workers[0], root_copy, S_ISDIR(st.st_mode));
+
+  pthread_t *threads = search_xmalloc(engine.nworkers * sizeof(pthread_t));
+  int started = 1;
+  for (int i = 1; i < engine.nworkers; i++)
+  {
+    if (pthread_create(&threads[i], NULL, search_worker_main, &engine.workers[i]) != 0)
+      break; // Run with fewer threads rather than fail the whole search
+    started++;
+  }
+  search_worker_main(&engine.workers[0]);
+  for (int i = 1; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  // Merge and sort the per-worker results so output order is deterministic
+  size_t total = 0;
+  for (int i = 0; i < engine.nworkers; i++)
+    total += engine.workers[i].nresults;
+
+  SearchResult *all = search_xmalloc((total ? total : 1) * sizeof(SearchResult));
+  size_t k = 0;
+  for (int i = 0; i < engine.nworkers; i++)
+  {
+    memcpy(all + k, engine.workers[i].results, engine.workers[i].nresults * sizeof(SearchResult));
+    k += engine.workers[i].nresults;
+    free(engine.workers[i].results);
+    free(engine.workers[i].scratch.buf);
+    rx_matcher_free(engine.workers[i].rx);
+    deque_destroy(&engine.workers[i].deque);
+  }
+  qsort(all, total, sizeof(SearchResult), compare_results);
+
+  // Each result is already one formatted block: hand them to the kernel as
+  // they are instead of copying them through stdout's buffer
+  fflush(stdout);
+  for (size_t i = 0; i < total; i++)
+  {
+    bio_write(STDOUT_FILENO, all[i].text, all[i].len);
+    free(all[i].text);
+    free(all[i].path);
+  }
+
+  free(all);
+  free(engine.workers);
+  pthread_mutex_destroy(&engine.idle_lock);
+  pthread_cond_destroy(&engine.idle_cond);
+  return 0;
+}
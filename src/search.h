@@ -0,0 +1,28 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "rx.h"
+
+// Upper bound on worker threads accepted by "search -j"
+#define SEARCH_MAX_JOBS 256
+
+// Options for one run of the search engine
+typedef struct
+{
+  const char *query;   // Literal text to look for
+  const RxProg *regex; // If set, lines are matched against this instead
+  int jobs;            // Number of worker threads (>= 1)
+
+  // Optional pre-filter, called for every regular file before it is read.
+  // Returning nonzero skips the file. Must be safe to call from any thread.
+  int (*skip_file)(void *ctx, const char *path);
+  void *skip_ctx;
+} SearchOptions;
+
+// Walk root recursively and print every line containing opts->query (or
+// matching opts->regex).
+// Matches are grouped by file and printed in sorted path order.
+// Returns 0 on success, -1 if root could not be opened.
+int search_run(const char *root, const SearchOptions *opts);
+
+#endif // SEARCH_H
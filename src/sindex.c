@@ -0,0 +1,1220 @@
+// sindex.c
+//
+// On-disk trigram index for "search". Every file under the indexed root is
+// reduced to the set of 3-byte sequences it contains; for each trigram the
+// index stores a delta/varint coded list of file ids. A literal query can only
+// occur in files that contain all of its trigrams, so intersecting a handful
+// of posting lists tells the search engine which files it can skip.
+//
+// Files that change after the build are re-indexed into an in-memory delta
+// segment (see swatch.c). Queries consult the delta first, and
+// sindex_merge_write folds it into a fresh on-disk index without re-reading
+// any file that did not change.
+//
+// Layout of .pss_index (host byte order, all offsets from the file start):
+//
+//   SearchIndexHeader
+//   SearchIndexFile[nfiles]        sorted by relative path
+//   SearchIndexTrigram[ntrigrams]  sorted by trigram
+//   posting bytes                  varint deltas of file ids
+//   path bytes                     relative paths, not NUL terminated
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sindex.h"
+
+#ifdef __APPLE__
+#define ST_MTIM(st) ((st).st_mtimespec)
+#else
+#define ST_MTIM(st) ((st).st_mtim)
+#endif
+
+#define TRIGRAM_SPACE (1u << 24)
+#define TRIGRAM_RADIX_BITS 12
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nfiles;
+  uint32_t ntrigrams;
+  uint32_t reserved;
+  int64_t built_at;
+  uint64_t files_off;
+  uint64_t trigrams_off;
+  uint64_t postings_off;
+  uint64_t paths_off;
+  uint64_t total_size;
+} SearchIndexHeader;
+
+typedef struct
+{
+  uint64_t path_off;
+  uint32_t path_len;
+  uint32_t reserved;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t size;
+  int64_t indexed_at; // Modified at or after this second means "racy"
+} SearchIndexFile;
+
+typedef struct
+{
+  uint32_t trigram;
+  uint32_t count;
+  uint64_t postings_off;
+} SearchIndexTrigram;
+
+struct SearchIndex
+{
+  void *map;
+  size_t map_len;
+  const SearchIndexHeader *header;
+  const SearchIndexFile *files;
+  const SearchIndexTrigram *trigrams;
+  const unsigned char *postings;
+  const char *paths;
+};
+
+// A file re-indexed since the on-disk index was written
+struct SearchIndexDeltaEntry
+{
+  char *rel;
+  int deleted;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t size;
+  int64_t indexed_at;
+  uint64_t generation; // Bumped on every update, so merges can tell
+  uint32_t *trigrams;  // Sorted, distinct
+  size_t ntrigrams;
+  SearchIndexDeltaEntry *next;
+};
+
+struct SearchIndexDelta
+{
+  SearchIndexDeltaEntry **buckets;
+  size_t nbuckets;
+  size_t count;
+  uint64_t generation;
+  unsigned char *seen; // Trigram bitmap for sindex_delta_scan
+  uint32_t *scratch;
+  size_t scratch_cap;
+};
+
+// Copy of the delta taken for a background merge
+struct SearchIndexSnapshot
+{
+  SearchIndexDeltaEntry *entries;
+  size_t count;
+};
+
+struct SearchIndexQuery
+{
+  const SearchIndex *index;
+  const SearchIndexDelta *delta;
+  size_t root_prefix;        // Length of "root/" in paths handed to the filter
+  unsigned char *candidates; // One bit per file id of the base index
+  uint32_t *trigrams;        // Distinct trigrams of the query, for the delta
+  size_t ntrigrams;
+};
+
+static void *sindex_xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static size_t sindex_root_prefix(const char *root)
+{
+  size_t len = strlen(root);
+  return (len > 0 && root[len - 1] == '/') ? len : len + 1;
+}
+
+int sindex_is_index_file(const char *name)
+{
+  return strcmp(name, SINDEX_FILE_NAME) == 0 || strcmp(name, SINDEX_TMP_NAME) == 0;
+}
+
+static char *sindex_path(const char *root, const char *rel)
+{
+  char *path = sindex_xrealloc(NULL, strlen(root) + strlen(rel) + 2);
+  sprintf(path, "%s/%s", root, rel);
+  return path;
+}
+
+static uint32_t trigram_at(const unsigned char *b)
+{
+  return (uint32_t)b[0] << 16 | (uint32_t)b[1] << 8 | b[2];
+}
+
+/*
+  Index construction.
+*/
+
+// A file found while walking the tree
+typedef struct
+{
+  char *rel;
+  struct stat st;
+} BuildFile;
+
+typedef struct
+{
+  BuildFile *files;
+  size_t nfiles;
+  size_t cap;
+} BuildList;
+
+static void build_walk(const char *root, const char *rel, BuildList *list)
+{
+  char *dir_path;
+  size_t root_len = strlen(root);
+  size_t rel_len = strlen(rel);
+
+  dir_path = sindex_xrealloc(NULL, root_len + rel_len + 2);
+  sprintf(dir_path, rel_len ? "%s/%s" : "%s%s", root, rel);
+
+  DIR *dp = opendir(dir_path);
+  if (dp == NULL)
+  {
+    fprintf(stderr, "search: %s: %s\n", dir_path, strerror(errno));
+    free(dir_path);
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dp)) != NULL)
+  {
+    const char *name = entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+      continue;
+    if (rel_len == 0 && sindex_is_index_file(name))
+      continue; // The index itself and its temporary files
+
+    size_t name_len = strlen(name);
+    char *child_rel = sindex_xrealloc(NULL, rel_len + name_len + 2);
+    sprintf(child_rel, rel_len ? "%s/%s" : "%s%s", rel, name);
+
+    char *child_path = sindex_xrealloc(NULL, root_len + rel_len + name_len + 3);
+    sprintf(child_path, "%s/%s", root, child_rel);
+
+    struct stat st;
+    if (lstat(child_path, &st) == 0)
+    {
+      if (S_ISDIR(st.st_mode))
+      {
+        build_walk(root, child_rel, list);
+      }
+      else if (S_ISREG(st.st_mode))
+      {
+        if (list->nfiles == list->cap)
+        {
+          list->cap = list->cap ? list->cap * 2 : 256;
+          list->files = sindex_xrealloc(list->files, list->cap * sizeof(BuildFile));
+        }
+        list->files[list->nfiles].rel = child_rel;
+        list->files[list->nfiles].st = st;
+        list->nfiles++;
+        child_rel = NULL; // Owned by the list now
+      }
+    }
+    free(child_path);
+    free(child_rel);
+  }
+  closedir(dp);
+  free(dir_path);
+}
+
+static int compare_build_files(const void *a, const void *b)
+{
+  return strcmp(((const BuildFile *)a)->rel, ((const BuildFile *)b)->rel);
+}
+
+// Stable LSD radix sort of (trigram << 32 | file id) pairs. When the pairs
+// were generated in file id order (a full build) only the trigram bits need
+// sorting, since stability keeps every posting list in id order; a merge
+// produces ids out of order and sorts on them first.
+static void sort_pairs(uint64_t *pairs, size_t n, int ids_sorted)
+{
+  uint64_t *tmp = sindex_xrealloc(NULL, (n ? n : 1) * sizeof(uint64_t));
+  size_t *counts = sindex_xrealloc(NULL, (1u << TRIGRAM_RADIX_BITS) * sizeof(size_t));
+  static const int all_shifts[] = {0, 12, 24, 32, 44};
+
+  for (int pass = ids_sorted ? 3 : 0; pass < 5; pass++)
+  {
+    int shift = all_shifts[pass];
+    memset(counts, 0, (1u << TRIGRAM_RADIX_BITS) * sizeof(size_t));
+    for (size_t i = 0; i < n; i++)
+      counts[(pairs[i] >> shift) & ((1u << TRIGRAM_RADIX_BITS) - 1)]++;
+    size_t sum = 0;
+    for (size_t b = 0; b < (1u << TRIGRAM_RADIX_BITS); b++)
+    {
+      size_t c = counts[b];
+      counts[b] = sum;
+      sum += c;
+    }
+    for (size_t i = 0; i < n; i++)
+      tmp[counts[(pairs[i] >> shift) & ((1u << TRIGRAM_RADIX_BITS) - 1)]++] = pairs[i];
+    memcpy(pairs, tmp, n * sizeof(uint64_t));
+  }
+  free(counts);
+  free(tmp);
+}
+
+static size_t put_varint(unsigned char *out, uint32_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (unsigned char)v;
+  return n;
+}
+
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint32_t *v)
+{
+  uint32_t result = 0;
+  int shift = 0;
+  while (p < end && shift < 35)
+  {
+    unsigned char b = *p++;
+    result |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+    {
+      *v = result;
+      return p;
+    }
+    shift += 7;
+  }
+  return NULL;
+}
+
+// Store the distinct trigrams of buf in *out (unordered) and return how many
+// there are. seen must be all zero on entry and is all zero again on return.
+static size_t distinct_trigrams(const unsigned char *buf, size_t len, unsigned char *seen,
+                                uint32_t **out, size_t *out_cap)
+{
+  size_t nseen = 0;
+  if (len < 3)
+    return 0;
+
+  uint32_t t = (uint32_t)buf[0] << 8 | buf[1];
+  for (size_t i = 2; i < len; i++)
+  {
+    t = ((t << 8) | buf[i]) & (TRIGRAM_SPACE - 1);
+    if (seen[t >> 3] & (1u << (t & 7)))
+      continue;
+    seen[t >> 3] |= 1u << (t & 7);
+    if (nseen == *out_cap)
+    {
+      *out_cap = *out_cap ? *out_cap * 2 : 4096;
+      *out = sindex_xrealloc(*out, *out_cap * sizeof(uint32_t));
+    }
+    (*out)[nseen++] = t;
+  }
+
+  for (size_t i = 0; i < nseen; i++)
+    seen[(*out)[i] >> 3] &= ~(1u << ((*out)[i] & 7)); // Reset for the next file
+  return nseen;
+}
+
+// Growable array of (trigram << 32 | file id) pairs
+typedef struct
+{
+  uint64_t *pairs;
+  size_t count;
+  size_t cap;
+} PairList;
+
+static void pairs_add(PairList *list, const uint32_t *tris, size_t ntris, uint32_t file_id)
+{
+  if (list->count + ntris > list->cap)
+  {
+    while (list->count + ntris > list->cap)
+      list->cap = list->cap ? list->cap * 2 : 65536;
+    list->pairs = sindex_xrealloc(list->pairs, list->cap * sizeof(uint64_t));
+  }
+  for (size_t i = 0; i < ntris; i++)
+    list->pairs[list->count++] = (uint64_t)tris[i] << 32 | file_id;
+}
+
+// Read or map a whole file. *mapped tells the caller how to release it.
+static unsigned char *load_file(const char *path, size_t size, int *mapped)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  *mapped = 0;
+  if (size == 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map != MAP_FAILED)
+  {
+    *mapped = 1;
+    close(fd);
+    return map;
+  }
+
+  unsigned char *buf = malloc(size);
+  size_t have = 0;
+  while (buf && have < size)
+  {
+    ssize_t n = read(fd, buf + have, size - have);
+    if (n <= 0)
+      break;
+    have += n;
+  }
+  close(fd);
+  return buf;
+}
+
+// One file as it will appear in a written index
+typedef struct
+{
+  const char *rel;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t size;
+  int64_t indexed_at;
+} WriteFile;
+
+// Encode and write an index. files must be sorted by path and pairs must be
+// sorted by (trigram, file id). The new file replaces the old one atomically
+// so concurrent searches never see a half-written index.
+static int sindex_write(const char *root, const WriteFile *wfiles, size_t nfiles,
+                        const uint64_t *pairs, size_t npairs, SearchIndexStats *stats)
+{
+  size_t ntrigrams = 0;
+  for (size_t i = 0; i < npairs; i++)
+  {
+    if (i == 0 || (pairs[i] >> 32) != (pairs[i - 1] >> 32))
+      ntrigrams++;
+  }
+
+  SearchIndexTrigram *tris = sindex_xrealloc(NULL, (ntrigrams ? ntrigrams : 1) * sizeof(SearchIndexTrigram));
+  unsigned char *postings = sindex_xrealloc(NULL, npairs * 5 + 1);
+  size_t postings_len = 0, t = 0;
+  uint32_t prev = 0;
+  for (size_t i = 0; i < npairs; i++)
+  {
+    uint32_t tri = (uint32_t)(pairs[i] >> 32);
+    uint32_t id = (uint32_t)pairs[i];
+    if (i == 0 || tri != tris[t - 1].trigram)
+    {
+      tris[t].trigram = tri;
+      tris[t].count = 0;
+      tris[t].postings_off = postings_len;
+      t++;
+      prev = 0;
+    }
+    postings_len += put_varint(postings + postings_len, id - prev);
+    prev = id;
+    tris[t - 1].count++;
+  }
+
+  // Lay out the file
+  SearchIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SINDEX_MAGIC, sizeof(header.magic));
+  header.version = SINDEX_VERSION;
+  header.nfiles = (uint32_t)nfiles;
+  header.ntrigrams = (uint32_t)ntrigrams;
+  header.built_at = time(NULL);
+  header.files_off = sizeof(header);
+  header.trigrams_off = header.files_off + nfiles * sizeof(SearchIndexFile);
+  header.postings_off = header.trigrams_off + ntrigrams * sizeof(SearchIndexTrigram);
+  header.paths_off = header.postings_off + postings_len;
+
+  SearchIndexFile *files = sindex_xrealloc(NULL, (nfiles ? nfiles : 1) * sizeof(SearchIndexFile));
+  uint64_t path_off = 0;
+  for (size_t i = 0; i < nfiles; i++)
+  {
+    memset(&files[i], 0, sizeof(files[i]));
+    files[i].path_off = path_off;
+    files[i].path_len = (uint32_t)strlen(wfiles[i].rel);
+    files[i].mtime_sec = wfiles[i].mtime_sec;
+    files[i].mtime_nsec = wfiles[i].mtime_nsec;
+    files[i].size = wfiles[i].size;
+    files[i].indexed_at = wfiles[i].indexed_at;
+    path_off += files[i].path_len;
+  }
+  header.total_size = header.paths_off + path_off;
+
+  char *index_path = sindex_path(root, SINDEX_FILE_NAME);
+  char *tmp_path = sindex_path(root, SINDEX_TMP_NAME);
+
+  int rc = -1;
+  FILE *fp = fopen(tmp_path, "wb");
+  if (fp == NULL)
+  {
+    perror("search: cannot write index");
+  }
+  else
+  {
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(files, sizeof(SearchIndexFile), nfiles, fp);
+    fwrite(tris, sizeof(SearchIndexTrigram), ntrigrams, fp);
+    fwrite(postings, 1, postings_len, fp);
+    for (size_t i = 0; i < nfiles; i++)
+      fwrite(wfiles[i].rel, 1, files[i].path_len, fp);
+
+    if (ferror(fp) | fclose(fp))
+      perror("search: cannot write index");
+    else if (rename(tmp_path, index_path) != 0)
+      perror("search: cannot install index");
+    else
+      rc = 0;
+    if (rc != 0)
+      unlink(tmp_path);
+  }
+
+  if (stats)
+  {
+    stats->files = header.nfiles;
+    stats->trigrams = header.ntrigrams;
+    stats->postings = npairs;
+    stats->index_size = header.total_size;
+  }
+
+  free(files);
+  free(tris);
+  free(postings);
+  free(index_path);
+  free(tmp_path);
+  return rc;
+}
+
+int sindex_build(const char *root, SearchIndexStats *stats)
+{
+  BuildList list = {NULL, 0, 0};
+  struct stat root_st;
+
+  if (stat(root, &root_st) != 0 || !S_ISDIR(root_st.st_mode))
+  {
+    fprintf(stderr, "search: %s: not a directory\n", root);
+    return -1;
+  }
+
+  time_t indexed_at = time(NULL);
+  build_walk(root, "", &list);
+  qsort(list.files, list.nfiles, sizeof(BuildFile), compare_build_files);
+
+  unsigned char *seen = calloc(TRIGRAM_SPACE / 8, 1);
+  uint32_t *tris = NULL;
+  size_t tris_cap = 0;
+  PairList pairs = {NULL, 0, 0};
+  uint64_t bytes = 0;
+
+  if (!seen)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+
+  WriteFile *wfiles = sindex_xrealloc(NULL, (list.nfiles ? list.nfiles : 1) * sizeof(WriteFile));
+  for (size_t i = 0; i < list.nfiles; i++)
+  {
+    BuildFile *f = &list.files[i];
+    char *path = sindex_path(root, f->rel);
+
+    int mapped;
+    size_t size = f->st.st_size;
+    unsigned char *data = load_file(path, size, &mapped);
+    if (data)
+    {
+      size_t n = distinct_trigrams(data, size, seen, &tris, &tris_cap);
+      pairs_add(&pairs, tris, n, (uint32_t)i);
+      bytes += size;
+      if (mapped)
+        munmap(data, size);
+      else
+        free(data);
+    }
+    free(path);
+
+    wfiles[i].rel = f->rel;
+    wfiles[i].mtime_sec = ST_MTIM(f->st).tv_sec;
+    wfiles[i].mtime_nsec = ST_MTIM(f->st).tv_nsec;
+    wfiles[i].size = f->st.st_size;
+    wfiles[i].indexed_at = indexed_at;
+  }
+  free(seen);
+  free(tris);
+
+  sort_pairs(pairs.pairs, pairs.count, 1);
+  int rc = sindex_write(root, wfiles, list.nfiles, pairs.pairs, pairs.count, stats);
+  if (stats)
+    stats->bytes_indexed = bytes;
+
+  for (size_t i = 0; i < list.nfiles; i++)
+    free(list.files[i].rel);
+  free(list.files);
+  free(wfiles);
+  free(pairs.pairs);
+  return rc;
+}
+
+/*
+  Index lookup.
+*/
+
+SearchIndex *sindex_open(const char *root)
+{
+  char *path = sindex_path(root, SINDEX_FILE_NAME);
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SearchIndexHeader))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  const SearchIndexHeader *h = map;
+  uint64_t size = st.st_size;
+  if (memcmp(h->magic, SINDEX_MAGIC, sizeof(h->magic)) != 0 || h->version != SINDEX_VERSION ||
+      h->total_size != size || h->files_off + (uint64_t)h->nfiles * sizeof(SearchIndexFile) > h->trigrams_off ||
+      h->trigrams_off + (uint64_t)h->ntrigrams * sizeof(SearchIndexTrigram) > h->postings_off ||
+      h->postings_off > h->paths_off || h->paths_off > size)
+  {
+    fprintf(stderr, "search: ignoring damaged index in %s\n", root);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  SearchIndex *index = calloc(1, sizeof(SearchIndex));
+  if (!index)
+  {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  index->map = map;
+  index->map_len = st.st_size;
+  index->header = h;
+  index->files = (const SearchIndexFile *)((const char *)map + h->files_off);
+  index->trigrams = (const SearchIndexTrigram *)((const char *)map + h->trigrams_off);
+  index->postings = (const unsigned char *)map + h->postings_off;
+  index->paths = (const char *)map + h->paths_off;
+  return index;
+}
+
+void sindex_close(SearchIndex *index)
+{
+  if (!index)
+    return;
+  munmap(index->map, index->map_len);
+  free(index);
+}
+
+static const SearchIndexTrigram *find_trigram(const SearchIndex *index, uint32_t tri)
+{
+  size_t lo = 0, hi = index->header->ntrigrams;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index->trigrams[mid].trigram < tri)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < index->header->ntrigrams && index->trigrams[lo].trigram == tri)
+    return &index->trigrams[lo];
+  return NULL;
+}
+
+// Decode one posting list into a bitmap
+static void decode_postings(const SearchIndex *index, const SearchIndexTrigram *tri, unsigned char *bits)
+{
+  const unsigned char *p = index->postings + tri->postings_off;
+  const unsigned char *end = (const unsigned char *)index->paths;
+  uint32_t id = 0;
+  for (uint32_t i = 0; i < tri->count && p; i++)
+  {
+    uint32_t delta;
+    p = get_varint(p, end, &delta);
+    if (!p)
+      break;
+    id += delta;
+    if (id < index->header->nfiles)
+      bits[id >> 3] |= 1u << (id & 7);
+  }
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int sorted_contains(const uint32_t *arr, size_t n, uint32_t v)
+{
+  size_t lo = 0, hi = n;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (arr[mid] < v)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && arr[lo] == v;
+}
+
+SearchIndexQuery *sindex_query(const SearchIndex *index, const SearchIndexDelta *delta,
+                               const char *root, const char *query, size_t len)
+{
+  if (!index || len < 3)
+    return NULL;
+
+  size_t nbytes = (index->header->nfiles + 7) / 8;
+  SearchIndexQuery *q = calloc(1, sizeof(SearchIndexQuery));
+  unsigned char *result = calloc(nbytes ? nbytes : 1, 1);
+  unsigned char *tmp = calloc(nbytes ? nbytes : 1, 1);
+  uint32_t *qtris = malloc((len - 2) * sizeof(uint32_t));
+  if (!q || !result || !tmp || !qtris)
+  {
+    free(q);
+    free(result);
+    free(tmp);
+    free(qtris);
+    return NULL;
+  }
+  q->index = index;
+  q->delta = delta;
+  q->root_prefix = sindex_root_prefix(root);
+  q->candidates = result;
+  q->trigrams = qtris;
+
+  for (size_t i = 0; i + 3 <= len; i++)
+    qtris[i] = trigram_at((const unsigned char *)query + i);
+  qsort(qtris, len - 2, sizeof(uint32_t), compare_u32);
+  for (size_t i = 0; i < len - 2; i++)
+  {
+    if (q->ntrigrams == 0 || qtris[q->ntrigrams - 1] != qtris[i])
+      qtris[q->ntrigrams++] = qtris[i];
+  }
+
+  // Start from the rarest trigram so the intersection shrinks quickly
+  const SearchIndexTrigram *rarest = NULL;
+  for (size_t i = 0; i < q->ntrigrams; i++)
+  {
+    const SearchIndexTrigram *tri = find_trigram(index, qtris[i]);
+    if (!tri)
+    {
+      free(tmp);
+      return q; // Some trigram occurs nowhere: no indexed file can match
+    }
+    if (!rarest || tri->count < rarest->count)
+      rarest = tri;
+  }
+  decode_postings(index, rarest, result);
+
+  for (size_t i = 0; i < q->ntrigrams; i++)
+  {
+    const SearchIndexTrigram *tri = find_trigram(index, qtris[i]);
+    if (tri == rarest)
+      continue;
+    memset(tmp, 0, nbytes);
+    decode_postings(index, tri, tmp);
+    for (size_t k = 0; k < nbytes; k++)
+      result[k] &= tmp[k];
+  }
+  free(tmp);
+  return q;
+}
+
+void sindex_query_free(SearchIndexQuery *query)
+{
+  if (!query)
+    return;
+  free(query->candidates);
+  free(query->trigrams);
+  free(query);
+}
+
+static long find_file(const SearchIndex *index, const char *rel)
+{
+  size_t rel_len = strlen(rel);
+  size_t lo = 0, hi = index->header->nfiles;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    const SearchIndexFile *f = &index->files[mid];
+    size_t n = f->path_len < rel_len ? f->path_len : rel_len;
+    int cmp = memcmp(index->paths + f->path_off, rel, n);
+    if (cmp == 0)
+      cmp = (f->path_len > rel_len) - (f->path_len < rel_len);
+    if (cmp == 0)
+      return (long)mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+void sindex_for_each_in_dir(const SearchIndex *index, const char *dir,
+                            void (*fn)(void *ctx, const char *rel), void *ctx)
+{
+  if (!index)
+    return;
+
+  size_t dir_len = strlen(dir);
+  char *prefix = sindex_xrealloc(NULL, dir_len + 2);
+  sprintf(prefix, "%s/", dir);
+  size_t plen = dir_len + 1;
+
+  // Paths are sorted, so everything under dir is one contiguous run
+  size_t lo = 0, hi = index->header->nfiles;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    const SearchIndexFile *f = &index->files[mid];
+    size_t n = f->path_len < plen ? f->path_len : plen;
+    int cmp = memcmp(index->paths + f->path_off, prefix, n);
+    if (cmp < 0 || (cmp == 0 && f->path_len < plen))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  char *rel = NULL;
+  size_t rel_cap = 0;
+  for (size_t i = lo; i < index->header->nfiles; i++)
+  {
+    const SearchIndexFile *f = &index->files[i];
+    if (f->path_len < plen || memcmp(index->paths + f->path_off, prefix, plen) != 0)
+      break;
+    if (f->path_len + 1 > rel_cap)
+    {
+      rel_cap = f->path_len + 1;
+      rel = sindex_xrealloc(rel, rel_cap);
+    }
+    memcpy(rel, index->paths + f->path_off, f->path_len);
+    rel[f->path_len] = '\0';
+    fn(ctx, rel);
+  }
+  free(rel);
+  free(prefix);
+}
+
+static const SearchIndexDeltaEntry *delta_find(const SearchIndexDelta *delta, const char *rel);
+
+int sindex_skip_file(void *query, const char *path)
+{
+  SearchIndexQuery *q = query;
+  const SearchIndex *index = q->index;
+  struct stat st;
+
+  if (strlen(path) < q->root_prefix)
+    return 0;
+  const char *rel = path + q->root_prefix;
+
+  // The delta segment is newer than the base index, so it wins
+  const SearchIndexDeltaEntry *e = q->delta ? delta_find(q->delta, rel) : NULL;
+  if (e)
+  {
+    if (e->deleted || stat(path, &st) != 0 || (uint64_t)st.st_size != e->size ||
+        ST_MTIM(st).tv_sec != e->mtime_sec || ST_MTIM(st).tv_nsec != e->mtime_nsec ||
+        ST_MTIM(st).tv_sec >= e->indexed_at)
+      return 0;
+    for (size_t i = 0; i < q->ntrigrams; i++)
+    {
+      if (!sorted_contains(e->trigrams, e->ntrigrams, q->trigrams[i]))
+        return 1;
+    }
+    return 0;
+  }
+
+  long id = find_file(index, rel);
+  if (id < 0)
+    return 0; // Not indexed yet
+
+  const SearchIndexFile *f = &index->files[id];
+  if (stat(path, &st) != 0 || (uint64_t)st.st_size != f->size ||
+      ST_MTIM(st).tv_sec != f->mtime_sec || ST_MTIM(st).tv_nsec != f->mtime_nsec ||
+      ST_MTIM(st).tv_sec >= f->indexed_at)
+    return 0; // Changed since (or racily during) indexing: verify it
+
+  return !(q->candidates[id >> 3] & (1u << (id & 7)));
+}
+
+/*
+  Delta segment.
+*/
+
+#define DELTA_INITIAL_BUCKETS 64
+
+static size_t delta_hash(const char *s)
+{
+  size_t h = 1469598103934665603ULL;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+  return h;
+}
+
+SearchIndexDelta *sindex_delta_new(void)
+{
+  SearchIndexDelta *delta = calloc(1, sizeof(SearchIndexDelta));
+  if (!delta)
+    return NULL;
+  delta->nbuckets = DELTA_INITIAL_BUCKETS;
+  delta->buckets = calloc(delta->nbuckets, sizeof(SearchIndexDeltaEntry *));
+  if (!delta->buckets)
+  {
+    free(delta);
+    return NULL;
+  }
+  return delta;
+}
+
+static void delta_entry_free(SearchIndexDeltaEntry *e)
+{
+  if (!e)
+    return;
+  free(e->rel);
+  free(e->trigrams);
+  free(e);
+}
+
+void sindex_delta_clear(SearchIndexDelta *delta)
+{
+  for (size_t b = 0; b < delta->nbuckets; b++)
+  {
+    SearchIndexDeltaEntry *e = delta->buckets[b];
+    while (e)
+    {
+      SearchIndexDeltaEntry *next = e->next;
+      delta_entry_free(e);
+      e = next;
+    }
+    delta->buckets[b] = NULL;
+  }
+  delta->count = 0;
+}
+
+void sindex_delta_free(SearchIndexDelta *delta)
+{
+  if (!delta)
+    return;
+  sindex_delta_clear(delta);
+  free(delta->buckets);
+  free(delta->seen);
+  free(delta->scratch);
+  free(delta);
+}
+
+size_t sindex_delta_count(const SearchIndexDelta *delta)
+{
+  return delta ? delta->count : 0;
+}
+
+static const SearchIndexDeltaEntry *delta_find(const SearchIndexDelta *delta, const char *rel)
+{
+  const SearchIndexDeltaEntry *e = delta->buckets[delta_hash(rel) & (delta->nbuckets - 1)];
+  while (e && strcmp(e->rel, rel) != 0)
+    e = e->next;
+  return e;
+}
+
+SearchIndexDeltaEntry *sindex_delta_scan(SearchIndexDelta *delta, const char *root, const char *rel)
+{
+  SearchIndexDeltaEntry *e = calloc(1, sizeof(SearchIndexDeltaEntry));
+  if (!e)
+    return NULL;
+  e->rel = sindex_xrealloc(NULL, strlen(rel) + 1);
+  strcpy(e->rel, rel);
+  e->indexed_at = time(NULL);
+
+  char *path = sindex_path(root, rel);
+  struct stat st;
+  if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    e->deleted = 1;
+    free(path);
+    return e;
+  }
+  e->mtime_sec = ST_MTIM(st).tv_sec;
+  e->mtime_nsec = ST_MTIM(st).tv_nsec;
+  e->size = st.st_size;
+
+  if (!delta->seen)
+  {
+    delta->seen = calloc(TRIGRAM_SPACE / 8, 1);
+    if (!delta->seen)
+    {
+      fprintf(stderr, "lsh: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  int mapped;
+  unsigned char *data = load_file(path, st.st_size, &mapped);
+  if (data)
+  {
+    size_t n = distinct_trigrams(data, st.st_size, delta->seen, &delta->scratch, &delta->scratch_cap);
+    e->trigrams = sindex_xrealloc(NULL, (n ? n : 1) * sizeof(uint32_t));
+    memcpy(e->trigrams, delta->scratch, n * sizeof(uint32_t));
+    qsort(e->trigrams, n, sizeof(uint32_t), compare_u32);
+    e->ntrigrams = n;
+    if (mapped)
+      munmap(data, st.st_size);
+    else
+      free(data);
+  }
+  else if (st.st_size > 0)
+  {
+    e->deleted = 1; // Unreadable: never let the index vouch for it
+  }
+  free(path);
+  return e;
+}
+
+void sindex_delta_put(SearchIndexDelta *delta, SearchIndexDeltaEntry *entry)
+{
+  if (delta->count >= delta->nbuckets)
+  {
+    // Grow and rehash at load factor 1
+    size_t nbuckets = delta->nbuckets * 2;
+    SearchIndexDeltaEntry **buckets = calloc(nbuckets, sizeof(SearchIndexDeltaEntry *));
+    if (buckets)
+    {
+      for (size_t b = 0; b < delta->nbuckets; b++)
+      {
+        SearchIndexDeltaEntry *e = delta->buckets[b];
+        while (e)
+        {
+          SearchIndexDeltaEntry *next = e->next;
+          size_t nb = delta_hash(e->rel) & (nbuckets - 1);
+          e->next = buckets[nb];
+          buckets[nb] = e;
+          e = next;
+        }
+      }
+      free(delta->buckets);
+      delta->buckets = buckets;
+      delta->nbuckets = nbuckets;
+    }
+  }
+
+  entry->generation = ++delta->generation;
+  SearchIndexDeltaEntry **slot = &delta->buckets[delta_hash(entry->rel) & (delta->nbuckets - 1)];
+  while (*slot && strcmp((*slot)->rel, entry->rel) != 0)
+    slot = &(*slot)->next;
+  if (*slot)
+  {
+    entry->next = (*slot)->next;
+    delta_entry_free(*slot);
+  }
+  else
+  {
+    entry->next = NULL;
+    delta->count++;
+  }
+  *slot = entry;
+}
+
+/*
+  Merging the delta into a new base index.
+*/
+
+SearchIndexSnapshot *sindex_delta_snapshot(const SearchIndexDelta *delta)
+{
+  SearchIndexSnapshot *snap = calloc(1, sizeof(SearchIndexSnapshot));
+  if (!snap)
+    return NULL;
+  snap->entries = calloc(delta->count ? delta->count : 1, sizeof(SearchIndexDeltaEntry));
+  if (!snap->entries)
+  {
+    free(snap);
+    return NULL;
+  }
+
+  for (size_t b = 0; b < delta->nbuckets; b++)
+  {
+    for (const SearchIndexDeltaEntry *e = delta->buckets[b]; e; e = e->next)
+    {
+      SearchIndexDeltaEntry *copy = &snap->entries[snap->count++];
+      *copy = *e;
+      copy->next = NULL;
+      copy->rel = sindex_xrealloc(NULL, strlen(e->rel) + 1);
+      strcpy(copy->rel, e->rel);
+      copy->trigrams = sindex_xrealloc(NULL, (e->ntrigrams ? e->ntrigrams : 1) * sizeof(uint32_t));
+      memcpy(copy->trigrams, e->trigrams, e->ntrigrams * sizeof(uint32_t));
+    }
+  }
+  return snap;
+}
+
+void sindex_snapshot_free(SearchIndexSnapshot *snap)
+{
+  if (!snap)
+    return;
+  for (size_t i = 0; i < snap->count; i++)
+  {
+    free(snap->entries[i].rel);
+    free(snap->entries[i].trigrams);
+  }
+  free(snap->entries);
+  free(snap);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  return strcmp(((const SearchIndexDeltaEntry *)a)->rel, ((const SearchIndexDeltaEntry *)b)->rel);
+}
+
+int sindex_merge_write(const char *root, const SearchIndex *base, SearchIndexSnapshot *snap,
+                       SearchIndexStats *stats)
+{
+  uint32_t nbase = base ? base->header->nfiles : 0;
+  qsort(snap->entries, snap->count, sizeof(SearchIndexDeltaEntry), compare_entries);
+
+  // Surviving base files keep their metadata; updated files come from the
+  // snapshot. Both lists are sorted, so a single merge pass orders them.
+  size_t cap = nbase + snap->count;
+  WriteFile *wfiles = sindex_xrealloc(NULL, (cap ? cap : 1) * sizeof(WriteFile));
+  int64_t *base_to_new = sindex_xrealloc(NULL, (nbase ? nbase : 1) * sizeof(int64_t));
+  char **base_names = sindex_xrealloc(NULL, (nbase ? nbase : 1) * sizeof(char *));
+  size_t *snap_to_new = sindex_xrealloc(NULL, (snap->count ? snap->count : 1) * sizeof(size_t));
+  size_t nfiles = 0, bi = 0, si = 0;
+
+  for (uint32_t i = 0; i < nbase; i++)
+  {
+    const SearchIndexFile *f = &base->files[i];
+    base_names[i] = sindex_xrealloc(NULL, f->path_len + 1);
+    memcpy(base_names[i], base->paths + f->path_off, f->path_len);
+    base_names[i][f->path_len] = '\0';
+  }
+
+  while (bi < nbase || si < snap->count)
+  {
+    int cmp;
+    if (bi == nbase)
+      cmp = 1;
+    else if (si == snap->count)
+      cmp = -1;
+    else
+      cmp = strcmp(base_names[bi], snap->entries[si].rel);
+
+    if (cmp < 0)
+    {
+      const SearchIndexFile *f = &base->files[bi];
+      WriteFile *w = &wfiles[nfiles];
+      w->rel = base_names[bi];
+      w->mtime_sec = f->mtime_sec;
+      w->mtime_nsec = f->mtime_nsec;
+      w->size = f->size;
+      w->indexed_at = f->indexed_at;
+      base_to_new[bi++] = nfiles++;
+      continue;
+    }
+
+    if (cmp == 0)
+      base_to_new[bi++] = -1; // Superseded by the delta
+
+    const SearchIndexDeltaEntry *e = &snap->entries[si];
+    if (e->deleted)
+    {
+      snap_to_new[si++] = (size_t)-1;
+      continue;
+    }
+    WriteFile *w = &wfiles[nfiles];
+    w->rel = e->rel;
+    w->mtime_sec = e->mtime_sec;
+    w->mtime_nsec = e->mtime_nsec;
+    w->size = e->size;
+    w->indexed_at = e->indexed_at;
+    snap_to_new[si++] = nfiles++;
+  }
+
+  // Re-key the surviving base postings and add the delta's
+  PairList pairs = {NULL, 0, 0};
+  for (uint32_t t = 0; base && t < base->header->ntrigrams; t++)
+  {
+    const SearchIndexTrigram *tri = &base->trigrams[t];
+    const unsigned char *p = base->postings + tri->postings_off;
+    const unsigned char *end = (const unsigned char *)base->paths;
+    uint32_t id = 0;
+    for (uint32_t k = 0; k < tri->count && p; k++)
+    {
+      uint32_t d;
+      p = get_varint(p, end, &d);
+      if (!p)
+        break;
+      id += d;
+      if (id < nbase && base_to_new[id] >= 0)
+      {
+        uint32_t new_id = (uint32_t)base_to_new[id];
+        pairs_add(&pairs, &tri->trigram, 1, new_id);
+      }
+    }
+  }
+  for (size_t i = 0; i < snap->count; i++)
+  {
+    if (snap_to_new[i] != (size_t)-1)
+      pairs_add(&pairs, snap->entries[i].trigrams, snap->entries[i].ntrigrams, (uint32_t)snap_to_new[i]);
+  }
+
+  sort_pairs(pairs.pairs, pairs.count, 0);
+  int rc = sindex_write(root, wfiles, nfiles, pairs.pairs, pairs.count, stats);
+
+  for (uint32_t i = 0; i < nbase; i++)
+    free(base_names[i]);
+  free(base_names);
+  free(base_to_new);
+  free(snap_to_new);
+  free(wfiles);
+  free(pairs.pairs);
+  return rc;
+}
+
+void sindex_delta_retire(SearchIndexDelta *delta, const SearchIndexSnapshot *snap)
+{
+  // Drop entries that are now part of the base index; anything updated
+  // while the merge ran has a newer generation and stays in the delta.
+  for (size_t i = 0; i < snap->count; i++)
+  {
+    const SearchIndexDeltaEntry *s = &snap->entries[i];
+    SearchIndexDeltaEntry **slot = &delta->buckets[delta_hash(s->rel) & (delta->nbuckets - 1)];
+    while (*slot && strcmp((*slot)->rel, s->rel) != 0)
+      slot = &(*slot)->next;
+    if (*slot && (*slot)->generation == s->generation)
+    {
+      SearchIndexDeltaEntry *dead = *slot;
+      *slot = dead->next;
+      delta_entry_free(dead);
+      delta->count--;
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#ifndef SINDEX_H
+#define SINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Name of the index file written at the top of an indexed tree
+#define SINDEX_FILE_NAME ".pss_index"
+// What a new index is written to before it replaces the old one
+#define SINDEX_TMP_NAME SINDEX_FILE_NAME ".tmp"
+#define SINDEX_MAGIC "PSSIDX1"
+#define SINDEX_VERSION 2
+
+// Summary printed after "search --index"
+typedef struct
+{
+  uint32_t files;
+  uint32_t trigrams;
+  uint64_t postings;
+  uint64_t bytes_indexed;
+  uint64_t index_size;
+} SearchIndexStats;
+
+typedef struct SearchIndex SearchIndex;
+typedef struct SearchIndexQuery SearchIndexQuery;
+typedef struct SearchIndexDelta SearchIndexDelta;
+typedef struct SearchIndexDeltaEntry SearchIndexDeltaEntry;
+typedef struct SearchIndexSnapshot SearchIndexSnapshot;
+
+// Is name (a directory entry) an index file, or one being written? Searches
+// and the index itself leave those out.
+int sindex_is_index_file(const char *name);
+
+// Build (or rebuild) the trigram index for root. Returns 0 on success.
+int sindex_build(const char *root, SearchIndexStats *stats);
+
+// Map the index stored in root, or return NULL if there is none
+SearchIndex *sindex_open(const char *root);
+void sindex_close(SearchIndex *index);
+
+// Work out which indexed files can contain query, taking files re-indexed
+// into delta (which may be NULL) into account. root is the directory as the
+// search engine will spell it in paths. Returns NULL when the index cannot
+// narrow anything down (e.g. the query is shorter than three bytes); the
+// caller should then scan every file.
+SearchIndexQuery *sindex_query(const SearchIndex *index, const SearchIndexDelta *delta,
+                               const char *root, const char *query, size_t len);
+void sindex_query_free(SearchIndexQuery *query);
+
+// Search filter: returns nonzero if path is known not to contain the query.
+// Files that are new or have changed since the index was built are never
+// skipped, so a stale index only costs speed, not correctness.
+int sindex_skip_file(void *query, const char *path);
+
+// Call fn for every indexed file whose path starts with dir + "/"
+void sindex_for_each_in_dir(const SearchIndex *index, const char *dir,
+                            void (*fn)(void *ctx, const char *rel), void *ctx);
+
+// In-memory delta segment holding files re-indexed since the last write.
+// The delta does no locking of its own; see swatch.c.
+SearchIndexDelta *sindex_delta_new(void);
+void sindex_delta_free(SearchIndexDelta *delta);
+void sindex_delta_clear(SearchIndexDelta *delta);
+size_t sindex_delta_count(const SearchIndexDelta *delta);
+
+// Re-index root/rel from disk (a missing file yields a deletion record).
+// Touches nothing but the delta's scratch space, so it may run without the
+// lock that guards lookups, but only one thread may call it at a time.
+SearchIndexDeltaEntry *sindex_delta_scan(SearchIndexDelta *delta, const char *root, const char *rel);
+// Insert or replace an entry; the delta takes ownership
+void sindex_delta_put(SearchIndexDelta *delta, SearchIndexDeltaEntry *entry);
+
+// Background merge: copy the delta, write base + copy as a new index file,
+// then drop the entries that did not change in the meantime.
+SearchIndexSnapshot *sindex_delta_snapshot(const SearchIndexDelta *delta);
+int sindex_merge_write(const char *root, const SearchIndex *base, SearchIndexSnapshot *snap,
+                       SearchIndexStats *stats);
+void sindex_delta_retire(SearchIndexDelta *delta, const SearchIndexSnapshot *snap);
+void sindex_snapshot_free(SearchIndexSnapshot *snap);
+
+#endif // SINDEX_H
@@ -0,0 +1,197 @@
+// spawn.c
+//
+// Starting external commands. Everything the shell runs goes through
+// posix_spawn, which glibc implements with a vfork-style clone: the child
+// shares the shell's memory until it execs, so starting a command costs the
+// same whether the shell holds a few KB or several GB of indexes. fork, by
+// contrast, copies the page tables of the whole address space first.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "spawn.h"
+#include "cmdhash.h"
+#include "jobs.h"
+
+extern char **environ;
+
+static void spawn_check(int rc)
+{
+  if (rc == ENOMEM)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void spawn_io_init(SpawnIo *io)
+{
+  spawn_check(posix_spawn_file_actions_init(&io->actions));
+  io->opens = 0;
+  io->set_pgroup = 0;
+  io->pgroup = 0;
+}
+
+void spawn_io_destroy(SpawnIo *io)
+{
+  posix_spawn_file_actions_destroy(&io->actions);
+}
+
+void spawn_io_reset(SpawnIo *io)
+{
+#ifdef __GLIBC__
+  // Dup, close and tcsetpgrp actions live in the array alone, so emptying
+  // it is enough; an open also owns a copy of its path
+  if (io->opens == 0)
+  {
+    io->actions.__used = 0;
+    io->set_pgroup = 0;
+    io->pgroup = 0;
+    return;
+  }
+#endif
+  spawn_io_destroy(io);
+  spawn_io_init(io);
+}
+
+void spawn_io_open(SpawnIo *io, int fd, const char *path, int flags, mode_t mode)
+{
+  io->opens++;
+  spawn_check(posix_spawn_file_actions_addopen(&io->actions, fd, path, flags, mode));
+}
+
+void spawn_io_dup(SpawnIo *io, int from, int to)
+{
+  spawn_check(posix_spawn_file_actions_adddup2(&io->actions, from, to));
+}
+
+void spawn_io_close(SpawnIo *io, int fd)
+{
+  spawn_check(posix_spawn_file_actions_addclose(&io->actions, fd));
+}
+
+void spawn_io_pgroup(SpawnIo *io, pid_t pgid, int foreground)
+{
+  io->set_pgroup = 1;
+  io->pgroup = pgid;
+  if (foreground)
+  {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+    // The child's signals stay blocked until it execs, so it may take the
+    // terminal while still in the background
+    spawn_check(posix_spawn_file_actions_addtcsetpgrp_np(&io->actions, STDIN_FILENO));
+#endif
+  }
+}
+
+pid_t spawn_start(char *const argv[], const SpawnIo *io)
+{
+  const posix_spawn_file_actions_t *actions = io ? &io->actions : NULL;
+  posix_spawnattr_t attr;
+  pid_t pid;
+  int rc;
+
+  const char *path = cmdhash_lookup(argv[0]);
+  if (path == NULL)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  // Whatever group it joins, the child gets back the job control signals
+  // an interactive shell ignores
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGTSTP);
+  sigaddset(&defaults, SIGTTIN);
+  sigaddset(&defaults, SIGTTOU);
+  short flags = POSIX_SPAWN_SETSIGDEF;
+  spawn_check(posix_spawnattr_init(&attr));
+  spawn_check(posix_spawnattr_setsigdefault(&attr, &defaults));
+  if (io && io->set_pgroup)
+  {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    spawn_check(posix_spawnattr_setpgroup(&attr, io->pgroup));
+  }
+  spawn_check(posix_spawnattr_setflags(&attr, flags));
+  rc = posix_spawn(&pid, path, actions, &attr, argv, environ);
+  if (rc == ENOENT && path != argv[0])
+  {
+    // Removed since its directory was last checked: search PATH again
+    cmdhash_forget(argv[0]);
+    rc = posix_spawnp(&pid, argv[0], actions, &attr, argv, environ);
+  }
+  posix_spawnattr_destroy(&attr);
+  if (rc != 0)
+  {
+    errno = rc;
+    return -1;
+  }
+  return pid;
+}
+
+int spawn_wait(pid_t pid)
+{
+  int status;
+  for (;;)
+  {
+    if (waitpid(pid, &status, 0) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+      break;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Under job control the command runs as a job of its own, with its own
+// process group and the terminal, so Ctrl+Z stops it into the job table
+// the way it would a pipeline instead of leaving the shell waiting
+static int spawn_run_job(char *const argv[])
+{
+  char cmd[256];
+  size_t len = 0;
+  for (size_t i = 0; argv[i] && len < sizeof(cmd) - 1; i++)
+    len += snprintf(cmd + len, sizeof(cmd) - len, i ? " %s" : "%s", argv[i]);
+
+  Job *job = jobs_new(cmd);
+  SpawnIo io;
+  spawn_io_init(&io);
+  spawn_io_pgroup(&io, jobs_pgid(job), 1);
+  pid_t pid = spawn_start(argv, &io);
+  spawn_io_destroy(&io);
+  if (pid < 0)
+  {
+    int err = errno;
+    fprintf(stderr, "lsh: %s: %s\n", argv[0], strerror(err));
+    jobs_foreground(job); // Frees it, with no process to wait for
+    return spawn_error_status(err);
+  }
+  jobs_add_process(job, pid);
+  return jobs_foreground(job);
+}
+
+int spawn_run(char *const argv[], const SpawnIo *io)
+{
+  if (io == NULL && jobs_control())
+    return spawn_run_job(argv);
+  pid_t pid = spawn_start(argv, io);
+  if (pid < 0)
+  {
+    int err = errno;
+    fprintf(stderr, "lsh: %s: %s\n", argv[0], strerror(err));
+    return spawn_error_status(err);
+  }
+  return spawn_wait(pid);
+}
+
+int spawn_error_status(int err)
+{
+  return err == ENOENT ? SPAWN_NOT_FOUND : SPAWN_NOT_EXECUTABLE;
+}
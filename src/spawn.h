@@ -0,0 +1,63 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <spawn.h>
+#include <sys/types.h>
+
+// Exit statuses reported by spawn_run when the command could not be
+// started: it does not exist, or it exists but cannot be run
+#define SPAWN_NOT_FOUND 127
+#define SPAWN_NOT_EXECUTABLE 126
+
+// Redirections applied in the child before the command starts, in the order
+// they were added, and optionally the process group it joins
+typedef struct
+{
+  posix_spawn_file_actions_t actions;
+  int opens; // spawn_io_open calls, whose paths the actions hold copies of
+  int set_pgroup;
+  pid_t pgroup;
+} SpawnIo;
+
+void spawn_io_init(SpawnIo *io);
+void spawn_io_destroy(SpawnIo *io);
+// Drop every redirection and the process group, to set io up for another
+// command. With glibc the memory for the actions is kept, so a SpawnIo
+// reused for each command stops allocating once it has held the most
+// redirections one needs.
+void spawn_io_reset(SpawnIo *io);
+// Open path with flags (and mode, for O_CREAT) as fd in the child
+void spawn_io_open(SpawnIo *io, int fd, const char *path, int flags, mode_t mode);
+// Make to a copy of from in the child
+void spawn_io_dup(SpawnIo *io, int from, int to);
+void spawn_io_close(SpawnIo *io, int fd);
+// Put the child in process group pgid (0: a new group led by the child), with
+// the job control signals the shell ignores back to their defaults. With
+// foreground set the child also takes the terminal on fd 0 before it execs,
+// so call this before any spawn_io_dup that replaces fd 0.
+void spawn_io_pgroup(SpawnIo *io, pid_t pgid, int foreground);
+
+// Start argv[0] with argv, found through the command hash table (see
+// cmdhash.h), with io applied if it is not NULL. SIGTSTP, SIGTTIN and SIGTTOU
+// are back to their defaults in the child. Children are started with
+// posix_spawn, which does not copy the shell's page tables the way fork
+// does. Returns the child's pid, or -1 with errno set.
+pid_t spawn_start(char *const argv[], const SpawnIo *io);
+
+// Wait for pid to exit. Returns its exit code, or 128 + the signal number
+// if a signal killed it. Only for children outside job control, which
+// cannot be stopped from the terminal.
+int spawn_wait(pid_t pid);
+
+// spawn_start, then spawn_wait. With job control and no io, the command
+// runs as a foreground job instead (see jobs.h), which Ctrl+Z can stop.
+// Prints "lsh: <error>" and returns spawn_error_status(errno) if the
+// command could not be started.
+int spawn_run(char *const argv[], const SpawnIo *io);
+
+// The exit status for a command spawn_start failed to start with err:
+// SPAWN_NOT_FOUND for ENOENT, SPAWN_NOT_EXECUTABLE for anything else, such
+// as EACCES or ENOEXEC
+int spawn_error_status(int err);
+
+#endif // SPAWN_H
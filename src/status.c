@@ -0,0 +1,15 @@
+// status.c
+//
+// Exit status of builtins. Builtins return whether the shell goes on, so the
+// status they end with is set here instead, apart from the registry in
+// builtins.c so that modules with a builtin of their own link without it.
+
+#include "status.h"
+
+int builtin_status;
+
+int builtin_fail(int status)
+{
+  builtin_status = status;
+  return 1;
+}
@@ -0,0 +1,14 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+// Exit status of the builtin being run, which "$?" and the shell's own exit
+// status pass on like a program's. The shell sets it to 0 before each
+// builtin; one that fails sets it, to 1 or to the status of a program it
+// ran on the user's behalf.
+extern int builtin_status;
+
+// Record that the running builtin failed with status. Returns 1 (go on), so
+// an error path can end with "return builtin_fail(1);".
+int builtin_fail(int status);
+
+#endif // STATUS_H
@@ -0,0 +1,472 @@
+// suggest.c
+//
+// "Did you mean" suggestions for commands that were not found. Candidate
+// names come from three places: the builtins, the executables in each PATH
+// directory, and the commands run most often according to the history. They
+// all go into one symmetric delete index (symdel.h), so finding the closest
+// names costs a few dozen hash lookups rather than a distance per candidate.
+//
+// Each name counts the places it comes from. When a PATH directory changes,
+// or PATH itself does, only the directories affected are scanned again: the
+// names of the old scan lose a reference, those of the new one gain one. A
+// name left with none stays in the index, skipped by searches, until dead
+// names outnumber live ones and the index is rebuilt without them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "suggest.h"
+#include "symdel.h"
+#include "builtins.h"
+#include "cmdhash.h"
+#include "hist.h"
+
+// Below this many names the index is never rebuilt to drop dead ones
+#define SUGGEST_COMPACT_MIN 1024
+
+typedef struct
+{
+  uint32_t on_path; // PATH directories with an executable of this name
+  uint32_t runs; // Times run, if among the most frequent commands
+  uint8_t builtin;
+} SuggestName;
+
+typedef struct
+{
+  char *path;
+  struct timespec mtime; // As last scanned; zero if it could not be read
+  struct timespec checked; // When mtime was last read, monotonic
+  uint32_t *names; // Ids of the executables found
+  size_t nnames;
+} SuggestDir;
+
+static SymDel suggest_index;
+static SuggestName *suggest_names; // By word number in the index
+static size_t suggest_names_cap;
+static size_t suggest_dead; // Names with no place left to come from
+static int suggest_built;
+
+static SuggestDir *suggest_dirs;
+static size_t suggest_ndirs;
+static char *suggest_path; // PATH when the directories were last listed
+
+static void *suggest_xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static int suggest_alive(const SuggestName *s)
+{
+  return s->builtin || s->on_path > 0 || s->runs > 0;
+}
+
+// Id of word in the index, added with no references if it is new
+static uint32_t suggest_node(const char *word, size_t len)
+{
+  size_t count = suggest_index.count;
+  uint32_t id = symdel_add(&suggest_index, word, len);
+  if (suggest_index.count == count)
+    return id;
+  if (suggest_index.count > suggest_names_cap)
+  {
+    suggest_names_cap = suggest_names_cap ? suggest_names_cap * 2 : 1024;
+    suggest_names = suggest_xrealloc(suggest_names, suggest_names_cap * sizeof(SuggestName));
+  }
+  memset(&suggest_names[id], 0, sizeof(SuggestName));
+  suggest_dead++;
+  return id;
+}
+
+static void suggest_path_ref(uint32_t id, int delta)
+{
+  SuggestName *s = &suggest_names[id];
+  int was_alive = suggest_alive(s);
+  s->on_path += delta;
+  if (was_alive && !suggest_alive(s))
+    suggest_dead++;
+  else if (!was_alive && suggest_alive(s))
+    suggest_dead--;
+}
+
+static void suggest_drop_names(SuggestDir *d)
+{
+  for (size_t i = 0; i < d->nnames; i++)
+    suggest_path_ref(d->names[i], -1);
+  free(d->names);
+  d->names = NULL;
+  d->nnames = 0;
+}
+
+// List the executables in d again, if it changed since the last time or
+// force is set
+static void suggest_scan_dir(SuggestDir *d, const struct timespec *now, int force)
+{
+  struct stat st;
+  struct timespec mtime = {0, 0};
+
+  d->checked = *now;
+  if (stat(d->path, &st) == 0)
+    mtime = st.st_mtim;
+  if (!force && mtime.tv_sec == d->mtime.tv_sec && mtime.tv_nsec == d->mtime.tv_nsec)
+    return;
+  d->mtime = mtime;
+  suggest_drop_names(d);
+
+  DIR *dir = opendir(d->path);
+  if (dir == NULL)
+    return;
+  size_t cap = 0;
+  struct dirent *e;
+  while ((e = readdir(dir)) != NULL)
+  {
+    if (e->d_name[0] == '.')
+      continue;
+    if (e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN)
+      continue;
+    if (fstatat(dirfd(dir), e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111))
+      continue;
+    uint32_t id = suggest_node(e->d_name, strlen(e->d_name));
+    if (id == SYMDEL_NONE)
+      continue;
+    if (d->nnames == cap)
+    {
+      cap = cap ? cap * 2 : 64;
+      d->names = suggest_xrealloc(d->names, cap * sizeof(uint32_t));
+    }
+    d->names[d->nnames++] = id;
+    suggest_path_ref(id, 1);
+  }
+  closedir(dir);
+}
+
+static long suggest_elapsed_ms(const struct timespec *since, const struct timespec *now)
+{
+  return (now->tv_sec - since->tv_sec) * 1000L + (now->tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+// Bring the PATH directories up to date. A directory that stays in PATH
+// keeps its names; only new ones are scanned. Relative entries depend on
+// the current directory and are left out.
+static void suggest_sync_path(void)
+{
+  const char *path = getenv("PATH");
+  struct timespec now;
+
+  if (path == NULL)
+    path = "/bin:/usr/bin"; // execvp's default
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (suggest_path && strcmp(path, suggest_path) == 0)
+  {
+    for (size_t i = 0; i < suggest_ndirs; i++)
+    {
+      if (suggest_elapsed_ms(&suggest_dirs[i].checked, &now) >= SUGGEST_RECHECK_MS)
+        suggest_scan_dir(&suggest_dirs[i], &now, 0);
+    }
+    return;
+  }
+
+  SuggestDir *old = suggest_dirs;
+  size_t nold = suggest_ndirs;
+  size_t n = 1;
+  for (const char *p = path; *p; p++)
+    n += *p == ':';
+  suggest_dirs = suggest_xrealloc(NULL, n * sizeof(SuggestDir));
+  suggest_ndirs = 0;
+
+  for (const char *p = path;;)
+  {
+    const char *end = strchr(p, ':');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (len > 0 && p[0] == '/')
+    {
+      SuggestDir *d = &suggest_dirs[suggest_ndirs++];
+      size_t j = 0;
+      while (j < nold && !(old[j].path && strncmp(old[j].path, p, len) == 0 && old[j].path[len] == '\0'))
+        j++;
+      if (j < nold)
+      {
+        *d = old[j];
+        old[j].path = NULL; // Taken
+      }
+      else
+      {
+        memset(d, 0, sizeof(*d));
+        d->path = suggest_xrealloc(NULL, len + 1);
+        memcpy(d->path, p, len);
+        d->path[len] = '\0';
+        suggest_scan_dir(d, &now, 1);
+      }
+    }
+    if (end == NULL)
+      break;
+    p = end + 1;
+  }
+
+  for (size_t j = 0; j < nold; j++)
+  {
+    if (old[j].path == NULL)
+      continue;
+    suggest_drop_names(&old[j]);
+    free(old[j].path);
+  }
+  free(old);
+  free(suggest_path);
+  suggest_path = suggest_xrealloc(NULL, strlen(path) + 1);
+  strcpy(suggest_path, path);
+}
+
+// Rebuild the index from the live names only
+static void suggest_compact(void)
+{
+  SymDel old = suggest_index;
+  SuggestName *old_names = suggest_names;
+  uint32_t *remap = suggest_xrealloc(NULL, old.count * sizeof(uint32_t));
+
+  symdel_init(&suggest_index);
+  suggest_names = NULL;
+  suggest_names_cap = 0;
+  suggest_dead = 0;
+  for (size_t i = 0; i < old.count; i++)
+  {
+    remap[i] = SYMDEL_NONE;
+    if (!suggest_alive(&old_names[i]))
+      continue;
+    remap[i] = suggest_node(symdel_word(&old, (uint32_t)i), old.lens[i]);
+    suggest_names[remap[i]] = old_names[i];
+    suggest_dead--;
+  }
+  for (size_t i = 0; i < suggest_ndirs; i++)
+  {
+    for (size_t k = 0; k < suggest_dirs[i].nnames; k++)
+      suggest_dirs[i].names[k] = remap[suggest_dirs[i].names[k]];
+  }
+  free(remap);
+  free(old_names);
+  symdel_free(&old);
+}
+
+typedef struct
+{
+  const char *word;
+  size_t len;
+  uint32_t runs;
+} SuggestCount;
+
+static uint32_t suggest_hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h;
+}
+
+static int suggest_by_runs(const void *a, const void *b)
+{
+  const SuggestCount *x = a, *y = b;
+  return x->runs < y->runs ? 1 : x->runs > y->runs ? -1 : 0;
+}
+
+// The command word of a history entry, in *word. Returns its length, or 0
+// if it is not a plain name (a path, an assignment, something quoted).
+static size_t suggest_command_word(const HistEntry *e, const char **word)
+{
+  size_t i = 0, start;
+  while (i < e->cmd_len && (e->cmd[i] == ' ' || e->cmd[i] == '\t'))
+    i++;
+  start = i;
+  for (; i < e->cmd_len; i++)
+  {
+    char c = e->cmd[i];
+    if (c == ' ' || c == '\t' || c == '|' || c == '&' || c == '<' || c == '>')
+      break;
+    if (c == '/' || c == '=' || c == '$' || c == '\'' || c == '"' || c == '\\' || c == '#')
+      return 0;
+  }
+  *word = e->cmd + start;
+  return i - start;
+}
+
+// Count the command words of the history and keep the most frequent
+static void suggest_load_history(void)
+{
+  HistDb *db = hist_store();
+  if (db == NULL)
+    return;
+
+  SuggestCount *table = NULL;
+  size_t cap = 0, used = 0;
+  uint32_t count = histdb_count(db);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    HistEntry e;
+    const char *word;
+    histdb_get(db, i, &e);
+    size_t len = suggest_command_word(&e, &word);
+    if (len == 0 || len > SYMDEL_MAX_LEN)
+      continue;
+
+    if ((used + 1) * 2 > cap)
+    {
+      SuggestCount *old = table;
+      size_t old_cap = cap;
+      cap = cap ? cap * 2 : 256;
+      table = calloc(cap, sizeof(SuggestCount));
+      if (!table)
+      {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      for (size_t k = 0; k < old_cap; k++)
+      {
+        if (old[k].word == NULL)
+          continue;
+        size_t pos = suggest_hash(old[k].word, old[k].len) & (cap - 1);
+        while (table[pos].word)
+          pos = (pos + 1) & (cap - 1);
+        table[pos] = old[k];
+      }
+      free(old);
+    }
+    size_t pos = suggest_hash(word, len) & (cap - 1);
+    while (table[pos].word && !(table[pos].len == len && memcmp(table[pos].word, word, len) == 0))
+      pos = (pos + 1) & (cap - 1);
+    if (table[pos].word == NULL)
+    {
+      table[pos].word = word;
+      table[pos].len = len;
+      used++;
+    }
+    table[pos].runs++;
+  }
+
+  // Pack the used slots to the front, most frequent first
+  size_t n = 0;
+  for (size_t k = 0; k < cap; k++)
+  {
+    if (table[k].word)
+      table[n++] = table[k];
+  }
+  qsort(table, n, sizeof(SuggestCount), suggest_by_runs);
+  for (size_t k = 0; k < n && k < SUGGEST_HISTORY_MAX; k++)
+  {
+    uint32_t id = suggest_node(table[k].word, table[k].len);
+    if (id == SYMDEL_NONE)
+      continue;
+    if (!suggest_alive(&suggest_names[id]))
+      suggest_dead--;
+    suggest_names[id].runs = table[k].runs;
+  }
+  free(table);
+}
+
+static void suggest_build(void)
+{
+  size_t count;
+  const Builtin *b = builtin_list(&count);
+
+  symdel_init(&suggest_index);
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t id = suggest_node(b[i].name, strlen(b[i].name));
+    if (!suggest_alive(&suggest_names[id]))
+      suggest_dead--;
+    suggest_names[id].builtin = 1;
+  }
+  suggest_load_history();
+  suggest_built = 1;
+}
+
+typedef struct
+{
+  size_t n, max;
+  unsigned dist; // Of every name in id; the search radius until one is found
+  uint32_t id[SUGGEST_MAX];
+} SuggestFind;
+
+// Whether a is a better suggestion than b at the same distance: run more
+// often, then a builtin, then first in alphabetical order
+static int suggest_better(uint32_t a, uint32_t b)
+{
+  const SuggestName *x = &suggest_names[a], *y = &suggest_names[b];
+  if (x->runs != y->runs)
+    return x->runs > y->runs;
+  if (x->builtin != y->builtin)
+    return x->builtin;
+  return strcmp(symdel_word(&suggest_index, a), symdel_word(&suggest_index, b)) < 0;
+}
+
+static unsigned suggest_visit(uint32_t id, unsigned dist, void *ctx)
+{
+  SuggestFind *f = ctx;
+  const SuggestName *s = &suggest_names[id];
+
+  // Only the closest names are offered. A command known only from the
+  // history must still be there to be run.
+  if (dist == 0 || dist > f->dist || !suggest_alive(s) ||
+      !(s->builtin || s->on_path || cmdhash_lookup(symdel_word(&suggest_index, id)) != NULL))
+    return f->dist;
+  if (dist < f->dist)
+  {
+    f->dist = dist;
+    f->n = 0;
+  }
+  size_t at = f->n;
+  while (at > 0 && suggest_better(id, f->id[at - 1]))
+    at--;
+  if (at < f->max)
+  {
+    size_t last = f->n < f->max ? f->n : f->max - 1;
+    memmove(&f->id[at + 1], &f->id[at], (last - at) * sizeof(uint32_t));
+    f->id[at] = id;
+    if (f->n < f->max)
+      f->n++;
+  }
+  return f->dist;
+}
+
+size_t suggest_commands(const char *name, const char **out, size_t max)
+{
+  size_t len = strlen(name);
+  SuggestFind f;
+
+  if (len < 2 || len > SYMDEL_MAX_LEN || strchr(name, '/') != NULL || max == 0)
+    return 0;
+  if (!suggest_built)
+    suggest_build();
+  suggest_sync_path();
+  if (suggest_index.count >= SUGGEST_COMPACT_MIN && suggest_dead * 2 > suggest_index.count)
+    suggest_compact();
+
+  // One typo in a short name, two in a longer one
+  f.n = 0;
+  f.max = max < SUGGEST_MAX ? max : SUGGEST_MAX;
+  f.dist = len <= 4 ? 1 : 2;
+  symdel_search(&suggest_index, name, len, f.dist, suggest_visit, &f);
+  for (size_t i = 0; i < f.n; i++)
+    out[i] = symdel_word(&suggest_index, f.id[i]);
+  return f.n;
+}
+
+void suggest_report(const char *name)
+{
+  const char *found[SUGGEST_MAX];
+  size_t n = suggest_commands(name, found, SUGGEST_MAX);
+
+  if (n == 0)
+    return;
+  fprintf(stderr, "Did you mean `%s`", found[0]);
+  for (size_t i = 1; i < n; i++)
+    fprintf(stderr, i + 1 < n ? ", `%s`" : " or `%s`", found[i]);
+  fprintf(stderr, " instead of `%s`?\n", name);
+}
@@ -0,0 +1,25 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+#include <stddef.h>
+
+// Most names offered for one mistyped command
+#define SUGGEST_MAX 3
+// How many of the most frequent commands in the history are candidates
+#define SUGGEST_HISTORY_MAX 256
+// A PATH directory is rescanned at most this often, in milliseconds, when it
+// changes
+#define SUGGEST_RECHECK_MS 1000
+
+// Up to max known command names close to name, best first, in out. Names are
+// builtins, executables in the PATH directories and the commands run most
+// often. The index is built on first use and kept in step with PATH from
+// then on. Returns how many were found; the strings stay valid until the
+// next call.
+size_t suggest_commands(const char *name, const char **out, size_t max);
+
+// Print "Did you mean ..." for a command name that was not found, if
+// anything close to it is known
+void suggest_report(const char *name);
+
+#endif // SUGGEST_H
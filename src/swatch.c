@@ -0,0 +1,620 @@
+// swatch.c
+//
+// Keeps search indexes current while an interactive shell runs. Every
+// indexed tree that has been used in this session is watched with inotify;
+// changed, created and deleted files are re-indexed into the index's delta
+// segment after a short quiet period, and a background thread merges the
+// delta into a new on-disk index once it grows past SWATCH_MERGE_THRESHOLD
+// entries. Adding the watches means walking the whole tree, so the watcher
+// thread does that too, and the search that first uses a tree does not wait
+// for it. Nothing is watched until swatch_enable is called.
+//
+// Locking: each LiveIndex has a rwlock guarding its base index and delta.
+// Searches hold it for reading for their whole run; the watcher and the
+// merger take it for writing only to install results they computed without
+// it. merge_lock serialises everything that rewrites the index file.
+// watcher_lock only guards the hand-over of new trees to the watcher
+// thread; its watches and pending files are its own, so it walks
+// directories and re-reads files without any lock a search could wait on.
+//
+// Correctness never depends on the watcher: the index filter re-checks size
+// and mtime of every file, so a missed or overflowed event only costs speed.
+// On systems without inotify the indexes are simply not refreshed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "swatch.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#define SWATCH_HAVE_INOTIFY 1
+#endif
+
+struct LiveIndex
+{
+  char *root; // Canonical path
+  pthread_rwlock_t lock;
+  pthread_mutex_t merge_lock;
+  SearchIndex *base;
+  SearchIndexDelta *delta;
+  int merge_requested;
+  int watched;
+  LiveIndex *next;
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static LiveIndex *registry;
+
+static pthread_mutex_t merge_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t merge_queue_cond = PTHREAD_COND_INITIALIZER;
+static int merger_started;
+static int swatch_enabled;
+
+static void swatch_start_watching(LiveIndex *live);
+
+void swatch_enable(void)
+{
+  pthread_mutex_lock(&registry_lock);
+  swatch_enabled = 1;
+  pthread_mutex_unlock(&registry_lock);
+}
+
+// Start watching live unless that already happened, or watching is off.
+// Must be called without registry_lock held, since the watcher thread takes
+// it.
+static void swatch_ensure_watched(LiveIndex *live)
+{
+  pthread_mutex_lock(&registry_lock);
+  if (!swatch_enabled)
+  {
+    pthread_mutex_unlock(&registry_lock);
+    return;
+  }
+  int first = !live->watched;
+  live->watched = 1;
+  pthread_mutex_unlock(&registry_lock);
+  if (first)
+    swatch_start_watching(live);
+}
+
+static LiveIndex *registry_find(const char *canonical)
+{
+  for (LiveIndex *live = registry; live; live = live->next)
+  {
+    if (strcmp(live->root, canonical) == 0)
+      return live;
+  }
+  return NULL;
+}
+
+static LiveIndex *registry_add(const char *canonical, SearchIndex *base)
+{
+  LiveIndex *live = calloc(1, sizeof(LiveIndex));
+  if (!live)
+    return NULL;
+  live->root = strdup(canonical);
+  live->delta = sindex_delta_new();
+  if (!live->root || !live->delta)
+  {
+    free(live->root);
+    sindex_delta_free(live->delta);
+    free(live);
+    return NULL;
+  }
+  pthread_rwlock_init(&live->lock, NULL);
+  pthread_mutex_init(&live->merge_lock, NULL);
+  live->base = base;
+  live->next = registry;
+  registry = live;
+  return live;
+}
+
+int swatch_acquire(const char *root, SearchIndexView *view)
+{
+  char canonical[PATH_MAX];
+  if (realpath(root, canonical) == NULL)
+    return -1;
+
+  pthread_mutex_lock(&registry_lock);
+  LiveIndex *live = registry_find(canonical);
+  if (!live)
+  {
+    SearchIndex *base = sindex_open(canonical);
+    if (base)
+    {
+      live = registry_add(canonical, base);
+      if (!live)
+        sindex_close(base);
+    }
+  }
+  pthread_mutex_unlock(&registry_lock);
+
+  if (!live)
+    return -1;
+  swatch_ensure_watched(live);
+
+  pthread_rwlock_rdlock(&live->lock);
+  if (!live->base)
+  {
+    pthread_rwlock_unlock(&live->lock);
+    return -1;
+  }
+  view->live = live;
+  view->base = live->base;
+  view->delta = live->delta;
+  return 0;
+}
+
+void swatch_release(SearchIndexView *view)
+{
+  if (view->live)
+    pthread_rwlock_unlock(&view->live->lock);
+  view->live = NULL;
+  view->base = NULL;
+  view->delta = NULL;
+}
+
+int swatch_rebuild(const char *root, SearchIndexStats *stats)
+{
+  char canonical[PATH_MAX];
+  if (realpath(root, canonical) == NULL)
+  {
+    fprintf(stderr, "search: %s: %s\n", root, strerror(errno));
+    return -1;
+  }
+
+  pthread_mutex_lock(&registry_lock);
+  LiveIndex *live = registry_find(canonical);
+  if (!live)
+    live = registry_add(canonical, NULL);
+  pthread_mutex_unlock(&registry_lock);
+
+  if (!live)
+    return sindex_build(canonical, stats);
+  swatch_ensure_watched(live);
+
+  pthread_mutex_lock(&live->merge_lock);
+  int rc = sindex_build(canonical, stats);
+  if (rc == 0)
+  {
+    SearchIndex *fresh = sindex_open(canonical);
+    pthread_rwlock_wrlock(&live->lock);
+    SearchIndex *old = live->base;
+    live->base = fresh;
+    // Changes racing with the build are caught by the mtime checks, so the
+    // old delta can go
+    sindex_delta_clear(live->delta);
+    pthread_rwlock_unlock(&live->lock);
+    sindex_close(old);
+  }
+  pthread_mutex_unlock(&live->merge_lock);
+  return rc;
+}
+
+/*
+  Background merging.
+*/
+
+static void swatch_merge(LiveIndex *live)
+{
+  SearchIndexStats stats;
+
+  pthread_mutex_lock(&live->merge_lock);
+
+  pthread_rwlock_rdlock(&live->lock);
+  SearchIndexSnapshot *snap = sindex_delta_snapshot(live->delta);
+  const SearchIndex *base = live->base; // Only replaced under merge_lock
+  pthread_rwlock_unlock(&live->lock);
+
+  if (snap && sindex_merge_write(live->root, base, snap, &stats) == 0)
+  {
+    SearchIndex *fresh = sindex_open(live->root);
+    if (fresh)
+    {
+      pthread_rwlock_wrlock(&live->lock);
+      SearchIndex *old = live->base;
+      live->base = fresh;
+      sindex_delta_retire(live->delta, snap);
+      pthread_rwlock_unlock(&live->lock);
+      sindex_close(old);
+    }
+  }
+  sindex_snapshot_free(snap);
+
+  pthread_mutex_unlock(&live->merge_lock);
+}
+
+static void *swatch_merger_main(void *arg)
+{
+  for (;;)
+  {
+    LiveIndex *todo = NULL;
+
+    pthread_mutex_lock(&merge_queue_lock);
+    while (todo == NULL)
+    {
+      pthread_mutex_lock(&registry_lock);
+      for (LiveIndex *live = registry; live; live = live->next)
+      {
+        if (live->merge_requested)
+        {
+          live->merge_requested = 0;
+          todo = live;
+          break;
+        }
+      }
+      pthread_mutex_unlock(&registry_lock);
+      if (todo == NULL)
+        pthread_cond_wait(&merge_queue_cond, &merge_queue_lock);
+    }
+    pthread_mutex_unlock(&merge_queue_lock);
+
+    swatch_merge(todo);
+  }
+  return NULL;
+}
+
+static void swatch_request_merge(LiveIndex *live)
+{
+  pthread_mutex_lock(&merge_queue_lock);
+  if (!merger_started)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, swatch_merger_main, NULL) == 0)
+    {
+      pthread_detach(thread);
+      merger_started = 1;
+    }
+  }
+  pthread_mutex_lock(&registry_lock);
+  live->merge_requested = 1;
+  pthread_mutex_unlock(&registry_lock);
+  pthread_cond_signal(&merge_queue_cond);
+  pthread_mutex_unlock(&merge_queue_lock);
+}
+
+#ifdef SWATCH_HAVE_INOTIFY
+
+/*
+  inotify watcher.
+*/
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW | IN_ONLYDIR)
+
+// What an inotify watch descriptor refers to
+typedef struct
+{
+  LiveIndex *live;
+  char *rel_dir; // "" for the root
+} WatchDir;
+
+// A file waiting to be re-indexed
+typedef struct
+{
+  LiveIndex *live;
+  char *rel;
+} PendingFile;
+
+static pthread_mutex_t watcher_lock = PTHREAD_MUTEX_INITIALIZER;
+static int inotify_fd = -1;
+// Only the watcher thread touches these
+static WatchDir *watch_dirs; // Indexed by watch descriptor
+static int watch_dirs_cap;
+static PendingFile *pending;
+static size_t npending, pending_cap;
+
+// Trees waiting for the watcher thread to add their watches, under
+// watcher_lock, and the pipe that wakes it up for them
+static LiveIndex **to_watch;
+static size_t nto_watch, to_watch_cap;
+static int watch_wake[2] = {-1, -1};
+
+static char *swatch_join(const char *dir, const char *name)
+{
+  char *rel = malloc(strlen(dir) + strlen(name) + 2);
+  if (!rel)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(rel, *dir ? "%s/%s" : "%s%s", dir, name);
+  return rel;
+}
+
+static void pending_add(LiveIndex *live, char *rel)
+{
+  if (npending == pending_cap)
+  {
+    size_t cap = pending_cap ? pending_cap * 2 : 64;
+    PendingFile *grown = realloc(pending, cap * sizeof(PendingFile));
+    if (!grown)
+    {
+      free(rel);
+      return;
+    }
+    pending = grown;
+    pending_cap = cap;
+  }
+  pending[npending].live = live;
+  pending[npending].rel = rel;
+  npending++;
+}
+
+static void watch_add_tree(LiveIndex *live, const char *rel_dir, int queue_files)
+{
+  char *path = swatch_join(live->root, rel_dir);
+  int wd = inotify_add_watch(inotify_fd, path, WATCH_MASK);
+  if (wd < 0)
+  {
+    if (errno == ENOSPC)
+      fprintf(stderr, "search: inotify watch limit reached; %s will not be kept up to date\n", path);
+    free(path);
+    return;
+  }
+
+  if (wd >= watch_dirs_cap)
+  {
+    int cap = watch_dirs_cap ? watch_dirs_cap : 256;
+    while (cap <= wd)
+      cap *= 2;
+    WatchDir *grown = realloc(watch_dirs, cap * sizeof(WatchDir));
+    if (!grown)
+    {
+      free(path);
+      return;
+    }
+    memset(grown + watch_dirs_cap, 0, (cap - watch_dirs_cap) * sizeof(WatchDir));
+    watch_dirs = grown;
+    watch_dirs_cap = cap;
+  }
+  free(watch_dirs[wd].rel_dir);
+  watch_dirs[wd].live = live;
+  watch_dirs[wd].rel_dir = strdup(rel_dir);
+
+  DIR *dp = opendir(path);
+  free(path);
+  if (!dp)
+    return;
+
+  struct dirent *entry;
+  while ((entry = readdir(dp)) != NULL)
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    char *rel = swatch_join(rel_dir, entry->d_name);
+    int is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN)
+    {
+      char *full = swatch_join(live->root, rel);
+      struct stat st;
+      is_dir = lstat(full, &st) == 0 && S_ISDIR(st.st_mode);
+      free(full);
+    }
+
+    if (is_dir)
+    {
+      watch_add_tree(live, rel, queue_files);
+      free(rel);
+    }
+    else if (queue_files)
+    {
+      pending_add(live, rel); // A directory that appeared after indexing
+    }
+    else
+    {
+      free(rel);
+    }
+  }
+  closedir(dp);
+}
+
+static void queue_deleted(void *ctx, const char *rel)
+{
+  pending_add(ctx, strdup(rel));
+}
+
+static void handle_event(const struct inotify_event *ev)
+{
+  if (ev->mask & IN_Q_OVERFLOW)
+    return; // Lost events are caught later by the mtime checks
+  if (ev->wd < 0 || ev->wd >= watch_dirs_cap || !watch_dirs[ev->wd].live)
+    return;
+
+  WatchDir *wdir = &watch_dirs[ev->wd];
+  if (ev->mask & IN_IGNORED)
+  {
+    free(wdir->rel_dir);
+    wdir->rel_dir = NULL;
+    wdir->live = NULL;
+    return;
+  }
+  if (ev->len == 0)
+    return;
+  if (*wdir->rel_dir == '\0' && sindex_is_index_file(ev->name))
+    return; // Our own index file
+
+  char *rel = swatch_join(wdir->rel_dir, ev->name);
+  if (ev->mask & IN_ISDIR)
+  {
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+      watch_add_tree(wdir->live, rel, 1);
+    }
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+      // Record the vanished files so the next merge drops them
+      pthread_rwlock_rdlock(&wdir->live->lock);
+      sindex_for_each_in_dir(wdir->live->base, rel, queue_deleted, wdir->live);
+      pthread_rwlock_unlock(&wdir->live->lock);
+    }
+    free(rel);
+    return;
+  }
+  pending_add(wdir->live, rel);
+}
+
+static int compare_pending(const void *a, const void *b)
+{
+  const PendingFile *pa = a, *pb = b;
+  if (pa->live != pb->live)
+    return pa->live < pb->live ? -1 : 1;
+  return strcmp(pa->rel, pb->rel);
+}
+
+static void process_pending(void)
+{
+  // Editors produce bursts of events per save; handle each file once
+  qsort(pending, npending, sizeof(PendingFile), compare_pending);
+
+  for (size_t i = 0; i < npending; i++)
+  {
+    PendingFile *p = &pending[i];
+    if (i + 1 < npending && pending[i + 1].live == p->live && strcmp(pending[i + 1].rel, p->rel) == 0)
+    {
+      free(p->rel);
+      continue;
+    }
+
+    // Read the file without holding the lock, then install the result
+    SearchIndexDeltaEntry *entry = sindex_delta_scan(p->live->delta, p->live->root, p->rel);
+    if (entry)
+    {
+      pthread_rwlock_wrlock(&p->live->lock);
+      sindex_delta_put(p->live->delta, entry);
+      size_t count = sindex_delta_count(p->live->delta);
+      pthread_rwlock_unlock(&p->live->lock);
+      if (count >= SWATCH_MERGE_THRESHOLD && (i + 1 == npending || pending[i + 1].live != p->live))
+        swatch_request_merge(p->live);
+    }
+    free(p->rel);
+  }
+  npending = 0;
+}
+
+static long monotonic_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// Add the watches of the trees queued by swatch_start_watching. The walk
+// is done without watcher_lock, so searches queueing more trees meanwhile
+// do not wait for it.
+static void watch_queued_trees(void)
+{
+  char buf[64];
+  while (read(watch_wake[0], buf, sizeof(buf)) > 0)
+    ;
+  for (;;)
+  {
+    pthread_mutex_lock(&watcher_lock);
+    LiveIndex *live = nto_watch > 0 ? to_watch[--nto_watch] : NULL;
+    pthread_mutex_unlock(&watcher_lock);
+    if (live == NULL)
+      break;
+    watch_add_tree(live, "", 0);
+  }
+}
+
+static void *swatch_watcher_main(void *arg)
+{
+  char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  long first_pending_ms = 0;
+
+  for (;;)
+  {
+    struct pollfd pfd[2] = {{inotify_fd, POLLIN, 0}, {watch_wake[0], POLLIN, 0}};
+    int have_pending = npending > 0;
+
+    int ready = poll(pfd, 2, have_pending ? SWATCH_DEBOUNCE_MS : -1);
+    if (ready < 0 && errno != EINTR)
+      break;
+    if (ready > 0 && (pfd[1].revents & POLLIN))
+      watch_queued_trees();
+
+    if (ready > 0 && (pfd[0].revents & POLLIN))
+    {
+      ssize_t len = read(inotify_fd, buf, sizeof(buf));
+      for (char *p = buf; len > 0 && p < buf + len;)
+      {
+        const struct inotify_event *ev = (const struct inotify_event *)p;
+        handle_event(ev);
+        p += sizeof(struct inotify_event) + ev->len;
+      }
+      if (!have_pending && npending > 0)
+        first_pending_ms = monotonic_ms();
+    }
+
+    // Re-index once things go quiet, or periodically under constant churn
+    if (npending > 0 && (ready == 0 || monotonic_ms() - first_pending_ms >= SWATCH_MAX_DELAY_MS))
+      process_pending();
+  }
+  return NULL;
+}
+
+// Hand live to the watcher thread, starting it the first time
+static void swatch_start_watching(LiveIndex *live)
+{
+  pthread_mutex_lock(&watcher_lock);
+  if (inotify_fd < 0)
+  {
+    pthread_t thread;
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd >= 0 && pipe2(watch_wake, O_NONBLOCK | O_CLOEXEC) == 0 &&
+        pthread_create(&thread, NULL, swatch_watcher_main, NULL) == 0)
+    {
+      pthread_detach(thread);
+    }
+    else if (inotify_fd >= 0)
+    {
+      close(inotify_fd);
+      inotify_fd = -1;
+      if (watch_wake[0] >= 0)
+      {
+        close(watch_wake[0]);
+        close(watch_wake[1]);
+        watch_wake[0] = watch_wake[1] = -1;
+      }
+    }
+  }
+  if (inotify_fd >= 0)
+  {
+    if (nto_watch == to_watch_cap)
+    {
+      size_t cap = to_watch_cap ? to_watch_cap * 2 : 8;
+      LiveIndex **grown = realloc(to_watch, cap * sizeof(LiveIndex *));
+      if (!grown)
+      {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      to_watch = grown;
+      to_watch_cap = cap;
+    }
+    to_watch[nto_watch++] = live;
+    ssize_t rc = write(watch_wake[1], "", 1); // Full pipe: a wakeup is pending anyway
+    (void)rc;
+  }
+  pthread_mutex_unlock(&watcher_lock);
+}
+
+#else
+
+static void swatch_start_watching(LiveIndex *live)
+{
+  (void)live; // No inotify: rely on the staleness checks alone
+}
+
+#endif // SWATCH_HAVE_INOTIFY
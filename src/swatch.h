@@ -0,0 +1,38 @@
+#ifndef SWATCH_H
+#define SWATCH_H
+
+#include "sindex.h"
+
+// Delta entries that trigger a background merge into the on-disk index
+#define SWATCH_MERGE_THRESHOLD 128
+// Quiet period before queued file events are re-indexed, in milliseconds
+#define SWATCH_DEBOUNCE_MS 100
+// Upper bound on how long a busy tree can postpone re-indexing
+#define SWATCH_MAX_DELAY_MS 1000
+
+typedef struct LiveIndex LiveIndex;
+
+// A consistent view of one indexed tree: the on-disk base index plus the
+// files re-indexed since it was written. Valid until swatch_release.
+typedef struct
+{
+  LiveIndex *live;
+  const SearchIndex *base;
+  const SearchIndexDelta *delta;
+} SearchIndexView;
+
+// Keep the indexes used from now on up to date as their trees change. Only
+// an interactive shell calls this; a one-shot run has no use for watcher
+// threads.
+void swatch_enable(void);
+
+// Look up the index for root, opening it and (once enabled) starting to
+// watch the tree on first use. Returns 0 and fills view on success, -1 if
+// root has no index.
+int swatch_acquire(const char *root, SearchIndexView *view);
+void swatch_release(SearchIndexView *view);
+
+// Build the index for root from scratch and keep it up to date from then on
+int swatch_rebuild(const char *root, SearchIndexStats *stats);
+
+#endif // SWATCH_H
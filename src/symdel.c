@@ -0,0 +1,295 @@
+// symdel.c
+//
+// Symmetric delete index for "did you mean" lookups (see suggest.c). Each
+// distinct delete of a word prefix is a key in an open-addressing table; the
+// words it came from hang off the key as a list of postings. Keys are only
+// hashes: a collision just adds a candidate, and every candidate is measured
+// before it is reported.
+//
+// Distances are Damerau-Levenshtein. A swap of two neighbouring characters
+// is one edit, and deleting one of the two from each side brings the words
+// together, so swaps are found like any other typo.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symdel.h"
+
+// Deletes of one prefix: none, one, or two of its characters
+#define SYMDEL_MAX_VARIANTS (1 + SYMDEL_PREFIX + SYMDEL_PREFIX * (SYMDEL_PREFIX - 1) / 2)
+
+typedef struct
+{
+  uint32_t hash;
+  unsigned deletes;
+} SymDelVariant;
+
+static void *symdel_xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "lsh: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void symdel_init(SymDel *s)
+{
+  memset(s, 0, sizeof(*s));
+}
+
+void symdel_free(SymDel *s)
+{
+  free(s->offsets);
+  free(s->lens);
+  free(s->seen);
+  free(s->pool);
+  free(s->keys);
+  free(s->postings);
+  symdel_init(s);
+}
+
+static unsigned symdel_min(unsigned a, unsigned b)
+{
+  return a < b ? a : b;
+}
+
+// Lowrance and Wagner's algorithm. d[i + 1][j + 1] is the distance between
+// the first i characters of a and the first j of b; row and column 0 hold a
+// bound larger than any distance. last[c] is the last row whose character
+// of a was c, for the transposition case. The smallest value in a row never
+// decreases from one row to the next, so once it exceeds bound so does the
+// distance.
+unsigned symdel_distance(const char *a, size_t alen, const char *b, size_t blen, unsigned bound)
+{
+  const unsigned char *x = (const unsigned char *)a, *y = (const unsigned char *)b;
+  unsigned d[SYMDEL_MAX_LEN + 2][SYMDEL_MAX_LEN + 2];
+  size_t last[256];
+  unsigned inf = (unsigned)(alen + blen);
+
+  if ((alen > blen ? alen - blen : blen - alen) > bound)
+    return bound + 1;
+
+  // Only the entries for characters of a and b are ever read
+  for (size_t i = 0; i < alen; i++)
+    last[x[i]] = 0;
+  for (size_t j = 0; j < blen; j++)
+    last[y[j]] = 0;
+
+  d[0][0] = inf;
+  for (size_t i = 0; i <= alen; i++)
+  {
+    d[i + 1][0] = inf;
+    d[i + 1][1] = (unsigned)i;
+  }
+  for (size_t j = 0; j <= blen; j++)
+  {
+    d[0][j + 1] = inf;
+    d[1][j + 1] = (unsigned)j;
+  }
+
+  for (size_t i = 1; i <= alen; i++)
+  {
+    size_t match = 0; // Last column of this row where a and b agreed
+    unsigned row_min = (unsigned)i;
+    for (size_t j = 1; j <= blen; j++)
+    {
+      size_t k = last[y[j - 1]], l = match;
+      unsigned cost = 1;
+      if (x[i - 1] == y[j - 1])
+      {
+        cost = 0;
+        match = j;
+      }
+      unsigned best = symdel_min(d[i][j] + cost, symdel_min(d[i + 1][j] + 1, d[i][j + 1] + 1));
+      best = symdel_min(best, d[k][l] + (unsigned)((i - k - 1) + 1 + (j - l - 1)));
+      d[i + 1][j + 1] = best;
+      row_min = symdel_min(row_min, best);
+    }
+    if (row_min > bound)
+      return bound + 1;
+    last[x[i - 1]] = i;
+  }
+  return symdel_min(d[alen + 1][blen + 1], bound + 1);
+}
+
+static uint32_t symdel_hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  // FNV-1a's low bits mix poorly and the table uses them
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return h;
+}
+
+// Every string made by deleting up to edits characters of str, each once,
+// into out[*n]. Characters are deleted left to right, from position from
+// on, so no combination is made twice; the same string can still come from
+// different combinations ("aab"), and is kept with its fewest deletes.
+static void symdel_deletes(const char *str, size_t len, size_t from, unsigned deleted, unsigned edits,
+                           SymDelVariant *out, size_t *n)
+{
+  uint32_t h = symdel_hash(str, len);
+  size_t k = 0;
+  while (k < *n && out[k].hash != h)
+    k++;
+  if (k == *n)
+    out[(*n)++] = (SymDelVariant){h, deleted};
+  else if (deleted < out[k].deletes)
+    out[k].deletes = deleted;
+
+  if (deleted == edits)
+    return;
+  for (size_t i = from; i < len; i++)
+  {
+    char shorter[SYMDEL_PREFIX];
+    memcpy(shorter, str, i);
+    memcpy(shorter + i, str + i + 1, len - i - 1);
+    symdel_deletes(shorter, len - 1, i, deleted + 1, edits, out, n);
+  }
+}
+
+static size_t symdel_variants(const char *word, size_t len, unsigned edits, SymDelVariant *out)
+{
+  size_t n = 0;
+  symdel_deletes(word, len < SYMDEL_PREFIX ? len : SYMDEL_PREFIX, 0, 0, edits, out, &n);
+  return n;
+}
+
+// Slot of the key with hash h, or of the empty slot where it would go
+static size_t symdel_slot(const SymDel *s, uint32_t h)
+{
+  size_t pos = h & (s->keys_cap - 1);
+  while (s->keys[pos].head != SYMDEL_NONE && s->keys[pos].hash != h)
+    pos = (pos + 1) & (s->keys_cap - 1);
+  return pos;
+}
+
+static void symdel_grow_keys(SymDel *s)
+{
+  SymDelKey *old = s->keys;
+  size_t old_cap = s->keys_cap;
+
+  s->keys_cap = old_cap ? old_cap * 2 : 1024;
+  s->keys = symdel_xrealloc(NULL, s->keys_cap * sizeof(SymDelKey));
+  for (size_t i = 0; i < s->keys_cap; i++)
+    s->keys[i].head = SYMDEL_NONE;
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    if (old[i].head != SYMDEL_NONE)
+      s->keys[symdel_slot(s, old[i].hash)] = old[i];
+  }
+  free(old);
+}
+
+static void symdel_post(SymDel *s, uint32_t h, uint32_t word)
+{
+  if ((s->nkeys + 1) * 2 > s->keys_cap)
+    symdel_grow_keys(s);
+  if (s->npostings == s->postings_cap)
+  {
+    s->postings_cap = s->postings_cap ? s->postings_cap * 2 : 4096;
+    s->postings = symdel_xrealloc(s->postings, s->postings_cap * sizeof(SymDelPosting));
+  }
+  size_t pos = symdel_slot(s, h);
+  if (s->keys[pos].head == SYMDEL_NONE)
+  {
+    s->keys[pos].hash = h;
+    s->nkeys++;
+  }
+  s->postings[s->npostings] = (SymDelPosting){word, s->keys[pos].head};
+  s->keys[pos].head = (uint32_t)s->npostings++;
+}
+
+static uint32_t symdel_find(const SymDel *s, const char *word, size_t len)
+{
+  if (s->keys_cap == 0)
+    return SYMDEL_NONE;
+  const SymDelKey *key = &s->keys[symdel_slot(s, symdel_hash(word, len < SYMDEL_PREFIX ? len : SYMDEL_PREFIX))];
+  for (uint32_t p = key->head; p != SYMDEL_NONE; p = s->postings[p].next)
+  {
+    uint32_t w = s->postings[p].word;
+    if (s->lens[w] == len && memcmp(symdel_word(s, w), word, len) == 0)
+      return w;
+  }
+  return SYMDEL_NONE;
+}
+
+uint32_t symdel_add(SymDel *s, const char *word, size_t len)
+{
+  if (len == 0 || len > SYMDEL_MAX_LEN)
+    return SYMDEL_NONE;
+  uint32_t w = symdel_find(s, word, len);
+  if (w != SYMDEL_NONE)
+    return w;
+
+  if (s->count == s->cap)
+  {
+    s->cap = s->cap ? s->cap * 2 : 256;
+    s->offsets = symdel_xrealloc(s->offsets, s->cap * sizeof(uint32_t));
+    s->lens = symdel_xrealloc(s->lens, s->cap);
+    s->seen = symdel_xrealloc(s->seen, s->cap * sizeof(uint32_t));
+  }
+  if (s->pool_len + len + 1 > s->pool_cap)
+  {
+    while (s->pool_len + len + 1 > s->pool_cap)
+      s->pool_cap = s->pool_cap ? s->pool_cap * 2 : 4096;
+    s->pool = symdel_xrealloc(s->pool, s->pool_cap);
+  }
+  w = (uint32_t)s->count++;
+  s->offsets[w] = (uint32_t)s->pool_len;
+  s->lens[w] = (uint8_t)len;
+  s->seen[w] = 0;
+  memcpy(s->pool + s->pool_len, word, len);
+  s->pool[s->pool_len + len] = '\0';
+  s->pool_len += len + 1;
+
+  SymDelVariant variants[SYMDEL_MAX_VARIANTS];
+  size_t n = symdel_variants(word, len, SYMDEL_MAX_EDITS, variants);
+  for (size_t i = 0; i < n; i++)
+    symdel_post(s, variants[i].hash, w);
+  return w;
+}
+
+void symdel_search(SymDel *s, const char *word, size_t len, unsigned max, SymDelVisit visit, void *ctx)
+{
+  SymDelVariant variants[SYMDEL_MAX_VARIANTS];
+
+  if (s->count == 0 || len == 0 || len > SYMDEL_MAX_LEN)
+    return;
+  if (max > SYMDEL_MAX_EDITS)
+    max = SYMDEL_MAX_EDITS;
+  if (++s->search == 0)
+  {
+    // Wrapped around: forget which words the old searches saw
+    memset(s->seen, 0, s->count * sizeof(uint32_t));
+    s->search = 1;
+  }
+
+  size_t n = symdel_variants(word, len, max, variants);
+  // Fewest deletes first, so close words are found early and narrow max
+  for (unsigned deletes = 0; deletes <= max; deletes++)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      if (variants[i].deletes != deletes)
+        continue;
+      const SymDelKey *key = &s->keys[symdel_slot(s, variants[i].hash)];
+      for (uint32_t p = key->head; p != SYMDEL_NONE; p = s->postings[p].next)
+      {
+        uint32_t w = s->postings[p].word;
+        if (s->seen[w] == s->search)
+          continue;
+        s->seen[w] = s->search;
+        unsigned d = symdel_distance(word, len, symdel_word(s, w), s->lens[w], max);
+        if (d <= max)
+          max = visit(w, d, ctx);
+      }
+    }
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef SYMDEL_H
+#define SYMDEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest word the index holds; longer ones are not added or looked up
+#define SYMDEL_MAX_LEN 64
+// Most edits a search can allow
+#define SYMDEL_MAX_EDITS 2
+// Only the deletes of a word's first this many characters are indexed
+#define SYMDEL_PREFIX 7
+// "No word"
+#define SYMDEL_NONE UINT32_MAX
+
+// Symmetric delete index ("SymSpell"): two words within k edits of each
+// other can both be turned into the same string by deleting at most k
+// characters from each. Every string made by deleting up to
+// SYMDEL_MAX_EDITS characters from a word's prefix is indexed; a search
+// makes the same deletes of the query, looks each up, and measures the
+// distance only to the words found that way. The cost depends on the length
+// of the query, not on the number of words.
+typedef struct
+{
+  uint32_t hash;
+  uint32_t head; // First posting, or SYMDEL_NONE for an empty slot
+} SymDelKey;
+
+typedef struct
+{
+  uint32_t word;
+  uint32_t next; // Next posting under the same key, or SYMDEL_NONE
+} SymDelPosting;
+
+typedef struct
+{
+  uint32_t *offsets; // Of each word in the pool
+  uint8_t *lens;
+  uint32_t *seen; // Search in which each word was last measured
+  size_t count, cap;
+  char *pool; // Words, each NUL terminated
+  size_t pool_len, pool_cap;
+  SymDelKey *keys; // Open addressing on the hash of a delete
+  size_t nkeys, keys_cap;
+  SymDelPosting *postings;
+  size_t npostings, postings_cap;
+  uint32_t search; // Number of the current search, for seen
+} SymDel;
+
+// Called by symdel_search for each word found, with its distance from the
+// query. Returns the largest distance still wanted, which may narrow the
+// rest of the search.
+typedef unsigned (*SymDelVisit)(uint32_t word, unsigned dist, void *ctx);
+
+void symdel_init(SymDel *s);
+void symdel_free(SymDel *s);
+
+// Add word, unless it is there already. Returns its number (words are
+// numbered from 0 in the order added), or SYMDEL_NONE if it is empty or
+// longer than SYMDEL_MAX_LEN.
+uint32_t symdel_add(SymDel *s, const char *word, size_t len);
+
+// Visit every word within max (at most SYMDEL_MAX_EDITS) edits of word,
+// closest first as far as the deletes tell
+void symdel_search(SymDel *s, const char *word, size_t len, unsigned max, SymDelVisit visit, void *ctx);
+
+static inline const char *symdel_word(const SymDel *s, uint32_t word)
+{
+  return s->pool + s->offsets[word];
+}
+
+// Damerau-Levenshtein distance: insertions, deletions, substitutions and
+// swaps of two neighbouring characters each count as one edit. Both lengths
+// must be at most SYMDEL_MAX_LEN. Gives up as soon as the distance is known
+// to exceed bound, returning bound + 1.
+unsigned symdel_distance(const char *a, size_t alen, const char *b, size_t blen, unsigned bound);
+
+#endif // SYMDEL_H
@@ -2,8 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/wait.h>
 #include "utils.h"
+#include "cmdhash.h"
+#include "spawn.h"
+#include "status.h"
 
 // Color definitions for better visibility
 #define RED "\x1b[31m"
@@ -20,13 +22,14 @@ int lsh_search_env(char **args)
   if (args[2] == NULL)
   {
     printf(RED "Usage: search <VAR_NAME>\n" RESET);
-    return 1;
+    return builtin_fail(1);
   }
 
   char *value = getenv(args[2]);
   if (value == NULL)
   {
     printf(RED "Environment variable '%s' not found.\n" RESET, args[2]);
+    builtin_fail(1);
   }
   else
   {
@@ -42,16 +45,19 @@ int lsh_setenv(char **args)
   if (args[2] == NULL || args[3] == NULL)
   {
     printf(RED "Usage: set <VAR_NAME> <VALUE>\n" RESET);
-    return 1;
+    return builtin_fail(1);
   }
 
   if (setenv(args[2], args[3], 1) == 0)
   {
+    if (strcmp(args[2], "PATH") == 0)
+      cmdhash_invalidate();
     printf(GREEN "Environment variable '%s' set to '%s'\n" RESET, args[2], args[3]);
   }
   else
   {
     perror(RED "Error setting environment variable" RESET);
+    builtin_fail(1);
   }
 
   return 1;
@@ -63,16 +69,19 @@ int lsh_unsetenv(char **args)
   if (args[2] == NULL)
   {
     printf(RED "Usage: unset <VAR_NAME>\n" RESET);
-    return 1;
+    return builtin_fail(1);
   }
 
   if (unsetenv(args[2]) == 0)
   {
+    if (strcmp(args[2], "PATH") == 0)
+      cmdhash_invalidate();
     printf(GREEN "Environment variable '%s' removed.\n" RESET, args[2]);
   }
   else
   {
     perror(RED "Error removing environment variable" RESET);
+    builtin_fail(1);
   }
 
   return 1;
@@ -107,18 +116,7 @@ int lsh_env(char **args)
   if (args[1] == NULL)
   {
     // If no argument is provided, run the system's default env command.
-    if (fork() == 0)
-    {
-      // Child process
-      execvp("env", args);
-      perror("execvp");
-      exit(EXIT_FAILURE);
-    }
-    else
-    {
-      // Parent process waits for the child to finish
-      wait(NULL);
-    }
+    builtin_status = spawn_run(args, NULL);
   }
   else
   {
@@ -0,0 +1,258 @@
+// dict_gen.c
+//
+// Build-time generator for the built-in dictionary: reads definitions in
+// the format of .definitions.txt ("term = definition" lines, the last one
+// for a term winning, "term =" deleting it), finds a minimal perfect hash
+// for the terms (src/phash.c) and writes the whole dictionary out as a C
+// header for src/dict.c, each entry in the slot of its term, so that the
+// table is no bigger than the list of entries. Equal strings are stored
+// once.
+//
+// Usage: dict_gen glossary.txt > dict_table.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../src/phash.h"
+
+typedef struct
+{
+  char *term; // NUL terminated, in the file buffer
+  size_t term_len;
+  const char *def; // NULL for a delete
+  size_t def_len;
+  size_t line; // Later lines win
+} Record;
+
+// Strings stored so far, for sharing equal ones
+typedef struct
+{
+  uint32_t off, len;
+} PoolString;
+
+static char *pool;
+static size_t pool_len, pool_cap;
+static PoolString *interned;
+static size_t interned_cap = 1024, interned_count;
+
+static void *xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p)
+  {
+    fprintf(stderr, "dict_gen: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint32_t hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h ^ (h >> 15);
+}
+
+static size_t intern_slot(const PoolString *table, size_t cap, const char *s, size_t len)
+{
+  size_t pos = hash(s, len) & (cap - 1);
+  while (table[pos].len != UINT32_MAX &&
+         !(table[pos].len == len && memcmp(pool + table[pos].off, s, len) == 0))
+    pos = (pos + 1) & (cap - 1);
+  return pos;
+}
+
+// Offset of s in the pool, adding it if no equal string is there yet
+static uint32_t intern(const char *s, size_t len)
+{
+  if ((interned_count + 1) * 2 > interned_cap || interned == NULL)
+  {
+    PoolString *old = interned;
+    size_t old_cap = interned ? interned_cap : 0;
+    interned_cap = old ? interned_cap * 2 : interned_cap;
+    interned = xrealloc(NULL, interned_cap * sizeof(PoolString));
+    memset(interned, 0xff, interned_cap * sizeof(PoolString));
+    for (size_t i = 0; i < old_cap; i++)
+    {
+      if (old[i].len != UINT32_MAX)
+        interned[intern_slot(interned, interned_cap, pool + old[i].off, old[i].len)] = old[i];
+    }
+    free(old);
+  }
+  size_t pos = intern_slot(interned, interned_cap, s, len);
+  if (interned[pos].len != UINT32_MAX)
+    return interned[pos].off;
+
+  while (pool_len + len > pool_cap)
+    pool_cap = pool_cap ? pool_cap * 2 : 4096;
+  pool = xrealloc(pool, pool_cap);
+  memcpy(pool + pool_len, s, len);
+  interned[pos] = (PoolString){(uint32_t)pool_len, (uint32_t)len};
+  interned_count++;
+  pool_len += len;
+  return interned[pos].off;
+}
+
+static int by_term_then_line(const void *a, const void *b)
+{
+  const Record *x = a, *y = b;
+  int c = strcmp(x->term, y->term);
+  if (c != 0)
+    return c;
+  return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+  FILE *f = fopen(path, "rb");
+  char *buf = NULL;
+  size_t cap = 0, n;
+  if (f == NULL)
+    return NULL;
+  *len = 0;
+  do
+  {
+    if (*len + 65536 > cap)
+    {
+      cap = cap ? cap * 2 : 65536;
+      buf = xrealloc(buf, cap + 1);
+    }
+    n = fread(buf + *len, 1, cap - *len, f);
+    *len += n;
+  } while (n > 0);
+  fclose(f);
+  buf[*len] = '\0';
+  return buf;
+}
+
+// A C string literal of s, in pieces of up to 64 bytes per line
+static void print_literal(const char *s, size_t len)
+{
+  if (len == 0)
+    printf("\"\"");
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c = (unsigned char)s[i];
+    if (i % 64 == 0)
+      printf("%s\"", i ? "\"\n    " : "");
+    if (c == '"' || c == '\\' || c == '?') // '?' could start a trigraph
+      printf("\\%c", c);
+    else if (c < ' ' || c >= 0x7f)
+      printf("\\%03o", c);
+    else
+      putchar(c);
+    if (i + 1 == len)
+      putchar('"');
+  }
+}
+
+int main(int argc, char **argv)
+{
+  size_t len, nrecords = 0, cap = 0, line = 0;
+  Record *records = NULL;
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "Usage: dict_gen <definitions file>\n");
+    return EXIT_FAILURE;
+  }
+  char *buf = read_file(argv[1], &len);
+  if (buf == NULL)
+  {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  // The same rules as defstore.c
+  for (char *p = buf; p < buf + len; line++)
+  {
+    char *nl = memchr(p, '\n', buf + len - p);
+    char *end = nl ? nl : buf + len;
+    char *eq = memmem(p, end - p, " = ", 3);
+    Record r = {p, 0, NULL, 0, line};
+    if (eq && eq > p)
+    {
+      r.term_len = eq - p;
+      r.def = eq + 3;
+      r.def_len = end - (eq + 3);
+    }
+    else if (end - p > 2 && end[-2] == ' ' && end[-1] == '=')
+      r.term_len = end - 2 - p;
+    if (r.term_len > 0)
+    {
+      r.term[r.term_len] = '\0';
+      if (nrecords == cap)
+      {
+        cap = cap ? cap * 2 : 1024;
+        records = xrealloc(records, cap * sizeof(Record));
+      }
+      records[nrecords++] = r;
+    }
+    p = end + 1;
+  }
+
+  // Keep the last record of each term, unless it deletes the term
+  size_t n = 0;
+  if (nrecords > 0)
+    qsort(records, nrecords, sizeof(Record), by_term_then_line);
+  for (size_t i = 0; i < nrecords; i++)
+  {
+    if (i + 1 < nrecords && strcmp(records[i].term, records[i + 1].term) == 0)
+      continue;
+    if (records[i].def != NULL)
+      records[n++] = records[i];
+  }
+
+  const char **keys = xrealloc(NULL, (n + 1) * sizeof(char *));
+  for (size_t i = 0; i < n; i++)
+    keys[i] = records[i].term;
+  Phash ph;
+  if (phash_build(&ph, keys, n) != 0)
+  {
+    fprintf(stderr, "dict_gen: could not build a perfect hash for %zu terms\n", n);
+    return EXIT_FAILURE;
+  }
+
+  uint32_t (*offsets)[2] = xrealloc(NULL, (n + 1) * sizeof(*offsets));
+  size_t raw = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    offsets[i][0] = intern(records[i].term, records[i].term_len);
+    offsets[i][1] = intern(records[i].def, records[i].def_len);
+    raw += records[i].term_len + records[i].def_len;
+  }
+
+  printf("// Generated by tools/dict_gen.c from %s. Do not edit.\n", argv[1]);
+  printf("// %zu terms; %zu bytes of text, %zu once equal strings are shared.\n\n", n, raw, pool_len);
+  printf("#define DICT_KEYS %zu\n", n);
+  printf("#define DICT_SEED 0x%016llxull\n", (unsigned long long)ph.seed);
+  printf("#define DICT_BUCKETS %u\n", ph.nbuckets);
+  printf("#define DICT_SLOTS %u\n\n", ph.nslots);
+  printf("static const uint32_t dict_disp[%u] = {", ph.nbuckets);
+  for (uint32_t b = 0; b < ph.nbuckets; b++)
+    printf("%s%u", b == 0 ? "" : b % 16 ? ", " : ",\n    ", ph.disp[b]);
+  printf("};\n\n");
+  printf("// Term and definition in each slot, in dict_strings\n");
+  printf("static const DictEntry dict_entries[%zu] = {", n ? n : 1);
+  for (uint32_t s = 0; s < ph.nslots; s++)
+  {
+    uint32_t i = ph.slots[s];
+    printf("%s{%u, %zu, %u, %zu}", s == 0 ? "\n    " : s % 4 ? ", " : ",\n    ", offsets[i][0],
+           records[i].term_len, offsets[i][1], records[i].def_len);
+  }
+  printf("%s};\n\n", n ? "\n" : "{0, 0, 0, 0}");
+  printf("static const char dict_strings[] =\n    ");
+  print_literal(pool, pool_len);
+  printf(";\n");
+
+  phash_free(&ph);
+  free(offsets);
+  free(keys);
+  free(records);
+  free(interned);
+  free(pool);
+  free(buf);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+// phash_gen.c
+//
+// Build-time generator for the builtin lookup table: reads the builtin
+// names from src/builtins.def, finds a minimal perfect hash for them
+// (src/phash.c) and writes it out as a C header for src/builtins.c.
+//
+// Usage: phash_gen > builtins_phash.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/phash.h"
+
+static const char *names[] = {
+#define BUILTIN(name, fn, usage, summary, help) name,
+#include "../src/builtins.def"
+#undef BUILTIN
+};
+
+int main(void)
+{
+  size_t n = sizeof(names) / sizeof(names[0]);
+  Phash ph;
+
+  if (phash_build(&ph, names, n) != 0)
+  {
+    fprintf(stderr, "phash_gen: builtins.def names a builtin twice\n");
+    return EXIT_FAILURE;
+  }
+  printf("// Generated by tools/phash_gen.c from src/builtins.def. Do not edit.\n\n");
+  printf("#define BUILTINS_PHASH_KEYS %zu\n", n);
+  printf("#define BUILTINS_PHASH_SEED 0x%016llxull\n", (unsigned long long)ph.seed);
+  printf("#define BUILTINS_PHASH_BUCKETS %u\n", ph.nbuckets);
+  printf("#define BUILTINS_PHASH_SLOTS %u\n\n", ph.nslots);
+  printf("static const uint32_t builtins_phash_disp[%u] = {", ph.nbuckets);
+  for (uint32_t b = 0; b < ph.nbuckets; b++)
+    printf("%s%u", b ? ", " : "", ph.disp[b]);
+  printf("};\n\n");
+  printf("// Index into builtins.def of the builtin in each slot\n");
+  printf("static const uint16_t builtins_phash_slots[%u] = {", ph.nslots);
+  for (uint32_t s = 0; s < ph.nslots; s++)
+    printf("%s%u", s ? ", " : "", ph.slots[s]);
+  printf("};\n");
+  phash_free(&ph);
+  return EXIT_SUCCESS;
+}